@@ -0,0 +1,674 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  .aix attribute index for shapefile layers.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** An attribute index holds one DBF column of a shapefile as a list of
+** (key, shape id) entries sorted by key, so equality and range lookups are a
+** binary search plus a sequential read. It lives next to the shapefile as
+** <basename>.<item>.aix:
+**
+**   bytes 0-3    "MSAI"
+**   byte  4      byte order (MS_NEW_LSB_ORDER or MS_NEW_MSB_ORDER)
+**   byte  5      version (1)
+**   byte  6      key type, 'N' (double) or 'C' (string)
+**   byte  7      unused
+**   bytes 8-11   number of DBF records when the index was built
+**   bytes 12-15  key width in bytes (8 for numeric keys)
+**   bytes 16-19  number of entries
+**   bytes 20-    entries: key (NUL padded for strings) then 32 bit shape id
+**
+** Keys are the item values exactly as the shapefile provider hands them to
+** the expression evaluator, so an index lookup selects the same features the
+** FILTER would. The FILTER is still evaluated on every feature read, the index
+** only narrows the status bitmap.
+*/
+
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include "mapserver.h"
+#include "maptree.h"
+
+
+
+#define MS_ATTRINDEX_SIGNATURE "MSAI"
+#define MS_ATTRINDEX_VERSION 1
+#define MS_ATTRINDEX_HEADER_SIZE 20
+#define MS_ATTRINDEX_MAXOPEN 4
+
+typedef struct {
+  FILE *fp;
+  int needswap;
+  char keytype;
+  int keywidth;
+  int numentries;
+  int entrysize;
+  char *key; /* current entry, keywidth+1 bytes */
+  ms_int32 id;
+} attrIndexObj;
+
+typedef struct {
+  layerObj *layer;
+  shapefileObj *shpfile;
+  tokenListNodeObjPtr node;
+  int numopen;
+  char *items[MS_ATTRINDEX_MAXOPEN];
+  attrIndexObj *indexes[MS_ATTRINDEX_MAXOPEN];
+} attrIndexSearchObj;
+
+typedef struct {
+  char *key;
+  double dblkey;
+  ms_int32 id;
+} attrIndexEntryObj;
+
+static void SwapWord( int length, void * wordP )
+{
+  int i;
+  uchar temp;
+
+  for( i=0; i < length/2; i++ ) {
+    temp = ((uchar *) wordP)[i];
+    ((uchar *)wordP)[i] = ((uchar *) wordP)[length-i-1];
+    ((uchar *) wordP)[length-i-1] = temp;
+  }
+}
+
+static int msNativeOrder(void)
+{
+  int i = 1;
+  return (*((uchar *) &i) == 1) ? MS_NEW_LSB_ORDER : MS_NEW_MSB_ORDER;
+}
+
+/*
+** Returns source with suffix in place of any .shp extension, with room for
+** extra more characters. The caller frees the result.
+*/
+static char *msAttributeIndexSibling(const char *source, const char *suffix, int extra)
+{
+  char *filename, *s;
+
+  filename = (char *) msSmallMalloc(strlen(source) + strlen(suffix) + extra + 1);
+  strcpy(filename, source);
+  s = strstr(filename, ".shp");
+  if(!s) s = strstr(filename, ".SHP");
+  if(s) *s = '\0';
+  strcat(filename, suffix);
+
+  return filename;
+}
+
+/*
+** Returns the index file name for item of the shapefile named by source, with
+** or without the .shp extension. The caller frees the result.
+*/
+char *msAttributeIndexFilename(const char *source, const char *item)
+{
+  char *filename, *s;
+  int i;
+
+  filename = msAttributeIndexSibling(source, ".", strlen(item) + strlen(MS_ATTRINDEX_EXTENSION));
+  s = filename + strlen(filename);
+  for(i=0; item[i]; i++) *s++ = tolower(item[i]);
+  strcpy(s, MS_ATTRINDEX_EXTENSION);
+
+  return filename;
+}
+
+/* ==================================================================== */
+/*      Building.                                                       */
+/* ==================================================================== */
+
+static int cmpNumericEntries(const void *a, const void *b)
+{
+  const attrIndexEntryObj *ea = (const attrIndexEntryObj *) a, *eb = (const attrIndexEntryObj *) b;
+
+  if(ea->dblkey < eb->dblkey) return -1;
+  if(ea->dblkey > eb->dblkey) return 1;
+  return ea->id - eb->id;
+}
+
+static int cmpStringEntries(const void *a, const void *b)
+{
+  const attrIndexEntryObj *ea = (const attrIndexEntryObj *) a, *eb = (const attrIndexEntryObj *) b;
+  int c = strcmp(ea->key, eb->key);
+
+  if(c) return c;
+  return ea->id - eb->id;
+}
+
+/*
+** Writes the attribute index for item to filename. keytype is 'N' or 'C', or
+** 0 to pick it from the DBF field type.
+*/
+int msWriteAttributeIndex(shapefileObj *shpfile, const char *item, char keytype, const char *filename)
+{
+  attrIndexEntryObj *entries;
+  int itemindex, numrecords, numentries=0, keywidth=0, i;
+  int width, decimals;
+  char fieldname[32], header[MS_ATTRINDEX_HEADER_SIZE];
+  DBFFieldType fieldtype;
+  ms_int32 value;
+  FILE *fp;
+
+  if(!shpfile->hDBF) {
+    msSetError(MS_SHPERR, "Shapefile has no attribute table.", "msWriteAttributeIndex()");
+    return MS_FAILURE;
+  }
+
+  itemindex = msDBFGetItemIndex(shpfile->hDBF, (char *) item);
+  if(itemindex == -1) return MS_FAILURE; /* error already set */
+
+  fieldtype = msDBFGetFieldInfo(shpfile->hDBF, itemindex, fieldname, &width, &decimals);
+  if(keytype == 0)
+    keytype = (fieldtype == FTInteger || fieldtype == FTDouble) ? 'N' : 'C';
+
+  numrecords = msDBFGetRecordCount(shpfile->hDBF);
+  entries = (attrIndexEntryObj *) msSmallMalloc(sizeof(attrIndexEntryObj) * MS_MAX(numrecords, 1));
+
+  for(i=0; i<numrecords; i++) {
+    char **values = msDBFGetValueList(shpfile->hDBF, i, &itemindex, 1);
+    if(!values) {
+      while(numentries > 0) msFree(entries[--numentries].key);
+      msFree(entries);
+      return MS_FAILURE;
+    }
+
+    entries[numentries].id = i;
+    entries[numentries].key = NULL;
+    if(keytype == 'N') {
+      entries[numentries].dblkey = atof(values[0]);
+      msFreeCharArray(values, 1);
+      if(entries[numentries].dblkey != entries[numentries].dblkey) continue; /* NaN never compares true */
+    } else {
+      entries[numentries].key = values[0];
+      keywidth = MS_MAX(keywidth, (int) strlen(values[0]));
+      free(values);
+    }
+    numentries++;
+  }
+
+  if(keytype == 'N') {
+    keywidth = sizeof(double);
+    qsort(entries, numentries, sizeof(attrIndexEntryObj), cmpNumericEntries);
+  } else {
+    keywidth = MS_MAX(keywidth, 1);
+    qsort(entries, numentries, sizeof(attrIndexEntryObj), cmpStringEntries);
+  }
+
+  fp = fopen(filename, "wb");
+  if(!fp) {
+    msSetError(MS_IOERR, "Unable to open %s for writing.", "msWriteAttributeIndex()", filename);
+    for(i=0; i<numentries; i++) msFree(entries[i].key);
+    msFree(entries);
+    return MS_FAILURE;
+  }
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, MS_ATTRINDEX_SIGNATURE, 4);
+  header[4] = msNativeOrder();
+  header[5] = MS_ATTRINDEX_VERSION;
+  header[6] = keytype;
+  value = numrecords;
+  memcpy(header+8, &value, 4);
+  value = keywidth;
+  memcpy(header+12, &value, 4);
+  value = numentries;
+  memcpy(header+16, &value, 4);
+  fwrite(header, sizeof(header), 1, fp);
+
+  if(keytype == 'C') {
+    char *key = (char *) msSmallCalloc(1, keywidth);
+    for(i=0; i<numentries; i++) {
+      memset(key, 0, keywidth);
+      memcpy(key, entries[i].key, strlen(entries[i].key));
+      fwrite(key, keywidth, 1, fp);
+      fwrite(&(entries[i].id), 4, 1, fp);
+      free(entries[i].key);
+    }
+    free(key);
+  } else {
+    for(i=0; i<numentries; i++) {
+      fwrite(&(entries[i].dblkey), sizeof(double), 1, fp);
+      fwrite(&(entries[i].id), 4, 1, fp);
+    }
+  }
+
+  msFree(entries);
+
+  if(fclose(fp) != 0) {
+    msSetError(MS_IOERR, "Error writing %s.", "msWriteAttributeIndex()", filename);
+    return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+
+/* ==================================================================== */
+/*      Searching.                                                      */
+/* ==================================================================== */
+
+static void msAttributeIndexClose(attrIndexObj *index)
+{
+  if(!index) return;
+  fclose(index->fp);
+  free(index->key);
+  free(index);
+}
+
+/*
+** Opens the index of item for shpfile. Returns NULL without setting an error
+** if there is none or it no longer matches the DBF.
+*/
+static attrIndexObj *msAttributeIndexOpen(shapefileObj *shpfile, const char *item, int debug)
+{
+  attrIndexObj *index;
+  char header[MS_ATTRINDEX_HEADER_SIZE];
+  char *filename, *dbfname;
+  ms_int32 numrecords, keywidth, numentries;
+  struct stat indexstat, dbfstat;
+  FILE *fp;
+
+  filename = msAttributeIndexFilename(shpfile->source, item);
+  fp = fopen(filename, "rb");
+  if(!fp || stat(filename, &indexstat) != 0) {
+    if(fp) fclose(fp);
+    msFree(filename);
+    return NULL;
+  }
+
+  if(fread(header, sizeof(header), 1, fp) != 1 || memcmp(header, MS_ATTRINDEX_SIGNATURE, 4) != 0
+      || header[5] != MS_ATTRINDEX_VERSION || (header[6] != 'N' && header[6] != 'C')) {
+    if(debug) msDebug("msAttributeIndexOpen(): %s is not an attribute index, ignored.\n", filename);
+    fclose(fp);
+    msFree(filename);
+    return NULL;
+  }
+
+  memcpy(&numrecords, header+8, 4);
+  memcpy(&keywidth, header+12, 4);
+  memcpy(&numentries, header+16, 4);
+  if(header[4] != msNativeOrder()) {
+    SwapWord(4, &numrecords);
+    SwapWord(4, &keywidth);
+    SwapWord(4, &numentries);
+  }
+
+  /* a rewritten shapefile invalidates the index */
+  dbfname = msAttributeIndexSibling(shpfile->source, ".dbf", 0);
+  if(numrecords != shpfile->numshapes || keywidth <= 0
+      || (stat(dbfname, &dbfstat) == 0 && dbfstat.st_mtime > indexstat.st_mtime)) {
+    if(debug) msDebug("msAttributeIndexOpen(): %s is out of date, ignored.\n", filename);
+    fclose(fp);
+    msFree(dbfname);
+    msFree(filename);
+    return NULL;
+  }
+  msFree(dbfname);
+  msFree(filename);
+
+  index = (attrIndexObj *) msSmallMalloc(sizeof(attrIndexObj));
+  index->fp = fp;
+  index->needswap = (header[4] != msNativeOrder());
+  index->keytype = header[6];
+  index->keywidth = keywidth;
+  index->numentries = numentries;
+  index->entrysize = keywidth + 4;
+  index->key = (char *) msSmallCalloc(1, keywidth + 1);
+  index->id = -1;
+
+  return index;
+}
+
+/* reads entry i, or the next one if i is -1 */
+static int msAttributeIndexRead(attrIndexObj *index, int i)
+{
+  if(i >= 0 && fseek(index->fp, MS_ATTRINDEX_HEADER_SIZE + (long) i * index->entrysize, SEEK_SET) != 0)
+    return MS_FAILURE;
+
+  if(fread(index->key, index->keywidth, 1, index->fp) != 1 || fread(&(index->id), 4, 1, index->fp) != 1)
+    return MS_FAILURE;
+
+  if(index->needswap) {
+    SwapWord(4, &(index->id));
+    if(index->keytype == 'N') SwapWord(sizeof(double), index->key);
+  }
+
+  return MS_SUCCESS;
+}
+
+/* compares the current entry with a numeric or string key */
+static int msAttributeIndexCompare(attrIndexObj *index, double dblkey, const char *key)
+{
+  if(index->keytype == 'N') {
+    double d;
+    memcpy(&d, index->key, sizeof(double));
+    return (d < dblkey) ? -1 : ((d > dblkey) ? 1 : 0);
+  }
+  return key ? strcmp(index->key, key) : 0;
+}
+
+/*
+** Sets the bit of every shape whose key lies between the given bounds. A NULL
+** lo or hi leaves that end open, for strings only equality (lo == hi) is used.
+*/
+static int msAttributeIndexSearch(attrIndexObj *index, ms_bitarray bits, int numshapes,
+                                  const double *lo, int lo_incl, const double *hi, int hi_incl, const char *key)
+{
+  int first=0, last=index->numentries, mid, c;
+
+  if(key && (int) strlen(key) > index->keywidth) return MS_SUCCESS; /* can't be in there */
+
+  /* binary search for the first entry at or past the lower bound */
+  if(lo || key) {
+    while(first < last) {
+      mid = first + (last - first) / 2;
+      if(msAttributeIndexRead(index, mid) != MS_SUCCESS) return MS_FAILURE;
+      c = msAttributeIndexCompare(index, lo ? *lo : 0, key);
+      if(c < 0 || (c == 0 && lo && !lo_incl))
+        first = mid + 1;
+      else
+        last = mid;
+    }
+  }
+
+  if(first >= index->numentries) return MS_SUCCESS;
+  if(msAttributeIndexRead(index, first) != MS_SUCCESS) return MS_FAILURE;
+
+  for(;;) {
+    if(key)
+      c = msAttributeIndexCompare(index, 0, key);
+    else if(hi)
+      c = msAttributeIndexCompare(index, *hi, NULL);
+    else
+      c = -1;
+    if(c > 0 || (c == 0 && hi && !hi_incl)) break;
+
+    if(index->id >= 0 && index->id < numshapes)
+      msSetBit(bits, index->id, 1);
+
+    if(++first >= index->numentries) break;
+    if(msAttributeIndexRead(index, -1) != MS_SUCCESS) return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+
+static attrIndexObj *msAttributeIndexGet(attrIndexSearchObj *search, const char *item)
+{
+  int i;
+
+  for(i=0; i<search->numopen; i++) {
+    if(strcasecmp(search->items[i], item) == 0) return search->indexes[i];
+  }
+
+  if(search->numopen == MS_ATTRINDEX_MAXOPEN) return NULL;
+
+  search->items[search->numopen] = msStrdup(item);
+  search->indexes[search->numopen] = msAttributeIndexOpen(search->shpfile, item, search->layer->debug);
+  return search->indexes[search->numopen++];
+}
+
+/*
+** Looks up one comparison. *bits is left NULL when the comparison can't be
+** answered from an index, meaning "no restriction".
+*/
+static int msAttributeIndexComparison(attrIndexSearchObj *search, tokenListNodeObjPtr binding, int op,
+                                      tokenListNodeObjPtr literal, ms_bitarray *bits)
+{
+  attrIndexObj *index;
+  int numeric, status;
+  double value;
+
+  *bits = NULL;
+
+  if(binding->token == MS_TOKEN_BINDING_STRING && literal->token == MS_TOKEN_LITERAL_STRING)
+    numeric = MS_FALSE;
+  else if((binding->token == MS_TOKEN_BINDING_DOUBLE || binding->token == MS_TOKEN_BINDING_INTEGER)
+          && literal->token == MS_TOKEN_LITERAL_NUMBER)
+    numeric = MS_TRUE;
+  else
+    return MS_SUCCESS;
+
+  index = msAttributeIndexGet(search, binding->tokenval.bindval.item);
+  if(!index || (index->keytype == 'N') != numeric) return MS_SUCCESS;
+  if(!numeric && op != MS_TOKEN_COMPARISON_EQ) return MS_SUCCESS;
+
+  *bits = msAllocBitArray(search->shpfile->numshapes);
+  if(!*bits) {
+    msSetError(MS_MEMERR, NULL, "msAttributeIndexComparison()");
+    return MS_FAILURE;
+  }
+
+  if(!numeric) {
+    status = msAttributeIndexSearch(index, *bits, search->shpfile->numshapes, NULL, 0, NULL, 0, literal->tokenval.strval);
+  } else {
+    value = literal->tokenval.dblval;
+    switch(op) {
+      case MS_TOKEN_COMPARISON_EQ:
+        status = msAttributeIndexSearch(index, *bits, search->shpfile->numshapes, &value, MS_TRUE, &value, MS_TRUE, NULL);
+        break;
+      case MS_TOKEN_COMPARISON_LT:
+        status = msAttributeIndexSearch(index, *bits, search->shpfile->numshapes, NULL, 0, &value, MS_FALSE, NULL);
+        break;
+      case MS_TOKEN_COMPARISON_LE:
+        status = msAttributeIndexSearch(index, *bits, search->shpfile->numshapes, NULL, 0, &value, MS_TRUE, NULL);
+        break;
+      case MS_TOKEN_COMPARISON_GT:
+        status = msAttributeIndexSearch(index, *bits, search->shpfile->numshapes, &value, MS_FALSE, NULL, 0, NULL);
+        break;
+      case MS_TOKEN_COMPARISON_GE:
+        status = msAttributeIndexSearch(index, *bits, search->shpfile->numshapes, &value, MS_TRUE, NULL, 0, NULL);
+        break;
+      default: /* not something a sorted index answers */
+        status = MS_SUCCESS;
+        free(*bits);
+        *bits = NULL;
+        break;
+    }
+  }
+
+  if(status != MS_SUCCESS) {
+    free(*bits);
+    *bits = NULL;
+  }
+  return status;
+}
+
+static int msAttributeIndexOr(attrIndexSearchObj *search, ms_bitarray *bits);
+
+/* term := '(' or ')' | binding op literal | literal op binding */
+static int msAttributeIndexTerm(attrIndexSearchObj *search, ms_bitarray *bits)
+{
+  tokenListNodeObjPtr a, op, b;
+  int token;
+
+  *bits = NULL;
+  a = search->node;
+  if(!a) return MS_FAILURE;
+
+  if(a->token == '(') {
+    search->node = a->next;
+    if(msAttributeIndexOr(search, bits) != MS_SUCCESS) return MS_FAILURE;
+    if(!search->node || search->node->token != ')') {
+      msFree(*bits);
+      *bits = NULL;
+      return MS_FAILURE;
+    }
+    search->node = search->node->next;
+    return MS_SUCCESS;
+  }
+
+  op = a->next;
+  if(!op) return MS_FAILURE;
+  b = op->next;
+  if(!b) return MS_FAILURE;
+  search->node = b->next;
+
+  token = op->token;
+  if(token < MS_TOKEN_COMPARISON_EQ || token > MS_TOKEN_COMPARISON_DWITHIN) return MS_FAILURE;
+
+  if(a->token >= MS_TOKEN_BINDING_DOUBLE && a->token <= MS_TOKEN_BINDING_TIME
+      && b->token >= MS_TOKEN_LITERAL_NUMBER && b->token <= MS_TOKEN_LITERAL_SHAPE)
+    return msAttributeIndexComparison(search, a, token, b, bits);
+
+  if(b->token >= MS_TOKEN_BINDING_DOUBLE && b->token <= MS_TOKEN_BINDING_TIME
+      && a->token >= MS_TOKEN_LITERAL_NUMBER && a->token <= MS_TOKEN_LITERAL_SHAPE) {
+    /* literal on the left, mirror the comparison */
+    if(token == MS_TOKEN_COMPARISON_LT) token = MS_TOKEN_COMPARISON_GT;
+    else if(token == MS_TOKEN_COMPARISON_GT) token = MS_TOKEN_COMPARISON_LT;
+    else if(token == MS_TOKEN_COMPARISON_LE) token = MS_TOKEN_COMPARISON_GE;
+    else if(token == MS_TOKEN_COMPARISON_GE) token = MS_TOKEN_COMPARISON_LE;
+    return msAttributeIndexComparison(search, b, token, a, bits);
+  }
+
+  return MS_FAILURE;
+}
+
+/* and := term (AND term)*, an unrestricted term leaves the others in charge */
+static int msAttributeIndexAnd(attrIndexSearchObj *search, ms_bitarray *bits)
+{
+  ms_bitarray other;
+  size_t i, size = msGetBitArraySize(search->shpfile->numshapes);
+
+  if(msAttributeIndexTerm(search, bits) != MS_SUCCESS) return MS_FAILURE;
+
+  while(search->node && search->node->token == MS_TOKEN_LOGICAL_AND) {
+    search->node = search->node->next;
+    if(msAttributeIndexTerm(search, &other) != MS_SUCCESS) {
+      msFree(*bits);
+      *bits = NULL;
+      return MS_FAILURE;
+    }
+    if(!other) continue;
+    if(!*bits) {
+      *bits = other;
+      continue;
+    }
+    for(i=0; i<size; i++) (*bits)[i] &= other[i];
+    free(other);
+  }
+
+  return MS_SUCCESS;
+}
+
+/* or := and (OR and)*, a single unrestricted branch makes the whole unrestricted */
+static int msAttributeIndexOr(attrIndexSearchObj *search, ms_bitarray *bits)
+{
+  ms_bitarray other;
+  size_t i, size = msGetBitArraySize(search->shpfile->numshapes);
+  int unrestricted;
+
+  if(msAttributeIndexAnd(search, bits) != MS_SUCCESS) return MS_FAILURE;
+  unrestricted = (*bits == NULL);
+
+  while(search->node && search->node->token == MS_TOKEN_LOGICAL_OR) {
+    search->node = search->node->next;
+    if(msAttributeIndexAnd(search, &other) != MS_SUCCESS) {
+      msFree(*bits);
+      *bits = NULL;
+      return MS_FAILURE;
+    }
+    if(!other || unrestricted) {
+      unrestricted = MS_TRUE;
+      msFree(other);
+      continue;
+    }
+    for(i=0; i<size; i++) (*bits)[i] |= other[i];
+    free(other);
+  }
+
+  if(unrestricted) {
+    msFree(*bits);
+    *bits = NULL;
+  }
+
+  return MS_SUCCESS;
+}
+
+/*
+** Narrows shpfile->status down to the shapes that can pass the layer FILTER,
+** using the attribute indexes of the columns the filter compares against.
+** Filters other than a string match on FILTERITEM or an expression built from
+** =, <, <=, >, >= comparisons joined by AND/OR leave the status untouched.
+** Returns MS_DONE if no shape is left.
+*/
+int msFilterAttributeIndex(layerObj *layer, shapefileObj *shpfile)
+{
+  attrIndexSearchObj search;
+  ms_bitarray bits = NULL;
+  size_t i, size;
+  int status = MS_SUCCESS;
+
+  if(!shpfile->status || !layer->filter.string) return MS_SUCCESS;
+
+  memset(&search, 0, sizeof(search));
+  search.layer = layer;
+  search.shpfile = shpfile;
+
+  if(layer->filter.type == MS_STRING) {
+    tokenListNodeObj binding, literal;
+
+    if(!layer->filteritem || (layer->filter.flags & MS_EXP_INSENSITIVE)) return MS_SUCCESS;
+    binding.token = MS_TOKEN_BINDING_STRING;
+    binding.tokenval.bindval.item = layer->filteritem;
+    literal.token = MS_TOKEN_LITERAL_STRING;
+    literal.tokenval.strval = layer->filter.string;
+    status = msAttributeIndexComparison(&search, &binding, MS_TOKEN_COMPARISON_EQ, &literal, &bits);
+  } else if(layer->filter.type == MS_EXPRESSION && layer->filter.tokens) {
+    search.node = layer->filter.tokens;
+    status = msAttributeIndexOr(&search, &bits);
+    if(status == MS_SUCCESS && search.node != NULL) { /* trailing tokens we don't understand */
+      msFree(bits);
+      bits = NULL;
+    }
+  }
+
+  for(i=0; i<(size_t)search.numopen; i++) {
+    msAttributeIndexClose(search.indexes[i]);
+    msFree(search.items[i]);
+  }
+
+  if(status != MS_SUCCESS || !bits) {
+    msFree(bits);
+    return MS_SUCCESS; /* nothing to gain, the filter does all the work */
+  }
+
+  if(layer->debug >= MS_DEBUGLEVEL_VVV)
+    msDebug("msFilterAttributeIndex(): narrowed %s with an attribute index.\n", shpfile->source);
+
+  size = msGetBitArraySize(shpfile->numshapes);
+  for(i=0; i<size; i++) shpfile->status[i] &= bits[i];
+  free(bits);
+
+  if(msGetNextBit(shpfile->status, 0, shpfile->numshapes) == -1)
+    return MS_DONE;
+
+  return status;
+}
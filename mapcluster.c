@@ -31,7 +31,9 @@
 
 /* $Id$ */
 #include <assert.h>
+#include <sys/stat.h>
 #include "mapserver.h"
+#include "mapthread.h"
 
 
 
@@ -47,9 +49,13 @@
 #define MSCLUSTER_GROUP    "Cluster:Group"
 #define MSCLUSTER_GROUPINDEX   -101
 
+/* number of source layers kept in the process level feature cache */
+#define MSCLUSTER_CACHE_MAX_LAYERS 16
+
 typedef struct cluster_tree_node clusterTreeNode;
 typedef struct cluster_info clusterInfo;
 typedef struct cluster_layer_info msClusterLayerInfo;
+typedef struct cluster_cache clusterCache;
 
 /* forward declarations */
 void msClusterLayerCopyVirtualTable(layerVTableObj* vtable);
@@ -101,6 +107,32 @@ struct cluster_tree_node {
   clusterTreeNode* subnode[4];
 };
 
+/* process level cache of the source features (CLUSTER_USE_CACHE) */
+struct cluster_cache {
+  /* identifies the source layer and the requested items */
+  char* key;
+  time_t created;
+  /* modification time of the source file, 0 if unknown */
+  time_t mtime;
+  unsigned long last_used;
+  int ref_count;
+  /* set when the entry has been replaced and should be freed on release */
+  int stale;
+  /* source features in the order they were read from the source layer */
+  shapeObj* shapes;
+  int numshapes;
+  /* uniform grid over the feature positions, cellshapes holds the feature
+     indexes bucketed by cell, cellstart the first position of each cell */
+  rectObj extent;
+  int ncols;
+  int nrows;
+  double cellsizex;
+  double cellsizey;
+  int* cellstart;
+  int* cellshapes;
+  clusterCache* next;
+};
+
 /* layeinfo */
 struct cluster_layer_info {
   /* array of features (finalized clusters) */
@@ -129,6 +161,11 @@ struct cluster_layer_info {
   clusterCompareRegionFunc fnCompare;
   /* diagnostics */
   int depth;
+  /* cached source features and the candidates selected for the current extent */
+  clusterCache* cache;
+  int* cacheHits;
+  int numCacheHits;
+  int currentCacheHit;
 };
 
 
@@ -377,6 +414,401 @@ void clusterDestroyData(msClusterLayerInfo *layerinfo)
   layerinfo->numNodes = 0;
 }
 
+/*
+** Source feature cache.
+**
+** When the CLUSTER_USE_CACHE processing option is set, the source features
+** of the layer are read once and kept in a process level cache, so that
+** subsequent requests of a long running process (FastCGI, mapscript) only
+** need to pick up the features of the current extent from a grid index
+** instead of querying the source layer again. The entries are protected by
+** the TLOCK_CLUSTER mutex, and they are never modified once registered.
+** The features are returned in the original order, so the clusters are
+** identical to the ones built from the source layer directly.
+**
+** An entry is replaced when it is older than CLUSTER_CACHE_TIMEOUT seconds or
+** when the source file (shapefile or OGR datasource file) has been modified,
+** and the least recently used entry is dropped when the cache holds
+** MSCLUSTER_CACHE_MAX_LAYERS of them. Sources without a file to check (e.g.
+** database connections) are only refreshed through CLUSTER_CACHE_TIMEOUT.
+** Tiled sources are never cached.
+*/
+static clusterCache* clusterCacheList = NULL;
+static int clusterCacheCount = 0;
+static unsigned long clusterCacheClock = 0;
+
+static void clusterCacheDestroy(clusterCache* cache)
+{
+  int i;
+  for (i = 0; i < cache->numshapes; i++)
+    msFreeShape(&cache->shapes[i]);
+  msFree(cache->shapes);
+  msFree(cache->cellstart);
+  msFree(cache->cellshapes);
+  msFree(cache->key);
+  msFree(cache);
+}
+
+static char* clusterCacheAppendKey(char* key, const char* value)
+{
+  key = msStringConcatenate(key, value ? (char*)value : "");
+  return msStringConcatenate(key, "|");
+}
+
+/* the key identifies the source data and the items retrieved from it */
+static char* clusterCacheGetKey(layerObj* layer, layerObj* srcLayer)
+{
+  int i;
+  char* key = NULL;
+
+  key = clusterCacheAppendKey(key, layer->map->mappath);
+  key = clusterCacheAppendKey(key, layer->map->shapepath);
+  key = clusterCacheAppendKey(key, layer->name);
+  key = clusterCacheAppendKey(key, srcLayer->data);
+  key = clusterCacheAppendKey(key, srcLayer->connection);
+  key = clusterCacheAppendKey(key, srcLayer->tileindex);
+  for (i = 0; i < srcLayer->numitems; i++)
+    key = clusterCacheAppendKey(key, srcLayer->items[i]);
+
+  return key;
+}
+
+/* modification time of the file the source features are read from, 0 if unknown */
+static time_t clusterCacheGetMTime(layerObj* srcLayer)
+{
+  char szPath[MS_MAXPATHLEN];
+  mapObj* map = srcLayer->map;
+  struct stat sStat;
+
+  if (srcLayer->connectiontype == MS_SHAPEFILE) {
+    time_t shpmtime, dbfmtime;
+
+    if (!srcLayer->data || !msBuildPath3(szPath, map->mappath, map->shapepath, srcLayer->data))
+      return 0;
+    shpmtime = msShapefileGetMTime(szPath, ".shp");
+    dbfmtime = msShapefileGetMTime(szPath, ".dbf");
+    return MS_MAX(shpmtime, dbfmtime);
+  }
+
+  if (srcLayer->connectiontype == MS_OGR && srcLayer->connection &&
+      msTryBuildPath3(szPath, map->mappath, map->shapepath, srcLayer->connection) &&
+      stat(szPath, &sStat) == 0)
+    return sStat.st_mtime;
+
+  return 0;
+}
+
+/* unlink an entry from the cache list and free it as soon as it is not referenced */
+static void clusterCacheRemove(clusterCache* cache)
+{
+  clusterCache** link = &clusterCacheList;
+
+  while (*link != cache)
+    link = &(*link)->next;
+  *link = cache->next;
+  --clusterCacheCount;
+
+  cache->stale = MS_TRUE;
+  if (cache->ref_count == 0)
+    clusterCacheDestroy(cache);
+}
+
+/* check whether the cached source features can be used for this layer */
+static int clusterCacheIsApplicable(layerObj* layer, msClusterLayerInfo* layerinfo)
+{
+  const char* value = msLayerGetProcessingKey(layer, "CLUSTER_USE_CACHE");
+
+  if (!value || !(EQUAL(value, "ON") || EQUAL(value, "TRUE") || EQUAL(value, "YES")))
+    return MS_FALSE;
+
+  if (layer->transform != MS_TRUE)
+    return MS_FALSE;
+
+  /* a tile could be rewritten without touching the tile index, which would
+     go unnoticed, so tiled sources are always read directly */
+  if (layerinfo->srcLayer.tileindex != NULL || layerinfo->srcLayer.connectiontype == MS_TILED_SHAPEFILE)
+    return MS_FALSE;
+
+  /* the filters may vary from request to request, the cache holds the unfiltered features */
+  if (layer->filter.string != NULL || layerinfo->srcLayer.filter.string != NULL)
+    return MS_FALSE;
+
+  return MS_TRUE;
+}
+
+static int clusterCacheGetCell(clusterCache* cache, double x, double y, int* col, int* row)
+{
+  *col = (int)((x - cache->extent.minx) / cache->cellsizex);
+  *row = (int)((y - cache->extent.miny) / cache->cellsizey);
+
+  *col = MS_MAX(0, MS_MIN(cache->ncols - 1, *col));
+  *row = MS_MAX(0, MS_MIN(cache->nrows - 1, *row));
+
+  return *row * cache->ncols + *col;
+}
+
+/* read all features of the source layer and build the grid index */
+static clusterCache* clusterCacheBuild(layerObj* layer, msClusterLayerInfo* layerinfo, int isQuery)
+{
+  layerObj* srcLayer = &layerinfo->srcLayer;
+  clusterCache* cache;
+  rectObj extent;
+  shapeObj shape;
+  int status, i, col, row, cell, numcells;
+  int maxshapes = 0;
+  int* cellpos;
+
+  if (msLayerGetExtent(srcLayer, &extent) != MS_SUCCESS)
+    return NULL;
+
+  status = msLayerWhichShapes(srcLayer, extent, isQuery);
+  if (status != MS_SUCCESS && status != MS_DONE)
+    return NULL;
+
+  cache = (clusterCache*)msSmallCalloc(1, sizeof(clusterCache));
+
+  if (status == MS_SUCCESS) {
+    msInitShape(&shape);
+    while ((status = msLayerNextShape(srcLayer, &shape)) == MS_SUCCESS) {
+      if (cache->numshapes == maxshapes) {
+        maxshapes = (maxshapes > 0) ? maxshapes * 2 : 256;
+        cache->shapes = (shapeObj*)msSmallRealloc(cache->shapes, sizeof(shapeObj) * maxshapes);
+      }
+      /* the cache takes the ownership of the shape data */
+      cache->shapes[cache->numshapes++] = shape;
+      msInitShape(&shape);
+    }
+    msFreeShape(&shape);
+
+    if (status != MS_DONE) {
+      clusterCacheDestroy(cache);
+      return NULL;
+    }
+  }
+
+  /* set up a grid of about 4 features per cell over the feature positions */
+  if (cache->numshapes > 0) {
+    cache->extent.minx = cache->extent.maxx = cache->shapes[0].bounds.minx;
+    cache->extent.miny = cache->extent.maxy = cache->shapes[0].bounds.miny;
+    for (i = 1; i < cache->numshapes; i++) {
+      cache->extent.minx = MS_MIN(cache->extent.minx, cache->shapes[i].bounds.minx);
+      cache->extent.maxx = MS_MAX(cache->extent.maxx, cache->shapes[i].bounds.minx);
+      cache->extent.miny = MS_MIN(cache->extent.miny, cache->shapes[i].bounds.miny);
+      cache->extent.maxy = MS_MAX(cache->extent.maxy, cache->shapes[i].bounds.miny);
+    }
+  }
+
+  cache->ncols = cache->nrows = MS_MAX(1, MS_MIN(1024, (int)sqrt(cache->numshapes / 4.0)));
+  cache->cellsizex = (cache->extent.maxx - cache->extent.minx) / cache->ncols;
+  cache->cellsizey = (cache->extent.maxy - cache->extent.miny) / cache->nrows;
+  if (cache->cellsizex <= 0)
+    cache->cellsizex = 1;
+  if (cache->cellsizey <= 0)
+    cache->cellsizey = 1;
+
+  numcells = cache->ncols * cache->nrows;
+  cache->cellstart = (int*)msSmallCalloc(numcells + 1, sizeof(int));
+  cache->cellshapes = (int*)msSmallMalloc(sizeof(int) * MS_MAX(1, cache->numshapes));
+
+  for (i = 0; i < cache->numshapes; i++) {
+    cell = clusterCacheGetCell(cache, cache->shapes[i].bounds.minx, cache->shapes[i].bounds.miny, &col, &row);
+    ++cache->cellstart[cell + 1];
+  }
+  for (i = 0; i < numcells; i++)
+    cache->cellstart[i + 1] += cache->cellstart[i];
+
+  cellpos = (int*)msSmallMalloc(sizeof(int) * numcells);
+  memcpy(cellpos, cache->cellstart, sizeof(int) * numcells);
+  for (i = 0; i < cache->numshapes; i++) {
+    cell = clusterCacheGetCell(cache, cache->shapes[i].bounds.minx, cache->shapes[i].bounds.miny, &col, &row);
+    cache->cellshapes[cellpos[cell]++] = i;
+  }
+  msFree(cellpos);
+
+  cache->created = time(NULL);
+
+  if (layer->debug >= MS_DEBUGLEVEL_VV)
+    msDebug("clusterCacheBuild(): cached %d features of layer %s in a %dx%d grid.\n",
+            cache->numshapes, layer->name, cache->ncols, cache->nrows);
+
+  return cache;
+}
+
+/* get a referenced cache entry for the source layer, build it if required */
+static clusterCache* clusterCacheRequest(layerObj* layer, msClusterLayerInfo* layerinfo, int isQuery)
+{
+  const char* value;
+  int timeout = 0;
+  char* key;
+  time_t mtime;
+  clusterCache* cache;
+  clusterCache* built = NULL;
+
+  value = msLayerGetProcessingKey(layer, "CLUSTER_CACHE_TIMEOUT");
+  if (value)
+    timeout = atoi(value);
+
+  key = clusterCacheGetKey(layer, &layerinfo->srcLayer);
+  mtime = clusterCacheGetMTime(&layerinfo->srcLayer);
+
+  for (;;) {
+    msAcquireLock(TLOCK_CLUSTER);
+
+    cache = clusterCacheList;
+    while (cache && strcmp(cache->key, key) != 0)
+      cache = cache->next;
+
+    if (cache && !built && ((timeout > 0 && time(NULL) - cache->created > timeout) || cache->mtime != mtime)) {
+      /* expired or the source has been modified */
+      clusterCacheRemove(cache);
+      cache = NULL;
+    }
+
+    if (cache) {
+      /* found (or another thread has registered the same data meanwhile) */
+      ++cache->ref_count;
+      cache->last_used = ++clusterCacheClock;
+      msReleaseLock(TLOCK_CLUSTER);
+      if (built)
+        clusterCacheDestroy(built);
+      msFree(key);
+      return cache;
+    }
+
+    if (built) {
+      /* make room by dropping the least recently used entry */
+      while (clusterCacheCount >= MSCLUSTER_CACHE_MAX_LAYERS) {
+        clusterCache* lru = clusterCacheList;
+        for (cache = clusterCacheList; cache; cache = cache->next) {
+          if (cache->last_used < lru->last_used)
+            lru = cache;
+        }
+        clusterCacheRemove(lru);
+      }
+
+      built->key = key;
+      built->mtime = mtime;
+      built->ref_count = 1;
+      built->last_used = ++clusterCacheClock;
+      built->next = clusterCacheList;
+      clusterCacheList = built;
+      ++clusterCacheCount;
+      msReleaseLock(TLOCK_CLUSTER);
+      return built;
+    }
+
+    msReleaseLock(TLOCK_CLUSTER);
+
+    /* read the source layer without holding the lock */
+    if ((built = clusterCacheBuild(layer, layerinfo, isQuery)) == NULL) {
+      msFree(key);
+      return NULL;
+    }
+  }
+}
+
+static void clusterCacheRelease(clusterCache* cache)
+{
+  msAcquireLock(TLOCK_CLUSTER);
+  if (--cache->ref_count == 0 && cache->stale)
+    clusterCacheDestroy(cache);
+  msReleaseLock(TLOCK_CLUSTER);
+}
+
+/* free the cache entries, the referenced ones are freed on release */
+void msClusterCacheCleanup(void)
+{
+  clusterCache* cache;
+  clusterCache* next;
+
+  msAcquireLock(TLOCK_CLUSTER);
+  cache = clusterCacheList;
+  while (cache) {
+    next = cache->next;
+    cache->stale = MS_TRUE;
+    if (cache->ref_count == 0)
+      clusterCacheDestroy(cache);
+    cache = next;
+  }
+  clusterCacheList = NULL;
+  clusterCacheCount = 0;
+  msReleaseLock(TLOCK_CLUSTER);
+}
+
+static int clusterCacheCompareHits(const void* a, const void* b)
+{
+  return *(const int*)a - *(const int*)b;
+}
+
+/* select the cached features the dynamic path would retrieve: the bounds must
+   overlap the search rectangle and the anchor point (the lower left corner)
+   extended by the cluster distance must overlap it as well */
+static void clusterCacheWhichShapes(msClusterLayerInfo* layerinfo, rectObj searchrect,
+                                    double maxDistanceX, double maxDistanceY)
+{
+  clusterCache* cache = layerinfo->cache;
+  int mincol, minrow, maxcol, maxrow, col, row, i, cell;
+  shapeObj* shape;
+  rectObj anchorrect;
+
+  layerinfo->numCacheHits = 0;
+  layerinfo->currentCacheHit = 0;
+
+  /* the area the anchor points of the matching features may fall into */
+  anchorrect = searchrect;
+  anchorrect.minx -= maxDistanceX;
+  anchorrect.miny -= maxDistanceY;
+
+  if (cache->numshapes == 0 || !msRectOverlap(&anchorrect, &cache->extent))
+    return;
+
+  if (!layerinfo->cacheHits)
+    layerinfo->cacheHits = (int*)msSmallMalloc(sizeof(int) * cache->numshapes);
+
+  /* the features are indexed by their anchor point */
+  clusterCacheGetCell(cache, anchorrect.minx, anchorrect.miny, &mincol, &minrow);
+  clusterCacheGetCell(cache, anchorrect.maxx, anchorrect.maxy, &maxcol, &maxrow);
+
+  for (row = minrow; row <= maxrow; row++) {
+    for (col = mincol; col <= maxcol; col++) {
+      cell = row * cache->ncols + col;
+      for (i = cache->cellstart[cell]; i < cache->cellstart[cell + 1]; i++) {
+        shape = &cache->shapes[cache->cellshapes[i]];
+        if (shape->bounds.minx >= anchorrect.minx && shape->bounds.miny >= anchorrect.miny &&
+            msRectOverlap(&searchrect, &shape->bounds))
+          layerinfo->cacheHits[layerinfo->numCacheHits++] = cache->cellshapes[i];
+      }
+    }
+  }
+
+  /* restore the order of the source layer */
+  qsort(layerinfo->cacheHits, layerinfo->numCacheHits, sizeof(int), clusterCacheCompareHits);
+}
+
+/* get the next source feature either from the cache or from the source layer */
+static int clusterNextSourceShape(msClusterLayerInfo* layerinfo, shapeObj* shape)
+{
+  if (!layerinfo->cache)
+    return msLayerNextShape(&layerinfo->srcLayer, shape);
+
+  if (layerinfo->currentCacheHit >= layerinfo->numCacheHits)
+    return MS_DONE;
+
+  return msCopyShape(&layerinfo->cache->shapes[layerinfo->cacheHits[layerinfo->currentCacheHit++]], shape);
+}
+
+static void clusterCacheDetach(msClusterLayerInfo* layerinfo)
+{
+  if (layerinfo->cache) {
+    clusterCacheRelease(layerinfo->cache);
+    layerinfo->cache = NULL;
+  }
+  msFree(layerinfo->cacheHits);
+  layerinfo->cacheHits = NULL;
+  layerinfo->numCacheHits = 0;
+  layerinfo->currentCacheHit = 0;
+}
+
 /* traverse the quadtree to find the neighbouring shapes and update some data
 on the related shapes (when adding a new feature)*/
 static void findRelatedShapes(msClusterLayerInfo* layerinfo,
@@ -957,20 +1389,28 @@ int RebuildClusters(layerObj *layer, int isQuery)
 
   srcLayer = &layerinfo->srcLayer;
 
-  /* start retrieving the shapes */
-  status = msLayerWhichShapes(srcLayer, searchrect, isQuery);
-  if(status == MS_DONE) {
-    /* no overlap */
-    return MS_SUCCESS;
-  } else if(status != MS_SUCCESS) {
-    return MS_FAILURE;
+  /* use the process level cache of the source features if possible */
+  if (!layerinfo->cache && clusterCacheIsApplicable(layer, layerinfo))
+    layerinfo->cache = clusterCacheRequest(layer, layerinfo, isQuery);
+
+  if (layerinfo->cache) {
+    clusterCacheWhichShapes(layerinfo, searchrect, maxDistanceX, maxDistanceY);
+  } else {
+    /* start retrieving the shapes */
+    status = msLayerWhichShapes(srcLayer, searchrect, isQuery);
+    if(status == MS_DONE) {
+      /* no overlap */
+      return MS_SUCCESS;
+    } else if(status != MS_SUCCESS) {
+      return MS_FAILURE;
+    }
   }
 
   /* step through the source shapes and populate the quadtree with the tentative clusters */
   if ((current = clusterInfoCreate(layerinfo)) == NULL)
     return MS_FAILURE;
 
-  while((status = msLayerNextShape(srcLayer, &current->shape)) == MS_SUCCESS) {
+  while((status = clusterNextSourceShape(layerinfo, &current->shape)) == MS_SUCCESS) {
 #if defined(USE_PROJ) && defined(USE_CLUSTER_EXTERNAL)
     /* transform the shape to the projection of this layer */
     if(srcLayer->transform == MS_TRUE && srcLayer->project && layer->transform == MS_TRUE && layer->project &&msProjectionsDiffer(&(srcLayer->projection), &(layer->projection)))
@@ -1152,6 +1592,7 @@ int msClusterLayerClose(layerObj *layer)
     return MS_SUCCESS;
 
   clusterDestroyData(layerinfo);
+  clusterCacheDetach(layerinfo);
 
   msLayerClose(&layerinfo->srcLayer);
   freeLayer(&layerinfo->srcLayer);
@@ -1202,6 +1643,9 @@ int msClusterLayerInitItemInfo(layerObj *layer)
   /* Cleanup any previous item selection */
   msClusterLayerFreeItemInfo(layer);
 
+  /* the cached features hold the values of the previous item selection */
+  clusterCacheDetach(layerinfo);
+
   layer->iteminfo = (int *) msSmallMalloc(sizeof(int) * layer->numitems);
 
   itemindexes = layer->iteminfo;
@@ -1380,6 +1824,11 @@ msClusterLayerInfo* msClusterInitialize(layerObj *layer)
   layerinfo->finalizedNodes = NULL;
   layerinfo->numFinalizedNodes = 0;
 
+  layerinfo->cache = NULL;
+  layerinfo->cacheHits = NULL;
+  layerinfo->numCacheHits = 0;
+  layerinfo->currentCacheHit = 0;
+
   return layerinfo;
 }
 
@@ -636,6 +636,7 @@ int msCopyLabelCacheMember(labelCacheMemberObj *dst, labelCacheMemberObj *src)
   MS_COPYSTELEM(numlabels);
   dst->labels = (labelObj *) msSmallMalloc(sizeof(labelObj)*dst->numlabels);
   for (i = 0; i < dst->numlabels; i++) {
+    initLabel(&(dst->labels[i]));
     msCopyLabel(&(dst->labels[i]), &(src->labels[i]));
   }
 
@@ -287,7 +287,8 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   wmsParamsObj sLastWMSParams;
 #endif
 
-  if(map->debug >= MS_DEBUGLEVEL_TUNING) msGettimeofday(&mapstarttime, NULL);
+  if(map->debug >= MS_DEBUGLEVEL_TUNING || map->profile.enabled) msGettimeofday(&mapstarttime, NULL);
+  if(map->profile.enabled) map->profile.query = map->profile.labelcache = map->profile.total = 0;
 
   if(querymap) { /* use queryMapObj image dimensions */
     if(map->querymap.width != -1) map->width = map->querymap.width;
@@ -310,7 +311,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
 
   /* Time the OWS query phase */
-  if(map->debug >= MS_DEBUGLEVEL_TUNING ) msGettimeofday(&starttime, NULL);
+  if(map->debug >= MS_DEBUGLEVEL_TUNING || map->profile.enabled) msGettimeofday(&starttime, NULL);
 
   /* How many OWS (WMS/WFS) layers do we have to draw?
    * Note: numOWSLayers is the number of actual layers and numOWSRequests is
@@ -380,11 +381,15 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     return NULL;
   }
 
-  if(map->debug >= MS_DEBUGLEVEL_TUNING) {
+  if(map->debug >= MS_DEBUGLEVEL_TUNING || map->profile.enabled) {
     msGettimeofday(&endtime, NULL);
-    msDebug("msDrawMap(): WMS/WFS set-up and query, %.3fs\n",
-            (endtime.tv_sec+endtime.tv_usec/1.0e6)-
-            (starttime.tv_sec+starttime.tv_usec/1.0e6) );
+    if(map->profile.enabled)
+      map->profile.query += (endtime.tv_sec+endtime.tv_usec/1.0e6)-
+                            (starttime.tv_sec+starttime.tv_usec/1.0e6);
+    if(map->debug >= MS_DEBUGLEVEL_TUNING)
+      msDebug("msDrawMap(): WMS/WFS set-up and query, %.3fs\n",
+              (endtime.tv_sec+endtime.tv_usec/1.0e6)-
+              (starttime.tv_sec+starttime.tv_usec/1.0e6) );
   }
 
 #endif /* USE_WMS_LYR || USE_WFS_LYR */
@@ -483,7 +488,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     }
   }
 
-  if(map->debug >= MS_DEBUGLEVEL_TUNING) msGettimeofday(&starttime, NULL);
+  if(map->debug >= MS_DEBUGLEVEL_TUNING || map->profile.enabled) msGettimeofday(&starttime, NULL);
 
   if(msDrawLabelCache(image, map) != MS_SUCCESS) {
     msFreeImage(image);
@@ -496,11 +501,15 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     return(NULL);
   }
 
-  if(map->debug >= MS_DEBUGLEVEL_TUNING) {
+  if(map->debug >= MS_DEBUGLEVEL_TUNING || map->profile.enabled) {
     msGettimeofday(&endtime, NULL);
-    msDebug("msDrawMap(): Drawing Label Cache, %.3fs\n",
-            (endtime.tv_sec+endtime.tv_usec/1.0e6)-
-            (starttime.tv_sec+starttime.tv_usec/1.0e6) );
+    if(map->profile.enabled)
+      map->profile.labelcache = (endtime.tv_sec+endtime.tv_usec/1.0e6)-
+                                (starttime.tv_sec+starttime.tv_usec/1.0e6);
+    if(map->debug >= MS_DEBUGLEVEL_TUNING)
+      msDebug("msDrawMap(): Drawing Label Cache, %.3fs\n",
+              (endtime.tv_sec+endtime.tv_usec/1.0e6)-
+              (starttime.tv_sec+starttime.tv_usec/1.0e6) );
   }
 
   for(i=0; i<map->numlayers; i++) { /* for each layer, check for postlabelcache layers */
@@ -582,11 +591,15 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   }
 #endif
 
-  if(map->debug >= MS_DEBUGLEVEL_TUNING) {
+  if(map->debug >= MS_DEBUGLEVEL_TUNING || map->profile.enabled) {
     msGettimeofday(&mapendtime, NULL);
-    msDebug("msDrawMap() total time: %.3fs\n",
-            (mapendtime.tv_sec+mapendtime.tv_usec/1.0e6)-
-            (mapstarttime.tv_sec+mapstarttime.tv_usec/1.0e6) );
+    if(map->profile.enabled)
+      map->profile.total = (mapendtime.tv_sec+mapendtime.tv_usec/1.0e6)-
+                           (mapstarttime.tv_sec+mapstarttime.tv_usec/1.0e6);
+    if(map->debug >= MS_DEBUGLEVEL_TUNING)
+      msDebug("msDrawMap() total time: %.3fs\n",
+              (mapendtime.tv_sec+mapendtime.tv_usec/1.0e6)-
+              (mapstarttime.tv_sec+mapstarttime.tv_usec/1.0e6) );
   }
 
   return(image);
@@ -688,6 +701,11 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image)
 
   if(layer->opacity == 0) return MS_SUCCESS; /* layer is completely transparent, skip it */
 
+  /* vector tiles only carry features, there is nothing to encode for these */
+  if(MS_RENDERER_MVT(image->format) &&
+      (layer->type == MS_LAYER_RASTER || layer->type == MS_LAYER_CHART || layer->connectiontype == MS_WMS))
+    return MS_SUCCESS;
+
   /* conditions may have changed since this layer last drawn, so set
      layer->project true to recheck projection needs (Bug #673) */
   layer->project = MS_TRUE;
@@ -916,6 +934,7 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   double minfeaturesize = -1;
   int maxfeatures=-1;
   int featuresdrawn=0;
+  struct mstimeval starttime, endtime;
 
   if (image)
     maxfeatures=msLayerGetMaxFeaturesToDraw(layer, image->format);
@@ -933,6 +952,8 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   msClearLayerPenValues(layer);
 #endif
 
+  if(map->profile.enabled) msGettimeofday(&starttime, NULL);
+
   /* open this layer */
   status = msLayerOpen(layer);
   if(status != MS_SUCCESS) return MS_FAILURE;
@@ -960,6 +981,13 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   }
 
   status = msLayerWhichShapes(layer, searchrect, MS_FALSE);
+
+  if(map->profile.enabled) {
+    msGettimeofday(&endtime, NULL);
+    map->profile.query += (endtime.tv_sec+endtime.tv_usec/1.0e6)-
+                          (starttime.tv_sec+starttime.tv_usec/1.0e6);
+  }
+
   if(status == MS_DONE) { /* no overlap */
     msLayerClose(layer);
     return MS_SUCCESS;
@@ -979,6 +1007,15 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   if(layer->minfeaturesize > 0)
     minfeaturesize = Pix2LayerGeoref(map, layer, layer->minfeaturesize);
 
+  /* shapes only live for one iteration below, let the shapefile drivers
+     take their storage from a scratch arena instead of the heap */
+  if(layer->connectiontype == MS_SHAPEFILE || layer->connectiontype == MS_TILED_SHAPEFILE)
+    layer->shapearena = msCreateShapeArena();
+
+  layer->classcache = msAcquireClassCache(layer, map, classgroup, nclasses);
+  layer->classdispatch = msCreateClassDispatch(layer, map, classgroup, nclasses);
+  layer->labelpointcache = msAcquireLabelPointCache(layer, map);
+
   while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
 
     /* Check if the shape size is ok to be drawn */
@@ -1036,7 +1073,8 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     if(annotate && layer->class[shape.classindex]->numlabels > 0) {
       msShapeGetAnnotation(layer, &shape);
       drawmode |= MS_DRAWMODE_LABELS;
-      if (msLayerGetProcessingKey(layer, "LABEL_NO_CLIP")) {
+      /* cached label points are computed from the unclipped shapes */
+      if (msLayerGetProcessingKey(layer, "LABEL_NO_CLIP") || layer->labelpointcache) {
         drawmode |= MS_DRAWMODE_UNCLIPPEDLABELS;
       }
     }
@@ -1114,6 +1152,16 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     msFreeShape(&shape);
   }
 
+  msFreeShape(&shape); /* in case we broke out of the loop early */
+  msFreeShapeArena(layer->shapearena);
+  layer->shapearena = NULL;
+  msReleaseClassCache(layer->classcache);
+  layer->classcache = NULL;
+  msFreeClassDispatch(layer->classdispatch);
+  layer->classdispatch = NULL;
+  msReleaseLabelPointCache(layer->labelpointcache);
+  layer->labelpointcache = NULL;
+
   if (classgroup)
     msFree(classgroup);
 
@@ -1584,6 +1632,44 @@ int circleLayerDrawShape(mapObj *map, imageObj *image, layerObj *layer, shapeObj
   /* TODO: need to handle circle annotation */
 }
 
+/*
+** Finds the label point of polygon shape, in image coordinates. This is the pole
+** of inaccessibility when the layer sets PROCESSING "LABEL_POINT_PRECISION=<pixels>",
+** and msPolygonLabelPoint() otherwise. cache, if not NULL, must have been acquired
+** for layer and shape must be the unclipped feature.
+*/
+static int msDrawGetPolygonLabelPoint(layerObj *layer, mapObj *map, shapeObj *shape, long shapeindex,
+                                      double minfeaturesize, labelPointCacheObj *cache, pointObj *lp)
+{
+  const char *value;
+  double precision = 0;
+  int status;
+
+  /* the cached point is the same whatever the class, check its minfeaturesize first */
+  if(minfeaturesize > 0) {
+    msComputeBounds(shape);
+    if(MS_MIN(shape->bounds.maxx - shape->bounds.minx, shape->bounds.maxy - shape->bounds.miny) < minfeaturesize)
+      return MS_FAILURE;
+  }
+
+  status = msLabelPointCacheLookup(cache, map, shapeindex, lp);
+  if(status != MS_DONE)
+    return status;
+
+  value = msLayerGetProcessingKey(layer, "LABEL_POINT_PRECISION");
+  if(value)
+    precision = atof(value);
+
+  if(precision > 0)
+    status = msPolygonPoleOfInaccessibility(shape, lp, precision, 0);
+  else
+    status = msPolygonLabelPoint(shape, lp, 0);
+
+  msLabelPointCacheStore(cache, map, shapeindex, (status == MS_SUCCESS) ? lp : NULL);
+
+  return status;
+}
+
 int annotationLayerDrawShape(mapObj *map, imageObj *image, layerObj *layer, shapeObj *shape)
 {
   int c = shape->classindex;
@@ -1698,7 +1784,7 @@ anno_cleanup_line:
       return ret;
     case(MS_SHAPE_POLYGON):
 
-      if (msPolygonLabelPoint(shape, &annopnt, minfeaturesize) == MS_SUCCESS) {
+      if (msDrawGetPolygonLabelPoint(layer, map, shape, shape->index, minfeaturesize, NULL, &annopnt) == MS_SUCCESS) {
         if(annopnt.x>0 && annopnt.y >0 && annopnt.x <= image->width && annopnt.y<=image->height) {
           if (label->angle != 0)
             label->angle -= map->gt.rotation_angle; /* TODO: isn't this a bug, the label angle will be changed at each feature ? */
@@ -1942,7 +2028,8 @@ int polygonLayerDrawShape(mapObj *map, imageObj *image, layerObj *layer,
   if(MS_DRAW_LABELS(drawmode)) {
     if (layer->class[c]->numlabels > 0) {
       double minfeaturesize = layer->class[c]->labels[0]->minfeaturesize * image->resolutionfactor;
-      if (msPolygonLabelPoint(anno_shape, &annopnt, minfeaturesize) == MS_SUCCESS) {
+      if (msDrawGetPolygonLabelPoint(layer, map, anno_shape, shape->index, minfeaturesize,
+                                     MS_DRAW_UNCLIPPED_LABELS(drawmode) ? layer->labelpointcache : NULL, &annopnt) == MS_SUCCESS) {
         for (i = 0; i < layer->class[c]->numlabels; i++)
           if (layer->class[c]->labels[i]->angle != 0) layer->class[c]->labels[i]->angle -= map->gt.rotation_angle; /* TODO: is this correct ??? */
         if (layer->labelcache) {
@@ -2374,6 +2461,35 @@ int msDrawLabel(mapObj *map, imageObj *image, pointObj labelPnt, char *string, l
   return MS_SUCCESS;
 }
 
+/*
+** In grid mode msTestLabelCacheCollisions() only looks at the labels anchored within
+** labelcache->gridreach of the tested polygon, so grow it to cover the footprint and
+** leader line of every label that has been processed. The grid anchor of a label is
+** the start of its leader line if it has one.
+*/
+static void growLabelCacheGridReach(mapObj *map, labelCacheMemberObj *cachePtr)
+{
+  labelCacheObj *labelcache = &(map->labelcache);
+  pointObj *anchor;
+  double reach = 0;
+
+  if(labelcache->gridsize <= 0 || !cachePtr->poly)
+    return;
+
+  anchor = cachePtr->leaderline ? &(cachePtr->leaderline->point[0]) : &(cachePtr->point);
+  reach = MS_MAX(reach, anchor->x - cachePtr->poly->bounds.minx);
+  reach = MS_MAX(reach, cachePtr->poly->bounds.maxx - anchor->x);
+  reach = MS_MAX(reach, anchor->y - cachePtr->poly->bounds.miny);
+  reach = MS_MAX(reach, cachePtr->poly->bounds.maxy - anchor->y);
+  if(cachePtr->leaderbbox) {
+    reach = MS_MAX(reach, anchor->x - cachePtr->leaderbbox->minx);
+    reach = MS_MAX(reach, cachePtr->leaderbbox->maxx - anchor->x);
+    reach = MS_MAX(reach, anchor->y - cachePtr->leaderbbox->miny);
+    reach = MS_MAX(reach, cachePtr->leaderbbox->maxy - anchor->y);
+  }
+  labelcache->gridreach = MS_MAX(labelcache->gridreach, reach);
+}
+
 /* private shortcut function to try a leader offsetted label */
 void offsetAndTest(imageObj*image, mapObj *map, labelCacheMemberObj *cachePtr, double ox, double oy,
                    int priority, int label_idx, shapeObj *unoffsetedpoly)
@@ -2609,6 +2725,7 @@ int msDrawOffsettedLabels(imageObj *image, mapObj *map, int priority)
             if(labelPtr->annotext)
               msDrawText(image, labelPtr->annopoint, labelPtr->annotext, labelPtr, &(map->fontset), layerPtr->scalefactor); /* actually draw the label */
           }
+          growLabelCacheGridReach(map, cachePtr);
           /* TODO: draw cachePtr->marker, but where ? */
 
           /*
@@ -2628,10 +2745,16 @@ int msDrawOffsettedLabels(imageObj *image, mapObj *map, int priority)
           */
 
         } else {
+          /* put the label back where it was, in grid mode it still blocks its
+             lower ranked neighbours from there */
+          cachePtr->point = cachePtr->leaderline->point[0];
+          msFreeShape(cachePtr->poly);
+          msCopyShape(&origPoly, cachePtr->poly);
           msFree(cachePtr->leaderline->point);
           msFree(cachePtr->leaderline);
           msFree(cachePtr->leaderbbox);
           cachePtr->leaderline = NULL;
+          cachePtr->leaderbbox = NULL;
         }
         msFreeShape(&origPoly);
       }
@@ -2749,6 +2872,25 @@ int computeLabelMarkerPoly(mapObj *map, imageObj *img, labelCacheMemberObj *cach
   return MS_SUCCESS;
 }
 
+/*
+** In grid mode (see msLabelCacheBuildGrid()) labels that could not be placed still
+** block their lower ranked neighbours, so that whether a label is drawn only depends
+** on the candidates in the neighbouring grid cells.
+*/
+static void addLabelCacheFootprint(mapObj *map, labelCacheMemberObj *cachePtr, shapeObj *poly)
+{
+  if(map->labelcache.gridsize <= 0 || poly->numlines == 0)
+    return;
+
+  if(!cachePtr->poly) {
+    cachePtr->poly = (shapeObj*)msSmallMalloc(sizeof(shapeObj));
+    msInitShape(cachePtr->poly);
+  }
+  msAddLine(cachePtr->poly, poly->line);
+  msComputeBounds(cachePtr->poly);
+  growLabelCacheGridReach(map, cachePtr);
+}
+
 int msDrawLabelCache(imageObj *image, mapObj *map)
 {
   int nReturnVal = MS_SUCCESS;
@@ -2808,6 +2950,20 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
         if(map->debug) msDebug("msDrawLabelCache(): labelcache_map_edge_buffer = %d\n", map->labelcache.gutter);
       }
 
+      /* Look for labelcache_grid_size map metadata
+       * If set then labels are placed on a world grid of cells of that size (in pixels)
+       * so that adjacent tiles agree on the labels along their common edge
+       */
+      if((value = msLookupHashTable(&(map->web.metadata), "labelcache_grid_size")) != NULL) {
+        int gridsize = MS_ABS(atoi(value));
+        if(gridsize > 0 && gridsize < MS_LABELCACHE_MIN_GRID_SIZE) {
+          if(map->debug) msDebug("msDrawLabelCache(): labelcache_grid_size %d raised to %d\n", gridsize, MS_LABELCACHE_MIN_GRID_SIZE);
+          gridsize = MS_LABELCACHE_MIN_GRID_SIZE;
+        }
+        if(msLabelCacheBuildGrid(map, gridsize) != MS_SUCCESS)
+          return MS_FAILURE;
+      }
+
       for(priority=MS_MAX_LABEL_PRIORITY-1; priority>=0; priority--) {
         labelCacheSlotObj *cacheslot;
         cacheslot = &(map->labelcache.slots[priority]);
@@ -2849,11 +3005,12 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
               cachePtr->status = msTestLabelCacheCollisions(map,cachePtr,&cachePtr->labelpath->bounds,label_mindistance,priority,l);
 
 
-            if(!cachePtr->status) {
+            if(!cachePtr->status && map->labelcache.gridsize <= 0) {
               msFreeShape(&cachePtr->labelpath->bounds);
               continue;
             } else {
-              /* take ownership of cachePtr->poly*/
+              /* take ownership of cachePtr->poly, in grid mode even if the label collided
+                 since it then still blocks its lower ranked neighbours */
               cachePtr->poly = (shapeObj*)msSmallMalloc(sizeof(shapeObj));
               msInitShape(cachePtr->poly);
               cachePtr->poly->type = MS_SHAPE_POLYGON;
@@ -2866,6 +3023,9 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
               cachePtr->poly->bounds.maxx = cachePtr->labelpath->bounds.bounds.maxx;
               cachePtr->poly->bounds.maxy = cachePtr->labelpath->bounds.bounds.maxy;
               msFreeShape(&cachePtr->labelpath->bounds);
+              growLabelCacheGridReach(map, cachePtr);
+              if(!cachePtr->status)
+                continue;
             }
 
             msDrawTextLine(image, labelPtr->annotext, labelPtr, cachePtr->labelpath, &(map->fontset), layerPtr->scalefactor); /* Draw the curved label */
@@ -2884,6 +3044,7 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
                 marker_offset_y = (marker_poly.bounds.maxy-marker_poly.bounds.miny)/2.0;
                 /* if this is an annotation layer, transfer the markerPoly */
                 if( MS_OFF == msTestLabelCacheCollisions(map, cachePtr, &marker_poly, 0,priority, l)) {
+                  addLabelCacheFootprint(map, cachePtr, &marker_poly);
                   continue; /* the marker collided, no point continuing */
                 }
               }
@@ -2933,8 +3094,10 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
                   label_marker_status = msTestLabelCacheCollisions(map, cachePtr,&label_marker_poly, 0,priority, l);
                 }
                 if(label_marker_status == MS_OFF &&
-                    !(labelPtr->force || classPtr->leader.maxdistance))
+                    !(labelPtr->force || classPtr->leader.maxdistance)) {
+                  addLabelCacheFootprint(map, cachePtr, &label_marker_poly);
                   break; /* the marker collided, break from multi-label loop */
+                }
               }
 
 
@@ -3041,6 +3204,11 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
                   npositions = 8;
                 }
 
+                /* falling back to another position would make the outcome depend on labels
+                   further away than the neighbouring grid cells */
+                if(map->labelcache.gridsize > 0)
+                  npositions = 1;
+
                 for(i=0; i<npositions; i++) {
                   // RFC 77 TODO: take label_marker_offset_x/y into account
                   labelPtr->annopoint = get_metrics_line(&(cachePtr->point), positions[i], r,
@@ -3103,6 +3271,7 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
                     if(labelPtr->force == MS_OFF) {
                       /* check for collisions inside the label group unless the label is FORCE GROUP */
                       if(cachePtr->poly && cachePtr->poly->numlines && intersectLabelPolygons(&metrics_poly, cachePtr->poly) == MS_TRUE) {
+                        addLabelCacheFootprint(map, cachePtr, &metrics_poly);
                         break; /* collision within the group */
                       }
                     }
@@ -3118,6 +3287,9 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
 
               if((!labelPtr->status || !label_marker_status) && classPtr->leader.maxdistance == 0) {
                 labelPtr->status = MS_OFF;
+                if(labelPtr->annotext)
+                  addLabelCacheFootprint(map, cachePtr, &metrics_poly);
+                addLabelCacheFootprint(map, cachePtr, &label_marker_poly);
                 break; /* no point looking at more labels, unless their is a leader defined, in which
                 case we still want to compute the full cachePtr->poly to be used for offset tests */
               } else {
@@ -3156,8 +3328,10 @@ int msDrawLabelCache(imageObj *image, mapObj *map)
                 }
                 msAddLine(cachePtr->poly, marker_poly.line);
               }
-              if(cachePtr->poly)
+              if(cachePtr->poly) {
                 msComputeBounds(cachePtr->poly);
+                growLabelCacheGridReach(map, cachePtr);
+              }
             }
 
             if(cachePtr->status == MS_OFF)
@@ -50,7 +50,7 @@ extern int InvGeoTransform( double *gt_in, double *gt_out );
 
 static int
 LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
-                layerObj *layer,
+                layerObj *layer, int nOverview,
                 int src_xoff, int src_yoff, int src_xsize, int src_ysize,
                 GByte *pabyBuffer,
                 int dst_xsize, int dst_ysize,
@@ -59,16 +59,35 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
 static int
 msDrawRasterLayerGDAL_RawMode(
   mapObj *map, layerObj *layer, imageObj *image, GDALDatasetH hDS,
+  int nOverview,
   int src_xoff, int src_yoff, int src_xsize, int src_ysize,
   int dst_xoff, int dst_yoff, int dst_xsize, int dst_ysize );
 
 static int
 msDrawRasterLayerGDAL_16BitClassification(
   mapObj *map, layerObj *layer, rasterBufferObj *rb,
-  GDALDatasetH hDS, GDALRasterBandH hBand,
+  GDALDatasetH hDS, GDALRasterBandH hBand, int nOverview,
   int src_xoff, int src_yoff, int src_xsize, int src_ysize,
   int dst_xoff, int dst_yoff, int dst_xsize, int dst_ysize );
 
+static void
+msGDALGetOverviewWindow( GDALRasterBandH hBand, GDALRasterBandH hOvr,
+                         int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+                         int *ovr_xoff, int *ovr_yoff,
+                         int *ovr_xsize, int *ovr_ysize );
+static CPLErr
+msGDALOverviewRasterIO( GDALRasterBandH hBand, int nOverview,
+                        int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+                        void *pData, int dst_xsize, int dst_ysize,
+                        GDALDataType eType );
+static CPLErr
+msGDALOverviewDatasetRasterIO( GDALDatasetH hDS, int nOverview,
+                               int src_xoff, int src_yoff,
+                               int src_xsize, int src_ysize,
+                               void *pData, int dst_xsize, int dst_ysize,
+                               GDALDataType eType,
+                               int band_count, int *band_numbers );
+
 #ifdef USE_GD
 static void Dither24to8( GByte *pabyRed, GByte *pabyGreen, GByte *pabyBlue,
                          GByte *pabyDithered, int xsize, int ysize,
@@ -130,6 +149,7 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
   GDALRasterBandH hBand1=NULL, hBand2=NULL, hBand3=NULL, hBandAlpha=NULL;
   int bHaveRGBNoData = FALSE;
   int nNoData1=-1,nNoData2=-1,nNoData3=-1;
+  int nOverview;
   rasterBufferObj *mask_rb = NULL;
 #ifdef USE_GD
   int   anColorCube[256];
@@ -325,13 +345,21 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
     dst_ysize = src_ysize = MIN(image->height,src_ysize);
   }
 
+  /*
+   * Pick the overview level matching the requested resolution, so
+   * zoomed out views don't read the full resolution pixels.
+   */
+  nOverview = msGetGDALOverviewLevel( layer, hDS,
+                                      src_xsize, src_ysize,
+                                      dst_xsize, dst_ysize );
+
   /*
    * In RAWDATA mode we don't fool with colors.  Do the raw processing,
    * and return from the function early.
    */
   if( MS_RENDERER_RAWDATA( image->format ) ) {
     return msDrawRasterLayerGDAL_RawMode(
-             map, layer, image, hDS,
+             map, layer, image, hDS, nOverview,
              src_xoff, src_yoff, src_xsize, src_ysize,
              dst_xoff, dst_yoff, dst_xsize, dst_ysize );
   }
@@ -483,7 +511,7 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
   if( classified
       && hBand1 != NULL && GDALGetRasterDataType( hBand1 ) != GDT_Byte ) {
     return msDrawRasterLayerGDAL_16BitClassification(
-             map, layer, rb, hDS, hBand1,
+             map, layer, rb, hDS, hBand1, nOverview,
              src_xoff, src_yoff, src_xsize, src_ysize,
              dst_xoff, dst_yoff, dst_xsize, dst_ysize );
   }
@@ -731,7 +759,7 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
   /*
    * Load image data into buffers with scaling, etc.
    */
-  if( LoadGDALImages( hDS, band_numbers, band_count, layer,
+  if( LoadGDALImages( hDS, band_numbers, band_count, layer, nOverview,
                       src_xoff, src_yoff, src_xsize, src_ysize,
                       pabyRaw1, dst_xsize, dst_ysize,
                       &bHaveRGBNoData,
@@ -782,9 +810,21 @@ int msDrawRasterLayerGDAL(mapObj *map, layerObj *layer, imageObj *image,
 
       hBandAlpha = GDALGetMaskBand(hBand1);
 
-      eErr = GDALRasterIO( hBandAlpha, GF_Read,
-                           src_xoff, src_yoff, src_xsize, src_ysize,
-                           pabyRawAlpha, dst_xsize, dst_ysize, GDT_Byte, 0,0);
+      if( nOverview >= 0 && nOverview < GDALGetOverviewCount(hBand1) ) {
+        /* use the mask of the overview, scaling the window the same way */
+        GDALRasterBandH hOvr = GDALGetOverview(hBand1, nOverview);
+        int ovr_xoff, ovr_yoff, ovr_xsize, ovr_ysize;
+
+        msGDALGetOverviewWindow( hBand1, hOvr,
+                                 src_xoff, src_yoff, src_xsize, src_ysize,
+                                 &ovr_xoff, &ovr_yoff, &ovr_xsize, &ovr_ysize );
+        eErr = GDALRasterIO( GDALGetMaskBand(hOvr), GF_Read,
+                             ovr_xoff, ovr_yoff, ovr_xsize, ovr_ysize,
+                             pabyRawAlpha, dst_xsize, dst_ysize, GDT_Byte, 0,0);
+      } else
+        eErr = GDALRasterIO( hBandAlpha, GF_Read,
+                             src_xoff, src_yoff, src_xsize, src_ysize,
+                             pabyRawAlpha, dst_xsize, dst_ysize, GDT_Byte, 0,0);
 
       if( eErr != CE_None ) {
         msSetError( MS_IOERR, "GDALRasterIO() failed: %s",
@@ -1324,7 +1364,7 @@ static int ApplyLUT( int iColorIndex, layerObj *layer,
 
 static int
 LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
-                layerObj *layer,
+                layerObj *layer, int nOverview,
                 int src_xoff, int src_yoff, int src_xsize, int src_ysize,
                 GByte *pabyWholeBuffer,
                 int dst_xsize, int dst_ysize,
@@ -1369,12 +1409,12 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
       && CSLFetchNameValue( layer->processing, "SCALE_2" ) == NULL
       && CSLFetchNameValue( layer->processing, "SCALE_3" ) == NULL
       && CSLFetchNameValue( layer->processing, "SCALE_4" ) == NULL ) {
-    eErr = GDALDatasetRasterIO( hDS, GF_Read,
-                                src_xoff, src_yoff, src_xsize, src_ysize,
-                                pabyWholeBuffer,
-                                dst_xsize, dst_ysize, GDT_Byte,
-                                band_count, band_numbers,
-                                0,0,0);
+    eErr = msGDALOverviewDatasetRasterIO( hDS, nOverview,
+                                          src_xoff, src_yoff,
+                                          src_xsize, src_ysize,
+                                          pabyWholeBuffer,
+                                          dst_xsize, dst_ysize, GDT_Byte,
+                                          band_count, band_numbers );
 
     if( eErr != CE_None ) {
       msSetError( MS_IOERR,
@@ -1424,12 +1464,11 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
     return -1;
   }
 
-  eErr = GDALDatasetRasterIO(
-           hDS, GF_Read,
+  eErr = msGDALOverviewDatasetRasterIO(
+           hDS, nOverview,
            src_xoff, src_yoff, src_xsize, src_ysize,
            pafWholeRawData, dst_xsize, dst_ysize, GDT_Float32,
-           band_count, band_numbers,
-           0, 0, 0 );
+           band_count, band_numbers );
 
   if( eErr != CE_None ) {
     msSetError( MS_IOERR, "GDALDatasetRasterIO() failed: %s",
@@ -1899,6 +1938,7 @@ int msGetGDALGeoTransform( GDALDatasetH hDS, mapObj *map, layerObj *layer,
 static int
 msDrawRasterLayerGDAL_RawMode(
   mapObj *map, layerObj *layer, imageObj *image, GDALDatasetH hDS,
+  int nOverview,
   int src_xoff, int src_yoff, int src_xsize, int src_ysize,
   int dst_xoff, int dst_yoff, int dst_xsize, int dst_ysize )
 
@@ -2013,11 +2053,12 @@ msDrawRasterLayerGDAL_RawMode(
     return -1;
   }
 
-  eErr = GDALDatasetRasterIO( hDS, GF_Read,
-                              src_xoff, src_yoff, src_xsize, src_ysize,
-                              pBuffer, dst_xsize, dst_ysize, eDataType,
-                              image->format->bands, band_list,
-                              0, 0, 0 );
+  eErr = msGDALOverviewDatasetRasterIO( hDS, nOverview,
+                                        src_xoff, src_yoff,
+                                        src_xsize, src_ysize,
+                                        pBuffer, dst_xsize, dst_ysize,
+                                        eDataType,
+                                        image->format->bands, band_list );
   free( band_list );
 
   if( eErr != CE_None ) {
@@ -2105,7 +2146,7 @@ msDrawRasterLayerGDAL_RawMode(
 static int
 msDrawRasterLayerGDAL_16BitClassification(
   mapObj *map, layerObj *layer, rasterBufferObj *rb,
-  GDALDatasetH hDS, GDALRasterBandH hBand,
+  GDALDatasetH hDS, GDALRasterBandH hBand, int nOverview,
   int src_xoff, int src_yoff, int src_xsize, int src_ysize,
   int dst_xoff, int dst_yoff, int dst_xsize, int dst_ysize )
 
@@ -2143,9 +2184,10 @@ msDrawRasterLayerGDAL_16BitClassification(
     return -1;
   }
 
-  eErr = GDALRasterIO( hBand, GF_Read,
-                       src_xoff, src_yoff, src_xsize, src_ysize,
-                       pafRawData, dst_xsize, dst_ysize, GDT_Float32, 0, 0 );
+  eErr = msGDALOverviewRasterIO( hBand, nOverview,
+                                 src_xoff, src_yoff, src_xsize, src_ysize,
+                                 pafRawData, dst_xsize, dst_ysize,
+                                 GDT_Float32 );
 
   if( eErr != CE_None ) {
     free( pafRawData );
@@ -2503,5 +2545,206 @@ int *msGetGDALBandList( layerObj *layer, void *hDS,
   }
 }
 
+/************************************************************************/
+/*                       msGetGDALOverviewLevel()                       */
+/*                                                                      */
+/*      Select the overview of the dataset best suited to read the      */
+/*      given source window into a buffer of the given size.  The       */
+/*      coarsest overview that still provides at least the requested   */
+/*      resolution is chosen.  Returns -1 when the full resolution     */
+/*      band should be read.                                            */
+/*                                                                      */
+/*      The selection can be controlled with the OVERVIEW_LEVEL         */
+/*      processing option (AUTO, NONE or an explicit overview index)    */
+/*      and the OVERVIEW_OVERSAMPLE_RATIO processing option, which      */
+/*      requires the selected overview to have that many times the      */
+/*      resolution of the output.                                       */
+/************************************************************************/
+
+int msGetGDALOverviewLevel( layerObj *layer, void *hDSVoid,
+                            int src_xsize, int src_ysize,
+                            int dst_xsize, int dst_ysize )
+
+{
+  GDALDatasetH hDS = (GDALDatasetH) hDSVoid;
+  GDALRasterBandH hBand;
+  const char *pszLevel, *pszRatio;
+  double dfDesiredFactor, dfOversample = 1.0, dfBestFactor = 1.0;
+  int nOverviewCount, iOverview, nBestOverview = -1;
+
+  if( GDALGetRasterCount( hDS ) < 1 || dst_xsize < 1 || dst_ysize < 1 )
+    return -1;
+
+  hBand = GDALGetRasterBand( hDS, 1 );
+  nOverviewCount = GDALGetOverviewCount( hBand );
+  if( nOverviewCount < 1 )
+    return -1;
+
+  pszLevel = CSLFetchNameValue( layer->processing, "OVERVIEW_LEVEL" );
+  if( pszLevel != NULL && EQUAL(pszLevel,"NONE") )
+    return -1;
+
+  if( pszLevel != NULL && !EQUAL(pszLevel,"AUTO") ) {
+    iOverview = atoi(pszLevel);
+    if( iOverview < 0 || iOverview >= nOverviewCount ) {
+      if( layer->debug )
+        msDebug( "msGetGDALOverviewLevel(): OVERVIEW_LEVEL=%s out of range, "
+                 "dataset has %d overviews, using full resolution.\n",
+                 pszLevel, nOverviewCount );
+      return -1;
+    }
+    return iOverview;
+  }
+
+  pszRatio = CSLFetchNameValue( layer->processing,
+                                "OVERVIEW_OVERSAMPLE_RATIO" );
+  if( pszRatio != NULL ) {
+    dfOversample = atof(pszRatio);
+    if( dfOversample < 1.0 )
+      dfOversample = 1.0;
+  }
+
+  dfDesiredFactor = MIN( src_xsize / (double) dst_xsize,
+                         src_ysize / (double) dst_ysize ) / dfOversample;
+  if( dfDesiredFactor <= 1.0 )
+    return -1;
+
+  for( iOverview = 0; iOverview < nOverviewCount; iOverview++ ) {
+    GDALRasterBandH hOvr = GDALGetOverview( hBand, iOverview );
+    double dfFactor;
+
+    if( hOvr == NULL || GDALGetRasterBandXSize( hOvr ) < 1 )
+      continue;
+
+    dfFactor = GDALGetRasterBandXSize( hBand )
+               / (double) GDALGetRasterBandXSize( hOvr );
+
+    /* allow for rounding of the overview size */
+    if( dfFactor <= dfDesiredFactor * 1.01 && dfFactor > dfBestFactor ) {
+      dfBestFactor = dfFactor;
+      nBestOverview = iOverview;
+    }
+  }
+
+  if( layer->debug && nBestOverview >= 0 )
+    msDebug( "msGetGDALOverviewLevel(): using overview %d (factor %g) "
+             "for a decimation of %g.\n",
+             nBestOverview, dfBestFactor, dfDesiredFactor * dfOversample );
+
+  return nBestOverview;
+}
+
+/************************************************************************/
+/*                      msGDALGetOverviewWindow()                       */
+/*                                                                      */
+/*      Translate a full resolution source window into the pixel        */
+/*      space of an overview band.                                      */
+/************************************************************************/
+
+static void
+msGDALGetOverviewWindow( GDALRasterBandH hBand, GDALRasterBandH hOvr,
+                         int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+                         int *ovr_xoff, int *ovr_yoff,
+                         int *ovr_xsize, int *ovr_ysize )
+
+{
+  int nOvrXSize = GDALGetRasterBandXSize( hOvr );
+  int nOvrYSize = GDALGetRasterBandYSize( hOvr );
+  double dfXRatio = nOvrXSize / (double) GDALGetRasterBandXSize( hBand );
+  double dfYRatio = nOvrYSize / (double) GDALGetRasterBandYSize( hBand );
+  int xend, yend;
+
+  *ovr_xoff = (int) floor( src_xoff * dfXRatio + 0.5 );
+  *ovr_yoff = (int) floor( src_yoff * dfYRatio + 0.5 );
+  xend = (int) floor( (src_xoff + src_xsize) * dfXRatio + 0.5 );
+  yend = (int) floor( (src_yoff + src_ysize) * dfYRatio + 0.5 );
+
+  *ovr_xoff = MAX(0,MIN(*ovr_xoff,nOvrXSize-1));
+  *ovr_yoff = MAX(0,MIN(*ovr_yoff,nOvrYSize-1));
+  xend = MIN(xend,nOvrXSize);
+  yend = MIN(yend,nOvrYSize);
+
+  *ovr_xsize = MAX(1,xend - *ovr_xoff);
+  *ovr_ysize = MAX(1,yend - *ovr_yoff);
+}
+
+/************************************************************************/
+/*                       msGDALOverviewRasterIO()                       */
+/*                                                                      */
+/*      Read a window of a band, from the requested overview if one     */
+/*      was selected.  Falls back to the full resolution band if the    */
+/*      band has no such overview.                                      */
+/************************************************************************/
+
+static CPLErr
+msGDALOverviewRasterIO( GDALRasterBandH hBand, int nOverview,
+                        int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+                        void *pData, int dst_xsize, int dst_ysize,
+                        GDALDataType eType )
+
+{
+  GDALRasterBandH hOvr = NULL;
+
+  if( nOverview >= 0 && nOverview < GDALGetOverviewCount( hBand ) )
+    hOvr = GDALGetOverview( hBand, nOverview );
+
+  if( hOvr != NULL ) {
+    int ovr_xoff, ovr_yoff, ovr_xsize, ovr_ysize;
+
+    msGDALGetOverviewWindow( hBand, hOvr,
+                             src_xoff, src_yoff, src_xsize, src_ysize,
+                             &ovr_xoff, &ovr_yoff, &ovr_xsize, &ovr_ysize );
+    return GDALRasterIO( hOvr, GF_Read,
+                         ovr_xoff, ovr_yoff, ovr_xsize, ovr_ysize,
+                         pData, dst_xsize, dst_ysize, eType, 0, 0 );
+  }
+
+  return GDALRasterIO( hBand, GF_Read,
+                       src_xoff, src_yoff, src_xsize, src_ysize,
+                       pData, dst_xsize, dst_ysize, eType, 0, 0 );
+}
+
+/************************************************************************/
+/*                   msGDALOverviewDatasetRasterIO()                    */
+/*                                                                      */
+/*      Band interleaved equivalent of GDALDatasetRasterIO() reading    */
+/*      from the selected overview level of each band.                  */
+/************************************************************************/
+
+static CPLErr
+msGDALOverviewDatasetRasterIO( GDALDatasetH hDS, int nOverview,
+                               int src_xoff, int src_yoff,
+                               int src_xsize, int src_ysize,
+                               void *pData, int dst_xsize, int dst_ysize,
+                               GDALDataType eType,
+                               int band_count, int *band_numbers )
+
+{
+  int i, nBandSize;
+  CPLErr eErr = CE_None;
+
+  if( nOverview < 0 )
+    return GDALDatasetRasterIO( hDS, GF_Read,
+                                src_xoff, src_yoff, src_xsize, src_ysize,
+                                pData, dst_xsize, dst_ysize, eType,
+                                band_count, band_numbers, 0, 0, 0 );
+
+  nBandSize = dst_xsize * dst_ysize * (GDALGetDataTypeSize(eType) / 8);
+
+  for( i = 0; i < band_count && eErr == CE_None; i++ ) {
+    GDALRasterBandH hBand = GDALGetRasterBand( hDS, band_numbers[i] );
+
+    if( hBand == NULL )
+      return CE_Failure;
+
+    eErr = msGDALOverviewRasterIO( hBand, nOverview,
+                                   src_xoff, src_yoff, src_xsize, src_ysize,
+                                   ((GByte *) pData) + i * nBandSize,
+                                   dst_xsize, dst_ysize, eType );
+  }
+
+  return eErr;
+}
+
 #endif /* def USE_GDAL */
 
@@ -1704,6 +1704,7 @@ void initLabel(labelObj *label)
   label->maxlength = 0;
   label->minlength = 0;
   label->space_size_10=0.0;
+  label->textcache = NULL;
 
   label->encoding = NULL;
 
@@ -1776,6 +1777,7 @@ int freeLabel(labelObj *label)
     msFreeShape(label->annopoly);
     msFree(label->annopoly);
   }
+  msFreeLabelTextCache(label);
 
   freeLabelLeader(&(label->leader));
 
@@ -2438,7 +2440,7 @@ static void writeHashTable(FILE *stream, int indent, const char *title, hashTabl
 
   indent++;
   writeBlockBegin(stream, indent, title);
-  for (i=0; i<MS_HASHSIZE; i++) {
+  for (i=0; i<table->size; i++) {
     if (table->items[i] != NULL) {
       for (tp=table->items[i]; tp!=NULL; tp=tp->next)
         writeNameValuePair(stream, indent, tp->key, tp->data);
@@ -2456,7 +2458,7 @@ static void writeHashTableInline(FILE *stream, int indent, char *name, hashTable
   if(msHashIsEmpty(table)) return;
 
   ++indent;
-  for (i=0; i<MS_HASHSIZE; ++i) {
+  for (i=0; i<table->size; ++i) {
     if (table->items[i] != NULL) {
       for (tp=table->items[i]; tp!=NULL; tp=tp->next) {
         writeIndent(stream, indent);
@@ -3751,6 +3753,10 @@ int initLayer(layerObj *layer, mapObj *map)
 
   layer->layerinfo = NULL;
   layer->wfslayerinfo = NULL;
+  layer->shapearena = NULL;
+  layer->classcache = NULL;
+  layer->classdispatch = NULL;
+  layer->labelpointcache = NULL;
 
   layer->items = NULL;
   layer->iteminfo = NULL;
@@ -5574,8 +5580,11 @@ int initMap(mapObj *map)
     map->labelcache.slots[i].markers = NULL;
     map->labelcache.slots[i].markercachesize = 0;
     map->labelcache.slots[i].nummarkers = 0;
+    map->labelcache.slots[i].grid = NULL;
   }
   map->labelcache.numlabels = 0;
+  map->labelcache.gridsize = 0;
+  map->labelcache.gridreach = 0;
 
   map->fontset.filename = NULL;
   map->fontset.numfonts = 0;
@@ -5613,6 +5622,9 @@ int initMap(mapObj *map)
 
   msInitQuery(&(map->query));
 
+  map->profile.enabled = MS_FALSE;
+  map->profile.query = map->profile.labelcache = map->profile.total = 0;
+
   return(0);
 }
 
@@ -5670,38 +5682,47 @@ layerObj *msGrowMapLayers( mapObj *map )
 }
 
 
-int msFreeLabelCacheSlot(labelCacheSlotObj *cacheslot)
+void msFreeLabelCacheMember(labelCacheMemberObj *cachePtr)
 {
-  int i, j;
+  int j;
 
-  /* free the labels */
-  if (cacheslot->labels) {
-    for(i=0; i<cacheslot->numlabels; i++) {
-      if (cacheslot->labels[i].labelpath)
-        msFreeLabelPathObj(cacheslot->labels[i].labelpath);
+  if (cachePtr->labelpath)
+    msFreeLabelPathObj(cachePtr->labelpath);
 
-      for(j=0; j<cacheslot->labels[i].numlabels; j++) freeLabel(&(cacheslot->labels[i].labels[j]));
-      msFree(cacheslot->labels[i].labels);
+  for(j=0; j<cachePtr->numlabels; j++) freeLabel(&(cachePtr->labels[j]));
+  msFree(cachePtr->labels);
 
-      if(cacheslot->labels[i].poly) {
-        msFreeShape(cacheslot->labels[i].poly); /* empties the shape */
-        msFree(cacheslot->labels[i].poly); /* free's the pointer */
-      }
+  if(cachePtr->poly) {
+    msFreeShape(cachePtr->poly); /* empties the shape */
+    msFree(cachePtr->poly); /* free's the pointer */
+  }
 
-      for(j=0; j<cacheslot->labels[i].numstyles; j++) freeStyle(&(cacheslot->labels[i].styles[j]));
-      msFree(cacheslot->labels[i].styles);
-      if(cacheslot->labels[i].leaderline) {
-        msFree(cacheslot->labels[i].leaderline->point);
-        msFree(cacheslot->labels[i].leaderline);
-        msFree(cacheslot->labels[i].leaderbbox);
-      }
-    }
+  for(j=0; j<cachePtr->numstyles; j++) freeStyle(&(cachePtr->styles[j]));
+  msFree(cachePtr->styles);
+  if(cachePtr->leaderline) {
+    msFree(cachePtr->leaderline->point);
+    msFree(cachePtr->leaderline);
+    msFree(cachePtr->leaderbbox);
+  }
+}
+
+int msFreeLabelCacheSlot(labelCacheSlotObj *cacheslot)
+{
+  int i;
+
+  /* free the labels */
+  if (cacheslot->labels) {
+    for(i=0; i<cacheslot->numlabels; i++)
+      msFreeLabelCacheMember(&(cacheslot->labels[i]));
   }
   msFree(cacheslot->labels);
   cacheslot->labels = NULL;
   cacheslot->cachesize = 0;
   cacheslot->numlabels = 0;
 
+  msFree(cacheslot->grid);
+  cacheslot->grid = NULL;
+
   /* free the markers */
   if (cacheslot->markers) {
     for(i=0; i<cacheslot->nummarkers; i++) {
@@ -5736,6 +5757,7 @@ int msInitLabelCacheSlot(labelCacheSlotObj *cacheslot)
 
   if(cacheslot->labels || cacheslot->markers)
     msFreeLabelCacheSlot(cacheslot);
+  cacheslot->grid = NULL;
 
   cacheslot->labels = (labelCacheMemberObj *)malloc(sizeof(labelCacheMemberObj)*MS_LABELCACHEINITSIZE);
   MS_CHECK_ALLOC(cacheslot->labels, sizeof(labelCacheMemberObj)*MS_LABELCACHEINITSIZE, MS_FAILURE);
@@ -5762,6 +5784,8 @@ int msInitLabelCache(labelCacheObj *cache)
   }
   cache->numlabels = 0;
   cache->gutter = 0;
+  cache->gridsize = 0;
+  cache->gridreach = 0;
 
   return MS_SUCCESS;
 }
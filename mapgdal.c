@@ -72,6 +72,10 @@ void msGDALCleanup( void )
 {
   if( bGDALInitialized ) {
     int iRepeat = 5;
+
+    /* close the tile datasets kept open by the raster tile cache */
+    msRasterTileCacheCleanup();
+
     msAcquireLock( TLOCK_GDAL );
 
 #if GDAL_RELEASE_DATE > 20101207
@@ -139,6 +143,61 @@ void CleanVSIDir( const char *pszDir )
   CSLDestroy( papszFiles );
 }
 
+/************************************************************************/
+/*                   msGDALSupportsStreamingOutput()                    */
+/*                                                                      */
+/*      Returns MS_TRUE if the output format's driver writes its        */
+/*      file sequentially, so CreateCopy() can write it straight to     */
+/*      the client through /vsistdout/ instead of a temporary file.     */
+/*      With bSingleFile set, drivers that put part of their output     */
+/*      (e.g. georeferencing) in sidecar files are refused.             */
+/************************************************************************/
+
+int msGDALSupportsStreamingOutput( outputFormatObj *format, int bSingleFile )
+
+{
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1100000
+  const char *pszDriver;
+
+  if( format == NULL || !EQUALN(format->driver,"GDAL/",5) )
+    return MS_FALSE;
+
+  pszDriver = format->driver+5;
+
+  if( EQUAL(pszDriver,"XYZ") )
+    return MS_TRUE;
+
+#if GDAL_VERSION_NUM >= 2000000
+  if( EQUAL(pszDriver,"GTiff")
+      && CSLTestBoolean(msGetOutputFormatOption(format,"STREAMABLE_OUTPUT","NO")) )
+    return MS_TRUE;
+#endif
+
+  if( !bSingleFile
+      && (EQUAL(pszDriver,"PNG") || EQUAL(pszDriver,"JPEG")
+          || EQUAL(pszDriver,"GIF")) )
+    return MS_TRUE;
+#endif
+
+  return MS_FALSE;
+}
+
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1100000
+/************************************************************************/
+/*                          msGDALStdoutWrite()                         */
+/*                                                                      */
+/*      /vsistdout/ redirection so streamed output goes through the     */
+/*      msIO layer (FastCGI, mapscript buffers) like everything else.   */
+/************************************************************************/
+
+static size_t msGDALStdoutWrite( const void *ptr, size_t size, size_t nmemb,
+                                 FILE *stream )
+
+{
+  return msIO_fwrite( ptr, size, nmemb, stream );
+}
+#endif
+
 /************************************************************************/
 /*                          msSaveImageGDAL()                           */
 /************************************************************************/
@@ -147,6 +206,8 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
 
 {
   int  bFileIsTemporary = MS_FALSE;
+  int  bStreaming = MS_FALSE;
+  int  bRawWrapped = MS_FALSE;
   GDALDatasetH hMemDS, hOutputDS;
   GDALDriverH  hMemDriver, hOutputDriver;
   int          nBands = 1;
@@ -190,8 +251,11 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
     if( pszExtension == NULL )
       pszExtension = "img.tmp";
 
-    if( bUseXmp == MS_FALSE && GDALGetMetadataItem( hOutputDriver, GDAL_DCAP_VIRTUALIO, NULL )
-        != NULL ) {
+    if( bUseXmp == MS_FALSE && msGDALSupportsStreamingOutput( format, MS_FALSE ) ) {
+      filename = msStrdup( "/vsistdout/" );
+      bStreaming = MS_TRUE;
+    } else if( bUseXmp == MS_FALSE && GDALGetMetadataItem( hOutputDriver, GDAL_DCAP_VIRTUALIO, NULL )
+               != NULL ) {
       CleanVSIDir( "/vsimem/msout" );
       filename = msTmpFile(map, NULL, "/vsimem/msout/", pszExtension );
     }
@@ -202,7 +266,7 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
       filename = msTmpFile(map, NULL, NULL, pszExtension );
     }
 
-    bFileIsTemporary = MS_TRUE;
+    bFileIsTemporary = !bStreaming;
   }
 
   /* -------------------------------------------------------------------- */
@@ -259,9 +323,44 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
     return MS_FAILURE;
   }
 
-  hMemDS = GDALCreate( hMemDriver, "msSaveImageGDAL_temp",
-                       image->width, image->height, nBands,
-                       eDataType, NULL );
+  /* -------------------------------------------------------------------- */
+  /*      Raw data images already hold band sequential pixels, so the     */
+  /*      memory dataset can wrap the image buffer rather than hold a     */
+  /*      second copy of it.                                              */
+  /* -------------------------------------------------------------------- */
+  if( format->imagemode == MS_IMAGEMODE_INT16
+      || format->imagemode == MS_IMAGEMODE_FLOAT32
+      || format->imagemode == MS_IMAGEMODE_BYTE ) {
+    char szPointer[64], szMEMFilename[256];
+    int nPixelSize = GDALGetDataTypeSize( eDataType ) / 8;
+    void *pData;
+
+    if( format->imagemode == MS_IMAGEMODE_INT16 )
+      pData = image->img.raw_16bit;
+    else if( format->imagemode == MS_IMAGEMODE_FLOAT32 )
+      pData = image->img.raw_float;
+    else
+      pData = image->img.raw_byte;
+
+    memset( szPointer, 0, sizeof(szPointer) );
+    CPLPrintPointer( szPointer, pData, sizeof(szPointer) );
+    snprintf( szMEMFilename, sizeof(szMEMFilename),
+              "MEM:::DATAPOINTER=%s,PIXELS=%d,LINES=%d,BANDS=%d,DATATYPE=%s,"
+              "PIXELOFFSET=%d,LINEOFFSET=%d,BANDOFFSET=" CPL_FRMT_GIB,
+              szPointer, image->width, image->height, nBands,
+              GDALGetDataTypeName( eDataType ), nPixelSize,
+              nPixelSize * image->width,
+              (GIntBig) nPixelSize * image->width * image->height );
+
+    hMemDS = GDALOpen( szMEMFilename, GA_Update );
+    bRawWrapped = (hMemDS != NULL);
+  } else
+    hMemDS = NULL;
+
+  if( hMemDS == NULL )
+    hMemDS = GDALCreate( hMemDriver, "msSaveImageGDAL_temp",
+                         image->width, image->height, nBands,
+                         eDataType, NULL );
   if( hMemDS == NULL ) {
     msReleaseLock( TLOCK_GDAL );
     msSetError( MS_MISCERR, "Failed to create MEM dataset.",
@@ -272,7 +371,7 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   /* -------------------------------------------------------------------- */
   /*      Copy the gd image into the memory dataset.                      */
   /* -------------------------------------------------------------------- */
-  for( iLine = 0; iLine < image->height; iLine++ ) {
+  for( iLine = 0; !bRawWrapped && iLine < image->height; iLine++ ) {
     int iBand;
 
     for( iBand = 0; iBand < nBands; iBand++ ) {
@@ -475,11 +574,41 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   memcpy( papszOptions, format->formatoptions,
           sizeof(char *) * format->numformatoptions );
 
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1100000
+  /* -------------------------------------------------------------------- */
+  /*      When streaming, the driver writes straight to the client.       */
+  /*      No .aux.xml may be written since it would land in the same      */
+  /*      stream, the temporary file path never sent those either.        */
+  /* -------------------------------------------------------------------- */
+  if( bStreaming ) {
+    if( msIO_needBinaryStdout() == MS_FAILURE ) {
+      free( papszOptions );
+      GDALClose( hMemDS );
+      msReleaseLock( TLOCK_GDAL );
+      msFree( filename );
+      return MS_FAILURE;
+    }
+    VSIStdoutSetRedirection( msGDALStdoutWrite, stdout );
+    CPLSetThreadLocalConfigOption( "GDAL_PAM_ENABLED", "NO" );
+  }
+#endif
+
   hOutputDS = GDALCreateCopy( hOutputDriver, filename, hMemDS, FALSE,
                               papszOptions, NULL, NULL );
 
   free( papszOptions );
 
+  if( hOutputDS != NULL )
+    GDALClose( hOutputDS );
+
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1100000
+  if( bStreaming ) {
+    CPLSetThreadLocalConfigOption( "GDAL_PAM_ENABLED", NULL );
+    VSIStdoutSetRedirection( fwrite, stdout );
+    msFree( filename );
+  }
+#endif
+
   if( hOutputDS == NULL ) {
     GDALClose( hMemDS );
     msReleaseLock( TLOCK_GDAL );
@@ -492,7 +621,6 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   /* closing the memory DS also frees all associated resources. */
   GDALClose( hMemDS );
 
-  GDALClose( hOutputDS );
   msReleaseLock( TLOCK_GDAL );
 
 
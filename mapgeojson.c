@@ -0,0 +1,454 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Native streaming GeoJSON output (for WFS and queries)
+ * Author:   MapServer Team
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+#include <ctype.h>
+#include "mapserver.h"
+#include "mapproject.h"
+
+/* the output is flushed to the msIO layer whenever this much is pending */
+#define GEOJSON_FLUSH_SIZE 65536
+
+typedef struct {
+  bufferObj buffer;
+  int precision; /* decimal places, -1 for full precision */
+} geoJSONWriterObj;
+
+/************************************************************************/
+/*                          low level writers                           */
+/************************************************************************/
+
+static void msGeoJSONFlush( geoJSONWriterObj *writer )
+{
+  if( writer->buffer.size > 0 ) {
+    msIO_fwrite( writer->buffer.data, 1, writer->buffer.size, stdout );
+    writer->buffer.size = 0;
+  }
+}
+
+static void msGeoJSONWrite( geoJSONWriterObj *writer, const char *str )
+{
+  msBufferAppend( &writer->buffer, (void*)str, strlen(str) );
+}
+
+static void msGeoJSONWriteDouble( geoJSONWriterObj *writer, double value )
+{
+  char num[64];
+  int len;
+
+  if( writer->precision < 0 ) {
+    len = snprintf( num, sizeof(num), "%.15g", value );
+  } else {
+    len = snprintf( num, sizeof(num), "%.*f", writer->precision, value );
+    /* drop trailing zeros, they are only noise on the wire */
+    if( strchr(num, '.') ) {
+      while( len > 0 && num[len-1] == '0' )
+        num[--len] = '\0';
+      if( len > 0 && num[len-1] == '.' )
+        num[--len] = '\0';
+    }
+    if( strcmp(num, "-0") == 0 ) {
+      num[0] = '0';
+      num[1] = '\0';
+      len = 1;
+    }
+  }
+  msBufferAppend( &writer->buffer, num, len );
+}
+
+/*
+** Write str as a quoted JSON string, escaping as required by RFC 4627.
+*/
+static void msGeoJSONWriteString( geoJSONWriterObj *writer, const char *str )
+{
+  const unsigned char *start = (const unsigned char*)str, *p;
+
+  msBufferAppend( &writer->buffer, "\"", 1 );
+  for( p = start; *p; p++ ) {
+    const char *escape = NULL;
+    char hex[8];
+
+    if( *p == '"' )
+      escape = "\\\"";
+    else if( *p == '\\' )
+      escape = "\\\\";
+    else if( *p == '\n' )
+      escape = "\\n";
+    else if( *p == '\r' )
+      escape = "\\r";
+    else if( *p == '\t' )
+      escape = "\\t";
+    else if( *p < 0x20 ) {
+      snprintf( hex, sizeof(hex), "\\u%04x", *p );
+      escape = hex;
+    }
+
+    if( escape ) {
+      if( p > start )
+        msBufferAppend( &writer->buffer, (void*)start, p - start );
+      msGeoJSONWrite( writer, escape );
+      start = p + 1;
+    }
+  }
+  if( p > start )
+    msBufferAppend( &writer->buffer, (void*)start, p - start );
+  msBufferAppend( &writer->buffer, "\"", 1 );
+}
+
+/*
+** Numeric attribute values go out unquoted, as long as they follow the
+** JSON number grammar (no "0x10", "inf", "+1", ".5" or "1." forms).
+*/
+static int msGeoJSONIsNumber( const char *value )
+{
+  const char *p = value;
+
+  if( *p == '-' ) p++;
+  if( *p == '0' )
+    p++;
+  else if( isdigit((unsigned char)*p) ) {
+    while( isdigit((unsigned char)*p) ) p++;
+  } else
+    return MS_FALSE;
+
+  if( *p == '.' ) {
+    p++;
+    if( !isdigit((unsigned char)*p) ) return MS_FALSE;
+    while( isdigit((unsigned char)*p) ) p++;
+  }
+  if( *p == 'e' || *p == 'E' ) {
+    p++;
+    if( *p == '+' || *p == '-' ) p++;
+    if( !isdigit((unsigned char)*p) ) return MS_FALSE;
+    while( isdigit((unsigned char)*p) ) p++;
+  }
+  return *p == '\0';
+}
+
+/************************************************************************/
+/*                          geometry writers                            */
+/************************************************************************/
+
+static void msGeoJSONWritePoint( geoJSONWriterObj *writer, pointObj *point )
+{
+  msGeoJSONWrite( writer, "[" );
+  msGeoJSONWriteDouble( writer, point->x );
+  msGeoJSONWrite( writer, "," );
+  msGeoJSONWriteDouble( writer, point->y );
+  msGeoJSONWrite( writer, "]" );
+}
+
+static void msGeoJSONWriteLine( geoJSONWriterObj *writer, lineObj *line )
+{
+  int i;
+  msGeoJSONWrite( writer, "[" );
+  for( i = 0; i < line->numpoints; i++ ) {
+    if( i > 0 ) msGeoJSONWrite( writer, "," );
+    msGeoJSONWritePoint( writer, &line->point[i] );
+  }
+  msGeoJSONWrite( writer, "]" );
+}
+
+/*
+** Polygon rings are written with the RFC 7946 orientation: exterior rings
+** counterclockwise, holes clockwise.
+*/
+static void msGeoJSONWriteRing( geoJSONWriterObj *writer, lineObj *line,
+                                int exterior )
+{
+  double area = 0;
+  int i, n = line->numpoints;
+
+  for( i = 0; i < n - 1; i++ )
+    area += line->point[i].x * line->point[i+1].y
+            - line->point[i+1].x * line->point[i].y;
+
+  if( (area < 0) != (exterior == MS_TRUE) ) {
+    msGeoJSONWriteLine( writer, line );
+    return;
+  }
+
+  msGeoJSONWrite( writer, "[" );
+  for( i = n - 1; i >= 0; i-- ) {
+    if( i < n - 1 ) msGeoJSONWrite( writer, "," );
+    msGeoJSONWritePoint( writer, &line->point[i] );
+  }
+  msGeoJSONWrite( writer, "]" );
+}
+
+static void msGeoJSONWritePolygon( geoJSONWriterObj *writer, shapeObj *shape,
+                                   int *outerlist, int outer )
+{
+  int i, *innerlist;
+
+  msGeoJSONWrite( writer, "[" );
+  msGeoJSONWriteRing( writer, &shape->line[outer], MS_TRUE );
+  innerlist = msGetInnerList( shape, outer, outerlist );
+  for( i = 0; innerlist && i < shape->numlines; i++ ) {
+    if( innerlist[i] != MS_TRUE ) continue;
+    msGeoJSONWrite( writer, "," );
+    msGeoJSONWriteRing( writer, &shape->line[i], MS_FALSE );
+  }
+  free( innerlist );
+  msGeoJSONWrite( writer, "]" );
+}
+
+static void msGeoJSONWriteGeometry( geoJSONWriterObj *writer, shapeObj *shape )
+{
+  int i, j, n;
+
+  if( shape->numlines == 0 || shape->type == MS_SHAPE_NULL ) {
+    msGeoJSONWrite( writer, "null" );
+    return;
+  }
+
+  switch( shape->type ) {
+    case MS_SHAPE_POINT:
+      for( i = 0, n = 0; i < shape->numlines; i++ )
+        n += shape->line[i].numpoints;
+      if( n == 1 ) {
+        msGeoJSONWrite( writer, "{\"type\":\"Point\",\"coordinates\":" );
+        msGeoJSONWritePoint( writer, &shape->line[0].point[0] );
+      } else {
+        msGeoJSONWrite( writer, "{\"type\":\"MultiPoint\",\"coordinates\":[" );
+        for( i = 0, n = 0; i < shape->numlines; i++ ) {
+          for( j = 0; j < shape->line[i].numpoints; j++ ) {
+            if( n++ > 0 ) msGeoJSONWrite( writer, "," );
+            msGeoJSONWritePoint( writer, &shape->line[i].point[j] );
+          }
+        }
+        msGeoJSONWrite( writer, "]" );
+      }
+      break;
+
+    case MS_SHAPE_LINE:
+      if( shape->numlines == 1 ) {
+        msGeoJSONWrite( writer, "{\"type\":\"LineString\",\"coordinates\":" );
+        msGeoJSONWriteLine( writer, &shape->line[0] );
+      } else {
+        msGeoJSONWrite( writer, "{\"type\":\"MultiLineString\",\"coordinates\":[" );
+        for( i = 0; i < shape->numlines; i++ ) {
+          if( i > 0 ) msGeoJSONWrite( writer, "," );
+          msGeoJSONWriteLine( writer, &shape->line[i] );
+        }
+        msGeoJSONWrite( writer, "]" );
+      }
+      break;
+
+    case MS_SHAPE_POLYGON: {
+      int *outerlist = msGetOuterList( shape );
+      int numouters = 0;
+
+      for( i = 0; outerlist && i < shape->numlines; i++ )
+        if( outerlist[i] == MS_TRUE ) numouters++;
+
+      if( numouters == 0 ) {
+        msGeoJSONWrite( writer, "null" );
+        free( outerlist );
+        return;
+      }
+
+      if( numouters == 1 ) {
+        msGeoJSONWrite( writer, "{\"type\":\"Polygon\",\"coordinates\":" );
+        for( i = 0; i < shape->numlines; i++ )
+          if( outerlist[i] == MS_TRUE )
+            msGeoJSONWritePolygon( writer, shape, outerlist, i );
+      } else {
+        msGeoJSONWrite( writer, "{\"type\":\"MultiPolygon\",\"coordinates\":[" );
+        for( i = 0, n = 0; i < shape->numlines; i++ ) {
+          if( outerlist[i] != MS_TRUE ) continue;
+          if( n++ > 0 ) msGeoJSONWrite( writer, "," );
+          msGeoJSONWritePolygon( writer, shape, outerlist, i );
+        }
+        msGeoJSONWrite( writer, "]" );
+      }
+      free( outerlist );
+      break;
+    }
+
+    default:
+      msGeoJSONWrite( writer, "null" );
+      return;
+  }
+  msGeoJSONWrite( writer, "}" );
+}
+
+/************************************************************************/
+/*                        msGeoJSONWriteShape()                         */
+/************************************************************************/
+
+static void msGeoJSONWriteShape( geoJSONWriterObj *writer, layerObj *layer,
+                                 shapeObj *shape, gmlItemListObj *item_list,
+                                 int featureid_index )
+{
+  int i, first = MS_TRUE;
+
+  msGeoJSONWrite( writer, "{\"type\":\"Feature\",\"id\":" );
+  if( featureid_index >= 0 && featureid_index < shape->numvalues ) {
+    if( msGeoJSONIsNumber( shape->values[featureid_index] ) )
+      msGeoJSONWrite( writer, shape->values[featureid_index] );
+    else
+      msGeoJSONWriteString( writer, shape->values[featureid_index] );
+  } else {
+    char id[32];
+    snprintf( id, sizeof(id), "%ld", shape->index );
+    msGeoJSONWrite( writer, id );
+  }
+
+  msGeoJSONWrite( writer, ",\"properties\":{" );
+  for( i = 0; i < item_list->numitems && i < shape->numvalues; i++ ) {
+    gmlItemObj *item = item_list->items + i;
+    const char *value = shape->values[i];
+
+    if( !item->visible )
+      continue;
+
+    if( !first ) msGeoJSONWrite( writer, "," );
+    first = MS_FALSE;
+    msGeoJSONWriteString( writer, item->alias ? item->alias : item->name );
+    msGeoJSONWrite( writer, ":" );
+
+    if( value == NULL )
+      msGeoJSONWrite( writer, "null" );
+    else if( item->type && (EQUAL(item->type, "Integer") || EQUAL(item->type, "Real"))
+             && msGeoJSONIsNumber( value ) )
+      msGeoJSONWrite( writer, value );
+    else
+      msGeoJSONWriteString( writer, value );
+  }
+
+  msGeoJSONWrite( writer, "},\"geometry\":" );
+  msGeoJSONWriteGeometry( writer, shape );
+  msGeoJSONWrite( writer, "}" );
+}
+
+/************************************************************************/
+/*                      msGeoJSONWriteFromQuery()                       */
+/*                                                                      */
+/*      Write the query results of all layers as a single GeoJSON      */
+/*      FeatureCollection. Features are serialized straight from the    */
+/*      shapeObj and streamed to the client as they are read.           */
+/************************************************************************/
+
+int msGeoJSONWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
+{
+  geoJSONWriterObj writer;
+  const char *precision;
+  int iLayer, i, status = MS_SUCCESS, numfeatures = 0;
+
+  precision = msGetOutputFormatOption( format, "COORDINATE_PRECISION", NULL );
+  writer.precision = precision ? MS_MAX(0, MS_MIN(atoi(precision), 17)) : -1;
+  msBufferInit( &writer.buffer );
+
+  if( sendheaders ) {
+    msIO_setHeader( "Content-Type", "%s",
+                    format->mimetype ? format->mimetype : "application/json" );
+    msIO_sendHeaders();
+  } else
+    msIO_fprintf( stdout, "%c", 10 );
+
+  msGeoJSONWrite( &writer, "{\"type\":\"FeatureCollection\",\"features\":[" );
+
+  for( iLayer = 0; iLayer < map->numlayers && status == MS_SUCCESS; iLayer++ ) {
+    layerObj *layer = GET_LAYER(map, iLayer);
+    gmlItemListObj *item_list;
+    shapeObj resultshape;
+    const char *value;
+    int featureid_index = -1;
+#ifdef USE_PROJ
+    int reproject = MS_FALSE;
+#endif
+
+    if( !layer->resultcache || layer->resultcache->numresults == 0 )
+      continue;
+
+#ifdef USE_PROJ
+    if( layer->transform == MS_TRUE
+        && layer->project
+        && msProjectionsDiffer( &(layer->projection),
+                                &(layer->map->projection) ) )
+      reproject = MS_TRUE;
+#endif
+
+    item_list = msGMLGetItems( layer, "G" );
+    if( item_list == NULL ) {
+      status = MS_FAILURE;
+      break;
+    }
+
+    if( (value = msOWSLookupMetadata( &(layer->metadata), "OFG", "featureid" )) != NULL ) {
+      for( i = 0; i < layer->numitems; i++ ) {
+        if( strcasecmp( layer->items[i], value ) == 0 ) {
+          featureid_index = i;
+          break;
+        }
+      }
+    }
+
+    msInitShape( &resultshape );
+
+    for( i = 0; i < layer->resultcache->numresults; i++ ) {
+      msFreeShape( &resultshape ); /* init too */
+
+      status = msLayerGetShape( layer, &resultshape,
+                                &(layer->resultcache->results[i]) );
+      if( status != MS_SUCCESS )
+        break;
+
+#ifdef USE_PROJ
+      if( reproject ) {
+        status = msProjectShape( &layer->projection, &layer->map->projection,
+                                 &resultshape );
+        if( status != MS_SUCCESS )
+          break;
+      }
+#endif
+
+      if( numfeatures++ > 0 )
+        msGeoJSONWrite( &writer, "," );
+      msGeoJSONWriteShape( &writer, layer, &resultshape, item_list,
+                           featureid_index );
+
+      if( writer.buffer.size >= GEOJSON_FLUSH_SIZE )
+        msGeoJSONFlush( &writer );
+    }
+
+    msFreeShape( &resultshape );
+    msGMLFreeItems( item_list );
+  }
+
+  /*
+  ** Headers are gone already, so even on failure close the collection to
+  ** hand back valid JSON. The error is reported through the return value.
+  */
+  msGeoJSONWrite( &writer, "]}\n" );
+  msGeoJSONFlush( &writer );
+  msBufferFree( &writer.buffer );
+
+  return status;
+}
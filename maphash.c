@@ -34,41 +34,46 @@
 
 
 
-static unsigned hash(const char *key)
+unsigned msHashKey(const char *key)
 {
   unsigned hashval;
 
   for(hashval=0; *key!='\0'; key++)
     hashval = tolower(*key) + 31 * hashval;
 
-  return(hashval % MS_HASHSIZE);
+  return(hashval);
 }
 
-hashTableObj *msCreateHashTable()
+static void initHashItems(hashTableObj *table)
 {
   int i;
+
+  for (i=0; i<table->size; i++)
+    table->items[i] = NULL;
+  table->numitems = 0;
+  table->resolved = NULL;
+  table->freeresolved = NULL;
+}
+
+hashTableObj *msCreateHashTable()
+{
   hashTableObj *table;
 
   table = (hashTableObj *) msSmallMalloc(sizeof(hashTableObj));
   table->items = (struct hashObj **) msSmallMalloc(sizeof(struct hashObj *)*MS_HASHSIZE);
-
-  for (i=0; i<MS_HASHSIZE; i++)
-    table->items[i] = NULL;
-  table->numitems = 0;
+  table->size = MS_HASHSIZE;
+  initHashItems(table);
 
   return table;
 }
 
 int initHashTable( hashTableObj *table )
 {
-  int i;
-
   table->items = (struct hashObj **) malloc(sizeof(struct hashObj *)*MS_HASHSIZE);
   MS_CHECK_ALLOC(table->items, sizeof(struct hashObj *)*MS_HASHSIZE, MS_FAILURE);
+  table->size = MS_HASHSIZE;
+  initHashItems(table);
 
-  for (i=0; i<MS_HASHSIZE; i++)
-    table->items[i] = NULL;
-  table->numitems = 0;
   return MS_SUCCESS;
 }
 
@@ -89,6 +94,15 @@ int msHashIsEmpty( hashTableObj *table )
     return MS_FALSE;
 }
 
+void msInvalidateHashTable( hashTableObj *table )
+{
+  if (table && table->resolved) {
+    if (table->freeresolved)
+      table->freeresolved(table->resolved);
+    table->resolved = NULL;
+    table->freeresolved = NULL;
+  }
+}
 
 void msFreeHashItems( hashTableObj *table )
 {
@@ -97,8 +111,9 @@ void msFreeHashItems( hashTableObj *table )
   struct hashObj *prev_tp=NULL;
 
   if (table) {
+    msInvalidateHashTable(table);
     if(table->items) {
-      for (i=0; i<MS_HASHSIZE; i++) {
+      for (i=0; i<table->size; i++) {
         if (table->items[i] != NULL) {
           for (tp=table->items[i]; tp!=NULL; prev_tp=tp,tp=tp->next,free(prev_tp)) {
             msFree(tp->key);
@@ -117,6 +132,35 @@ void msFreeHashItems( hashTableObj *table )
   }
 }
 
+/*
+** Keep chains short by doubling the number of buckets once the table holds
+** more than two items per bucket on average. The hash of every key is kept
+** in its item so this doesn't rehash any strings.
+*/
+static void growHashTable(hashTableObj *table)
+{
+  int i, size = table->size*2 + 1;
+  struct hashObj **items, *tp, *next;
+
+  items = (struct hashObj **) malloc(sizeof(struct hashObj *)*size);
+  if (items == NULL) return; /* keep using the current buckets */
+
+  for (i=0; i<size; i++)
+    items[i] = NULL;
+
+  for (i=0; i<table->size; i++) {
+    for (tp=table->items[i]; tp!=NULL; tp=next) {
+      next = tp->next;
+      tp->next = items[tp->hashval % size];
+      items[tp->hashval % size] = tp;
+    }
+  }
+
+  free(table->items);
+  table->items = items;
+  table->size = size;
+}
+
 struct hashObj *msInsertHashTable(hashTableObj *table,
                                   const char *key, const char *value) {
   struct hashObj *tp;
@@ -128,17 +172,23 @@ struct hashObj *msInsertHashTable(hashTableObj *table,
     return NULL;
   }
 
-  for (tp=table->items[hash(key)]; tp!=NULL; tp=tp->next)
-    if(strcasecmp(key, tp->key) == 0)
+  msInvalidateHashTable(table);
+
+  hashval = msHashKey(key);
+  for (tp=table->items[hashval % table->size]; tp!=NULL; tp=tp->next)
+    if(tp->hashval == hashval && strcasecmp(key, tp->key) == 0)
       break;
 
   if (tp == NULL) { /* not found */
+    if (table->numitems >= 2*table->size)
+      growHashTable(table);
+
     tp = (struct hashObj *) malloc(sizeof(*tp));
     MS_CHECK_ALLOC(tp, sizeof(*tp), NULL);
     tp->key = msStrdup(key);
-    hashval = hash(key);
-    tp->next = table->items[hashval];
-    table->items[hashval] = tp;
+    tp->hashval = hashval;
+    tp->next = table->items[hashval % table->size];
+    table->items[hashval % table->size] = tp;
     table->numitems++;
   } else {
     free(tp->data);
@@ -150,7 +200,7 @@ struct hashObj *msInsertHashTable(hashTableObj *table,
   return tp;
 }
 
-char *msLookupHashTable(hashTableObj *table, const char *key)
+char *msLookupHashTableWithHash(hashTableObj *table, const char *key, unsigned hashval)
 {
   struct hashObj *tp;
 
@@ -158,25 +208,36 @@ char *msLookupHashTable(hashTableObj *table, const char *key)
     return(NULL);
   }
 
-  for (tp=table->items[hash(key)]; tp!=NULL; tp=tp->next)
-    if (strcasecmp(key, tp->key) == 0)
+  for (tp=table->items[hashval % table->size]; tp!=NULL; tp=tp->next)
+    if (tp->hashval == hashval && strcasecmp(key, tp->key) == 0)
       return(tp->data);
 
   return NULL;
 }
 
+char *msLookupHashTable(hashTableObj *table, const char *key)
+{
+  if (!table || !key) {
+    return(NULL);
+  }
+
+  return msLookupHashTableWithHash(table, key, msHashKey(key));
+}
+
 int msRemoveHashTable(hashTableObj *table, const char *key)
 {
   struct hashObj *tp;
   struct hashObj *prev_tp=NULL;
   int status = MS_FAILURE;
+  unsigned hashval;
 
   if (!table || !key) {
     msSetError(MS_HASHERR, "No hash table", "msRemoveHashTable");
     return MS_FAILURE;
   }
 
-  tp=table->items[hash(key)];
+  hashval = msHashKey(key);
+  tp=table->items[hashval % table->size];
   if (!tp) {
     msSetError(MS_HASHERR, "No such hash entry", "msRemoveHashTable");
     return MS_FAILURE;
@@ -184,14 +245,15 @@ int msRemoveHashTable(hashTableObj *table, const char *key)
 
   prev_tp = NULL;
   while (tp != NULL) {
-    if (strcasecmp(key, tp->key) == 0) {
+    if (tp->hashval == hashval && strcasecmp(key, tp->key) == 0) {
       status = MS_SUCCESS;
+      msInvalidateHashTable(table);
       if (prev_tp) {
         prev_tp->next = tp->next;
         free(tp);
         break;
       } else {
-        table->items[hash(key)] = tp->next;
+        table->items[hashval % table->size] = tp->next;
         free(tp);
         break;
       }
@@ -215,7 +277,7 @@ const char *msFirstKeyFromHashTable( hashTableObj *table )
     return NULL;
   }
 
-  for (hash_index = 0; hash_index < MS_HASHSIZE; hash_index++ ) {
+  for (hash_index = 0; hash_index < table->size; hash_index++ ) {
     if (table->items[hash_index] != NULL )
       return table->items[hash_index]->key;
   }
@@ -236,7 +298,7 @@ const char *msNextKeyFromHashTable( hashTableObj *table, const char *lastKey )
   if ( lastKey == NULL )
     return msFirstKeyFromHashTable( table );
 
-  hash_index = hash(lastKey);
+  hash_index = msHashKey(lastKey) % table->size;
   for ( link = table->items[hash_index];
         link != NULL && strcasecmp(lastKey,link->key) != 0;
         link = link->next ) {}
@@ -244,11 +306,10 @@ const char *msNextKeyFromHashTable( hashTableObj *table, const char *lastKey )
   if ( link != NULL && link->next != NULL )
     return link->next->key;
 
-  while ( ++hash_index < MS_HASHSIZE ) {
+  while ( ++hash_index < table->size ) {
     if ( table->items[hash_index] != NULL )
       return table->items[hash_index]->key;
   }
 
   return NULL;
 }
-
@@ -40,7 +40,7 @@ extern "C" {
 #define  MS_DLL_EXPORT
 #endif
 
-#define MS_HASHSIZE 41
+#define MS_HASHSIZE 41 /* initial number of buckets, tables grow as items are added */
 
   /* =========================================================================
    * Structs
@@ -51,12 +51,16 @@ extern "C" {
     struct hashObj *next;  /* pointer to next item */
     char           *key;   /* string key that is hashed */
     char           *data;  /* string stored in this item */
+    unsigned        hashval; /* full hash of key, kept to avoid rehashing */
   };
 #endif /*SWIG*/
 
   typedef struct {
 #ifndef SWIG
     struct hashObj **items;  /* the hash table */
+    int              size;   /* number of buckets in items */
+    void            *resolved; /* data derived from the items (e.g. resolved OWS metadata), */
+    void           (*freeresolved)(void *); /* dropped whenever the table changes */
 #endif
 #ifdef SWIG
     %immutable;
@@ -153,6 +157,32 @@ extern "C" {
 
   MS_DLL_EXPORT int msHashIsEmpty( hashTableObj* table );
 
+  /* msHashKey - case insensitive hash of a key
+   * ARGS:
+   *     key - key string
+   * RETURNS:
+   *     the full hash value, callers can keep it for repeated lookups
+   */
+  MS_DLL_EXPORT unsigned msHashKey( const char *key );
+
+  /* msLookupHashTableWithHash - msLookupHashTable() with a precomputed hash
+   * ARGS:
+   *     table   - the target hash table
+   *     key     - key string of item
+   *     hashval - msHashKey(key)
+   * RETURNS:
+   *     string value of item
+   */
+  MS_DLL_EXPORT char *msLookupHashTableWithHash( hashTableObj *table, const char *key, unsigned hashval );
+
+  /* msInvalidateHashTable - drop data derived from the table
+   * ARGS:
+   *     table - target hash table
+   * RETURNS:
+   *     None
+   */
+  MS_DLL_EXPORT void msInvalidateHashTable( hashTableObj *table );
+
 #endif /*SWIG*/
 
 #ifdef __cplusplus
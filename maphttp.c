@@ -67,6 +67,8 @@
  **********************************************************************/
 static int gbCurlInitialized = MS_FALSE;
 
+static void msHTTPCacheCleanup(void);
+
 int msHTTPInit()
 {
   /* curl_global_init() should only be called once (no matter how
@@ -96,6 +98,8 @@ int msHTTPInit()
  **********************************************************************/
 void msHTTPCleanup()
 {
+  msHTTPCacheCleanup();
+
   msAcquireLock(TLOCK_OWS);
   if (gbCurlInitialized)
     curl_global_cleanup();
@@ -138,6 +142,9 @@ void msHTTPInitRequestObj(httpRequestObj *pasReqInfo, int numRequests)
     pasReqInfo[i].pszProxyPassword = NULL;
     pasReqInfo[i].pszHttpUsername = NULL;
     pasReqInfo[i].pszHttpPassword = NULL;
+    pasReqInfo[i].nCacheMaxAge = 0;
+    pasReqInfo[i].pszCacheDir = NULL;
+    pasReqInfo[i].bCacheImagesOnly = MS_FALSE;
 
     pasReqInfo[i].debug = MS_FALSE;
 
@@ -146,6 +153,8 @@ void msHTTPInitRequestObj(httpRequestObj *pasReqInfo, int numRequests)
     pasReqInfo[i].result_data = NULL;
     pasReqInfo[i].result_size = 0;
     pasReqInfo[i].result_buf_size = 0;
+    pasReqInfo[i].bNoStore = MS_FALSE;
+    pasReqInfo[i].nServerMaxAge = -1;
   }
 }
 
@@ -190,6 +199,10 @@ void msHTTPFreeRequestObj(httpRequestObj *pasReqInfo, int numRequests)
       free(pasReqInfo[i].pszHTTPCookieData);
     pasReqInfo[i].pszHTTPCookieData = NULL;
 
+    if (pasReqInfo[i].pszCacheDir)
+      free(pasReqInfo[i].pszCacheDir);
+    pasReqInfo[i].pszCacheDir = NULL;
+
     pasReqInfo[i].curl_handle = NULL;
 
     free( pasReqInfo[i].result_data );
@@ -256,6 +269,469 @@ static size_t msHTTPWriteFct(void *buffer, size_t size, size_t nmemb,
   }
 }
 
+/**********************************************************************
+ *                          HTTP response cache
+ *
+ * Successful responses to requests with nCacheMaxAge > 0 are kept in a
+ * process wide memory cache of at most MS_HTTP_CACHE_MEMORY_SIZE bytes
+ * and, if pszCacheDir is set, in files in that directory so they can be
+ * shared between processes.  The directory holds at most
+ * MS_HTTP_CACHE_DIR_ENTRIES files: the key picks the file, a new entry
+ * replaces whatever was stored in it, and expired files are deleted when
+ * they are read.  Entries are keyed on the URL, the POST
+ * body, the cookie and the HTTP user, and expire after the smaller of
+ * the request's max age and the max-age/Expires sent by the server.
+ * Responses marked no-store, no-cache or private are never cached, and
+ * neither are service exceptions sent with status 200: requests with
+ * bCacheImagesOnly set (WMS GetMap) only cache image responses, other
+ * responses are checked for an exception report root element.
+ **********************************************************************/
+typedef struct httpCacheEntry {
+  char *key;
+  char *contenttype;
+  char *data;
+  int   size;
+  time_t expires;
+  struct httpCacheEntry *prev, *next; /* most recently used first */
+} httpCacheEntryObj;
+
+static httpCacheEntryObj *psHTTPCacheHead = NULL;
+static httpCacheEntryObj *psHTTPCacheTail = NULL;
+static int nHTTPCacheBytes = 0;
+
+static char *msHTTPCacheGetKey(httpRequestObj *psReq)
+{
+  char *key = msStrdup(psReq->pszGetUrl);
+
+  key = msStringConcatenate(key, "\n");
+  if (psReq->pszPostRequest)
+    key = msStringConcatenate(key, psReq->pszPostRequest);
+  key = msStringConcatenate(key, "\n");
+  if (psReq->pszHTTPCookieData)
+    key = msStringConcatenate(key, psReq->pszHTTPCookieData);
+  key = msStringConcatenate(key, "\n");
+  if (psReq->pszHttpUsername)
+    key = msStringConcatenate(key, psReq->pszHttpUsername);
+
+  return key;
+}
+
+static char *msHTTPCacheGetFilename(httpRequestObj *psReq, const char *key)
+{
+  /* 64 bit FNV-1a hash of the key, the key itself is stored in the file
+   * so entries that end up in the same file are told apart */
+  unsigned long long hash = 14695981039346656037ULL;
+  char szHash[32], *pszFilename;
+  const unsigned char *p;
+
+  for (p = (const unsigned char *) key; *p; p++) {
+    hash ^= *p;
+    hash *= 1099511628211ULL;
+  }
+  snprintf(szHash, sizeof(szHash), "%04x.httpcache",
+           (unsigned int) (hash % MS_HTTP_CACHE_DIR_ENTRIES));
+
+  pszFilename = (char *) msSmallMalloc(MS_MAXPATHLEN);
+  if (msBuildPath(pszFilename, psReq->pszCacheDir, szHash) == NULL) {
+    free(pszFilename);
+    return NULL;
+  }
+  return pszFilename;
+}
+
+static void msHTTPCacheFreeEntry(httpCacheEntryObj *psEntry)
+{
+  msFree(psEntry->key);
+  msFree(psEntry->contenttype);
+  msFree(psEntry->data);
+  free(psEntry);
+}
+
+/* The following functions must be called with TLOCK_HTTPCACHE held */
+static void msHTTPCacheUnlink(httpCacheEntryObj *psEntry)
+{
+  if (psEntry->prev) psEntry->prev->next = psEntry->next;
+  else psHTTPCacheHead = psEntry->next;
+  if (psEntry->next) psEntry->next->prev = psEntry->prev;
+  else psHTTPCacheTail = psEntry->prev;
+  psEntry->prev = psEntry->next = NULL;
+}
+
+static void msHTTPCacheLinkFirst(httpCacheEntryObj *psEntry)
+{
+  psEntry->next = psHTTPCacheHead;
+  if (psHTTPCacheHead) psHTTPCacheHead->prev = psEntry;
+  else psHTTPCacheTail = psEntry;
+  psHTTPCacheHead = psEntry;
+}
+
+static void msHTTPCacheRemove(httpCacheEntryObj *psEntry)
+{
+  msHTTPCacheUnlink(psEntry);
+  nHTTPCacheBytes -= psEntry->size;
+  msHTTPCacheFreeEntry(psEntry);
+}
+
+/* Add an entry in front of the memory cache and evict the least
+ * recently used ones to stay within budget. Takes ownership of psEntry. */
+static void msHTTPCacheAddMemory(httpCacheEntryObj *psEntry)
+{
+  httpCacheEntryObj *psOld;
+
+  if (psEntry->size > MS_HTTP_CACHE_MEMORY_SIZE/4) {
+    msHTTPCacheFreeEntry(psEntry);
+    return;
+  }
+
+  msAcquireLock(TLOCK_HTTPCACHE);
+  for (psOld = psHTTPCacheHead; psOld != NULL; psOld = psOld->next) {
+    if (strcmp(psOld->key, psEntry->key) == 0) {
+      msHTTPCacheRemove(psOld);
+      break;
+    }
+  }
+
+  msHTTPCacheLinkFirst(psEntry);
+  nHTTPCacheBytes += psEntry->size;
+
+  while (nHTTPCacheBytes > MS_HTTP_CACHE_MEMORY_SIZE &&
+         psHTTPCacheTail != psEntry)
+    msHTTPCacheRemove(psHTTPCacheTail);
+  msReleaseLock(TLOCK_HTTPCACHE);
+}
+
+/* Read a cache file, returns NULL if missing, stale or for another key */
+static httpCacheEntryObj *msHTTPCacheReadFile(const char *pszFilename,
+    const char *key)
+{
+  FILE *fp;
+  httpCacheEntryObj *psEntry;
+  long expires;
+  int size, keylen, ok;
+  char szContentType[256];
+
+  fp = fopen(pszFilename, "rb");
+  if (fp == NULL)
+    return NULL;
+
+  if (fscanf(fp, "MSHTTPCACHE %ld %d %d\n", &expires, &size, &keylen) != 3) {
+    fclose(fp);
+    return NULL;
+  }
+  if ((time_t) expires <= time(NULL)) {
+    /* whatever entry the file holds has expired */
+    fclose(fp);
+    unlink(pszFilename);
+    return NULL;
+  }
+  if (size < 0 || size > INT_MAX - 1 || keylen != (int) strlen(key) ||
+      fgets(szContentType, sizeof(szContentType), fp) == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+  szContentType[strcspn(szContentType, "\n")] = '\0';
+
+  psEntry = (httpCacheEntryObj *) msSmallCalloc(1, sizeof(httpCacheEntryObj));
+  psEntry->key = (char *) msSmallMalloc(keylen + 1);
+  psEntry->data = (char *) msSmallMalloc(size + 1);
+  ok = (fread(psEntry->key, 1, keylen, fp) == keylen &&
+        fread(psEntry->data, 1, size, fp) == size);
+  fclose(fp);
+
+  psEntry->key[keylen] = '\0';
+  if (!ok || strcmp(psEntry->key, key) != 0) {
+    msHTTPCacheFreeEntry(psEntry);
+    return NULL;
+  }
+
+  psEntry->contenttype = msStrdup(szContentType);
+  psEntry->size = size;
+  psEntry->expires = (time_t) expires;
+  return psEntry;
+}
+
+static void msHTTPCacheWriteFile(const char *pszFilename,
+                                 httpCacheEntryObj *psEntry)
+{
+  FILE *fp;
+  char *pszTmpFilename;
+  int ok;
+
+  /* write to a private file first so readers never see a partial entry */
+  pszTmpFilename = (char *) msSmallMalloc(strlen(pszFilename) + 32);
+  sprintf(pszTmpFilename, "%s.%ld.tmp", pszFilename, (long) getpid());
+
+  fp = fopen(pszTmpFilename, "wb");
+  if (fp == NULL) {
+    free(pszTmpFilename);
+    return;
+  }
+
+  ok = (fprintf(fp, "MSHTTPCACHE %ld %d %d\n%s\n", (long) psEntry->expires,
+                psEntry->size, (int) strlen(psEntry->key),
+                psEntry->contenttype) > 0 &&
+        fwrite(psEntry->key, 1, strlen(psEntry->key), fp) == strlen(psEntry->key) &&
+        fwrite(psEntry->data, 1, psEntry->size, fp) == psEntry->size);
+
+  if (fclose(fp) != 0 || !ok || rename(pszTmpFilename, pszFilename) != 0)
+    unlink(pszTmpFilename);
+
+  free(pszTmpFilename);
+}
+
+/* Serve a request from the cache, returns MS_TRUE on a hit */
+static int msHTTPCacheFetch(httpRequestObj *psReq)
+{
+  httpCacheEntryObj *psEntry, *psFound = NULL;
+  char *key, *data = NULL, *contenttype = NULL, *pszFilename = NULL;
+  int size = 0;
+
+  key = msHTTPCacheGetKey(psReq);
+
+  msAcquireLock(TLOCK_HTTPCACHE);
+  for (psEntry = psHTTPCacheHead; psEntry != NULL; psEntry = psEntry->next) {
+    if (strcmp(psEntry->key, key) == 0)
+      break;
+  }
+  if (psEntry && psEntry->expires <= time(NULL)) {
+    msHTTPCacheRemove(psEntry);
+    psEntry = NULL;
+  }
+  if (psEntry) {
+    /* move to front and copy out while we hold the lock */
+    msHTTPCacheUnlink(psEntry);
+    msHTTPCacheLinkFirst(psEntry);
+
+    data = (char *) msSmallMalloc(psEntry->size + 1);
+    memcpy(data, psEntry->data, psEntry->size);
+    size = psEntry->size;
+    contenttype = msStrdup(psEntry->contenttype);
+  }
+  msReleaseLock(TLOCK_HTTPCACHE);
+
+  if (data == NULL && psReq->pszCacheDir != NULL) {
+    pszFilename = msHTTPCacheGetFilename(psReq, key);
+    if (pszFilename)
+      psFound = msHTTPCacheReadFile(pszFilename, key);
+    if (psFound) {
+      data = psFound->data;
+      size = psFound->size;
+      contenttype = msStrdup(psFound->contenttype);
+      psFound->data = (char *) msSmallMalloc(size + 1);
+      memcpy(psFound->data, data, size);
+      msHTTPCacheAddMemory(psFound);
+    }
+  }
+
+  msFree(pszFilename);
+  msFree(key);
+
+  if (data == NULL)
+    return MS_FALSE;
+
+  if (psReq->pszOutputFile != NULL) {
+    FILE *fp = fopen(psReq->pszOutputFile, "wb");
+    int ok = (fp != NULL && fwrite(data, 1, size, fp) == size);
+
+    if (fp) fclose(fp);
+    free(data);
+    if (!ok) {
+      msFree(contenttype);
+      return MS_FALSE;
+    }
+  } else {
+    free(psReq->result_data);
+    psReq->result_data = data;
+    psReq->result_size = size;
+    psReq->result_buf_size = size + 1;
+  }
+
+  psReq->nStatus = 242;
+  psReq->pszContentType = contenttype;
+  return MS_TRUE;
+}
+
+/**********************************************************************
+ *                          msHTTPIsExceptionContentType()
+ *
+ * Returns MS_TRUE if a response of this Content-Type is an OGC service
+ * exception rather than the requested data.
+ **********************************************************************/
+int msHTTPIsExceptionContentType(const char *pszContentType)
+{
+  return (pszContentType != NULL &&
+          (strcmp(pszContentType, "text/xml") == 0 ||
+           strcmp(pszContentType, "application/vnd.ogc.se_xml") == 0));
+}
+
+/* Does the start of an XML document have an exception report as root? */
+static int msHTTPCacheHasExceptionRoot(const char *data, int size)
+{
+  static const char *papszRoots[] = { "ServiceExceptionReport",
+                                      "ExceptionReport", "WFS_Exception", NULL
+                                    };
+  int i, j, n;
+
+  size = MS_MIN(size, 4096);
+  for (i = 0; i < size; i++) {
+    if (data[i] != '<' && data[i] != ':')
+      continue;
+    for (j = 0; papszRoots[j] != NULL; j++) {
+      n = strlen(papszRoots[j]);
+      if (i + 1 + n <= size && strncmp(data + i + 1, papszRoots[j], n) == 0)
+        return MS_TRUE;
+    }
+  }
+  return MS_FALSE;
+}
+
+/* Is this response a service exception rather than the requested data? */
+static int msHTTPCacheIsException(httpRequestObj *psReq, const char *data,
+                                  int size)
+{
+  const char *pszContentType = psReq->pszContentType;
+
+  /* anything but an image in response to a GetMap is an error report */
+  if (psReq->bCacheImagesOnly)
+    return (pszContentType == NULL ||
+            msHTTPIsExceptionContentType(pszContentType) ||
+            strncasecmp(pszContentType, "image/", 6) != 0);
+
+  /* text/xml is also used for GML, so look at the document itself */
+  if (msHTTPIsExceptionContentType(pszContentType) &&
+      strcmp(pszContentType, "text/xml") != 0)
+    return MS_TRUE;
+  return msHTTPCacheHasExceptionRoot(data, size);
+}
+
+/* Store the response of a completed request in the cache */
+static void msHTTPCacheStore(httpRequestObj *psReq)
+{
+  httpCacheEntryObj *psEntry;
+  long nMaxAge = psReq->nCacheMaxAge;
+
+  if (psReq->bNoStore || psReq->nStatus != 200)
+    return;
+
+  if (psReq->nServerMaxAge >= 0 && psReq->nServerMaxAge < nMaxAge)
+    nMaxAge = psReq->nServerMaxAge;
+  if (nMaxAge <= 0)
+    return;
+
+  psEntry = (httpCacheEntryObj *) msSmallCalloc(1, sizeof(httpCacheEntryObj));
+
+  if (psReq->pszOutputFile != NULL) {
+    FILE *fp = fopen(psReq->pszOutputFile, "rb");
+    long nSize;
+
+    if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (nSize = ftell(fp)) < 0 ||
+        nSize > INT_MAX - 1) {
+      if (fp) fclose(fp);
+      free(psEntry);
+      return;
+    }
+    rewind(fp);
+    psEntry->data = (char *) msSmallMalloc(nSize + 1);
+    psEntry->size = (int) fread(psEntry->data, 1, nSize, fp);
+    fclose(fp);
+    if (psEntry->size != nSize) {
+      msHTTPCacheFreeEntry(psEntry);
+      return;
+    }
+  } else if (psReq->result_data != NULL) {
+    psEntry->data = (char *) msSmallMalloc(psReq->result_size + 1);
+    memcpy(psEntry->data, psReq->result_data, psReq->result_size);
+    psEntry->size = psReq->result_size;
+  } else {
+    free(psEntry);
+    return;
+  }
+
+  /* servers send service exceptions with status 200, don't replay a
+   * transient remote error for the whole max age */
+  if (msHTTPCacheIsException(psReq, psEntry->data, psEntry->size)) {
+    if (psReq->debug)
+      msDebug("HTTP request: id=%d, not caching %s exception response.\n",
+              psReq->nLayerId,
+              psReq->pszContentType ? psReq->pszContentType : "untyped");
+    msHTTPCacheFreeEntry(psEntry);
+    return;
+  }
+
+  psEntry->key = msHTTPCacheGetKey(psReq);
+  psEntry->contenttype = msStrdup(psReq->pszContentType ?
+                                  psReq->pszContentType : "unknown/cached");
+  psEntry->expires = time(NULL) + nMaxAge;
+
+  if (psReq->debug)
+    msDebug("HTTP request: id=%d, caching %d bytes for %ld seconds.\n",
+            psReq->nLayerId, psEntry->size, nMaxAge);
+
+  if (psReq->pszCacheDir != NULL &&
+      psEntry->size <= MS_HTTP_CACHE_MEMORY_SIZE/4) {
+    char *pszFilename = msHTTPCacheGetFilename(psReq, psEntry->key);
+    if (pszFilename)
+      msHTTPCacheWriteFile(pszFilename, psEntry);
+    msFree(pszFilename);
+  }
+
+  msHTTPCacheAddMemory(psEntry);
+}
+
+/**********************************************************************
+ *                          msHTTPHeaderFct()
+ *
+ * CURLOPT_HEADERFUNCTION, records the caching directives of the
+ * response (Cache-Control and Expires headers).
+ **********************************************************************/
+static size_t msHTTPHeaderFct(void *buffer, size_t size, size_t nmemb,
+                              void *reqInfo)
+{
+  httpRequestObj *psReq = (httpRequestObj *)reqInfo;
+  size_t nLen = size*nmemb;
+  char *pszHeader, *pszValue;
+
+  pszHeader = (char *) msSmallMalloc(nLen + 1);
+  memcpy(pszHeader, buffer, nLen);
+  pszHeader[nLen] = '\0';
+  msStringTrimEOL(pszHeader);
+
+  if (strncasecmp(pszHeader, "HTTP/", 5) == 0) {
+    /* status line, reset what we learned from a previous (redirect) response */
+    psReq->bNoStore = MS_FALSE;
+    psReq->nServerMaxAge = -1;
+  } else if (strncasecmp(pszHeader, "Cache-Control:", 14) == 0) {
+    if (strcasestr(pszHeader, "no-store") || strcasestr(pszHeader, "no-cache") ||
+        strcasestr(pszHeader, "private"))
+      psReq->bNoStore = MS_TRUE;
+    if ((pszValue = strcasestr(pszHeader, "max-age=")) != NULL)
+      psReq->nServerMaxAge = atol(pszValue + 8);
+  } else if (strncasecmp(pszHeader, "Expires:", 8) == 0 &&
+             psReq->nServerMaxAge < 0) {
+    /* max-age takes precedence over Expires */
+    /* an invalid date means already expired */
+    time_t tExpires = curl_getdate(pszHeader + 8, NULL);
+    psReq->nServerMaxAge = (tExpires == (time_t) -1) ? 0 :
+                           MS_MAX(0, (long) (tExpires - time(NULL)));
+  }
+
+  free(pszHeader);
+  return nLen;
+}
+
+/**********************************************************************
+ *                          msHTTPCacheCleanup()
+ *
+ * Release the memory response cache, called from msHTTPCleanup().
+ **********************************************************************/
+static void msHTTPCacheCleanup()
+{
+  msAcquireLock(TLOCK_HTTPCACHE);
+  while (psHTTPCacheHead != NULL)
+    msHTTPCacheRemove(psHTTPCacheHead);
+  msReleaseLock(TLOCK_HTTPCACHE);
+}
+
 /**********************************************************************
  *                          msGetCURLAuthType()
  *
@@ -382,6 +858,14 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
       }
     }
 
+    /* Check the response cache */
+    if (pasReqInfo[i].nCacheMaxAge > 0 && msHTTPCacheFetch(&(pasReqInfo[i]))) {
+      if (pasReqInfo[i].debug)
+        msDebug("HTTP request: id=%d, found in response cache, skipping.\n",
+                pasReqInfo[i].nLayerId);
+      continue;
+    }
+
     /* Alloc curl handle */
     http_handle = curl_easy_init();
     if (http_handle == NULL) {
@@ -517,6 +1001,14 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
     curl_easy_setopt(http_handle, CURLOPT_WRITEDATA, &(pasReqInfo[i]));
     curl_easy_setopt(http_handle, CURLOPT_WRITEFUNCTION, msHTTPWriteFct);
 
+    /* Collect the caching directives of the response */
+    if (pasReqInfo[i].nCacheMaxAge > 0) {
+      pasReqInfo[i].bNoStore = MS_FALSE;
+      pasReqInfo[i].nServerMaxAge = -1;
+      curl_easy_setopt(http_handle, CURLOPT_HEADERDATA, &(pasReqInfo[i]));
+      curl_easy_setopt(http_handle, CURLOPT_HEADERFUNCTION, msHTTPHeaderFct);
+    }
+
     /* Provide a buffer where libcurl can write human readable error msgs
      */
     if (pasReqInfo[i].pszErrBuf == NULL)
@@ -686,6 +1178,9 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
       }
     }
 
+    if (psReq->nCacheMaxAge > 0)
+      msHTTPCacheStore(psReq);
+
     if (!MS_HTTP_SUCCESS(psReq->nStatus)) {
       /* Set status to MS_DONE to indicate that transfers were  */
       /* completed but may not be succesfull */
@@ -41,6 +41,12 @@ extern "C" {
 
 #define MS_HTTP_SUCCESS(status)  (status == 200 || status == 242)
 
+  /* Memory budget in bytes of the process wide HTTP response cache */
+#define MS_HTTP_CACHE_MEMORY_SIZE (16*1024*1024)
+  /* Number of files in the MS_HTTP_CACHE_DIR disk cache, each holding
+   * one response of at most MS_HTTP_CACHE_MEMORY_SIZE/4 bytes */
+#define MS_HTTP_CACHE_DIR_ENTRIES 1024
+
   enum MS_HTTP_PROXY_TYPE
   {
     MS_HTTP,
@@ -82,6 +88,12 @@ extern "C" {
     char    *pszHttpUsername;   /* HTTP Authentication username              */
     char    *pszHttpPassword;   /* HTTP Authentication password              */
 
+    int     nCacheMaxAge;       /* Max. age in seconds of cached responses */
+    /* that may be used, 0 disables the cache   */
+    char    *pszCacheDir;       /* Directory of the disk response cache,     */
+    /* NULL to keep responses in memory only    */
+    int     bCacheImagesOnly;   /* Only cache image/ responses (GetMap)      */
+
     /* For debugging/profiling */
     int         debug;         /* Debug mode?  MS_TRUE/MS_FALSE */
 
@@ -93,6 +105,9 @@ extern "C" {
     int       result_size;
     int       result_buf_size;
 
+    int       bNoStore;        /* response must not be cached */
+    long      nServerMaxAge;   /* max-age/Expires of the response, -1 if unset */
+
   } httpRequestObj;
 
 #ifdef USE_CURL
@@ -107,6 +122,7 @@ extern "C" {
   int  msHTTPGetFile(const char *pszGetUrl, const char *pszOutputFile,
                      int *pnHTTPStatus, int nTimeout, int bCheckLocalCache,
                      int bDebug);
+  int  msHTTPIsExceptionContentType(const char *pszContentType);
 
 #endif /*USE_CURL*/
 
@@ -32,6 +32,7 @@
 */
 
 #include "mapserver.h"
+#include "mapthread.h"
 
 
 
@@ -281,6 +282,78 @@ char *msAlignText(mapObj *map, labelObj *label, char *text)
 }
 
 
+/*
+ * transformed label texts are cached per label, the same text usually
+ * comes up many times in a single draw (street names, etc.). Entries are
+ * only valid for the encoding/wrap/maxlength/align settings the cache was
+ * filled with, and size and font are part of the key since they can be
+ * bound to attributes and change the alignment padding.
+ */
+#define MS_LABEL_TEXT_CACHE_SIZE 256
+
+typedef struct {
+  char *text;
+  char *result;
+  double size;
+  char *font;
+} labelTextCacheEntryObj;
+
+typedef struct {
+  char *encoding;
+  char wrap;
+  int maxlength;
+  int align;
+  labelTextCacheEntryObj entries[MS_LABEL_TEXT_CACHE_SIZE];
+} labelTextCacheObj;
+
+static void freeLabelTextCacheEntries(labelTextCacheObj *cache)
+{
+  int i;
+
+  for(i=0; i<MS_LABEL_TEXT_CACHE_SIZE; i++) {
+    msFree(cache->entries[i].text);
+    msFree(cache->entries[i].result);
+    msFree(cache->entries[i].font);
+  }
+  memset(cache->entries, 0, sizeof(cache->entries));
+}
+
+void msFreeLabelTextCache(labelObj *label)
+{
+  labelTextCacheObj *cache = (labelTextCacheObj *) label->textcache;
+
+  if(!cache) return;
+
+  freeLabelTextCacheEntries(cache);
+  msFree(cache->encoding);
+  free(cache);
+  label->textcache = NULL;
+}
+
+static labelTextCacheObj *getLabelTextCache(labelObj *label)
+{
+  labelTextCacheObj *cache = (labelTextCacheObj *) label->textcache;
+
+  if(cache && cache->wrap == label->wrap && cache->maxlength == label->maxlength && cache->align == label->align &&
+      ((!cache->encoding && !label->encoding) || (cache->encoding && label->encoding && strcmp(cache->encoding, label->encoding) == 0)))
+    return cache;
+
+  if(cache) { /* settings changed (e.g. through mapscript) */
+    freeLabelTextCacheEntries(cache);
+    msFree(cache->encoding);
+  } else {
+    cache = (labelTextCacheObj *) msSmallCalloc(1, sizeof(labelTextCacheObj));
+    label->textcache = cache;
+  }
+
+  cache->encoding = label->encoding ? msStrdup(label->encoding) : NULL;
+  cache->wrap = label->wrap;
+  cache->maxlength = label->maxlength;
+  cache->align = label->align;
+
+  return cache;
+}
+
 /*
  * this function applies the label encoding and wrap parameters
  * to the supplied text
@@ -290,6 +363,22 @@ char *msAlignText(mapObj *map, labelObj *label, char *text)
 char *msTransformLabelText(mapObj *map, labelObj *label, char *text)
 {
   char *newtext = text;
+  labelTextCacheObj *cache;
+  labelTextCacheEntryObj *entry;
+  unsigned hashval = 2166136261U;
+  const unsigned char *p;
+
+  if(!text) return NULL;
+
+  cache = getLabelTextCache(label);
+  for(p=(const unsigned char *)text; *p; p++)
+    hashval = (hashval ^ *p) * 16777619U;
+  entry = &(cache->entries[hashval % MS_LABEL_TEXT_CACHE_SIZE]);
+
+  if(entry->text && strcmp(entry->text, text) == 0 && entry->size == label->size &&
+      ((!entry->font && !label->font) || (entry->font && label->font && strcmp(entry->font, label->font) == 0)))
+    return msStrdup(entry->result);
+
   if(label->encoding)
     newtext = msGetEncodedString(text, label->encoding);
   else
@@ -303,9 +392,165 @@ char *msTransformLabelText(mapObj *map, labelObj *label, char *text)
     newtext = msAlignText(map, label, newtext);
   }
 
+  if(newtext) { /* failures and suppressed labels are not cached */
+    msFree(entry->text);
+    msFree(entry->result);
+    msFree(entry->font);
+    entry->text = msStrdup(text);
+    entry->result = msStrdup(newtext);
+    entry->size = label->size;
+    entry->font = label->font ? msStrdup(label->font) : NULL;
+  }
+
   return newtext;
 }
 
+/************************************************************************/
+/*                          Label point cache                           */
+/*                                                                      */
+/*      Finding the label point of a large polygon is expensive, and    */
+/*      tiled clients ask for the same polygons over and over, from     */
+/*      neighbouring tiles and metatiles.  With PROCESSING              */
+/*      "LABEL_POINT_CACHE=ON" the label point of each feature of a     */
+/*      shapefile layer is computed once from the unclipped feature and */
+/*      kept, in map coordinates, for the lifetime of the process, so   */
+/*      every tile places the label at the same spot.  Entries are kept */
+/*      per scale band (one per power of two of the scale denominator)  */
+/*      since the point is computed in pixels, and are reset when the   */
+/*      .shp file is modified.  Protected by TLOCK_LABELPOINTCACHE.     */
+/************************************************************************/
+
+#define MS_LABEL_POINT_CACHE_MAX 32
+
+#define MS_LABEL_POINT_UNKNOWN 0
+#define MS_LABEL_POINT_FOUND 1
+#define MS_LABEL_POINT_NONE 2
+
+struct labelPointCacheObj {
+  featureCacheObj cache;
+  pointObj *points; /* label point of each shape, in map coordinates */
+  unsigned char *state; /* MS_LABEL_POINT_* */
+};
+
+static void msLabelPointCacheReset(featureCacheObj *cache, int numshapes)
+{
+  labelPointCacheObj *pointcache = (labelPointCacheObj *) cache;
+
+  if(cache->numshapes != numshapes) {
+    msFree(pointcache->points);
+    msFree(pointcache->state);
+    pointcache->points = (pointObj *) msSmallMalloc(sizeof(pointObj) * MS_MAX(numshapes, 1));
+    pointcache->state = (unsigned char *) msSmallMalloc(MS_MAX(numshapes, 1));
+  }
+  memset(pointcache->state, MS_LABEL_POINT_UNKNOWN, MS_MAX(numshapes, 1));
+}
+
+static void msLabelPointCacheFree(featureCacheObj *cache)
+{
+  msFree(((labelPointCacheObj *) cache)->points);
+  msFree(((labelPointCacheObj *) cache)->state);
+}
+
+static featureCacheListObj labelPointCaches = {
+  TLOCK_LABELPOINTCACHE, MS_LABEL_POINT_CACHE_MAX, sizeof(labelPointCacheObj),
+  msLabelPointCacheReset, msLabelPointCacheFree, NULL, 0, 0
+};
+
+/*
+** Returns the label point cache to use while drawing layer at the current map
+** extent and scale, or NULL if the layer does not ask for one or cannot use one.
+** Must be released with msReleaseLabelPointCache().
+*/
+labelPointCacheObj *msAcquireLabelPointCache(layerObj *layer, mapObj *map)
+{
+  const char *value = msLayerGetProcessingKey(layer, "LABEL_POINT_CACHE");
+  shapefileObj *shpfile;
+  char *key, *projection, buffer[64];
+
+  if (!value || !(EQUAL(value, "ON") || EQUAL(value, "TRUE") || EQUAL(value, "YES")))
+    return NULL;
+
+  if(layer->connectiontype != MS_SHAPEFILE || !layer->layerinfo || layer->type != MS_LAYER_POLYGON)
+    return NULL;
+  shpfile = (shapefileObj *) layer->layerinfo;
+
+  /* the same features end up in different places with a different projection */
+  key = msStringConcatenate(msStrdup(shpfile->source), "\n");
+  projection = msGetProjectionString(&(layer->projection));
+  if(projection) key = msStringConcatenate(key, projection);
+  msFree(projection);
+  key = msStringConcatenate(key, "\n");
+  projection = msGetProjectionString(&(map->projection));
+  if(projection) key = msStringConcatenate(key, projection);
+  msFree(projection);
+
+  snprintf(buffer, sizeof(buffer), "\n%d\n", map->scaledenom > 0 ? (int) MS_NINT(log(map->scaledenom) / log(2.0)) : 0);
+  key = msStringConcatenate(key, buffer);
+  value = msLayerGetProcessingKey(layer, "LABEL_POINT_PRECISION");
+  if(value) key = msStringConcatenate(key, (char *) value);
+
+  return (labelPointCacheObj *) msAcquireFeatureCache(&labelPointCaches, key, msShapefileGetMTime(shpfile->source, ".shp"), shpfile->numshapes);
+}
+
+void msReleaseLabelPointCache(labelPointCacheObj *cache)
+{
+  msReleaseFeatureCache(&labelPointCaches, (featureCacheObj *) cache);
+}
+
+/*
+** Looks up the label point of shape shapeindex, in image coordinates of the current
+** map. Returns MS_SUCCESS with lp set, MS_FAILURE if the shape is known to have no
+** label point, or MS_DONE if it has not been computed yet.
+*/
+int msLabelPointCacheLookup(labelPointCacheObj *cache, mapObj *map, long shapeindex, pointObj *lp)
+{
+  int status = MS_DONE;
+
+  if(!cache || shapeindex < 0 || shapeindex >= cache->cache.numshapes) return MS_DONE;
+
+  msAcquireLock( TLOCK_LABELPOINTCACHE );
+  if(cache->state[shapeindex] == MS_LABEL_POINT_FOUND) {
+    lp->x = MS_MAP2IMAGE_X_IC_DBL(cache->points[shapeindex].x, map->extent.minx, 1.0/map->cellsize);
+    lp->y = MS_MAP2IMAGE_Y_IC_DBL(cache->points[shapeindex].y, map->extent.maxy, 1.0/map->cellsize);
+    status = MS_SUCCESS;
+  } else if(cache->state[shapeindex] == MS_LABEL_POINT_NONE) {
+    status = MS_FAILURE;
+  }
+  msReleaseLock( TLOCK_LABELPOINTCACHE );
+
+  return status;
+}
+
+/*
+** Stores the label point lp (image coordinates of the current map) of shape
+** shapeindex, or the fact that it has none if lp is NULL.
+*/
+void msLabelPointCacheStore(labelPointCacheObj *cache, mapObj *map, long shapeindex, pointObj *lp)
+{
+  if(!cache || shapeindex < 0 || shapeindex >= cache->cache.numshapes) return;
+
+  msAcquireLock( TLOCK_LABELPOINTCACHE );
+  if(lp) {
+    cache->points[shapeindex].x = MS_IMAGE2MAP_X(lp->x, map->extent.minx, map->cellsize);
+    cache->points[shapeindex].y = MS_IMAGE2MAP_Y(lp->y, map->extent.maxy, map->cellsize);
+    cache->state[shapeindex] = MS_LABEL_POINT_FOUND;
+  } else {
+    cache->state[shapeindex] = MS_LABEL_POINT_NONE;
+  }
+  msReleaseLock( TLOCK_LABELPOINTCACHE );
+}
+
+/************************************************************************/
+/*                      msLabelPointCacheCleanup()                      */
+/*                                                                      */
+/*      Free the label point caches.  Called from msCleanup().          */
+/************************************************************************/
+
+void msLabelPointCacheCleanup(void)
+{
+  msFeatureCacheListCleanup(&labelPointCaches);
+}
+
 int msAddLabelGroup(mapObj *map, int layerindex, int classindex, shapeObj *shape, pointObj *point, double featuresize)
 {
   int i, priority, numactivelabels=0;
@@ -756,11 +1001,94 @@ int msTestLabelCacheCollisions(labelCacheObj *labelcache, labelObj *labelPtr,
                                 int current_label, int mindistance, double label_size);
 */
 
+/*
+** Tests poly, a part of cachePtr, against curCachePtr, a label that has already
+** been rendered. Returns MS_FALSE if they collide.
+*/
+static int testLabelCacheMemberCollision(labelCacheMemberObj *cachePtr, labelCacheMemberObj *curCachePtr, shapeObj *poly,
+    int mindistance, double label_width)
+{
+  int ll, pp;
+
+  /*
+  ** Note 1: We add the label_size to the mindistance value when comparing because we do want the mindistance
+  ** value between the labels and not only from point to point.
+  **
+  ** Note 2: We only check the first label (could be multiples (RFC 77)) since that is *by far* the most common
+  ** use case. Could change in the future but it's not worth the overhead at this point.
+  */
+  if(mindistance >0  &&
+      (cachePtr->layerindex == curCachePtr->layerindex) &&
+      (cachePtr->classindex == curCachePtr->classindex) &&
+      (cachePtr->labels[0].annotext && curCachePtr->labels[0].annotext &&
+       strcmp(cachePtr->labels[0].annotext, curCachePtr->labels[0].annotext) == 0) &&
+      (msDistancePointToPoint(&(cachePtr->point), &(curCachePtr->point)) <= (mindistance + label_width))) { /* label is a duplicate */
+    return MS_FALSE;
+  }
+
+  if(intersectLabelPolygons(curCachePtr->poly, poly) == MS_TRUE) { /* polys intersect */
+    return MS_FALSE;
+  }
+  if(curCachePtr->leaderline) {
+    /* our poly against rendered leader lines */
+    /* first do a bbox check */
+    if(msRectOverlap(curCachePtr->leaderbbox, &(poly->bounds))) {
+      /* look for intersecting line segments */
+      for(ll=0; ll<poly->numlines; ll++)
+        for(pp=1; pp<poly->line[ll].numpoints; pp++)
+          if(msIntersectSegments(
+                &(poly->line[ll].point[pp-1]),
+                &(poly->line[ll].point[pp]),
+                &(curCachePtr->leaderline->point[0]),
+                &(curCachePtr->leaderline->point[1])) ==  MS_TRUE) {
+            return(MS_FALSE);
+          }
+    }
+
+  }
+  if(cachePtr->leaderline) {
+    /* does our leader intersect current label */
+    /* first do a bbox check */
+    if(msRectOverlap(cachePtr->leaderbbox, &(curCachePtr->poly->bounds))) {
+      /* look for intersecting line segments */
+      for(ll=0; ll<curCachePtr->poly->numlines; ll++)
+        for(pp=1; pp<curCachePtr->poly->line[ll].numpoints; pp++)
+          if(msIntersectSegments(
+                &(curCachePtr->poly->line[ll].point[pp-1]),
+                &(curCachePtr->poly->line[ll].point[pp]),
+                &(cachePtr->leaderline->point[0]),
+                &(cachePtr->leaderline->point[1])) ==  MS_TRUE) {
+            return(MS_FALSE);
+          }
+
+    }
+    if(curCachePtr->leaderline) {
+      /* TODO: check intersection of leader lines, not only bbox test ? */
+      if(msRectOverlap(curCachePtr->leaderbbox, cachePtr->leaderbbox)) {
+        return MS_FALSE;
+      }
+
+    }
+  }
+
+  return MS_TRUE;
+}
+
+/* world grid cell of image pixel x,y, relative to the first cell of the label cache grid */
+static void labelGridCell(mapObj *map, double x, double y, int *cx, int *cy)
+{
+  labelCacheObj *labelcache = &(map->labelcache);
+
+  /* snap to whole pixels of the world grid first so that all tiles agree on the cell */
+  *cx = (int) (floor(floor(map->extent.minx / map->cellsize + x + 0.5) / labelcache->gridsize) - labelcache->gridminx);
+  *cy = (int) (floor(floor(map->extent.maxy / map->cellsize - y + 0.5) / labelcache->gridsize) - labelcache->gridminy);
+}
+
 int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shapeObj *poly,
                                int mindistance, int current_priority, int current_label)
 {
   labelCacheObj *labelcache = &(map->labelcache);
-  int i, p, ll, pp;
+  int i, p, ll;
   double label_width = 0;
   labelCacheMemberObj *curCachePtr=NULL;
 
@@ -800,6 +1128,51 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shape
   if(mindistance > 0)
     label_width = poly->bounds.maxx - poly->bounds.minx;
 
+  if(labelcache->gridsize > 0) {
+    /* only labels anchored less than gridreach away from poly, our leader line or
+       (for duplicates) our label point can collide with it, the extra pixel accounts
+       for labelGridCell() snapping to whole pixels */
+    int cx, cy, cx0, cy0, cx1, cy1;
+    double reach = labelcache->gridreach + 1;
+    rectObj window = poly->bounds;
+
+    if(mindistance > 0) {
+      window.minx = MS_MIN(window.minx, cachePtr->point.x - (mindistance + label_width));
+      window.miny = MS_MIN(window.miny, cachePtr->point.y - (mindistance + label_width));
+      window.maxx = MS_MAX(window.maxx, cachePtr->point.x + (mindistance + label_width));
+      window.maxy = MS_MAX(window.maxy, cachePtr->point.y + (mindistance + label_width));
+    }
+    if(cachePtr->leaderbbox)
+      msMergeRect(&window, cachePtr->leaderbbox);
+
+    labelGridCell(map, window.minx - reach, window.maxy + reach, &cx0, &cy0);
+    labelGridCell(map, window.maxx + reach, window.miny - reach, &cx1, &cy1);
+    cx0 = MS_MAX(cx0, 0);
+    cy0 = MS_MAX(cy0, 0);
+    cx1 = MS_MIN(cx1, labelcache->gridwidth - 1);
+    cy1 = MS_MIN(cy1, labelcache->gridheight - 1);
+
+    for(p=current_priority; p<MS_MAX_LABEL_PRIORITY; p++) {
+      labelCacheSlotObj *cacheslot;
+      cacheslot = &(labelcache->slots[p]);
+      if(!cacheslot->grid) continue;
+
+      for(cy=cy0; cy<=cy1; cy++) {
+        for(cx=cx0; cx<=cx1; cx++) {
+          for(i=cacheslot->grid[cy*labelcache->gridwidth + cx]; i>=0; i=cacheslot->labels[i].gridnext) {
+            curCachePtr = &(cacheslot->labels[i]);
+            /* labels that have been processed have a poly, even if they collided */
+            if(!curCachePtr->poly || (p == current_priority && i == current_label))
+              continue;
+            if(testLabelCacheMemberCollision(cachePtr, curCachePtr, poly, mindistance, label_width) == MS_FALSE)
+              return MS_FALSE;
+          }
+        }
+      }
+    }
+    return MS_TRUE;
+  }
+
   for(p=current_priority; p<MS_MAX_LABEL_PRIORITY; p++) {
     labelCacheSlotObj *cacheslot;
     cacheslot = &(labelcache->slots[p]);
@@ -812,66 +1185,8 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shape
         /* skip testing against ourself */
         assert(p!=current_priority || i != current_label);
 
-        /*
-        ** Note 1: We add the label_size to the mindistance value when comparing because we do want the mindistance
-        ** value between the labels and not only from point to point.
-        **
-        ** Note 2: We only check the first label (could be multiples (RFC 77)) since that is *by far* the most common
-        ** use case. Could change in the future but it's not worth the overhead at this point.
-        */
-        if(mindistance >0  &&
-            (cachePtr->layerindex == curCachePtr->layerindex) &&
-            (cachePtr->classindex == curCachePtr->classindex) &&
-            (cachePtr->labels[0].annotext && curCachePtr->labels[0].annotext &&
-             strcmp(cachePtr->labels[0].annotext, curCachePtr->labels[0].annotext) == 0) &&
-            (msDistancePointToPoint(&(cachePtr->point), &(curCachePtr->point)) <= (mindistance + label_width))) { /* label is a duplicate */
+        if(testLabelCacheMemberCollision(cachePtr, curCachePtr, poly, mindistance, label_width) == MS_FALSE)
           return MS_FALSE;
-        }
-
-        if(intersectLabelPolygons(curCachePtr->poly, poly) == MS_TRUE) { /* polys intersect */
-          return MS_FALSE;
-        }
-        if(curCachePtr->leaderline) {
-          /* our poly against rendered leader lines */
-          /* first do a bbox check */
-          if(msRectOverlap(curCachePtr->leaderbbox, &(poly->bounds))) {
-            /* look for intersecting line segments */
-            for(ll=0; ll<poly->numlines; ll++)
-              for(pp=1; pp<poly->line[ll].numpoints; pp++)
-                if(msIntersectSegments(
-                      &(poly->line[ll].point[pp-1]),
-                      &(poly->line[ll].point[pp]),
-                      &(curCachePtr->leaderline->point[0]),
-                      &(curCachePtr->leaderline->point[1])) ==  MS_TRUE) {
-                  return(MS_FALSE);
-                }
-          }
-
-        }
-        if(cachePtr->leaderline) {
-          /* does our leader intersect current label */
-          /* first do a bbox check */
-          if(msRectOverlap(cachePtr->leaderbbox, &(curCachePtr->poly->bounds))) {
-            /* look for intersecting line segments */
-            for(ll=0; ll<curCachePtr->poly->numlines; ll++)
-              for(pp=1; pp<curCachePtr->poly->line[ll].numpoints; pp++)
-                if(msIntersectSegments(
-                      &(curCachePtr->poly->line[ll].point[pp-1]),
-                      &(curCachePtr->poly->line[ll].point[pp]),
-                      &(cachePtr->leaderline->point[0]),
-                      &(cachePtr->leaderline->point[1])) ==  MS_TRUE) {
-                  return(MS_FALSE);
-                }
-
-          }
-          if(curCachePtr->leaderline) {
-            /* TODO: check intersection of leader lines, not only bbox test ? */
-            if(msRectOverlap(curCachePtr->leaderbbox, cachePtr->leaderbbox)) {
-              return MS_FALSE;
-            }
-
-          }
-        }
       }
     } /* i */
 
@@ -880,6 +1195,177 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shape
   return MS_TRUE;
 }
 
+/*
+** Grid based label placement (WEB METADATA "labelcache_grid_size")
+**
+** Labels are normally placed greedily in the order they were added, so the labels
+** that end up near the edge of a tile depend on what else that particular request
+** happened to draw. In grid mode the world is divided into square cells of gridsize
+** pixels, anchored at the map coordinate origin so that every tile of a given scale
+** uses the same grid. Each label candidate gets a rank derived from its layer, text
+** and position on the world grid, only the best ranked candidate of each cell is
+** kept in every priority slot (forced labels are always kept), and the candidates
+** are then placed best ranked first. A candidate that could not be placed still
+** blocks the lower ranked ones and POSITION AUTO only tries its first position, so
+** whether a label is drawn only depends on the candidates anchored nearby:
+** adjacent tiles make the same decisions as long as they are rendered with a buffer
+** of one grid cell plus the extent of the largest label (including its leader
+** line and MINDISTANCE). Collisions are only tested against the cells within
+** labelcache->gridreach, the largest distance seen so far between a placed
+** label's point and the bounds of its footprint, so labels larger than a cell,
+** curved labels and leader lines are still tested against all their neighbours.
+*/
+
+typedef struct {
+  int index; /* in the cache slot */
+  int cell; /* in the grid window, -1 if outside */
+  unsigned int rank;
+  double x, y; /* world grid pixel of the label point */
+} labelGridCandidateObj;
+
+/* best ranked candidates first within each cell */
+static int compareLabelGridCells(const void *a, const void *b)
+{
+  const labelGridCandidateObj *ca = (const labelGridCandidateObj *) a, *cb = (const labelGridCandidateObj *) b;
+
+  if(ca->cell != cb->cell) return (ca->cell < cb->cell) ? -1 : 1;
+  if(ca->rank != cb->rank) return (ca->rank > cb->rank) ? -1 : 1;
+  if(ca->x != cb->x) return (ca->x < cb->x) ? -1 : 1;
+  if(ca->y != cb->y) return (ca->y < cb->y) ? -1 : 1;
+  return ca->index - cb->index;
+}
+
+/* worst ranked candidates first, msDrawLabelCache() walks the slots backwards */
+static int compareLabelGridRanks(const void *a, const void *b)
+{
+  const labelGridCandidateObj *ca = (const labelGridCandidateObj *) a, *cb = (const labelGridCandidateObj *) b;
+
+  if(ca->rank != cb->rank) return (ca->rank < cb->rank) ? -1 : 1;
+  if(ca->x != cb->x) return (ca->x > cb->x) ? -1 : 1;
+  if(ca->y != cb->y) return (ca->y > cb->y) ? -1 : 1;
+  return cb->index - ca->index;
+}
+
+static unsigned int labelGridHash(unsigned int hashval, const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char *) data;
+
+  while(size--)
+    hashval = (hashval ^ *p++) * 16777619U;
+  return hashval;
+}
+
+int msLabelCacheBuildGrid(mapObj *map, int gridsize)
+{
+  labelCacheObj *labelcache = &(map->labelcache);
+  int p, i, n, cx, cy, prevcell, *newindex;
+  double minx, maxx, miny, maxy;
+
+  labelcache->gridsize = 0;
+  labelcache->gridreach = 0;
+  if(gridsize <= 0 || map->cellsize <= 0)
+    return MS_SUCCESS;
+
+  /* the image and one cell all around it, in world grid cells */
+  minx = floor(map->extent.minx / map->cellsize + 0.5);
+  maxy = floor(map->extent.maxy / map->cellsize + 0.5);
+  maxx = minx + map->width;
+  miny = maxy - map->height;
+  labelcache->gridminx = floor(minx / gridsize) - 1;
+  labelcache->gridminy = floor(miny / gridsize) - 1;
+  labelcache->gridwidth = (int) (floor(maxx / gridsize) + 1 - labelcache->gridminx + 1);
+  labelcache->gridheight = (int) (floor(maxy / gridsize) + 1 - labelcache->gridminy + 1);
+  labelcache->gridsize = gridsize;
+
+  for(p=0; p<MS_MAX_LABEL_PRIORITY; p++) {
+    labelCacheSlotObj *cacheslot = &(labelcache->slots[p]);
+    labelGridCandidateObj *candidates;
+    labelCacheMemberObj *labels;
+
+    msFree(cacheslot->grid);
+    cacheslot->grid = NULL;
+    if(cacheslot->numlabels == 0) continue;
+
+    candidates = (labelGridCandidateObj *) msSmallMalloc(sizeof(labelGridCandidateObj) * cacheslot->numlabels);
+    for(i=0; i<cacheslot->numlabels; i++) {
+      labelCacheMemberObj *cachePtr = &(cacheslot->labels[i]);
+      layerObj *layerPtr = GET_LAYER(map, cachePtr->layerindex);
+      unsigned int hashval = 2166136261U;
+
+      candidates[i].index = i;
+      candidates[i].x = floor(map->extent.minx / map->cellsize + cachePtr->point.x + 0.5);
+      candidates[i].y = floor(map->extent.maxy / map->cellsize - cachePtr->point.y + 0.5);
+
+      labelGridCell(map, cachePtr->point.x, cachePtr->point.y, &cx, &cy);
+      if(cx >= 0 && cy >= 0 && cx < labelcache->gridwidth && cy < labelcache->gridheight)
+        candidates[i].cell = cy * labelcache->gridwidth + cx;
+      else
+        candidates[i].cell = -1;
+
+      if(layerPtr->name)
+        hashval = labelGridHash(hashval, layerPtr->name, strlen(layerPtr->name));
+      if(cachePtr->labels[0].annotext)
+        hashval = labelGridHash(hashval, cachePtr->labels[0].annotext, strlen(cachePtr->labels[0].annotext));
+      hashval = labelGridHash(hashval, &(candidates[i].x), sizeof(double));
+      hashval = labelGridHash(hashval, &(candidates[i].y), sizeof(double));
+      candidates[i].rank = hashval;
+    }
+
+    /* keep the best candidate of each cell, drop the ones that cannot show up in the image */
+    qsort(candidates, cacheslot->numlabels, sizeof(labelGridCandidateObj), compareLabelGridCells);
+    for(i=0, n=0, prevcell=-1; i<cacheslot->numlabels; i++) {
+      labelCacheMemberObj *cachePtr = &(cacheslot->labels[candidates[i].index]);
+      int cell = candidates[i].cell;
+
+      if(cachePtr->labels[0].force == MS_ON || (cell >= 0 && cell != prevcell)) {
+        candidates[n++] = candidates[i];
+      } else {
+        msFreeLabelCacheMember(cachePtr);
+        labelcache->numlabels--;
+      }
+      prevcell = cell;
+    }
+
+    qsort(candidates, n, sizeof(labelGridCandidateObj), compareLabelGridRanks);
+
+    newindex = (int *) msSmallMalloc(sizeof(int) * cacheslot->numlabels);
+    for(i=0; i<cacheslot->numlabels; i++)
+      newindex[i] = -1;
+    labels = (labelCacheMemberObj *) msSmallMalloc(sizeof(labelCacheMemberObj) * MS_MAX(cacheslot->cachesize, 1));
+    cacheslot->grid = (int *) msSmallMalloc(sizeof(int) * labelcache->gridwidth * labelcache->gridheight);
+    for(i=0; i<labelcache->gridwidth * labelcache->gridheight; i++)
+      cacheslot->grid[i] = -1;
+
+    for(i=0; i<n; i++) {
+      labels[i] = cacheslot->labels[candidates[i].index];
+      newindex[candidates[i].index] = i;
+      labels[i].gridnext = -1;
+      if(candidates[i].cell >= 0) {
+        labels[i].gridnext = cacheslot->grid[candidates[i].cell];
+        cacheslot->grid[candidates[i].cell] = i;
+      }
+    }
+
+    /* markers refer to their label by index */
+    for(i=0; i<cacheslot->nummarkers; i++) {
+      if(cacheslot->markers[i].id >= 0 && cacheslot->markers[i].id < cacheslot->numlabels)
+        cacheslot->markers[i].id = newindex[cacheslot->markers[i].id];
+    }
+
+    msFree(cacheslot->labels);
+    cacheslot->labels = labels;
+    cacheslot->numlabels = n;
+    msFree(newindex);
+    msFree(candidates);
+  }
+
+  if(map->debug)
+    msDebug("msLabelCacheBuildGrid(): %d labels left on a %dx%d grid of %d pixel cells\n",
+            labelcache->numlabels, labelcache->gridwidth, labelcache->gridheight, gridsize);
+
+  return MS_SUCCESS;
+}
+
 /* msGetLabelCacheMember()
 **
 ** Returns label cache members by index, making all members of the cache
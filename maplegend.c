@@ -635,6 +635,9 @@ int msEmbedLegend(mapObj *map, imageObj *img)
 
   rendererVTableObj *renderer;
 
+  if(MS_RENDERER_MVT(map->outputformat))
+    return MS_SUCCESS; /* vector tiles have no room for decorations */
+
   if(!MS_RENDERER_PLUGIN(map->outputformat) || !MS_MAP_RENDERER(map)->supports_pixel_buffer) {
     msSetError(MS_MISCERR, "unsupported output format", "msEmbedLegend()");
     return MS_FAILURE;
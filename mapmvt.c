@@ -0,0 +1,729 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Mapbox Vector Tile (MVT) output renderer
+ * Author:   MapServer Team
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** The MVT renderer doesn't draw anything: it hooks into the startShape/endShape
+** callbacks of the plugin renderer interface and encodes the clipped, pixel
+** transformed geometries of each feature together with its attributes into
+** a Mapbox Vector Tile (version 2) protobuf. Styling is left to the client.
+**
+** The protobuf encoding is done by hand, the tile schema being small enough:
+**
+**   Tile    { repeated Layer layers = 3; }
+**   Layer   { required uint32 version = 15; required string name = 1;
+**             repeated Feature features = 2; repeated string keys = 3;
+**             repeated Value values = 4; optional uint32 extent = 5; }
+**   Feature { optional uint64 id = 1; repeated uint32 tags = 2 [packed];
+**             optional GeomType type = 3; repeated uint32 geometry = 4 [packed]; }
+**   Value   { optional string string_value = 1; ... }
+*/
+
+#include "mapserver.h"
+
+#define MVT_DEFAULT_EXTENT 4096
+
+#define MVT_WIRE_VARINT 0
+#define MVT_WIRE_BYTES 2
+
+#define MVT_GEOM_POINT 1
+#define MVT_GEOM_LINESTRING 2
+#define MVT_GEOM_POLYGON 3
+
+#define MVT_CMD_MOVETO 1
+#define MVT_CMD_LINETO 2
+#define MVT_CMD_CLOSEPATH 7
+
+#define MVT_COMMAND(id,count) (((id) & 0x7) | ((count) << 3))
+#define MVT_ZIGZAG(n) (((unsigned int)(n) << 1) ^ (unsigned int)((n) >> 31))
+
+typedef struct {
+  int x, y;
+} mvtPointObj;
+
+typedef struct {
+  char *name;
+  bufferObj features;
+  int numfeatures;
+
+  /* attributes written as keys, and their indexes into layer->items */
+  char **keys;
+  int *itemindexes;
+  int numitemindexes;
+  int itemsresolved;
+
+  /* deduplicated attribute values, with an open addressing hash on top */
+  char **values;
+  int numvalues, maxvalues;
+  int *valuehash;
+  int hashsize;
+} mvtLayerObj;
+
+typedef struct {
+  bufferObj tile;
+  int extent;
+
+  mapObj *map;
+  layerObj *layer;
+  mvtLayerObj *current;
+
+  /* point layers: vertices captured in startShape(), see startShapeMVT() */
+  shapeObj points;
+
+  /* scratch space reused from one feature to the next */
+  bufferObj feature, packed;
+  mvtPointObj *ring;
+  int maxring;
+  unsigned int *geometry;
+  int numgeometry, maxgeometry;
+  int cursorx, cursory;
+} mvtRendererObj;
+
+#define MVT_RENDERER(image) ((mvtRendererObj*)(image)->img.plugin)
+
+/************************************************************************/
+/*                         protobuf primitives                          */
+/************************************************************************/
+
+static void mvtWriteVarint(bufferObj *buffer, unsigned long long value)
+{
+  unsigned char bytes[10];
+  int n = 0;
+  while(value >= 0x80) {
+    bytes[n++] = (unsigned char)((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  bytes[n++] = (unsigned char)value;
+  msBufferAppend(buffer, bytes, n);
+}
+
+static void mvtWriteTag(bufferObj *buffer, int field, int wiretype)
+{
+  mvtWriteVarint(buffer, (field << 3) | wiretype);
+}
+
+static void mvtWriteBytes(bufferObj *buffer, int field, const void *data, size_t length)
+{
+  mvtWriteTag(buffer, field, MVT_WIRE_BYTES);
+  mvtWriteVarint(buffer, length);
+  if(length > 0)
+    msBufferAppend(buffer, (void*)data, length);
+}
+
+static void mvtWriteString(bufferObj *buffer, int field, const char *str)
+{
+  mvtWriteBytes(buffer, field, str, strlen(str));
+}
+
+/************************************************************************/
+/*                         layer level helpers                          */
+/************************************************************************/
+
+static void mvtFreeLayer(mvtLayerObj *mvtlayer)
+{
+  int i;
+  if(!mvtlayer) return;
+  msFree(mvtlayer->name);
+  msBufferFree(&mvtlayer->features);
+  msFreeCharArray(mvtlayer->keys, mvtlayer->numitemindexes);
+  msFree(mvtlayer->itemindexes);
+  for(i=0; i<mvtlayer->numvalues; i++)
+    msFree(mvtlayer->values[i]);
+  msFree(mvtlayer->values);
+  msFree(mvtlayer->valuehash);
+  msFree(mvtlayer);
+}
+
+/*
+** Work out which of the layer items are written to the tile, based on the
+** mvt_include_items/mvt_exclude_items metadata (falling back to the ows_
+** ones). This has to wait until the first shape is seen as the item list is
+** only populated once the layer is open.
+*/
+static void mvtResolveItems(mvtLayerObj *mvtlayer, layerObj *layer)
+{
+  const char *value;
+  char **incitems = NULL, **excitems = NULL;
+  int numincitems = 0, numexcitems = 0;
+  int i, j;
+
+  mvtlayer->itemsresolved = MS_TRUE;
+  if(layer->numitems <= 0) return;
+
+  if((value = msLookupHashTable(&layer->metadata, "mvt_include_items")) == NULL)
+    value = msLookupHashTable(&layer->metadata, "ows_include_items");
+  if(value)
+    incitems = msStringSplit(value, ',', &numincitems);
+
+  if((value = msLookupHashTable(&layer->metadata, "mvt_exclude_items")) == NULL)
+    value = msLookupHashTable(&layer->metadata, "ows_exclude_items");
+  if(value)
+    excitems = msStringSplit(value, ',', &numexcitems);
+
+  mvtlayer->keys = (char**)msSmallMalloc(layer->numitems * sizeof(char*));
+  mvtlayer->itemindexes = (int*)msSmallMalloc(layer->numitems * sizeof(int));
+  for(i=0; i<layer->numitems; i++) {
+    int visible = MS_FALSE;
+    if(numincitems == 1 && strcasecmp(incitems[0], "all") == 0)
+      visible = MS_TRUE;
+    else {
+      for(j=0; j<numincitems; j++)
+        if(strcasecmp(layer->items[i], incitems[j]) == 0)
+          visible = MS_TRUE;
+    }
+    for(j=0; j<numexcitems; j++)
+      if(strcasecmp(layer->items[i], excitems[j]) == 0)
+        visible = MS_FALSE;
+    if(visible) {
+      mvtlayer->keys[mvtlayer->numitemindexes] = msStrdup(layer->items[i]);
+      mvtlayer->itemindexes[mvtlayer->numitemindexes++] = i;
+    }
+  }
+
+  msFreeCharArray(incitems, numincitems);
+  msFreeCharArray(excitems, numexcitems);
+}
+
+static unsigned int mvtHashString(const char *str)
+{
+  unsigned int hash = 5381;
+  while(*str)
+    hash = hash * 33 + (unsigned char)*str++;
+  return hash;
+}
+
+/*
+** Return the index of value in the layer value table, adding it if needed.
+** Values are compared case sensitively, so the maphash.h tables can't be
+** used here.
+*/
+static int mvtGetValueIndex(mvtLayerObj *mvtlayer, const char *value)
+{
+  unsigned int slot;
+
+  if(mvtlayer->numvalues * 2 >= mvtlayer->hashsize) {
+    int i;
+    mvtlayer->hashsize = mvtlayer->hashsize ? mvtlayer->hashsize * 2 : 256;
+    msFree(mvtlayer->valuehash);
+    mvtlayer->valuehash = (int*)msSmallMalloc(mvtlayer->hashsize * sizeof(int));
+    for(i=0; i<mvtlayer->hashsize; i++)
+      mvtlayer->valuehash[i] = -1;
+    for(i=0; i<mvtlayer->numvalues; i++) {
+      slot = mvtHashString(mvtlayer->values[i]) & (mvtlayer->hashsize - 1);
+      while(mvtlayer->valuehash[slot] != -1)
+        slot = (slot + 1) & (mvtlayer->hashsize - 1);
+      mvtlayer->valuehash[slot] = i;
+    }
+  }
+
+  slot = mvtHashString(value) & (mvtlayer->hashsize - 1);
+  while(mvtlayer->valuehash[slot] != -1) {
+    if(strcmp(mvtlayer->values[mvtlayer->valuehash[slot]], value) == 0)
+      return mvtlayer->valuehash[slot];
+    slot = (slot + 1) & (mvtlayer->hashsize - 1);
+  }
+
+  if(mvtlayer->numvalues == mvtlayer->maxvalues) {
+    mvtlayer->maxvalues = mvtlayer->maxvalues ? mvtlayer->maxvalues * 2 : 64;
+    mvtlayer->values = (char**)msSmallRealloc(mvtlayer->values, mvtlayer->maxvalues * sizeof(char*));
+  }
+  mvtlayer->values[mvtlayer->numvalues] = msStrdup(value);
+  mvtlayer->valuehash[slot] = mvtlayer->numvalues;
+  return mvtlayer->numvalues++;
+}
+
+/************************************************************************/
+/*                          geometry encoding                           */
+/************************************************************************/
+
+static void mvtAddCommand(mvtRendererObj *r, unsigned int value)
+{
+  if(r->numgeometry == r->maxgeometry) {
+    r->maxgeometry = r->maxgeometry ? r->maxgeometry * 2 : 256;
+    r->geometry = (unsigned int*)msSmallRealloc(r->geometry, r->maxgeometry * sizeof(unsigned int));
+  }
+  r->geometry[r->numgeometry++] = value;
+}
+
+static void mvtAddPoint(mvtRendererObj *r, int x, int y)
+{
+  mvtAddCommand(r, MVT_ZIGZAG(x - r->cursorx));
+  mvtAddCommand(r, MVT_ZIGZAG(y - r->cursory));
+  r->cursorx = x;
+  r->cursory = y;
+}
+
+/*
+** Quantize a pixel space line to the tile grid into r->ring, dropping
+** repeated vertices. Pixel coordinates refer to pixel centers, hence the
+** half pixel shift.
+*/
+static int mvtQuantizeLine(mvtRendererObj *r, imageObj *img, lineObj *line)
+{
+  double sx = (double)r->extent / img->width;
+  double sy = (double)r->extent / img->height;
+  int i, n = 0;
+
+  if(line->numpoints > r->maxring) {
+    r->maxring = line->numpoints;
+    r->ring = (mvtPointObj*)msSmallRealloc(r->ring, r->maxring * sizeof(mvtPointObj));
+  }
+  for(i=0; i<line->numpoints; i++) {
+    int x = MS_NINT((line->point[i].x + 0.5) * sx);
+    int y = MS_NINT((line->point[i].y + 0.5) * sy);
+    if(n > 0 && r->ring[n-1].x == x && r->ring[n-1].y == y)
+      continue;
+    r->ring[n].x = x;
+    r->ring[n].y = y;
+    n++;
+  }
+  return n;
+}
+
+static void mvtEncodeLine(mvtRendererObj *r, imageObj *img, lineObj *line)
+{
+  int i, n = mvtQuantizeLine(r, img, line);
+  if(n < 2) return;
+  mvtAddCommand(r, MVT_COMMAND(MVT_CMD_MOVETO, 1));
+  mvtAddPoint(r, r->ring[0].x, r->ring[0].y);
+  mvtAddCommand(r, MVT_COMMAND(MVT_CMD_LINETO, n - 1));
+  for(i=1; i<n; i++)
+    mvtAddPoint(r, r->ring[i].x, r->ring[i].y);
+}
+
+/*
+** Encode a polygon ring. MVT wants exterior rings with a positive area and
+** interior rings with a negative one (in y-down tile coordinates), so the
+** ring is walked backwards if its orientation doesn't match. Returns
+** MS_FALSE if the ring collapsed once quantized.
+*/
+static int mvtEncodeRing(mvtRendererObj *r, imageObj *img, lineObj *line, int exterior)
+{
+  int i, n = mvtQuantizeLine(r, img, line);
+  double area = 0;
+  int reverse;
+
+  if(n > 1 && r->ring[n-1].x == r->ring[0].x && r->ring[n-1].y == r->ring[0].y)
+    n--; /* ClosePath takes care of that one */
+  if(n < 3) return MS_FALSE;
+
+  for(i=0; i<n; i++) {
+    mvtPointObj *a = &r->ring[i], *b = &r->ring[(i+1)%n];
+    area += (double)a->x * b->y - (double)b->x * a->y;
+  }
+  if(area == 0) return MS_FALSE;
+  reverse = exterior ? (area < 0) : (area > 0);
+
+  mvtAddCommand(r, MVT_COMMAND(MVT_CMD_MOVETO, 1));
+  if(reverse) {
+    mvtAddPoint(r, r->ring[n-1].x, r->ring[n-1].y);
+    mvtAddCommand(r, MVT_COMMAND(MVT_CMD_LINETO, n - 1));
+    for(i=n-2; i>=0; i--)
+      mvtAddPoint(r, r->ring[i].x, r->ring[i].y);
+  } else {
+    mvtAddPoint(r, r->ring[0].x, r->ring[0].y);
+    mvtAddCommand(r, MVT_COMMAND(MVT_CMD_LINETO, n - 1));
+    for(i=1; i<n; i++)
+      mvtAddPoint(r, r->ring[i].x, r->ring[i].y);
+  }
+  mvtAddCommand(r, MVT_COMMAND(MVT_CMD_CLOSEPATH, 1));
+  return MS_TRUE;
+}
+
+static void mvtEncodePolygon(mvtRendererObj *r, imageObj *img, shapeObj *shape)
+{
+  int i, j, *outerlist, *innerlist;
+
+  outerlist = msGetOuterList(shape);
+  if(!outerlist) return;
+  for(i=0; i<shape->numlines; i++) {
+    if(outerlist[i] != MS_TRUE) continue;
+    if(!mvtEncodeRing(r, img, &shape->line[i], MS_TRUE)) continue;
+    innerlist = msGetInnerList(shape, i, outerlist);
+    if(!innerlist) continue;
+    for(j=0; j<shape->numlines; j++)
+      if(innerlist[j] == MS_TRUE)
+        mvtEncodeRing(r, img, &shape->line[j], MS_FALSE);
+    free(innerlist);
+  }
+  free(outerlist);
+}
+
+static void mvtEncodePoints(mvtRendererObj *r, imageObj *img, shapeObj *shape)
+{
+  double sx = (double)r->extent / img->width;
+  double sy = (double)r->extent / img->height;
+  int i, j, n = 0;
+
+  for(i=0; i<shape->numlines; i++)
+    n += shape->line[i].numpoints;
+  if(n == 0) return;
+
+  mvtAddCommand(r, MVT_COMMAND(MVT_CMD_MOVETO, n));
+  for(i=0; i<shape->numlines; i++)
+    for(j=0; j<shape->line[i].numpoints; j++)
+      mvtAddPoint(r, MS_NINT((shape->line[i].point[j].x + 0.5) * sx),
+                  MS_NINT((shape->line[i].point[j].y + 0.5) * sy));
+}
+
+/************************************************************************/
+/*                          renderer callbacks                          */
+/************************************************************************/
+
+static imageObj *createImageMVT(int width, int height, outputFormatObj *format, colorObj *bg)
+{
+  imageObj *image;
+  mvtRendererObj *r;
+
+  if(width <= 0 || height <= 0) {
+    msSetError(MS_MISCERR, "Invalid vector tile size %dx%d.", "createImageMVT()", width, height);
+    return NULL;
+  }
+  image = (imageObj*)msSmallCalloc(1, sizeof(imageObj));
+  r = (mvtRendererObj*)msSmallCalloc(1, sizeof(mvtRendererObj));
+  msBufferInit(&r->tile);
+  msBufferInit(&r->feature);
+  msBufferInit(&r->packed);
+  msInitShape(&r->points);
+  r->extent = atoi(msGetOutputFormatOption(format, "EXTENT", "4096"));
+  if(r->extent <= 0)
+    r->extent = MVT_DEFAULT_EXTENT;
+  image->img.plugin = (void*)r;
+  return image;
+}
+
+static int freeImageMVT(imageObj *image)
+{
+  mvtRendererObj *r = MVT_RENDERER(image);
+  if(r) {
+    mvtFreeLayer(r->current);
+    msBufferFree(&r->tile);
+    msBufferFree(&r->feature);
+    msBufferFree(&r->packed);
+    msFreeShape(&r->points);
+    msFree(r->ring);
+    msFree(r->geometry);
+    msFree(r);
+    image->img.plugin = NULL;
+  }
+  return MS_SUCCESS;
+}
+
+static int startLayerMVT(imageObj *img, mapObj *map, layerObj *layer)
+{
+  mvtRendererObj *r = MVT_RENDERER(img);
+
+  mvtFreeLayer(r->current);
+  r->current = (mvtLayerObj*)msSmallCalloc(1, sizeof(mvtLayerObj));
+  msBufferInit(&r->current->features);
+  if(layer->name)
+    r->current->name = msStrdup(layer->name);
+  else {
+    char name[32];
+    snprintf(name, sizeof(name), "layer%d", layer->index);
+    r->current->name = msStrdup(name);
+  }
+  r->map = map;
+  r->layer = layer;
+  return MS_SUCCESS;
+}
+
+static int endLayerMVT(imageObj *img, mapObj *map, layerObj *layer)
+{
+  mvtRendererObj *r = MVT_RENDERER(img);
+  mvtLayerObj *mvtlayer = r->current;
+  bufferObj buffer;
+  int i;
+
+  if(!mvtlayer) return MS_SUCCESS;
+
+  /* empty layers are simply left out of the tile */
+  if(mvtlayer->numfeatures > 0) {
+    msBufferInit(&buffer);
+    mvtWriteTag(&buffer, 15, MVT_WIRE_VARINT);
+    mvtWriteVarint(&buffer, 2);
+    mvtWriteString(&buffer, 1, mvtlayer->name);
+    msBufferAppend(&buffer, mvtlayer->features.data, mvtlayer->features.size);
+    for(i=0; i<mvtlayer->numitemindexes; i++)
+      mvtWriteString(&buffer, 3, mvtlayer->keys[i]);
+    for(i=0; i<mvtlayer->numvalues; i++) {
+      size_t len = strlen(mvtlayer->values[i]);
+      r->packed.size = 0;
+      mvtWriteBytes(&r->packed, 1, mvtlayer->values[i], len);
+      mvtWriteBytes(&buffer, 4, r->packed.data, r->packed.size);
+    }
+    mvtWriteTag(&buffer, 5, MVT_WIRE_VARINT);
+    mvtWriteVarint(&buffer, r->extent);
+
+    mvtWriteBytes(&r->tile, 3, buffer.data, buffer.size);
+    msBufferFree(&buffer);
+  }
+
+  mvtFreeLayer(mvtlayer);
+  r->current = NULL;
+  r->layer = NULL;
+  return MS_SUCCESS;
+}
+
+/*
+** Point layers transform their vertices one at a time in place, leaving the
+** ones outside of the map extent in map coordinates, so by the time
+** endShape() is called there's no telling them apart. Take our own copy of
+** the vertices that will be drawn here instead.
+*/
+static int startShapeMVT(imageObj *img, shapeObj *shape)
+{
+  mvtRendererObj *r = MVT_RENDERER(img);
+  layerObj *layer = r->layer;
+  mapObj *map = r->map;
+  double inv_cs;
+  int i, j;
+
+  msFreeShape(&r->points);
+  if(!layer || layer->type != MS_LAYER_POINT)
+    return MS_SUCCESS;
+
+  msCopyShape(shape, &r->points);
+#ifdef USE_PROJ
+  if(layer->project && layer->transform == MS_TRUE && msProjectionsDiffer(&(layer->projection), &(map->projection)))
+    msProjectShape(&layer->projection, &map->projection, &r->points);
+#endif
+
+  inv_cs = 1.0 / map->cellsize;
+  for(i=0; i<r->points.numlines; i++) {
+    lineObj *line = &r->points.line[i];
+    int n = 0;
+    for(j=0; j<line->numpoints; j++) {
+      pointObj p = line->point[j];
+      if(layer->transform == MS_TRUE) {
+        if(!msPointInRect(&p, &map->extent)) continue;
+        p.x = MS_MAP2IMAGE_X_IC_DBL(p.x, map->extent.minx, inv_cs);
+        p.y = MS_MAP2IMAGE_Y_IC_DBL(p.y, map->extent.maxy, inv_cs);
+      } else
+        msOffsetPointRelativeTo(&p, layer);
+      line->point[n++] = p;
+    }
+    line->numpoints = n;
+  }
+  return MS_SUCCESS;
+}
+
+static int endShapeMVT(imageObj *img, shapeObj *shape)
+{
+  mvtRendererObj *r = MVT_RENDERER(img);
+  mvtLayerObj *mvtlayer = r->current;
+  layerObj *layer = r->layer;
+  int i, geomtype;
+
+  if(!mvtlayer || !layer) return MS_SUCCESS;
+
+  r->numgeometry = 0;
+  r->cursorx = r->cursory = 0;
+  switch(layer->type) {
+    case MS_LAYER_POINT:
+      geomtype = MVT_GEOM_POINT;
+      mvtEncodePoints(r, img, &r->points);
+      msFreeShape(&r->points);
+      break;
+    case MS_LAYER_LINE:
+      geomtype = MVT_GEOM_LINESTRING;
+      for(i=0; i<shape->numlines; i++)
+        mvtEncodeLine(r, img, &shape->line[i]);
+      break;
+    case MS_LAYER_POLYGON:
+      geomtype = MVT_GEOM_POLYGON;
+      if(shape->numlines > 0)
+        mvtEncodePolygon(r, img, shape);
+      break;
+    default:
+      return MS_SUCCESS; /* nothing sensible to write for other layer types */
+  }
+  if(r->numgeometry == 0)
+    return MS_SUCCESS; /* clipped away or collapsed to nothing */
+
+  if(!mvtlayer->itemsresolved)
+    mvtResolveItems(mvtlayer, layer);
+
+  r->feature.size = 0;
+  if(shape->index >= 0) {
+    mvtWriteTag(&r->feature, 1, MVT_WIRE_VARINT);
+    mvtWriteVarint(&r->feature, shape->index);
+  }
+
+  r->packed.size = 0;
+  for(i=0; i<mvtlayer->numitemindexes; i++) {
+    int item = mvtlayer->itemindexes[i];
+    if(item >= shape->numvalues || !shape->values[item]) continue;
+    mvtWriteVarint(&r->packed, i);
+    mvtWriteVarint(&r->packed, mvtGetValueIndex(mvtlayer, shape->values[item]));
+  }
+  if(r->packed.size > 0)
+    mvtWriteBytes(&r->feature, 2, r->packed.data, r->packed.size);
+
+  mvtWriteTag(&r->feature, 3, MVT_WIRE_VARINT);
+  mvtWriteVarint(&r->feature, geomtype);
+
+  r->packed.size = 0;
+  for(i=0; i<r->numgeometry; i++)
+    mvtWriteVarint(&r->packed, r->geometry[i]);
+  mvtWriteBytes(&r->feature, 4, r->packed.data, r->packed.size);
+
+  mvtWriteBytes(&mvtlayer->features, 2, r->feature.data, r->feature.size);
+  mvtlayer->numfeatures++;
+  return MS_SUCCESS;
+}
+
+static int saveImageMVT(imageObj *img, mapObj *map, FILE *fp, outputFormatObj *format)
+{
+  mvtRendererObj *r = MVT_RENDERER(img);
+  msIOContext *context;
+
+  if(r->tile.size == 0)
+    return MS_SUCCESS;
+
+  context = msIO_getHandler(fp);
+  if(context)
+    msIO_contextWrite(context, r->tile.data, r->tile.size);
+  else
+    msIO_fwrite(r->tile.data, 1, r->tile.size, fp);
+  return MS_SUCCESS;
+}
+
+static unsigned char *saveImageBufferMVT(imageObj *img, int *size_ptr, outputFormatObj *format)
+{
+  mvtRendererObj *r = MVT_RENDERER(img);
+  unsigned char *data = (unsigned char*)msSmallMalloc(r->tile.size + 1);
+  if(r->tile.size > 0)
+    memcpy(data, r->tile.data, r->tile.size);
+  *size_ptr = (int)r->tile.size;
+  return data;
+}
+
+/*
+** Anything that would end up as pixels is simply dropped.
+*/
+static int renderLineMVT(imageObj *img, shapeObj *p, strokeStyleObj *style)
+{
+  return MS_SUCCESS;
+}
+
+static int renderPolygonMVT(imageObj *img, shapeObj *p, colorObj *color)
+{
+  return MS_SUCCESS;
+}
+
+static int renderPolygonTiledMVT(imageObj *img, shapeObj *p, imageObj *tile)
+{
+  return MS_SUCCESS;
+}
+
+static int renderGlyphsMVT(imageObj *img, double x, double y, labelStyleObj *style, char *text)
+{
+  return MS_SUCCESS;
+}
+
+static int renderSymbolMVT(imageObj *img, double x, double y, symbolObj *symbol, symbolStyleObj *style)
+{
+  return MS_SUCCESS;
+}
+
+static int renderTileMVT(imageObj *img, imageObj *tile, double x, double y)
+{
+  return MS_SUCCESS;
+}
+
+static int mergeRasterBufferMVT(imageObj *dest, rasterBufferObj *overlay, double opacity, int srcX, int srcY, int dstX, int dstY, int width, int height)
+{
+  return MS_SUCCESS;
+}
+
+static int getTruetypeTextBBoxMVT(rendererVTableObj *renderer, char **fonts, int numfonts, double size, char *string, rectObj *rect, double **advances, int bAdjustBaseline)
+{
+  rect->minx = rect->miny = rect->maxx = rect->maxy = 0.0;
+  if(advances) {
+    int i, numglyphs = msGetNumGlyphs(string);
+    *advances = (double*)msSmallMalloc(numglyphs * sizeof(double));
+    for(i=0; i<numglyphs; i++)
+      (*advances)[i] = size;
+  }
+  return MS_SUCCESS;
+}
+
+/*
+** Labels never make it to the tile, but bitmap labels still have to be
+** measured for the label cache to work: use the usual GD font sizes.
+*/
+static fontMetrics bitmapFontMetricsMVT[5] = {
+  {5, 8}, {6, 12}, {7, 13}, {8, 16}, {9, 15}
+};
+
+static int freeSymbolMVT(symbolObj *symbol)
+{
+  return MS_SUCCESS;
+}
+
+int msPopulateRendererVTableMVT(rendererVTableObj *renderer)
+{
+  int i;
+  renderer->supports_transparent_layers = 1;
+  renderer->supports_pixel_buffer = 0;
+  renderer->supports_bitmap_fonts = 1;
+  renderer->supports_clipping = 0;
+  renderer->supports_svg = 0;
+  renderer->use_imagecache = 0;
+  renderer->default_transform_mode = MS_TRANSFORM_FULLRESOLUTION;
+
+  renderer->startLayer = &startLayerMVT;
+  renderer->endLayer = &endLayerMVT;
+  renderer->startShape = &startShapeMVT;
+  renderer->endShape = &endShapeMVT;
+  renderer->createImage = &createImageMVT;
+  renderer->saveImage = &saveImageMVT;
+  renderer->saveImageBuffer = &saveImageBufferMVT;
+  renderer->freeImage = &freeImageMVT;
+
+  renderer->renderLine = &renderLineMVT;
+  renderer->renderLineTiled = NULL;
+  renderer->renderPolygon = &renderPolygonMVT;
+  renderer->renderPolygonTiled = &renderPolygonTiledMVT;
+  renderer->renderGlyphs = &renderGlyphsMVT;
+  renderer->renderGlyphsLine = NULL;
+  renderer->renderBitmapGlyphs = &renderGlyphsMVT;
+  renderer->renderEllipseSymbol = &renderSymbolMVT;
+  renderer->renderVectorSymbol = &renderSymbolMVT;
+  renderer->renderTruetypeSymbol = &renderSymbolMVT;
+  renderer->renderPixmapSymbol = &renderSymbolMVT;
+  renderer->renderTile = &renderTileMVT;
+  renderer->mergeRasterBuffer = &mergeRasterBufferMVT;
+  renderer->loadImageFromFile = msLoadMSRasterBufferFromFile;
+  renderer->getTruetypeTextBBox = &getTruetypeTextBBoxMVT;
+  renderer->freeSymbol = &freeSymbolMVT;
+  for(i=0; i<5; i++)
+    renderer->bitmapFontMetrics[i] = &bitmapFontMetricsMVT[i];
+  return MS_SUCCESS;
+}
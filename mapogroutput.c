@@ -41,6 +41,7 @@
 #  include "cpl_string.h"
 #endif
 
+#define MS_OGR_SEND_BUFFER_SIZE 65536
 
 
 #ifdef USE_OGR
@@ -152,6 +153,9 @@ char **msOGRRecursiveFileList( const char *path )
 
 /************************************************************************/
 /*                           msOGRCleanupDS()                           */
+/*                                                                      */
+/*      Remove the temporary datasource, or for streamed output         */
+/*      restore the default /vsistdout/ writer.                         */
 /************************************************************************/
 static void msOGRCleanupDS( const char *datasource_name )
 
@@ -160,6 +164,13 @@ static void msOGRCleanupDS( const char *datasource_name )
   char path[MS_MAXPATHLEN];
   int i;
 
+  if( EQUAL(datasource_name,"/vsistdout/") ) {
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1100000
+    VSIStdoutSetRedirection( fwrite, stdout );
+#endif
+    return;
+  }
+
   strlcpy( path, CPLGetPath( datasource_name ), sizeof(path) );
   file_list = CPLReadDir( path );
 
@@ -464,6 +475,108 @@ static int msOGRWriteShape( layerObj *map_layer, OGRLayerH hOGRLayer,
     return MS_FAILURE;
 }
 
+/************************************************************************/
+/*                    msOGRSupportsStreamingOutput()                    */
+/*                                                                      */
+/*      Returns MS_TRUE if the output format's driver writes a          */
+/*      single file sequentially, so the datasource can be created      */
+/*      directly on /vsistdout/ instead of in a temporary directory.    */
+/************************************************************************/
+
+static int msOGRSupportsStreamingOutput( outputFormatObj *format )
+
+{
+  const char *pszDriver = format->driver+4;
+
+  if( EQUAL(pszDriver,"GeoJSON") || EQUAL(pszDriver,"KML")
+      || EQUAL(pszDriver,"GPX") || EQUAL(pszDriver,"GeoRSS") )
+    return MS_TRUE;
+
+  /* CSV only needs seeking for the optional .csvt sidecar */
+  if( EQUAL(pszDriver,"CSV") )
+    return !CSLTestBoolean(
+             msGetOutputFormatOption( format, "LCO:CREATE_CSVT", "NO" ) );
+
+  /* GML writes a separate .xsd schema unless told otherwise */
+  if( EQUAL(pszDriver,"GML") )
+    return EQUAL(msGetOutputFormatOption( format, "DSCO:XSISCHEMA",
+                                          "EXTERNAL" ), "OFF");
+
+  return MS_FALSE;
+}
+
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1100000
+/************************************************************************/
+/*                          msOGRStdoutWrite()                          */
+/*                                                                      */
+/*      /vsistdout/ redirection so streamed output goes through the     */
+/*      msIO layer (FastCGI, mapscript buffers) like everything else.   */
+/************************************************************************/
+
+static size_t msOGRStdoutWrite( const void *ptr, size_t size, size_t nmemb,
+                                FILE *stream )
+
+{
+  return msIO_fwrite( ptr, size, nmemb, stream );
+}
+#endif
+
+/************************************************************************/
+/*                           msOGRSendFile()                            */
+/*                                                                      */
+/*      Copy one result file to the client, or into the open zip       */
+/*      file if hZip is not NULL.  Files under /vsimem/ are sent        */
+/*      straight from their memory buffer rather than read back.        */
+/************************************************************************/
+
+static int msOGRSendFile( const char *filename, void *hZip )
+
+{
+  FILE *fp;
+  int bytes_read;
+  char *buffer;
+
+  if( EQUALN(filename,"/vsimem/",8) ) {
+    vsi_l_offset length = 0;
+    GByte *data = VSIGetMemFileBuffer( filename, &length, FALSE );
+
+    if( data != NULL ) {
+#if defined(CPL_ZIP_API_OFFERED)
+      if( hZip != NULL ) {
+        CPLWriteFileInZip( hZip, data, (int) length );
+        return MS_SUCCESS;
+      }
+#endif
+      msIO_fwrite( data, 1, (size_t) length, stdout );
+      return MS_SUCCESS;
+    }
+  }
+
+  fp = VSIFOpenL( filename, "r" );
+  if( fp == NULL ) {
+    msSetError( MS_MISCERR,
+                "Failed to open result file '%s'.",
+                "msOGRSendFile()",
+                filename );
+    return MS_FAILURE;
+  }
+
+  buffer = (char *) msSmallMalloc( MS_OGR_SEND_BUFFER_SIZE );
+  while( (bytes_read = VSIFReadL( buffer, 1, MS_OGR_SEND_BUFFER_SIZE, fp )) > 0 ) {
+#if defined(CPL_ZIP_API_OFFERED)
+    if( hZip != NULL ) {
+      CPLWriteFileInZip( hZip, buffer, bytes_read );
+      continue;
+    }
+#endif
+    msIO_fwrite( buffer, 1, bytes_read, stdout );
+  }
+  msFree( buffer );
+  VSIFCloseL( fp );
+
+  return MS_SUCCESS;
+}
+
 #endif /* def USE_OGR */
 
 /************************************************************************/
@@ -519,9 +632,25 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
   }
 
   /* ==================================================================== */
-  /*      Determine the output datasource name to use.                    */
+  /*      Determine the output datasource name to use.  Without an        */
+  /*      explicit STORAGE, single file results from drivers that         */
+  /*      write sequentially are streamed and never touch the disk.       */
   /* ==================================================================== */
-  storage = msGetOutputFormatOption( format, "STORAGE", "filesystem" );
+#if !defined(CPL_ZIP_API_OFFERED)
+  form = msGetOutputFormatOption( format, "FORM", "multipart" );
+#else
+  form = msGetOutputFormatOption( format, "FORM", "zip" );
+#endif
+
+  storage = msGetOutputFormatOption( format, "STORAGE", NULL );
+  if( storage == NULL ) {
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1100000
+    if( EQUAL(form,"simple") && msOGRSupportsStreamingOutput( format ) )
+      storage = "stream";
+    else
+#endif
+      storage = "filesystem";
+  }
 
   /* -------------------------------------------------------------------- */
   /*      Where are we putting stuff?                                     */
@@ -591,10 +720,17 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
   /* -------------------------------------------------------------------- */
   if( EQUAL(storage,"stream") ) {
     if( sendheaders && format->mimetype ) {
+      if( EQUAL(form,"simple") )
+        msIO_setHeader("Content-Disposition","attachment; filename=%s",
+                       fo_filename );
       msIO_setHeader("Content-Type",format->mimetype);
       msIO_sendHeaders();
     } else
       msIO_fprintf( stdout, "%c", 10 );
+
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 1100000
+    VSIStdoutSetRedirection( msOGRStdoutWrite, stdout );
+#endif
   }
 
   /* ==================================================================== */
@@ -876,13 +1012,9 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
   /* -------------------------------------------------------------------- */
   /*      Get list of resulting files.                                    */
   /* -------------------------------------------------------------------- */
-#if !defined(CPL_ZIP_API_OFFERED)
-  form = msGetOutputFormatOption( format, "FORM", "multipart" );
-#else
-  form = msGetOutputFormatOption( format, "FORM", "zip" );
-#endif
-
-  if( EQUAL(form,"simple") ) {
+  if( EQUAL(storage,"stream") ) {
+    /* nothing on disk */
+  } else if( EQUAL(form,"simple") ) {
     file_list = CSLAddString( NULL, datasource_name );
   } else {
     char datasource_path[MS_MAXPATHLEN];
@@ -903,10 +1035,6 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
   /*      Handle case of simple file written to stdout.                   */
   /* -------------------------------------------------------------------- */
   else if( EQUAL(form,"simple") ) {
-    char buffer[1024];
-    int  bytes_read;
-    FILE *fp;
-
     if( sendheaders ) {
       msIO_setHeader("Content-Disposition","attachment; filename=%s",
                      CPLGetFilename( file_list[0] ) );
@@ -916,19 +1044,10 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
     } else
       msIO_fprintf( stdout, "%c", 10 );
 
-    fp = VSIFOpenL( file_list[0], "r" );
-    if( fp == NULL ) {
-      msSetError( MS_MISCERR,
-                  "Failed to open result file '%s'.",
-                  "msOGRWriteFromQuery()",
-                  file_list[0] );
+    if( msOGRSendFile( file_list[0], NULL ) != MS_SUCCESS ) {
       msOGRCleanupDS( datasource_name );
       return MS_FAILURE;
     }
-
-    while( (bytes_read = VSIFReadL( buffer, 1, sizeof(buffer), fp )) > 0 )
-      msIO_fwrite( buffer, 1, bytes_read, stdout );
-    VSIFCloseL( fp );
   }
 
   /* -------------------------------------------------------------------- */
@@ -941,10 +1060,6 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
     msIO_fprintf(stdout,"--%s\r\n",boundary );
 
     for( i = 0; file_list != NULL && file_list[i] != NULL; i++ ) {
-      FILE *fp;
-      int bytes_read;
-      char buffer[1024];
-
       if( sendheaders )
         msIO_fprintf( stdout,
                       "Content-Disposition: attachment; filename=%s\r\n"
@@ -952,21 +1067,11 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
                       "Content-Transfer-Encoding: binary\r\n\r\n",
                       CPLGetFilename( file_list[i] ));
 
-
-      fp = VSIFOpenL( file_list[i], "r" );
-      if( fp == NULL ) {
-        msSetError( MS_MISCERR,
-                    "Failed to open result file '%s'.",
-                    "msOGRWriteFromQuery()",
-                    file_list[0] );
+      if( msOGRSendFile( file_list[i], NULL ) != MS_SUCCESS ) {
         msOGRCleanupDS( datasource_name );
         return MS_FAILURE;
       }
 
-      while( (bytes_read = VSIFReadL( buffer, 1, sizeof(buffer), fp )) > 0 )
-        msIO_fwrite( buffer, 1, bytes_read, stdout );
-      VSIFCloseL( fp );
-
       if (file_list[i+1] == NULL)
         msIO_fprintf( stdout, "\r\n--%s--\r\n", boundary );
       else
@@ -975,7 +1080,9 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
   }
 
   /* -------------------------------------------------------------------- */
-  /*      Handle the case of a zip file result.                           */
+  /*      Handle the case of a zip file result.  The archive is built     */
+  /*      in memory, since the zip writer seeks back to patch each        */
+  /*      local header, and sent from its buffer without a read back.     */
   /* -------------------------------------------------------------------- */
   else if( EQUAL(form,"zip") ) {
 #if !defined(CPL_ZIP_API_OFFERED)
@@ -984,59 +1091,40 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
     msOGRCleanupDS( datasource_name );
     return MS_FAILURE;
 #else
-    FILE *fp;
     char *zip_filename = msTmpFile(map, NULL, "/vsimem/ogrzip/", "zip" );
     void *hZip;
-    int bytes_read;
-    char buffer[1024];
+    int status = MS_SUCCESS;
 
     hZip = CPLCreateZip( zip_filename, NULL );
 
     for( i = 0; file_list != NULL && file_list[i] != NULL; i++ ) {
 
       CPLCreateFileInZip( hZip, CPLGetFilename(file_list[i]), NULL );
+      status = msOGRSendFile( file_list[i], hZip );
+      CPLCloseFileInZip( hZip );
 
-      fp = VSIFOpenL( file_list[i], "r" );
-      if( fp == NULL ) {
-        CPLCloseZip( hZip );
-        msSetError( MS_MISCERR,
-                    "Failed to open result file '%s'.",
-                    "msOGRWriteFromQuery()",
-                    file_list[0] );
-        msOGRCleanupDS( datasource_name );
-        return MS_FAILURE;
-      }
+      if( status != MS_SUCCESS )
+        break;
+    }
+    CPLCloseZip( hZip );
 
-      while( (bytes_read = VSIFReadL( buffer, 1, sizeof(buffer), fp )) > 0 ) {
-        CPLWriteFileInZip( hZip, buffer, bytes_read );
+    if( status == MS_SUCCESS ) {
+      if( sendheaders ) {
+        msIO_setHeader("Content-Disposition","attachment; filename=%s",fo_filename);
+        msIO_setHeader("Content-Type","application/zip");
+        msIO_sendHeaders();
       }
-      VSIFCloseL( fp );
 
-      CPLCloseFileInZip( hZip );
+      status = msOGRSendFile( zip_filename, NULL );
     }
-    CPLCloseZip( hZip );
 
-    if( sendheaders ) {
-      msIO_setHeader("Content-Disposition","attachment; filename=%s",fo_filename);
-      msIO_setHeader("Content-Type","application/zip");
-      msIO_sendHeaders();
-    }
+    VSIUnlink( zip_filename );
+    msFree( zip_filename );
 
-    fp = VSIFOpenL( zip_filename, "r" );
-    if( fp == NULL ) {
-      msSetError( MS_MISCERR,
-                  "Failed to open zip file '%s'.",
-                  "msOGRWriteFromQuery()",
-                  file_list[0] );
+    if( status != MS_SUCCESS ) {
       msOGRCleanupDS( datasource_name );
       return MS_FAILURE;
     }
-
-    while( (bytes_read = VSIFReadL( buffer, 1, sizeof(buffer), fp )) > 0 )
-      msIO_fwrite( buffer, 1, bytes_read, stdout );
-    VSIFCloseL( fp );
-
-    msFree( zip_filename );
 #endif /* defined(CPL_ZIP_API_OFFERED) */
   }
 
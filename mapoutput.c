@@ -116,6 +116,8 @@ struct defaultOutputFormatEntry defaultoutputformats[] = {
   {"kml","KML","application/vnd.google-earth.kml+xml"},
   {"kmz","KMZ","application/vnd.google-earth.kmz"},
 #endif
+  {"mvt","MVT","application/vnd.mapbox-vector-tile"},
+  {"geojson","GEOJSON","application/json; subtype=geojson"},
   {NULL,NULL,NULL}
 };
 
@@ -305,6 +307,24 @@ outputFormatObj *msCreateDefaultOutputFormat( mapObj *map,
   }
 #endif
 
+  if( strcasecmp(driver,"MVT") == 0 ) {
+    if(!name) name="mvt";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("application/vnd.mapbox-vector-tile");
+    format->imagemode = MS_IMAGEMODE_RGB;
+    format->extension = msStrdup("mvt");
+    format->renderer = MS_RENDER_WITH_MVT;
+  }
+
+  if( strcasecmp(driver,"GEOJSON") == 0 ) {
+    if(!name) name="geojson";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("application/json; subtype=geojson");
+    format->imagemode = MS_IMAGEMODE_FEATURE;
+    format->extension = msStrdup("json");
+    format->renderer = MS_RENDER_WITH_GEOJSON;
+  }
+
 
 
 #ifdef USE_GDAL
@@ -929,7 +949,8 @@ void msGetOutputFormatMimeListWMS( mapObj *map, char **mime_list, int max_mime )
             strcasecmp(map->outputformatlist[i]->driver, "CAIRO/SVG")==0 ||
             strcasecmp(map->outputformatlist[i]->driver, "CAIRO/PDF")==0 ||
             strcasecmp(map->outputformatlist[i]->driver, "kml")==0 ||
-            strcasecmp(map->outputformatlist[i]->driver, "kmz")==0))
+            strcasecmp(map->outputformatlist[i]->driver, "kmz")==0 ||
+            strcasecmp(map->outputformatlist[i]->driver, "mvt")==0))
         mime_list[mime_count++] = map->outputformatlist[i]->mimetype;
     }
   }
@@ -1069,6 +1090,8 @@ int msInitializeRendererVTable(outputFormatObj *format)
       return msPopulateRendererVTableKML(format->vtable);
     case MS_RENDER_WITH_OGR:
       return msPopulateRendererVTableOGR(format->vtable);
+    case MS_RENDER_WITH_MVT:
+      return msPopulateRendererVTableMVT(format->vtable);
     default:
       msSetError(MS_MISCERR, "unsupported RendererVtable renderer %d",
                  "msInitializeRendererVTable()",format->renderer);
@@ -762,6 +762,105 @@ int msOWSParseRequestMetadata(const char *metadata, const char *request, int *di
   return allFlag;
 }
 
+/*
+** Resolved OWS metadata.
+**
+** The first namespaced lookup in a metadata table indexes all of its
+** ows_, wms_, wfs_, wcs_, gml_ and sos_ keys by their name without the
+** prefix, so later lookups are a single hash probe instead of building and
+** hashing one prefixed key per namespace. The index points into the table
+** items and is attached to the table, maphash.c drops it whenever the table
+** is modified.
+*/
+#define MS_OWS_NUM_NAMESPACES 6
+
+static const char owsNamespaceCodes[] = "OMFCGS"; /* same order as owsNamespacePrefixes */
+static const char *owsNamespacePrefixes[] = { "ows_", "wms_", "wfs_", "wcs_", "gml_", "sos_" };
+
+typedef struct owsMetadataEntryObj {
+  struct owsMetadataEntryObj *next;
+  const char *name; /* key without its namespace prefix */
+  unsigned hashval;
+  const char *values[MS_OWS_NUM_NAMESPACES];
+} owsMetadataEntryObj;
+
+typedef struct {
+  owsMetadataEntryObj **buckets;
+  owsMetadataEntryObj *entries;
+  int size;
+} owsMetadataIndexObj;
+
+static int msOWSGetNamespaceIndex(const char *key)
+{
+  int i;
+
+  if(strlen(key) <= 4) return -1;
+  for(i=0; i<MS_OWS_NUM_NAMESPACES; i++)
+    if(strncasecmp(key, owsNamespacePrefixes[i], 4) == 0) return i;
+
+  return -1;
+}
+
+static void msOWSFreeMetadataIndex(void *data)
+{
+  owsMetadataIndexObj *index = (owsMetadataIndexObj *) data;
+
+  free(index->buckets);
+  free(index->entries);
+  free(index);
+}
+
+static owsMetadataIndexObj *msOWSGetMetadataIndex(hashTableObj *metadata)
+{
+  owsMetadataIndexObj *index;
+  owsMetadataEntryObj *entry;
+  struct hashObj *tp;
+  int i, ns, numentries = 0;
+
+  if(metadata->resolved && metadata->freeresolved == msOWSFreeMetadataIndex)
+    return (owsMetadataIndexObj *) metadata->resolved;
+
+  msInvalidateHashTable(metadata); /* some other derived data, replace it */
+
+  for(i=0; i<metadata->size; i++)
+    for(tp=metadata->items[i]; tp!=NULL; tp=tp->next)
+      if(msOWSGetNamespaceIndex(tp->key) >= 0) numentries++;
+
+  index = (owsMetadataIndexObj *) msSmallMalloc(sizeof(owsMetadataIndexObj));
+  index->size = numentries + 1;
+  index->buckets = (owsMetadataEntryObj **) msSmallCalloc(index->size, sizeof(owsMetadataEntryObj *));
+  index->entries = (owsMetadataEntryObj *) msSmallCalloc(numentries + 1, sizeof(owsMetadataEntryObj));
+
+  numentries = 0;
+  for(i=0; i<metadata->size; i++) {
+    for(tp=metadata->items[i]; tp!=NULL; tp=tp->next) {
+      const char *name;
+      unsigned hashval;
+
+      if((ns = msOWSGetNamespaceIndex(tp->key)) < 0) continue;
+
+      name = tp->key + 4;
+      hashval = msHashKey(name);
+      for(entry=index->buckets[hashval % index->size]; entry!=NULL; entry=entry->next)
+        if(entry->hashval == hashval && strcasecmp(entry->name, name) == 0) break;
+
+      if(entry == NULL) {
+        entry = &(index->entries[numentries++]);
+        entry->name = name;
+        entry->hashval = hashval;
+        entry->next = index->buckets[hashval % index->size];
+        index->buckets[hashval % index->size] = entry;
+      }
+      entry->values[ns] = tp->data;
+    }
+  }
+
+  metadata->resolved = index;
+  metadata->freeresolved = msOWSFreeMetadataIndex;
+
+  return index;
+}
+
 /*
 ** msOWSLookupMetadata()
 **
@@ -775,63 +874,37 @@ int msOWSParseRequestMetadata(const char *metadata, const char *request, int *di
 const char *msOWSLookupMetadata(hashTableObj *metadata,
                                 const char *namespaces, const char *name)
 {
-  const char *value = NULL;
-
-  if (namespaces == NULL) {
-    value = msLookupHashTable(metadata, (char*)name);
-  } else {
-    char buf[100] = "ows_";
-
-    strlcpy(buf+4, name, 96);
-
-    while (value == NULL && *namespaces != '\0') {
-      switch (*namespaces) {
-        case 'O':         /* ows_... */
-          buf[0] = 'o';
-          buf[1] = 'w';
-          buf[2] = 's';
-          break;
-        case 'M':         /* wms_... */
-          buf[0] = 'w';
-          buf[1] = 'm';
-          buf[2] = 's';
-          break;
-        case 'F':         /* wfs_... */
-          buf[0] = 'w';
-          buf[1] = 'f';
-          buf[2] = 's';
-          break;
-        case 'C':         /* wcs_... */
-          buf[0] = 'w';
-          buf[1] = 'c';
-          buf[2] = 's';
-          break;
-        case 'G':         /* gml_... */
-          buf[0] = 'g';
-          buf[1] = 'm';
-          buf[2] = 'l';
-          break;
-        case 'S':         /* sos_... */
-          buf[0] = 's';
-          buf[1] = 'o';
-          buf[2] = 's';
-          break;
-        default:
-          /* We should never get here unless an invalid code (typo) is */
-          /* present in the code, but since this happened before... */
-          msSetError(MS_WMSERR,
-                     "Unsupported metadata namespace code (%c).",
-                     "msOWSLookupMetadata()", *namespaces );
-          assert(MS_FALSE);
-          return NULL;
-      }
-
-      value = msLookupHashTable(metadata, buf);
-      namespaces++;
+  owsMetadataIndexObj *index;
+  owsMetadataEntryObj *entry = NULL;
+  const char *code;
+  unsigned hashval;
+
+  if (namespaces == NULL)
+    return msLookupHashTable(metadata, (char*)name);
+
+  if (metadata && metadata->items && name) {
+    index = msOWSGetMetadataIndex(metadata);
+    hashval = msHashKey(name);
+    for (entry=index->buckets[hashval % index->size]; entry!=NULL; entry=entry->next)
+      if (entry->hashval == hashval && strcasecmp(entry->name, name) == 0) break;
+  }
+
+  for ( ; *namespaces != '\0'; namespaces++) {
+    if ((code = strchr(owsNamespaceCodes, *namespaces)) == NULL) {
+      /* We should never get here unless an invalid code (typo) is */
+      /* present in the code, but since this happened before... */
+      msSetError(MS_WMSERR,
+                 "Unsupported metadata namespace code (%c).",
+                 "msOWSLookupMetadata()", *namespaces );
+      assert(MS_FALSE);
+      return NULL;
     }
+
+    if (entry && entry->values[code - owsNamespaceCodes])
+      return entry->values[code - owsNamespaceCodes];
   }
 
-  return value;
+  return NULL;
 }
 
 
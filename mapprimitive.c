@@ -88,6 +88,123 @@ char *msShapeToWKT(shapeObj *shape)
 #endif
 }
 
+/*
+** Shape arena: a bump allocator for the storage of shapes that only live
+** for one iteration of a feature loop (see msDrawVectorLayer()). Memory is
+** handed out from a few large blocks and reclaimed all at once by
+** msResetShapeArena(). Shapes pointing into an arena carry it in
+** shape->arena so that msFreeShape() and friends leave that memory alone;
+** anything reallocated from the heap in between is still freed normally.
+*/
+#define MS_SHAPE_ARENA_BLOCKSIZE 65536
+#define MS_SHAPE_ARENA_ALIGN(n) (((n) + 7) & ~((size_t)7))
+
+typedef struct {
+  char *data;
+  size_t size;
+  size_t used;
+} shapeArenaBlockObj;
+
+struct shapeArenaObj {
+  shapeArenaBlockObj *blocks;
+  int numblocks;
+  int current; /* block currently being filled */
+};
+
+shapeArenaObj *msCreateShapeArena(void)
+{
+  shapeArenaObj *arena = (shapeArenaObj *) msSmallCalloc(1, sizeof(shapeArenaObj));
+  return arena;
+}
+
+void msFreeShapeArena(shapeArenaObj *arena)
+{
+  int i;
+
+  if(!arena) return;
+  for(i=0; i<arena->numblocks; i++)
+    free(arena->blocks[i].data);
+  free(arena->blocks);
+  free(arena);
+}
+
+void msResetShapeArena(shapeArenaObj *arena)
+{
+  int i;
+
+  if(!arena) return;
+  for(i=0; i<arena->numblocks && i<=arena->current; i++)
+    arena->blocks[i].used = 0;
+  arena->current = 0;
+}
+
+/*
+** Returns size bytes of storage from the arena, or from the heap if arena
+** is NULL so callers can share one code path.
+*/
+void *msShapeArenaAlloc(shapeArenaObj *arena, size_t size)
+{
+  shapeArenaBlockObj *block;
+
+  if(!arena) return malloc(size);
+
+  size = MS_SHAPE_ARENA_ALIGN(MS_MAX(size, 1));
+  for(; arena->current < arena->numblocks; arena->current++) {
+    block = &(arena->blocks[arena->current]);
+    if(block->size - block->used >= size) {
+      block->used += size;
+      return block->data + block->used - size;
+    }
+  }
+
+  /* out of room, add a block (oversized requests get one to themselves) */
+  arena->blocks = (shapeArenaBlockObj *) realloc(arena->blocks, sizeof(shapeArenaBlockObj)*(arena->numblocks+1));
+  MS_CHECK_ALLOC(arena->blocks, sizeof(shapeArenaBlockObj)*(arena->numblocks+1), NULL);
+  block = &(arena->blocks[arena->numblocks]);
+  block->size = MS_MAX(size, MS_SHAPE_ARENA_BLOCKSIZE);
+  block->data = (char *) malloc(block->size);
+  MS_CHECK_ALLOC(block->data, block->size, NULL);
+  block->used = size;
+  arena->current = arena->numblocks++;
+
+  return block->data;
+}
+
+char *msShapeArenaStrdup(shapeArenaObj *arena, const char *string)
+{
+  size_t len;
+  char *copy;
+
+  if(!arena) return msStrdup(string);
+
+  len = strlen(string) + 1;
+  copy = (char *) msShapeArenaAlloc(arena, len);
+  if(copy) memcpy(copy, string, len);
+  return copy;
+}
+
+int msShapeArenaOwns(shapeArenaObj *arena, const void *ptr)
+{
+  int i;
+
+  if(!arena || !ptr) return MS_FALSE;
+  for(i=0; i<arena->numblocks; i++) {
+    if((const char *)ptr >= arena->blocks[i].data && (const char *)ptr < arena->blocks[i].data + arena->blocks[i].size)
+      return MS_TRUE;
+  }
+  return MS_FALSE;
+}
+
+/*
+** free() for storage that may belong to an arena, arena storage is left
+** for msResetShapeArena() to reclaim.
+*/
+void msShapeArenaFree(shapeArenaObj *arena, void *ptr)
+{
+  if(!msShapeArenaOwns(arena, ptr))
+    free(ptr);
+}
+
 void msInitShape(shapeObj *shape)
 {
   /* spatial component */
@@ -103,6 +220,7 @@ void msInitShape(shapeObj *shape)
 
   shape->geometry = NULL;
   shape->renderer_cache = NULL;
+  shape->arena = NULL;
 
   /* annotation component */
   shape->text = NULL;
@@ -157,11 +275,15 @@ void msFreeShape(shapeObj *shape)
   if(!shape) return; /* for safety */
 
   for (c= 0; c < shape->numlines; c++)
-    free(shape->line[c].point);
+    msShapeArenaFree(shape->arena, shape->line[c].point);
 
-  if (shape->line) free(shape->line);
-  if(shape->values) msFreeCharArray(shape->values, shape->numvalues);
-  if(shape->text) free(shape->text);
+  if (shape->line) msShapeArenaFree(shape->arena, shape->line);
+  if(shape->values) {
+    for (c= 0; c < shape->numvalues; c++)
+      msShapeArenaFree(shape->arena, shape->values[c]);
+    msShapeArenaFree(shape->arena, shape->values);
+  }
+  if(shape->text) msShapeArenaFree(shape->arena, shape->text);
 
 #ifdef USE_GEOS
   msGEOSFreeGeometry(shape);
@@ -185,7 +307,7 @@ void msShapeDeleteLine( shapeObj *shape, int line )
     return;
   }
 
-  free( shape->line[line].point );
+  msShapeArenaFree( shape->arena, shape->line[line].point );
   if( line < shape->numlines - 1 ) {
     memmove( shape->line + line,
              shape->line + line + 1,
@@ -332,6 +454,12 @@ int msAddLineDirectly(shapeObj *p, lineObj *new_line)
   if( p->numlines == 0 ) {
     p->line = (lineObj *) malloc(sizeof(lineObj));
     MS_CHECK_ALLOC(p->line, sizeof(lineObj), MS_FAILURE);
+  } else if( msShapeArenaOwns(p->arena, p->line) ) {
+    /* can't realloc arena storage, move the line array to the heap */
+    lineObj *line = (lineObj *) malloc((p->numlines+1)*sizeof(lineObj));
+    MS_CHECK_ALLOC(line, (p->numlines+1)*sizeof(lineObj), MS_FAILURE);
+    memcpy(line, p->line, p->numlines*sizeof(lineObj));
+    p->line = line;
   } else {
     p->line = (lineObj *) realloc(p->line, (p->numlines+1)*sizeof(lineObj));
     MS_CHECK_ALLOC(p->line, (p->numlines+1)*sizeof(lineObj), MS_FAILURE);
@@ -534,8 +662,8 @@ void msClipPolylineRect(shapeObj *shape, rectObj rect)
     }
   }
 
-  for (i=0; i<shape->numlines; i++) free(shape->line[i].point);
-  free(shape->line);
+  for (i=0; i<shape->numlines; i++) msShapeArenaFree(shape->arena, shape->line[i].point);
+  msShapeArenaFree(shape->arena, shape->line);
 
   shape->line = tmp.line;
   shape->numlines = tmp.numlines;
@@ -687,8 +815,8 @@ void msClipPolygonRect(shapeObj *shape, rectObj rect)
     }
   } /* next line */
 
-  for (i=0; i<shape->numlines; i++) free(shape->line[i].point);
-  free(shape->line);
+  for (i=0; i<shape->numlines; i++) msShapeArenaFree(shape->arena, shape->line[i].point);
+  msShapeArenaFree(shape->arena, shape->line);
 
   shape->line = tmp.line;
   shape->numlines = tmp.numlines;
@@ -928,7 +1056,7 @@ void msTransformShapeSimplify(shapeObj *shape, rectObj extent, double cellsize)
   }
   if(!ok) {
     for(i=0; i<shape->numlines; i++) {
-      free(shape->line[i].point);
+      msShapeArenaFree(shape->arena, shape->line[i].point);
     }
     shape->numlines = 0 ;
   }
@@ -1519,6 +1647,160 @@ int msPolygonLabelPoint(shapeObj *p, pointObj *lp, double min_dimension)
     return(MS_FAILURE);
 }
 
+/*
+** Pole of inaccessibility label point: the interior point of a polygon that is
+** the farthest away from its outline, found to within precision (same units as
+** the shape) by recursively subdividing a grid of square cells and only keeping
+** the cells that could still contain a better point. Unlike msPolygonLabelPoint()
+** this always ends up well inside concave or ring shaped polygons.
+*/
+typedef struct {
+  double x, y; /* cell center */
+  double h; /* half the cell size */
+  double d; /* signed distance from the center to the polygon outline */
+  double max; /* upper bound of the distance within the cell */
+} polyLabelCellObj;
+
+/* positive inside the polygon, negative outside */
+static double polyLabelSignedDistance(shapeObj *p, double x, double y)
+{
+  int i, j, inside = MS_FALSE;
+  double dist, min_dist = -1;
+  pointObj pt, *a, *b;
+
+  pt.x = x;
+  pt.y = y;
+
+  for(j=0; j<p->numlines; j++) {
+    if(p->line[j].numpoints < 1) continue;
+    a = &(p->line[j].point[p->line[j].numpoints-1]);
+    for(i=0; i<p->line[j].numpoints; i++) {
+      b = &(p->line[j].point[i]);
+      if(((a->y > y) != (b->y > y)) && (x < (b->x - a->x) * (y - a->y) / (b->y - a->y) + a->x))
+        inside = !inside;
+      dist = msSquareDistancePointToSegment(&pt, a, b);
+      if((dist < min_dist) || (min_dist < 0)) min_dist = dist;
+      a = b;
+    }
+  }
+
+  if(min_dist < 0) return 0;
+  return (inside ? 1 : -1) * sqrt(min_dist);
+}
+
+static void polyLabelInitCell(polyLabelCellObj *cell, shapeObj *p, double x, double y, double h)
+{
+  cell->x = x;
+  cell->y = y;
+  cell->h = h;
+  cell->d = polyLabelSignedDistance(p, x, y);
+  cell->max = cell->d + h * sqrt(2.0);
+}
+
+/* binary max-heap on polyLabelCellObj.max */
+static void polyLabelPush(polyLabelCellObj **heap, int *n, int *size, polyLabelCellObj *cell)
+{
+  int i, parent;
+  polyLabelCellObj tmp;
+
+  if(*n == *size) {
+    *size = MS_MAX(64, *size * 2);
+    *heap = (polyLabelCellObj *) msSmallRealloc(*heap, sizeof(polyLabelCellObj) * (*size));
+  }
+  i = (*n)++;
+  (*heap)[i] = *cell;
+  while(i > 0) {
+    parent = (i - 1) / 2;
+    if((*heap)[parent].max >= (*heap)[i].max) break;
+    SWAP((*heap)[parent], (*heap)[i], tmp);
+    i = parent;
+  }
+}
+
+static void polyLabelPop(polyLabelCellObj *heap, int *n, polyLabelCellObj *cell)
+{
+  int i = 0, child;
+  polyLabelCellObj tmp;
+
+  *cell = heap[0];
+  heap[0] = heap[--(*n)];
+  while((child = 2*i + 1) < *n) {
+    if(child + 1 < *n && heap[child+1].max > heap[child].max) child++;
+    if(heap[i].max >= heap[child].max) break;
+    SWAP(heap[i], heap[child], tmp);
+    i = child;
+  }
+}
+
+int msPolygonPoleOfInaccessibility(shapeObj *p, pointObj *lp, double precision, double min_dimension)
+{
+  double minx, miny, width, height, cellsize, h, x, y;
+  polyLabelCellObj *heap = NULL, cell, best;
+  int n = 0, size = 0;
+
+  msComputeBounds(p);
+  minx = p->bounds.minx;
+  miny = p->bounds.miny;
+  width = p->bounds.maxx - minx;
+  height = p->bounds.maxy - miny;
+
+  if(min_dimension > 0)
+    if(MS_MIN(width, height) < min_dimension) return(MS_FAILURE);
+
+  cellsize = MS_MIN(width, height);
+  if(cellsize <= 0) return(MS_FAILURE);
+
+  /* don't let a tiny precision on a huge polygon turn into an unbounded search */
+  precision = MS_MAX(precision, MS_MAX(width, height) / 10000.0);
+
+  /* start with the bbox center and the center of gravity as candidates */
+  polyLabelInitCell(&best, p, minx + width / 2, miny + height / 2, 0);
+  if(getPolygonCenterOfGravity(p, lp) == MS_SUCCESS) {
+    polyLabelInitCell(&cell, p, lp->x, lp->y, 0);
+    if(cell.d > best.d) best = cell;
+  }
+
+  h = cellsize / 2;
+  for(x=minx; x<minx+width; x+=cellsize) {
+    for(y=miny; y<miny+height; y+=cellsize) {
+      polyLabelInitCell(&cell, p, x + h, y + h, h);
+      polyLabelPush(&heap, &n, &size, &cell);
+    }
+  }
+
+  while(n > 0) {
+    polyLabelPop(heap, &n, &cell);
+
+    if(cell.d > best.d) best = cell;
+
+    /* nothing better can be found in this cell */
+    if(cell.max - best.d <= precision) continue;
+
+    /* split it in four */
+    h = cell.h / 2;
+    x = cell.x;
+    y = cell.y;
+    polyLabelInitCell(&cell, p, x - h, y - h, h);
+    polyLabelPush(&heap, &n, &size, &cell);
+    polyLabelInitCell(&cell, p, x + h, y - h, h);
+    polyLabelPush(&heap, &n, &size, &cell);
+    polyLabelInitCell(&cell, p, x - h, y + h, h);
+    polyLabelPush(&heap, &n, &size, &cell);
+    polyLabelInitCell(&cell, p, x + h, y + h, h);
+    polyLabelPush(&heap, &n, &size, &cell);
+  }
+
+  msFree(heap);
+
+  if(best.d <= 0)
+    return(MS_FAILURE);
+
+  lp->x = best.x;
+  lp->y = best.y;
+
+  return(MS_SUCCESS);
+}
+
 /* Compute all the lineString/segment lengths and determine the longest lineString of a multiLineString
  * shape: in paramater, the multiLineString to compute.
  * segment_lengths: out parameter, the segment lengths of all lineString.
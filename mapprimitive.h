@@ -64,6 +64,11 @@ typedef struct {
 #endif
 } lineObj;
 
+#ifndef SWIG
+/* scratch allocator for shape storage, see msCreateShapeArena() */
+typedef struct shapeArenaObj shapeArenaObj;
+#endif
+
 typedef struct {
 #ifdef SWIG
   %immutable;
@@ -75,6 +80,7 @@ typedef struct {
   char **values;
   void *geometry;
   void *renderer_cache;
+  shapeArenaObj *arena; /* if set, some of the storage above belongs to this arena and must not be freed */
 #endif
 
 #ifdef SWIG
@@ -474,6 +474,12 @@ msProjectShapeLine(projectionObj *in, projectionObj *out,
           || line_out->point[0].y != line_out->point[line_out->numpoints-1].y) ) {
     /* make a copy because msAddPointToLine can realloc the array */
     pointObj sFirstPoint = line_out->point[0];
+    if( msShapeArenaOwns( shape->arena, line_out->point ) ) {
+      /* arena storage can't be realloc'd, move the points to the heap */
+      pointObj *points = (pointObj *) msSmallMalloc( sizeof(pointObj) * line_out->numpoints );
+      memcpy( points, line_out->point, sizeof(pointObj) * line_out->numpoints );
+      line_out->point = points;
+    }
     msAddPointToLine( line_out, &sFirstPoint );
   }
 
@@ -141,20 +141,44 @@ int msIsLayerQueryable(layerObj *lp)
   return MS_FALSE;
 }
 
+/*
+** Make sure the result cache can hold at least numresults results. The cache
+** grows geometrically so adding n results one at a time costs O(n) copying.
+*/
+int msResultCacheReserve(resultCacheObj *cache, int numresults)
+{
+  int cachesize;
+  resultObj *results;
+
+  if(numresults <= cache->cachesize) return MS_SUCCESS;
+
+  cachesize = MS_MAX(cache->cachesize, MS_RESULTCACHEINCREMENT);
+  while(cachesize < numresults) {
+    if(cachesize > INT_MAX/2) {
+      cachesize = numresults;
+      break;
+    }
+    cachesize *= 2;
+  }
+
+  results = (resultObj *) realloc(cache->results, sizeof(resultObj)*cachesize);
+  if(!results) {
+    msSetError(MS_MEMERR, "Failed to allocate %d results.", "msResultCacheReserve()", cachesize);
+    return MS_FAILURE;
+  }
+
+  cache->results = results;
+  cache->cachesize = cachesize;
+  return MS_SUCCESS;
+}
+
 static int addResult(resultCacheObj *cache, shapeObj *shape)
 {
   int i;
 
   if(cache->numresults == cache->cachesize) { /* just add it to the end */
-    if(cache->cachesize == 0)
-      cache->results = (resultObj *) malloc(sizeof(resultObj)*MS_RESULTCACHEINCREMENT);
-    else
-      cache->results = (resultObj *) realloc(cache->results, sizeof(resultObj)*(cache->cachesize+MS_RESULTCACHEINCREMENT));
-    if(!cache->results) {
-      msSetError(MS_MEMERR, "Realloc() error.", "addResult()");
+    if(msResultCacheReserve(cache, cache->numresults+1) != MS_SUCCESS)
       return(MS_FAILURE);
-    }
-    cache->cachesize += MS_RESULTCACHEINCREMENT;
   }
 
   i = cache->numresults;
@@ -179,7 +203,7 @@ static int addResult(resultCacheObj *cache, shapeObj *shape)
 static int saveQueryResults(mapObj *map, char *filename)
 {
   FILE *stream;
-  int i, j, n=0;
+  int i, n=0;
 
   if(!filename) {
     msSetError(MS_MISCERR, "No filename provided to save query results to.", "saveQueryResults()");
@@ -205,8 +229,8 @@ static int saveQueryResults(mapObj *map, char *filename)
       fwrite(&i, sizeof(int), 1, stream); /* layer index */
       fwrite(&(GET_LAYER(map, i)->resultcache->numresults), sizeof(int), 1, stream); /* number of results */
       fwrite(&(GET_LAYER(map, i)->resultcache->bounds), sizeof(rectObj), 1, stream); /* bounding box */
-      for(j=0; j<GET_LAYER(map, i)->resultcache->numresults; j++)
-        fwrite(&(GET_LAYER(map, i)->resultcache->results[j]), sizeof(resultObj), 1, stream); /* each result */
+      if(GET_LAYER(map, i)->resultcache->numresults > 0) /* all results in one go */
+        fwrite(GET_LAYER(map, i)->resultcache->results, sizeof(resultObj), GET_LAYER(map, i)->resultcache->numresults, stream);
     }
   }
 
@@ -263,14 +287,15 @@ static int loadQueryResults(mapObj *map, FILE *stream)
       return MS_FAILURE;
     }
 
+    if(GET_LAYER(map, j)->resultcache->numresults != (int) fread(GET_LAYER(map, j)->resultcache->results, sizeof(resultObj), GET_LAYER(map, j)->resultcache->numresults, stream)) { /* all results in one go */
+      msSetError(MS_MISCERR,"failed to read %d results from query file stream", "loadQueryResults()", GET_LAYER(map, j)->resultcache->numresults);
+      free(GET_LAYER(map, j)->resultcache->results);
+      free(GET_LAYER(map, j)->resultcache);
+      GET_LAYER(map, j)->resultcache = NULL;
+      return MS_FAILURE;
+    }
+
     for(k=0; k<GET_LAYER(map, j)->resultcache->numresults; k++) {
-      if(1 != fread(&(GET_LAYER(map, j)->resultcache->results[k]), sizeof(resultObj), 1, stream)) { /* each result */
-        msSetError(MS_MISCERR,"failed to read result %d from query file stream", "loadQueryResults()", k);
-        free(GET_LAYER(map, j)->resultcache->results);
-        free(GET_LAYER(map, j)->resultcache);
-        GET_LAYER(map, j)->resultcache = NULL;
-        return MS_FAILURE;
-      }
       if(!GET_LAYER(map, j)->tileindex) GET_LAYER(map, j)->resultcache->results[k].tileindex = -1; /* reset the tile index for non-tiled layers */
       GET_LAYER(map, j)->resultcache->results[k].resultindex = -1; /* all results loaded this way have a -1 result (set) index */
     }
@@ -1524,6 +1549,123 @@ int msQueryByFeatures(mapObj *map)
   return(MS_FAILURE);
 }
 
+/*
+** Nearest feature search for MODE=SINGLE point queries against plain shapefile
+** layers. Candidates from the spatial index are visited in order of the distance
+** from the query point to their bounding box, so the search stops as soon as no
+** remaining box can hold anything closer than the best feature found so far.
+*/
+typedef struct {
+  int shapeindex;
+  double mindist; /* lower bound on the distance to the shape */
+} nearestCandidateObj;
+
+static int compareNearestCandidates(const void *a, const void *b)
+{
+  const nearestCandidateObj *ca = (const nearestCandidateObj *) a;
+  const nearestCandidateObj *cb = (const nearestCandidateObj *) b;
+
+  if(ca->mindist < cb->mindist) return -1;
+  if(ca->mindist > cb->mindist) return 1;
+  return (ca->shapeindex > cb->shapeindex) ? -1 : (ca->shapeindex < cb->shapeindex); /* ties: highest index first */
+}
+
+static double distancePointToRect(pointObj *p, rectObj *rect)
+{
+  double dx=0, dy=0;
+
+  if(p->x < rect->minx) dx = rect->minx - p->x;
+  else if(p->x > rect->maxx) dx = p->x - rect->maxx;
+  if(p->y < rect->miny) dy = rect->miny - p->y;
+  else if(p->y > rect->maxy) dy = p->y - rect->maxy;
+
+  return sqrt(dx*dx + dy*dy);
+}
+
+static int canQueryNearest(mapObj *map, layerObj *lp, int paging)
+{
+  if(map->query.mode != MS_QUERY_SINGLE) return MS_FALSE;
+  if(lp->connectiontype != MS_SHAPEFILE || lp->layerinfo == NULL) return MS_FALSE;
+#ifdef USE_PROJ
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection))) return MS_FALSE; /* bounds are in layer coordinates */
+#endif
+  if(lp->_geomtransform.type != MS_GEOMTRANSFORM_NONE) return MS_FALSE;
+  if(lp->maxfeatures == 1) return MS_FALSE; /* the sequential scan returns the first match */
+  if(!paging && map->query.startindex > 1) return MS_FALSE; /* skipping depends on the read order */
+  return MS_TRUE;
+}
+
+static int queryNearestShape(mapObj *map, layerObj *lp, double t, int *classgroup, int nclasses, double minfeaturesize)
+{
+  shapefileObj *shpfile = (shapefileObj *) lp->layerinfo;
+  nearestCandidateObj *candidates;
+  int i, numcandidates=0, numread=0, status=MS_SUCCESS;
+  int bestindex=-1;
+  double d;
+  rectObj shaperect;
+  resultObj record;
+  shapeObj shape;
+
+  candidates = (nearestCandidateObj *) malloc(sizeof(nearestCandidateObj)*MS_MAX(shpfile->numshapes, 1));
+  MS_CHECK_ALLOC(candidates, sizeof(nearestCandidateObj)*MS_MAX(shpfile->numshapes, 1), MS_FAILURE);
+
+  for(i=msGetNextBit(shpfile->status, 0, shpfile->numshapes); i>=0; i=msGetNextBit(shpfile->status, i+1, shpfile->numshapes)) {
+    if(msSHPReadBounds(shpfile->hSHP, i, &shaperect) != MS_SUCCESS) continue; /* NULL or empty shape */
+    d = distancePointToRect(&(map->query.point), &shaperect);
+    if(d > t) continue;
+    candidates[numcandidates].shapeindex = i;
+    candidates[numcandidates].mindist = d;
+    numcandidates++;
+  }
+
+  qsort(candidates, numcandidates, sizeof(nearestCandidateObj), compareNearestCandidates);
+
+  msInitShape(&shape);
+  record.tileindex = -1;
+  record.resultindex = -1;
+  record.classindex = -1;
+
+  for(i=0; i<numcandidates; i++) {
+    if(candidates[i].mindist > t) break; /* nothing left can be closer */
+
+    record.shapeindex = candidates[i].shapeindex;
+    if((status = msLayerGetShape(lp, &shape, &record)) != MS_SUCCESS) break;
+    numread++;
+
+    if(shape.type == MS_SHAPE_NULL || (lp->numitems > 0 && lp->iteminfo && !msEvalExpression(lp, &shape, &(lp->filter), lp->filteritemindex))) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    if((shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) && msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
+    if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF) || !(lp->class[shape.classindex]->template))) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    d = msDistancePointToShape(&(map->query.point), &shape);
+    if(d < t || (d == t && shape.index > bestindex)) { /* same tie breaking as a sequential scan */
+      lp->resultcache->numresults = 0;
+      addResult(lp->resultcache, &shape);
+      bestindex = shape.index;
+      t = d; /* next one must be closer */
+    }
+
+    msFreeShape(&shape);
+  }
+
+  if(lp->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msQueryByPoint(): nearest search read %d of %d candidate shapes.\n", numread, numcandidates);
+
+  free(candidates);
+  return status;
+}
+
 /* msQueryByPoint()
  *
  * With mode=MS_QUERY_SINGLE:
@@ -1531,6 +1673,8 @@ int msQueryByFeatures(mapObj *map)
  *     shape from the first layer that finds a match).
  *   Set maxresults = 1 to have up to one result per layer (the closest shape
  *     from each layer).
+ *   A layer with MAXFEATURES 1 stops at the first shape found within the
+ *     tolerance, which is not necessarily the closest one.
  *
  * With mode=MS_QUERY_MULTIPLE:
  *   Set maxresults = 0 to have an unlimited number of results.
@@ -1673,7 +1817,13 @@ int msQueryByPoint(mapObj *map)
     if (lp->minfeaturesize > 0)
       minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+    status = MS_SUCCESS;
+    if(canQueryNearest(map, lp, paging)) {
+      status = queryNearestShape(map, lp, t, classgroup, nclasses, minfeaturesize);
+      if(status == MS_SUCCESS) status = MS_DONE; /* all candidates examined */
+    }
+
+    while(status == MS_SUCCESS && (status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
       /* Check if the shape size is ok to be drawn */
       if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
@@ -45,6 +45,7 @@ extern parseResultObj yypresult; /* result of parsing, true/false */
 #ifdef USE_GDAL
 #include "gdal.h"
 #include "cpl_string.h"
+#include "cpl_vsi.h"
 #endif
 
 #define MAXCOLORS 256
@@ -311,6 +312,211 @@ int msAddColorGD(mapObj *map, gdImagePtr img, int cmt, int r, int g, int b)
 
 #endif
 
+#ifdef USE_GDAL
+
+/************************************************************************/
+/*                        Raster tile dataset cache                     */
+/*                                                                      */
+/*      Tile index layers open and close every tile on every request.   */
+/*      If the MS_RASTER_TILE_CACHE_SIZE config option is set, up to    */
+/*      that many tile datasets are kept open for the lifetime of the   */
+/*      process and the least recently used ones are closed when the    */
+/*      limit is reached.  The cache holds one reference of each        */
+/*      dataset, and is protected by the TLOCK_GDAL mutex.              */
+/************************************************************************/
+
+typedef struct {
+  char *path;
+  GDALDatasetH hDS;
+  time_t mtime;
+  unsigned long last_used;
+} rasterTileDatasetObj;
+
+static rasterTileDatasetObj **tileDatasets = NULL;
+static int tileDatasetCount = 0;
+static int tileDatasetMax = 0;
+static unsigned long tileDatasetClock = 0;
+
+static time_t msRasterTileGetMTime( const char *path )
+{
+  VSIStatBufL sStat;
+
+  if( VSIStatL( path, &sStat ) != 0 )
+    return 0;
+
+  return sStat.st_mtime;
+}
+
+static void msRasterTileCacheRemove( int i )
+{
+  GDALClose( tileDatasets[i]->hDS );
+  msFree( tileDatasets[i]->path );
+  msFree( tileDatasets[i] );
+
+  tileDatasets[i] = tileDatasets[--tileDatasetCount];
+}
+
+/* It is assumed that TLOCK_GDAL is held. */
+static GDALDatasetH msRasterTileCacheLookup( const char *path )
+{
+  int i;
+
+  for( i = 0; i < tileDatasetCount; i++ ) {
+    if( strcmp( tileDatasets[i]->path, path ) == 0 ) {
+      /* the file has been replaced since it was opened */
+      if( tileDatasets[i]->mtime != msRasterTileGetMTime( path ) ) {
+        msRasterTileCacheRemove( i );
+        return NULL;
+      }
+
+      tileDatasets[i]->last_used = ++tileDatasetClock;
+      return tileDatasets[i]->hDS;
+    }
+  }
+
+  return NULL;
+}
+
+/* The cache takes over the reference of hDS. It is assumed that TLOCK_GDAL is held. */
+static void msRasterTileCacheAdd( const char *path, GDALDatasetH hDS, int max_size )
+{
+  rasterTileDatasetObj *tile;
+
+  while( tileDatasetCount > 0 && tileDatasetCount >= max_size ) {
+    int i, lru = 0;
+
+    for( i = 1; i < tileDatasetCount; i++ ) {
+      if( tileDatasets[i]->last_used < tileDatasets[lru]->last_used )
+        lru = i;
+    }
+    msRasterTileCacheRemove( lru );
+  }
+
+  if( tileDatasetCount == tileDatasetMax ) {
+    tileDatasetMax += 16;
+    tileDatasets = (rasterTileDatasetObj **)
+                   msSmallRealloc( tileDatasets, sizeof(rasterTileDatasetObj *) * tileDatasetMax );
+  }
+
+  tile = (rasterTileDatasetObj *) msSmallMalloc( sizeof(rasterTileDatasetObj) );
+  tile->path = msStrdup( path );
+  tile->hDS = hDS;
+  tile->mtime = msRasterTileGetMTime( path );
+  tile->last_used = ++tileDatasetClock;
+
+  tileDatasets[tileDatasetCount++] = tile;
+}
+
+/************************************************************************/
+/*                     msRasterTileCacheCleanup()                       */
+/*                                                                      */
+/*      Close the cached tile datasets.  Called from msGDALCleanup()    */
+/*      before the remaining datasets are closed.                       */
+/************************************************************************/
+
+void msRasterTileCacheCleanup( void )
+{
+  msAcquireLock( TLOCK_GDAL );
+
+  while( tileDatasetCount > 0 )
+    msRasterTileCacheRemove( tileDatasetCount - 1 );
+
+  msFree( tileDatasets );
+  tileDatasets = NULL;
+  tileDatasetMax = 0;
+
+  msReleaseLock( TLOCK_GDAL );
+}
+
+/************************************************************************/
+/*                       msRasterTileIsCovered()                        */
+/*                                                                      */
+/*      Check whether the visible part of a tile footprint is fully     */
+/*      covered by the footprints of the tiles drawn after it.  The     */
+/*      union of the later footprints is evaluated on the grid formed   */
+/*      by their edges.                                                 */
+/************************************************************************/
+
+static int msRasterTileCompareDouble( const void *a, const void *b )
+{
+  double da = *(const double *) a, db = *(const double *) b;
+  return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+static int msRasterTileIsCovered( rectObj *searchrect, rectObj *tilebounds,
+                                  int numtiles, int tile )
+{
+  rectObj area;
+  double *xs, *ys;
+  int *above;
+  int numabove = 0, nx = 0, ny = 0, i, j, k, covered = MS_TRUE;
+
+  area.minx = MS_MAX( tilebounds[tile].minx, searchrect->minx );
+  area.miny = MS_MAX( tilebounds[tile].miny, searchrect->miny );
+  area.maxx = MS_MIN( tilebounds[tile].maxx, searchrect->maxx );
+  area.maxy = MS_MIN( tilebounds[tile].maxy, searchrect->maxy );
+
+  if( area.minx >= area.maxx || area.miny >= area.maxy )
+    return MS_FALSE; /* degenerate footprint, let the driver decide */
+
+  above = (int *) msSmallMalloc( sizeof(int) * (numtiles - tile) );
+  xs = (double *) msSmallMalloc( sizeof(double) * 2 * (numtiles - tile + 1) );
+  ys = (double *) msSmallMalloc( sizeof(double) * 2 * (numtiles - tile + 1) );
+
+  xs[nx++] = area.minx;
+  xs[nx++] = area.maxx;
+  ys[ny++] = area.miny;
+  ys[ny++] = area.maxy;
+
+  for( i = tile + 1; i < numtiles; i++ ) {
+    if( !msRectOverlap( &tilebounds[i], &area ) )
+      continue;
+    above[numabove++] = i;
+    xs[nx++] = MS_MAX( area.minx, MS_MIN( area.maxx, tilebounds[i].minx ) );
+    xs[nx++] = MS_MAX( area.minx, MS_MIN( area.maxx, tilebounds[i].maxx ) );
+    ys[ny++] = MS_MAX( area.miny, MS_MIN( area.maxy, tilebounds[i].miny ) );
+    ys[ny++] = MS_MAX( area.miny, MS_MIN( area.maxy, tilebounds[i].maxy ) );
+  }
+
+  if( numabove == 0 )
+    covered = MS_FALSE;
+  else {
+    qsort( xs, nx, sizeof(double), msRasterTileCompareDouble );
+    qsort( ys, ny, sizeof(double), msRasterTileCompareDouble );
+
+    /* every cell of the grid must be inside one of the later footprints */
+    for( i = 0; i < nx - 1 && covered; i++ ) {
+      double x = (xs[i] + xs[i+1]) / 2;
+      if( xs[i] == xs[i+1] )
+        continue;
+      for( j = 0; j < ny - 1 && covered; j++ ) {
+        double y = (ys[j] + ys[j+1]) / 2;
+        if( ys[j] == ys[j+1] )
+          continue;
+        for( k = 0; k < numabove; k++ ) {
+          rectObj *r = &tilebounds[above[k]];
+          if( x >= r->minx && x <= r->maxx && y >= r->miny && y <= r->maxy )
+            break;
+        }
+        if( k == numabove )
+          covered = MS_FALSE;
+      }
+    }
+  }
+
+  msFree( above );
+  msFree( xs );
+  msFree( ys );
+
+  return covered;
+}
+
+#else
+
+void msRasterTileCacheCleanup( void ) {}
+
+#endif /* def USE_GDAL */
+
 /************************************************************************/
 /*                        msDrawRasterLayerLow()                        */
 /*                                                                      */
@@ -351,6 +557,12 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
   GDALDatasetH  hDS;
   double  adfGeoTransform[6];
   const char *close_connection;
+  const char *value;
+  int tile_cache_size = 0, cached;
+  char **tilenames = NULL;
+  rectObj *tilebounds = NULL;
+  int *tilecovered = NULL;
+  int numtiles = 0, maxtiles = 0, curtile = 0;
 
   msGDALInitialize();
 
@@ -491,26 +703,65 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
 
       goto cleanup;
     }
+
+    /* read the tile list up front so that hidden tiles can be skipped */
+    while((status = msLayerNextShape(tlp, &tshp)) == MS_SUCCESS) {
+      if(numtiles == maxtiles) {
+        maxtiles = (maxtiles > 0) ? maxtiles * 2 : 16;
+        tilenames = (char **) msSmallRealloc(tilenames, sizeof(char *) * maxtiles);
+        tilebounds = (rectObj *) msSmallRealloc(tilebounds, sizeof(rectObj) * maxtiles);
+      }
+
+      if(layer->data == NULL || strlen(layer->data) == 0 ) { /* assume whole filename is in attribute field */
+        tilenames[numtiles] = msStrdup(tshp.values[tileitemindex]);
+      } else {
+        snprintf(tilename, sizeof(tilename), "%s/%s", tshp.values[tileitemindex], layer->data);
+        tilenames[numtiles] = msStrdup(tilename);
+      }
+      tilebounds[numtiles] = tshp.bounds;
+      numtiles++;
+
+      msFreeShape(&tshp); /* done with the shape */
+    }
+
+    if(status == MS_FAILURE) {
+      final_status = MS_FAILURE;
+      goto cleanup;
+    }
+
+    /*
+    ** Tiles are drawn in the order of the tile index, so a tile whose visible
+    ** footprint is covered by later tiles would be painted over completely.
+    ** This is only true for opaque tiles, hence it must be requested.
+    */
+    tilecovered = (int *) msSmallCalloc(MS_MAX(1, numtiles), sizeof(int));
+    value = msLayerGetProcessingKey(layer, "TILEINDEX_SKIP_COVERED");
+    if(value && (strcasecmp(value, "YES") == 0 || strcasecmp(value, "ON") == 0 || strcasecmp(value, "TRUE") == 0)) {
+      for(i = 0; i < numtiles - 1; i++) {
+        tilecovered[i] = msRasterTileIsCovered(&searchrect, tilebounds, numtiles, i);
+        if(tilecovered[i] && layer->debug == MS_TRUE)
+          msDebug("msDrawRasterLayerLow(%s): skipping tile %s covered by later tiles.\n", layer->name, tilenames[i]);
+      }
+    }
+
+    /* keep the tile datasets open across requests if requested */
+    value = msGetConfigOption(map, "MS_RASTER_TILE_CACHE_SIZE");
+    if(value)
+      tile_cache_size = atoi(value);
   }
 
   done = MS_FALSE;
   while(done != MS_TRUE) {
     if(layer->tileindex) {
-      status = msLayerNextShape(tlp, &tshp);
-      if( status == MS_FAILURE) {
-        final_status = MS_FAILURE;
-        break;
-      }
+      if(curtile >= numtiles) break; /* no more tiles/images */
 
-      if(status == MS_DONE) break; /* no more tiles/images */
+      if(tilecovered[curtile]) {
+        curtile++;
+        continue;
+      }
 
-      if(layer->data == NULL || strlen(layer->data) == 0 ) { /* assume whole filename is in attribute field */
-        strlcpy( tilename, tshp.values[tileitemindex], sizeof(tilename));
-      } else
-        snprintf(tilename, sizeof(tilename), "%s/%s", tshp.values[tileitemindex], layer->data);
+      strlcpy( tilename, tilenames[curtile++], sizeof(tilename));
       filename = tilename;
-
-      msFreeShape(&tshp); /* done with the shape */
     } else {
       filename = layer->data;
       done = MS_TRUE; /* only one image so we're done after this */
@@ -543,11 +794,18 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
     ** oracle georaster do not use real paths.
     */
     decrypted_path = msDecryptStringTokens( map, szPath );
-    if( decrypted_path == NULL )
-      return MS_FAILURE;
+    if( decrypted_path == NULL ) {
+      final_status = MS_FAILURE;
+      break;
+    }
 
     msAcquireLock( TLOCK_GDAL );
-    hDS = GDALOpenShared( decrypted_path, GA_ReadOnly );
+    hDS = NULL;
+    cached = MS_FALSE;
+    if( tile_cache_size > 0 && (hDS = msRasterTileCacheLookup( decrypted_path )) != NULL )
+      cached = MS_TRUE;
+    else
+      hDS = GDALOpenShared( decrypted_path, GA_ReadOnly );
 
     /*
     ** If GDAL doesn't recognise it, and it wasn't successfully opened
@@ -579,7 +837,8 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
 
       if(ignore_missing == MS_MISSING_DATA_FAIL) {
         msSetError(MS_IOERR, "Corrupt, empty or missing file '%s' for layer '%s'. %s", "msDrawRasterLayerLow()", szPath, layer->name, cpl_error_msg );
-        return(MS_FAILURE);
+        final_status = MS_FAILURE;
+        break;
       } else if( ignore_missing == MS_MISSING_DATA_LOG ) {
         if( layer->debug || layer->map->debug ) {
           msDebug( "Corrupt, empty or missing file '%s' for layer '%s' ... ignoring this missing data.  %s\n", szPath, layer->name, cpl_error_msg );
@@ -590,10 +849,16 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
       } else {
         /* never get here */
         msSetError(MS_IOERR, "msIgnoreMissingData returned unexpected value.", "msDrawRasterLayerLow()");
-        return(MS_FAILURE);
+        final_status = MS_FAILURE;
+        break;
       }
     }
 
+    if( tile_cache_size > 0 && !cached ) {
+      msRasterTileCacheAdd( decrypted_path, hDS, tile_cache_size );
+      cached = MS_TRUE;
+    }
+
     msFree( decrypted_path );
     decrypted_path = NULL;
 
@@ -660,7 +925,8 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
     }
 
     if( status == -1 ) {
-      GDALClose( hDS );
+      if( !cached )
+        GDALClose( hDS );
       msReleaseLock( TLOCK_GDAL );
       final_status = MS_FAILURE;
       break;
@@ -678,8 +944,10 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
     if( close_connection == NULL && layer->tileindex == NULL )
       close_connection = "DEFER";
 
-    if( close_connection != NULL
-        && strcasecmp(close_connection,"DEFER") == 0 ) {
+    if( cached ) {
+      /* owned by the tile dataset cache */
+    } else if( close_connection != NULL
+               && strcasecmp(close_connection,"DEFER") == 0 ) {
       GDALDereferenceDataset( hDS );
     } else {
       GDALClose( hDS );
@@ -689,6 +957,12 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
 
 cleanup:
   if(layer->tileindex) { /* tiling clean-up */
+    for(i = 0; i < numtiles; i++)
+      msFree(tilenames[i]);
+    msFree(tilenames);
+    msFree(tilebounds);
+    msFree(tilecovered);
+
     msLayerClose(tlp);
     if(tilelayerindex == -1) {
       freeLayer(tlp);
@@ -95,8 +95,7 @@ extern int InvGeoTransform( double *gt_in, double *gt_out );
 /************************************************************************/
 /*                             addResult()                              */
 /*                                                                      */
-/*      this is a copy of the code in mapquery.c.  Should we prepare    */
-/*      a small public API for managing results caches?                 */
+/*      Storage is managed by msResultCacheReserve() in mapquery.c.     */
 /************************************************************************/
 
 static int addResult(resultCacheObj *cache, int classindex, int shapeindex, int tileindex)
@@ -104,15 +103,8 @@ static int addResult(resultCacheObj *cache, int classindex, int shapeindex, int
   int i;
 
   if(cache->numresults == cache->cachesize) { /* just add it to the end */
-    if(cache->cachesize == 0)
-      cache->results = (resultObj *) malloc(sizeof(resultObj)*MS_RESULTCACHEINCREMENT);
-    else
-      cache->results = (resultObj *) realloc(cache->results, sizeof(resultObj)*(cache->cachesize+MS_RESULTCACHEINCREMENT));
-    if(!cache->results) {
-      msSetError(MS_MEMERR, "Realloc() error.", "addResult()");
+    if(msResultCacheReserve(cache, cache->numresults+1) != MS_SUCCESS)
       return(MS_FAILURE);
-    }
-    cache->cachesize += MS_RESULTCACHEINCREMENT;
   }
 
   i = cache->numresults;
@@ -346,6 +346,8 @@ int msEmbedScalebar(mapObj *map, imageObj *img)
     msSetError(MS_MISCERR,"unsupported outputformat","msEmbedScalebar()");
     return MS_FAILURE;
   }
+  if(MS_RENDERER_MVT(map->outputformat))
+    return MS_SUCCESS; /* vector tiles have no room for decorations */
   index = msGetSymbolIndex(&(map->symbolset), "scalebar", MS_FALSE);
   if(index != -1)
     msRemoveSymbol(&(map->symbolset), index); /* remove cached symbol in case the function is called multiple
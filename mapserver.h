@@ -223,6 +223,7 @@ extern "C" {
 #define MS_MAX_LABEL_FONTS     5
 #define MS_DEFAULT_LABEL_PRIORITY 1
 #define MS_LABEL_FORCE_GROUP 2 /* other values are MS_ON/MS_OFF */
+#define MS_LABELCACHE_MIN_GRID_SIZE 16 /* smallest labelcache_grid_size in pixels */
 
   /* General defines, not wrapable */
 #ifndef SWIG
@@ -236,6 +237,7 @@ extern "C" {
 #define MS_TEMPLATE_EXPR "\\.(xml|wml|html|htm|svg|kml|gml|js|tmpl)$"
 
 #define MS_INDEX_EXTENSION ".qix"
+#define MS_ATTRINDEX_EXTENSION ".aix"
 
 #define MS_QUERY_RESULTS_MAGIC_STRING "MapServer Query Results"
 #define MS_QUERY_PARAMS_MAGIC_STRING "MapServer Query Params"
@@ -394,6 +396,7 @@ extern "C" {
 #define MS_RENDER_WITH_IMAGEMAP 5
 #define MS_RENDER_WITH_TEMPLATE 8 /* query results only */
 #define MS_RENDER_WITH_OGR 16
+#define MS_RENDER_WITH_GEOJSON 17
 
 #define MS_RENDER_WITH_PLUGIN 100
 #define MS_RENDER_WITH_CAIRO_RASTER   101
@@ -403,6 +406,7 @@ extern "C" {
 #define MS_RENDER_WITH_AGG 105
 #define MS_RENDER_WITH_GD 106
 #define MS_RENDER_WITH_KML 107
+#define MS_RENDER_WITH_MVT 108
 
 #ifndef SWIG
 
@@ -412,6 +416,8 @@ extern "C" {
 #define MS_RENDERER_TEMPLATE(format) ((format)->renderer == MS_RENDER_WITH_TEMPLATE)
 #define MS_RENDERER_KML(format) ((format)->renderer == MS_RENDER_WITH_KML)
 #define MS_RENDERER_OGR(format) ((format)->renderer == MS_RENDER_WITH_OGR)
+#define MS_RENDERER_GEOJSON(format) ((format)->renderer == MS_RENDER_WITH_GEOJSON)
+#define MS_RENDERER_MVT(format) ((format)->renderer == MS_RENDER_WITH_MVT)
 
 #define MS_RENDERER_PLUGIN(format) ((format)->renderer > MS_RENDER_WITH_PLUGIN)
 
@@ -1059,6 +1065,10 @@ extern "C" {
     shapeObj *annopoly;
 
     labelLeaderObj leader;
+
+#ifndef SWIG
+    void *textcache; /* msTransformLabelText() results, see maplabel.c */
+#endif
   } labelObj;
 
   /************************************************************************/
@@ -1168,6 +1178,7 @@ extern "C" {
 
 #ifndef SWIG
     labelPathObj *labelpath;  /* Path & bounds of curved labels.  Bug #1620 implementation */
+    int gridnext; /* next label anchored in the same grid cell, see msLabelCacheBuildGrid() */
 #endif /* SWIG */
 
     int markerid; /* corresponding marker (POINT layers only) */
@@ -1193,6 +1204,9 @@ extern "C" {
     markerCacheMemberObj *markers;
     int nummarkers;
     int markercachesize;
+#ifndef SWIG
+    int *grid; /* first label anchored in each grid cell, see msLabelCacheBuildGrid() */
+#endif /* SWIG */
   } labelCacheSlotObj;
 
   /************************************************************************/
@@ -1207,8 +1221,30 @@ extern "C" {
      */
     int numlabels;
     int gutter; /* space in pixels around the image where labels cannot be placed */
+#ifndef SWIG
+    int gridsize; /* labelcache_grid_size in pixels, 0 if labels are placed in drawing order */
+    double gridminx, gridminy; /* world grid cell of the first column and row */
+    int gridwidth, gridheight; /* grid cells covering the image */
+    double gridreach; /* largest distance from a placed label's point to its poly and leader bounds */
+#endif /* SWIG */
   } labelCacheObj;
 
+#ifndef SWIG
+  /************************************************************************/
+  /*                            drawProfileObj                            */
+  /*                                                                      */
+  /*      Wall clock time in seconds spent in the stages of the last      */
+  /*      msDrawMap() call, only collected when enabled is set (see       */
+  /*      shp2img -bench).                                                */
+  /************************************************************************/
+  typedef struct {
+    int enabled;
+    double query; /* layer open, feature search and OWS requests */
+    double labelcache; /* msDrawLabelCache() */
+    double total; /* whole of msDrawMap() */
+  } drawProfileObj;
+#endif /* SWIG */
+
   /************************************************************************/
   /*                         resultObj                                    */
   /************************************************************************/
@@ -1454,6 +1490,38 @@ extern "C" {
   /*      base unit of a map.                                             */
   /************************************************************************/
 
+#ifndef SWIG
+  /************************************************************************/
+  /*                           featureCacheObj                            */
+  /*                                                                      */
+  /*      Process wide cache of some data for each shape of a           */
+  /*      shapefile, see msAcquireFeatureCache().  The structure of a   */
+  /*      particular cache starts with a featureCacheObj.                 */
+  /************************************************************************/
+  typedef struct featureCacheObj {
+    char *key;
+    time_t mtime; /* of the file the data was computed from */
+    int numshapes;
+    int refcount; /* number of layers drawing with this cache */
+    unsigned long last_used;
+  } featureCacheObj;
+
+  typedef struct {
+    int lock; /* TLOCK_* protecting the list and the data of its caches */
+    int maxcaches;
+    size_t size; /* of the structure starting with a featureCacheObj */
+    void (*reset)(featureCacheObj *cache, int numshapes); /* (re)allocates and clears the data */
+    void (*free)(featureCacheObj *cache); /* frees the data */
+    featureCacheObj **caches;
+    int numcaches;
+    unsigned long clock;
+  } featureCacheListObj;
+
+  typedef struct classCacheObj classCacheObj; /* see msAcquireClassCache() */
+  typedef struct classDispatchObj classDispatchObj; /* see msCreateClassDispatch() */
+  typedef struct labelPointCacheObj labelPointCacheObj; /* see msAcquireLabelPointCache() */
+#endif
+
   typedef struct {
     double minscale;
     double maxscale;
@@ -1577,6 +1645,10 @@ extern "C" {
     /* SDL has converted OracleSpatial, SDE, Graticules */
     void *layerinfo; /* all connection types should use this generic pointer to a vendor specific structure */
     void *wfslayerinfo; /* For WFS layers, will contain a msWFSLayerInfo struct */
+    shapeArenaObj *shapearena; /* scratch shape storage while msDrawVectorLayer() runs, NULL otherwise */
+    classCacheObj *classcache; /* class of each shape, while msDrawVectorLayer() runs with PROCESSING "CLASS_CACHE=ON" */
+    classDispatchObj *classdispatch; /* CLASSITEM value to class index, while msDrawVectorLayer() runs */
+    labelPointCacheObj *labelpointcache; /* polygon label points, while msDrawVectorLayer() runs with PROCESSING "LABEL_POINT_CACHE=ON" */
 #endif /* not SWIG */
 
     /* attribute/classification handling components */
@@ -1760,6 +1832,8 @@ extern "C" {
     unsigned char encryption_key[MS_ENCRYPTION_KEY_SIZE]; /* 128bits encryption key */
 
     queryObj query;
+
+    drawProfileObj profile;
 #endif
   } mapObj;
 
@@ -1935,6 +2009,7 @@ extern "C" {
   MS_DLL_EXPORT char **msTokenizeMap(char *filename, int *numtokens);
   MS_DLL_EXPORT int msInitLabelCache(labelCacheObj *cache);
   MS_DLL_EXPORT int msFreeLabelCache(labelCacheObj *cache);
+  MS_DLL_EXPORT void msFreeLabelCacheMember(labelCacheMemberObj *cachePtr);
   MS_DLL_EXPORT int msCheckConnection(layerObj * layer); /* connection pooling functions (mapfile.c) */
   MS_DLL_EXPORT void msCloseConnections(mapObj *map);
 
@@ -1995,6 +2070,7 @@ extern "C" {
 
   MS_DLL_EXPORT int msGetQueryResultBounds(mapObj *map, rectObj *bounds);
   MS_DLL_EXPORT int msIsLayerQueryable(layerObj *lp);
+  MS_DLL_EXPORT int msResultCacheReserve(resultCacheObj *cache, int numresults);
   MS_DLL_EXPORT void msQueryFree(mapObj *map, int qlayer); /* todo: rename */
   MS_DLL_EXPORT int msRasterQueryByShape(mapObj *map, layerObj *layer, shapeObj *selectshape);
   MS_DLL_EXPORT int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect);
@@ -2037,6 +2113,7 @@ extern "C" {
   MS_DLL_EXPORT char *msCommifyString(char *str);
   MS_DLL_EXPORT int msHexToInt(char *hex);
   MS_DLL_EXPORT char *msGetEncodedString(const char *string, const char *encoding);
+  MS_DLL_EXPORT void msIconvCleanup(void);
   MS_DLL_EXPORT char *msConvertWideStringToUTF8 (const wchar_t* string, const char* encoding);
   MS_DLL_EXPORT int msGetNextGlyph(const char **in_ptr, char *out_string);
   MS_DLL_EXPORT int msGetNumGlyphs(const char *in_ptr);
@@ -2116,6 +2193,12 @@ extern "C" {
   MS_DLL_EXPORT int msFontsetLookupFonts(char* fontstring, int *numfonts, fontSetObj *fontset, char **lookedUpFonts);
 
   MS_DLL_EXPORT char *msTransformLabelText(mapObj *map, labelObj *label, char *text);
+  MS_DLL_EXPORT void msFreeLabelTextCache(labelObj *label);
+  MS_DLL_EXPORT labelPointCacheObj *msAcquireLabelPointCache(layerObj *layer, mapObj *map);
+  MS_DLL_EXPORT void msReleaseLabelPointCache(labelPointCacheObj *cache);
+  MS_DLL_EXPORT int msLabelPointCacheLookup(labelPointCacheObj *cache, mapObj *map, long shapeindex, pointObj *lp);
+  MS_DLL_EXPORT void msLabelPointCacheStore(labelPointCacheObj *cache, mapObj *map, long shapeindex, pointObj *lp);
+  MS_DLL_EXPORT void msLabelPointCacheCleanup(void);
   MS_DLL_EXPORT int msGetTruetypeTextBBox(rendererVTableObj *renderer, char* fontstring, fontSetObj *fontset, double size, char *string, rectObj *rect, double **advances, int bAdjustBaseline);
 
   MS_DLL_EXPORT int msGetLabelSize(mapObj *map, labelObj *label, char *string, double size, rectObj *rect, double **advances);
@@ -2123,6 +2206,7 @@ extern "C" {
   MS_DLL_EXPORT int msAddLabel(mapObj *map, labelObj *label, int layerindex, int classindex, shapeObj *shape, pointObj *point, labelPathObj *labelpath, double featuresize);
   MS_DLL_EXPORT int msAddLabelGroup(mapObj *map, int layerindex, int classindex, shapeObj *shape, pointObj *point, double featuresize);
   MS_DLL_EXPORT int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr, shapeObj *poly, int mindistance, int current_priority, int current_label);
+  MS_DLL_EXPORT int msLabelCacheBuildGrid(mapObj *map, int gridsize);
   MS_DLL_EXPORT labelCacheMemberObj *msGetLabelCacheMember(labelCacheObj *labelcache, int i);
 
   MS_DLL_EXPORT void msFreeShape(shapeObj *shape); /* in mapprimitive.c */
@@ -2132,6 +2216,13 @@ extern "C" {
   MS_DLL_EXPORT void msInitShape(shapeObj *shape);
   MS_DLL_EXPORT void msShapeDeleteLine( shapeObj *shape, int line );
   MS_DLL_EXPORT int msCopyShape(shapeObj *from, shapeObj *to);
+  MS_DLL_EXPORT shapeArenaObj *msCreateShapeArena(void);
+  MS_DLL_EXPORT void msFreeShapeArena(shapeArenaObj *arena);
+  MS_DLL_EXPORT void msResetShapeArena(shapeArenaObj *arena);
+  MS_DLL_EXPORT void *msShapeArenaAlloc(shapeArenaObj *arena, size_t size);
+  MS_DLL_EXPORT char *msShapeArenaStrdup(shapeArenaObj *arena, const char *string);
+  MS_DLL_EXPORT int msShapeArenaOwns(shapeArenaObj *arena, const void *ptr);
+  MS_DLL_EXPORT void msShapeArenaFree(shapeArenaObj *arena, void *ptr);
   MS_DLL_EXPORT int msIsOuterRing(shapeObj *shape, int r);
   MS_DLL_EXPORT int *msGetOuterList(shapeObj *shape);
   MS_DLL_EXPORT int *msGetInnerList(shapeObj *shape, int r, int *outerlist);
@@ -2161,6 +2252,7 @@ extern "C" {
       int line_index, double** segment_lengths, double line_length, double total_length,
       int* labelpaths_index, int* labelpaths_size, labelPathObj ***labelpaths, int** regular_lines, int *regular_lines_index, int* regular_lines_size);
   MS_DLL_EXPORT int msPolygonLabelPoint(shapeObj *p, pointObj *lp, double min_dimension);
+  MS_DLL_EXPORT int msPolygonPoleOfInaccessibility(shapeObj *p, pointObj *lp, double precision, double min_dimension);
   MS_DLL_EXPORT int msAddLine(shapeObj *p, lineObj *new_line);
   MS_DLL_EXPORT int msAddLineDirectly(shapeObj *p, lineObj *new_line);
   MS_DLL_EXPORT int msAddPointToLine(lineObj *line, pointObj *point );
@@ -2195,6 +2287,7 @@ extern "C" {
   MS_DLL_EXPORT int msLayerApplyScaletokens(layerObj *layer, double scale);
   MS_DLL_EXPORT int msLayerRestoreFromScaletokens(layerObj *layer);
   MS_DLL_EXPORT int msClusterLayerOpen(layerObj *layer); /* in mapcluster.c */
+  MS_DLL_EXPORT void msClusterCacheCleanup(void); /* in mapcluster.c */
   MS_DLL_EXPORT int msLayerIsOpen(layerObj *layer);
   MS_DLL_EXPORT void msLayerClose(layerObj *layer);
   MS_DLL_EXPORT int msLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery);
@@ -2381,6 +2474,7 @@ extern "C" {
 
   /*in mapraster.c */
   MS_DLL_EXPORT int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image, rasterBufferObj *rb );
+  MS_DLL_EXPORT void msRasterTileCacheCleanup(void);
 #ifdef USE_GD
   MS_DLL_EXPORT int msAddColorGD(mapObj *map, gdImagePtr img, int cmt, int r, int g, int b);
 #endif
@@ -2393,6 +2487,7 @@ extern "C" {
   MS_DLL_EXPORT int msGetGDALGeoTransform(void *hDS, mapObj *map, layerObj *layer, double *padfGeoTransform );
   MS_DLL_EXPORT int *msGetGDALBandList( layerObj *layer, void *hDS, int max_bands, int *band_count );
   MS_DLL_EXPORT double msGetGDALNoDataValue( layerObj *layer, void *hBand, int *pbGotNoData );
+  MS_DLL_EXPORT int msGetGDALOverviewLevel( layerObj *layer, void *hDS, int src_xsize, int src_ysize, int dst_xsize, int dst_ysize );
 
   /* in mapchart.c */
   MS_DLL_EXPORT int msDrawChartLayer(mapObj *map, layerObj *layer, imageObj *image);
@@ -2422,6 +2517,14 @@ extern "C" {
   MS_DLL_EXPORT int msEvalContext(mapObj *map, layerObj *layer, char *context);
   MS_DLL_EXPORT int msEvalExpression(layerObj *layer, shapeObj *shape, expressionObj *expression, int itemindex);
   MS_DLL_EXPORT int msShapeGetClass(layerObj *layer, mapObj *map, shapeObj *shape, int *classgroup, int numclasses);
+  MS_DLL_EXPORT featureCacheObj *msAcquireFeatureCache(featureCacheListObj *list, char *key, time_t mtime, int numshapes);
+  MS_DLL_EXPORT void msReleaseFeatureCache(featureCacheListObj *list, featureCacheObj *cache);
+  MS_DLL_EXPORT void msFeatureCacheListCleanup(featureCacheListObj *list);
+  MS_DLL_EXPORT classCacheObj *msAcquireClassCache(layerObj *layer, mapObj *map, int *classgroup, int numclasses);
+  MS_DLL_EXPORT void msReleaseClassCache(classCacheObj *cache);
+  MS_DLL_EXPORT void msClassCacheCleanup(void);
+  MS_DLL_EXPORT classDispatchObj *msCreateClassDispatch(layerObj *layer, mapObj *map, int *classgroup, int numclasses);
+  MS_DLL_EXPORT void msFreeClassDispatch(classDispatchObj *dispatch);
   MS_DLL_EXPORT int msShapeGetAnnotation(layerObj *layer, shapeObj *shape);
   MS_DLL_EXPORT int msShapeCheckSize(shapeObj *shape, double minfeaturesize);
   MS_DLL_EXPORT int msAdjustImage(rectObj rect, int *width, int *height);
@@ -2529,6 +2632,7 @@ extern "C" {
   /*      prototypes for functions in mapgdal.c                           */
   /* ==================================================================== */
   MS_DLL_EXPORT int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename );
+  MS_DLL_EXPORT int msGDALSupportsStreamingOutput( outputFormatObj *format, int bSingleFile );
   MS_DLL_EXPORT int msInitDefaultGDALOutputFormat( outputFormatObj *format );
 
   /* ==================================================================== */
@@ -2538,6 +2642,20 @@ extern "C" {
   MS_DLL_EXPORT int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format,
                                          int sendheaders );
 
+  /* ==================================================================== */
+  /*      prototypes for functions in mapgeojson.c                        */
+  /* ==================================================================== */
+  MS_DLL_EXPORT int msGeoJSONWriteFromQuery( mapObj *map, outputFormatObj *format,
+                                             int sendheaders );
+
+  /* ==================================================================== */
+  /*      prototypes for functions in mapattrindex.c                      */
+  /* ==================================================================== */
+  MS_DLL_EXPORT char *msAttributeIndexFilename(const char *source, const char *item);
+  MS_DLL_EXPORT int msWriteAttributeIndex(shapefileObj *shpfile, const char *item,
+                                          char keytype, const char *filename);
+  MS_DLL_EXPORT int msFilterAttributeIndex(layerObj *layer, shapefileObj *shpfile);
+
   /* ==================================================================== */
   /*      Public prototype for mapogr.cpp functions.                      */
   /* ==================================================================== */
@@ -2780,6 +2898,7 @@ extern "C" {
   MS_DLL_EXPORT int msPopulateRendererVTableGD( rendererVTableObj *renderer );
   MS_DLL_EXPORT int msPopulateRendererVTableKML( rendererVTableObj *renderer );
   MS_DLL_EXPORT int msPopulateRendererVTableOGR( rendererVTableObj *renderer );
+  MS_DLL_EXPORT int msPopulateRendererVTableMVT( rendererVTableObj *renderer );
 #ifdef USE_CAIRO
   MS_DLL_EXPORT void msCairoCleanup(void);
 #endif
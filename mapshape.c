@@ -36,7 +36,10 @@
 
 #include <limits.h>
 #include <assert.h>
+#include <ctype.h>
+#include <sys/stat.h>
 #include "mapserver.h"
+#include "mapthread.h"
 
 
 
@@ -476,15 +479,23 @@ SHPHandle msSHPCreate( const char * pszLayer, int nShapeType )
   pszFullname = (char *) msSmallMalloc(strlen(pszBasename) + 5);
   sprintf( pszFullname, "%s.shp", pszBasename );
   fpSHP = fopen(pszFullname, "wb" );
-  if( fpSHP == NULL )
+  if( fpSHP == NULL ) {
+    free( pszFullname );
+    free( pszBasename );
     return( NULL );
+  }
 
   sprintf( pszFullname, "%s.shx", pszBasename );
   fpSHX = fopen(pszFullname, "wb" );
-  if( fpSHX == NULL )
+  if( fpSHX == NULL ) {
+    fclose( fpSHP );
+    free( pszFullname );
+    free( pszBasename );
     return( NULL );
+  }
 
   free( pszFullname );
+  free( pszBasename );
 
   /* -------------------------------------------------------------------- */
   /*      Prepare header block for .shp file.                             */
@@ -1178,9 +1189,10 @@ int msSHXReadSize( SHPHandle psSHP, int hEntity )
 }
 
 /*
-** msSHPReadShape() - Reads the vertices for one shape from a shape file.
+** msSHPReadShapeArena() - Reads the vertices for one shape from a shape file,
+** taking the storage from arena when one is given.
 */
-void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
+static void msSHPReadShapeArena( SHPHandle psSHP, int hEntity, shapeObj *shape, shapeArenaObj *arena )
 {
   int i, j, k;
 #ifdef USE_POINT_Z_M
@@ -1189,6 +1201,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
   int nEntitySize, nRequiredSize;
 
   msInitShape(shape); /* initialize the shape */
+  shape->arena = arena;
 
   /* -------------------------------------------------------------------- */
   /*      Validate the record/entity number.                              */
@@ -1299,7 +1312,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     /* -------------------------------------------------------------------- */
     /*      Fill the shape structure.                                       */
     /* -------------------------------------------------------------------- */
-    shape->line = (lineObj *)malloc(sizeof(lineObj)*nParts);
+    shape->line = (lineObj *)msShapeArenaAlloc(arena, sizeof(lineObj)*nParts);
     MS_CHECK_ALLOC_NO_RET(shape->line, sizeof(lineObj)*nParts);
 
     shape->numlines = nParts;
@@ -1314,18 +1327,18 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
         msSetError(MS_SHPERR, "Corrupted .shp file : shape %d, shape->line[%d].numpoints=%d", "msSHPReadShape()",
                    hEntity, i, shape->line[i].numpoints);
         while(--i >= 0)
-          free(shape->line[i].point);
-        free(shape->line);
+          msShapeArenaFree(arena, shape->line[i].point);
+        msShapeArenaFree(arena, shape->line);
         shape->line = NULL;
         shape->numlines = 0;
         shape->type = MS_SHAPE_NULL;
         return;
       }
 
-      if( (shape->line[i].point = (pointObj *)malloc(sizeof(pointObj)*shape->line[i].numpoints)) == NULL ) {
+      if( (shape->line[i].point = (pointObj *)msShapeArenaAlloc(arena, sizeof(pointObj)*shape->line[i].numpoints)) == NULL ) {
         while(--i >= 0)
-          free(shape->line[i].point);
-        free(shape->line);
+          msShapeArenaFree(arena, shape->line[i].point);
+        msShapeArenaFree(arena, shape->line);
         shape->numlines = 0;
         shape->type = MS_SHAPE_NULL;
         msSetError(MS_MEMERR, "Out of memory", "msSHPReadShape()");
@@ -1413,14 +1426,14 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     /* -------------------------------------------------------------------- */
     /*      Fill the shape structure.                                       */
     /* -------------------------------------------------------------------- */
-    if( (shape->line = (lineObj *)malloc(sizeof(lineObj))) == NULL ) {
+    if( (shape->line = (lineObj *)msShapeArenaAlloc(arena, sizeof(lineObj))) == NULL ) {
       shape->type = MS_SHAPE_NULL;
       msSetError(MS_MEMERR, "Out of memory", "msSHPReadShape()");
       return;
     }
 
     if (nPoints < 0 || nPoints > 50 * 1000 * 1000) {
-      free(shape->line);
+      msShapeArenaFree(arena, shape->line);
       shape->type = MS_SHAPE_NULL;
       msSetError(MS_SHPERR, "Corrupted .shp file : shape %d, nPoints=%d.",
                  "msSHPReadShape()", hEntity, nPoints);
@@ -1431,7 +1444,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     if (psSHP->nShapeType == SHP_MULTIPOINTZ || psSHP->nShapeType == SHP_MULTIPOINTM)
       nRequiredSize += 16 + nPoints * 8;
     if (nRequiredSize > nEntitySize) {
-      free(shape->line);
+      msShapeArenaFree(arena, shape->line);
       shape->type = MS_SHAPE_NULL;
       msSetError(MS_SHPERR, "Corrupted .shp file : shape %d : nPoints = %d, nEntitySize = %d",
                  "msSHPReadShape()", hEntity, nPoints, nEntitySize);
@@ -1440,9 +1453,9 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
 
     shape->numlines = 1;
     shape->line[0].numpoints = nPoints;
-    shape->line[0].point = (pointObj *) malloc( nPoints * sizeof(pointObj) );
+    shape->line[0].point = (pointObj *) msShapeArenaAlloc( arena, nPoints * sizeof(pointObj) );
     if (shape->line[0].point == NULL) {
-      free(shape->line);
+      msShapeArenaFree(arena, shape->line);
       shape->numlines = 0;
       shape->type = MS_SHAPE_NULL;
       msSetError(MS_MEMERR, "Out of memory", "msSHPReadShape()");
@@ -1500,12 +1513,13 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
     /* -------------------------------------------------------------------- */
     /*      Fill the shape structure.                                       */
     /* -------------------------------------------------------------------- */
-    shape->line = (lineObj *)malloc(sizeof(lineObj));
+    shape->line = (lineObj *)msShapeArenaAlloc(arena, sizeof(lineObj));
     MS_CHECK_ALLOC_NO_RET(shape->line, sizeof(lineObj));
 
     shape->numlines = 1;
     shape->line[0].numpoints = 1;
-    shape->line[0].point = (pointObj *) msSmallMalloc(sizeof(pointObj));
+    shape->line[0].point = (pointObj *) msShapeArenaAlloc(arena, sizeof(pointObj));
+    MS_CHECK_ALLOC_NO_RET(shape->line[0].point, sizeof(pointObj));
 
     memcpy( &(shape->line[0].point[0].x), psSHP->pabyRec + 12, 8 );
     memcpy( &(shape->line[0].point[0].y), psSHP->pabyRec + 20, 8 );
@@ -1553,6 +1567,11 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
   return;
 }
 
+void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
+{
+  msSHPReadShapeArena( psSHP, hEntity, shape, NULL );
+}
+
 int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds)
 {
   /* -------------------------------------------------------------------- */
@@ -1615,6 +1634,217 @@ int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds)
   return MS_SUCCESS;
 }
 
+/************************************************************************/
+/*                       Shapefile handle cache                         */
+/*                                                                      */
+/*      Layers open and close their shapefiles (and tile index          */
+/*      shapefiles and .qix files) on every request.  If the            */
+/*      MS_SHAPEFILE_CACHE_SIZE config option is set, closed handles    */
+/*      are kept for the lifetime of the process, together with the    */
+/*      parsed .shx offsets and .qix headers, and handed out again by   */
+/*      msShapefileOpenCached().  A handle is only used by one layer at */
+/*      a time: it is removed from the cache while checked out.  The    */
+/*      least recently used handles are closed when the limit is        */
+/*      reached, and handles whose files have been modified since they  */
+/*      were opened are discarded.  Protected by TLOCK_SHPCACHE.        */
+/************************************************************************/
+
+typedef struct {
+  char *filename;
+  shapefileObj shpfile; /* idle shapefile, if disktree is NULL */
+  SHPTreeHandle disktree; /* idle spatial index, with its parsed header */
+  long rootoffset; /* file offset of the root node of disktree */
+  time_t mtime[2];
+  unsigned long last_used;
+} shapefileCacheEntryObj;
+
+static shapefileCacheEntryObj **shapefileCache = NULL;
+static int shapefileCacheCount = 0;
+static int shapefileCacheMax = 0;
+static unsigned long shapefileCacheClock = 0;
+
+/* modification time of filename with its extension replaced, 0 if missing */
+time_t msShapefileGetMTime(const char *filename, const char *extension)
+{
+  struct stat sStat;
+  char *path;
+  int i;
+
+  path = (char *) msSmallMalloc(strlen(filename) + strlen(extension) + 1);
+  strcpy(path, filename);
+
+  for (i = strlen(path) - 1;
+       i > 0 && path[i] != '.' && path[i] != '/' && path[i] != '\\';
+       i-- ) {}
+
+  if( path[i] == '.' )
+    path[i] = '\0';
+  strcat(path, extension);
+
+  if(stat(path, &sStat) != 0) {
+    /* try the upper case extension, as msSHPOpen() does */
+    for(i = strlen(path) - strlen(extension) + 1; path[i] != '\0'; i++)
+      path[i] = toupper(path[i]);
+    if(stat(path, &sStat) != 0) {
+      free(path);
+      return 0;
+    }
+  }
+
+  free(path);
+  return sStat.st_mtime;
+}
+
+static void msShapefileCacheRemove(int i)
+{
+  shapefileCacheEntryObj *entry = shapefileCache[i];
+
+  if(entry->disktree) {
+    msSHPDiskTreeClose(entry->disktree);
+  } else {
+    if(entry->shpfile.hSHP) msSHPClose(entry->shpfile.hSHP);
+    if(entry->shpfile.hDBF) msDBFClose(entry->shpfile.hDBF);
+  }
+  msFree(entry->filename);
+  msFree(entry);
+
+  shapefileCache[i] = shapefileCache[--shapefileCacheCount];
+}
+
+/* The cache takes over the handles of the entry. It is assumed that TLOCK_SHPCACHE is held. */
+static void msShapefileCacheAdd(shapefileCacheEntryObj *entry, int max_size)
+{
+  while( shapefileCacheCount > 0 && shapefileCacheCount >= max_size ) {
+    int i, lru = 0;
+
+    for( i = 1; i < shapefileCacheCount; i++ ) {
+      if( shapefileCache[i]->last_used < shapefileCache[lru]->last_used )
+        lru = i;
+    }
+    msShapefileCacheRemove( lru );
+  }
+
+  if( shapefileCacheCount == shapefileCacheMax ) {
+    shapefileCacheMax += 16;
+    shapefileCache = (shapefileCacheEntryObj **)
+                     msSmallRealloc( shapefileCache, sizeof(shapefileCacheEntryObj *) * shapefileCacheMax );
+  }
+
+  entry->last_used = ++shapefileCacheClock;
+  shapefileCache[shapefileCacheCount++] = entry;
+}
+
+/* Removes and returns an idle, up to date entry for filename. It is assumed that TLOCK_SHPCACHE is held. */
+static shapefileCacheEntryObj *msShapefileCacheCheckOut(const char *filename, int disktree, time_t mtime[2])
+{
+  int i;
+
+  for( i = 0; i < shapefileCacheCount; i++ ) {
+    shapefileCacheEntryObj *entry = shapefileCache[i];
+
+    if( (entry->disktree != NULL) != (disktree != MS_FALSE) || strcmp( entry->filename, filename ) != 0 )
+      continue;
+
+    if( entry->mtime[0] != mtime[0] || entry->mtime[1] != mtime[1] ) {
+      /* the file has been replaced since it was opened */
+      msShapefileCacheRemove( i-- );
+      continue;
+    }
+
+    shapefileCache[i] = shapefileCache[--shapefileCacheCount];
+    return entry;
+  }
+
+  return NULL;
+}
+
+/* Returns the handles of an open shapefile to the cache, see msShapefileClose() */
+static void msShapefileCacheRelease(shapefileObj *shpfile)
+{
+  shapefileCacheEntryObj *entry;
+
+  if(shpfile->status) {
+    free(shpfile->status);
+    shpfile->status = NULL;
+  }
+
+  entry = (shapefileCacheEntryObj *) msSmallMalloc(sizeof(shapefileCacheEntryObj));
+  entry->filename = msStrdup(shpfile->source);
+  entry->shpfile = *shpfile;
+  entry->disktree = NULL;
+  entry->rootoffset = 0;
+  entry->mtime[0] = shpfile->cachemtime[0];
+  entry->mtime[1] = shpfile->cachemtime[1];
+
+  msAcquireLock( TLOCK_SHPCACHE );
+  msShapefileCacheAdd( entry, shpfile->cachesize );
+  msReleaseLock( TLOCK_SHPCACHE );
+
+  shpfile->hSHP = NULL;
+  shpfile->hDBF = NULL;
+  shpfile->isopen = MS_FALSE;
+}
+
+/* Same as msSearchDiskTree(), but the .qix file is kept open in the cache. */
+static ms_bitarray msShapefileCacheSearchDiskTree(char *filename, rectObj aoi, int debug, int cachesize)
+{
+  shapefileCacheEntryObj *entry;
+  ms_bitarray status;
+  time_t mtime[2];
+
+  mtime[0] = msShapefileGetMTime(filename, MS_INDEX_EXTENSION);
+  mtime[1] = 0;
+
+  msAcquireLock( TLOCK_SHPCACHE );
+  entry = msShapefileCacheCheckOut( filename, MS_TRUE, mtime );
+  msReleaseLock( TLOCK_SHPCACHE );
+
+  if(entry) {
+    fseek(entry->disktree->fp, entry->rootoffset, SEEK_SET);
+  } else {
+    SHPTreeHandle disktree = msSHPDiskTreeOpen(filename, debug);
+    if(!disktree) {
+      if(debug) msSetError(MS_NOTFOUND, "Unable to open spatial index for %s. In most cases you can safely ignore this message, otherwise check file names and permissions.", "msSearchDiskTree()", filename);
+      return(NULL);
+    }
+
+    entry = (shapefileCacheEntryObj *) msSmallMalloc(sizeof(shapefileCacheEntryObj));
+    entry->filename = msStrdup(filename);
+    entry->disktree = disktree;
+    entry->rootoffset = ftell(disktree->fp);
+    entry->mtime[0] = mtime[0];
+    entry->mtime[1] = mtime[1];
+  }
+
+  status = msSearchDiskTreeHandle(entry->disktree, aoi);
+
+  msAcquireLock( TLOCK_SHPCACHE );
+  msShapefileCacheAdd( entry, cachesize );
+  msReleaseLock( TLOCK_SHPCACHE );
+
+  return(status);
+}
+
+/************************************************************************/
+/*                      msShapefileCacheCleanup()                       */
+/*                                                                      */
+/*      Close the cached handles.  Called from msCleanup().             */
+/************************************************************************/
+
+void msShapefileCacheCleanup(void)
+{
+  msAcquireLock( TLOCK_SHPCACHE );
+
+  while( shapefileCacheCount > 0 )
+    msShapefileCacheRemove( shapefileCacheCount - 1 );
+
+  msFree( shapefileCache );
+  shapefileCache = NULL;
+  shapefileCacheMax = 0;
+
+  msReleaseLock( TLOCK_SHPCACHE );
+}
+
 int msShapefileOpen(shapefileObj *shpfile, char *mode, char *filename, int log_failures)
 {
   int i;
@@ -1631,6 +1861,7 @@ int msShapefileOpen(shapefileObj *shpfile, char *mode, char *filename, int log_f
   shpfile->status = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_FALSE;
+  shpfile->cachesize = 0;
 
   /* open the shapefile file (appending ok) and get basic info */
   if(!mode)
@@ -1679,6 +1910,42 @@ int msShapefileOpen(shapefileObj *shpfile, char *mode, char *filename, int log_f
   return(0); /* all o.k. */
 }
 
+/*
+** Same as msShapefileOpen() in read-only mode, but if cachesize > 0 the handles
+** are taken from, and on msShapefileClose() returned to, the handle cache.
+*/
+int msShapefileOpenCached(shapefileObj *shpfile, char *filename, int log_failures, int cachesize)
+{
+  shapefileCacheEntryObj *entry;
+  time_t mtime[2];
+
+  if(cachesize <= 0 || !filename)
+    return msShapefileOpen(shpfile, "rb", filename, log_failures);
+
+  mtime[0] = msShapefileGetMTime(filename, ".shp");
+  mtime[1] = msShapefileGetMTime(filename, ".dbf");
+
+  msAcquireLock( TLOCK_SHPCACHE );
+  entry = msShapefileCacheCheckOut( filename, MS_FALSE, mtime );
+  msReleaseLock( TLOCK_SHPCACHE );
+
+  if(entry) {
+    *shpfile = entry->shpfile;
+    shpfile->status = NULL;
+    shpfile->lastshape = -1;
+    msFree(entry->filename);
+    msFree(entry);
+  } else if(msShapefileOpen(shpfile, "rb", filename, log_failures) == -1) {
+    return(-1);
+  }
+
+  shpfile->cachesize = cachesize;
+  shpfile->cachemtime[0] = mtime[0];
+  shpfile->cachemtime[1] = mtime[1];
+
+  return(0);
+}
+
 /* Creates a new shapefile */
 int msShapefileCreate(shapefileObj *shpfile, char *filename, int type)
 {
@@ -1707,6 +1974,7 @@ int msShapefileCreate(shapefileObj *shpfile, char *filename, int type)
   shpfile->status = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_TRUE;
+  shpfile->cachesize = 0;
 
   shpfile->hDBF = NULL; /* XBase file is NOT created here... */
   return(0);
@@ -1715,6 +1983,10 @@ int msShapefileCreate(shapefileObj *shpfile, char *filename, int type)
 void msShapefileClose(shapefileObj *shpfile)
 {
   if (shpfile && shpfile->isopen == MS_TRUE) { /* Silently return if called with NULL shpfile by freeLayer() */
+    if(shpfile->cachesize > 0) {
+      msShapefileCacheRelease(shpfile);
+      return;
+    }
     if(shpfile->hSHP) msSHPClose(shpfile->hSHP);
     if(shpfile->hDBF) msDBFClose(shpfile->hDBF);
     if(shpfile->status) free(shpfile->status);
@@ -1762,7 +2034,10 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
 
     sprintf(filename, "%s%s", sourcename, MS_INDEX_EXTENSION);
 
-    shpfile->status = msSearchDiskTree(filename, rect, debug);
+    if(shpfile->cachesize > 0)
+      shpfile->status = msShapefileCacheSearchDiskTree(filename, rect, debug, shpfile->cachesize);
+    else
+      shpfile->status = msSearchDiskTree(filename, rect, debug);
     free(filename);
     free(sourcename);
 
@@ -1799,6 +2074,14 @@ void msTileIndexAbsoluteDir(char *tiFileAbsDir, layerObj *layer)
   free(tiFileAbsDirTmp);
 }
 
+/* handle cache size for the shapefiles of a layer, see msShapefileOpenCached() */
+static int msSHPLayerCacheSize(layerObj *layer)
+{
+  const char *value = msGetConfigOption(layer->map, "MS_SHAPEFILE_CACHE_SIZE");
+
+  return value ? atoi(value) : 0;
+}
+
 /*
 ** Build possible paths we might find the tile file at:
 **   map dir + shape path + filename?
@@ -1815,13 +2098,14 @@ int msTiledSHPTryOpen(shapefileObj *shpfile, layerObj *layer, char *tiFileAbsDir
   char szPath[MS_MAXPATHLEN];
   int ignore_missing = msMapIgnoreMissingData(layer->map);
   int log_failures = MS_TRUE;
+  int cachesize = msSHPLayerCacheSize(layer);
 
   if( ignore_missing == MS_MISSING_DATA_IGNORE )
     log_failures = MS_FALSE;
 
-  if(msShapefileOpen(shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), log_failures) == -1) {
-    if(msShapefileOpen(shpfile, "rb", msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), log_failures) == -1) {
-      if(msShapefileOpen(shpfile, "rb", msBuildPath(szPath, layer->map->mappath, filename), log_failures) == -1) {
+  if(msShapefileOpenCached(shpfile, msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), log_failures, cachesize) == -1) {
+    if(msShapefileOpenCached(shpfile, msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), log_failures, cachesize) == -1) {
+      if(msShapefileOpenCached(shpfile, msBuildPath(szPath, layer->map->mappath, filename), log_failures, cachesize) == -1) {
         if(ignore_missing == MS_MISSING_DATA_FAIL) {
           msSetError(MS_IOERR, "Unable to open shapefile '%s' for layer '%s' ... fatal error.", "msTiledSHPTryOpen()", filename, layer->name);
           return(MS_FAILURE);
@@ -1845,7 +2129,7 @@ int msTiledSHPTryOpen(shapefileObj *shpfile, layerObj *layer, char *tiFileAbsDir
 
 int msTiledSHPOpenFile(layerObj *layer)
 {
-  int i;
+  int i, cachesize;
   char *filename, tilename[MS_MAXPATHLEN], szPath[MS_MAXPATHLEN];
   char tiFileAbsDir[MS_MAXPATHLEN];
 
@@ -1904,9 +2188,9 @@ int msTiledSHPOpenFile(layerObj *layer)
       return MS_FAILURE;
     }
 
-
-    if(msShapefileOpen(tSHP->tileshpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->tileindex), MS_TRUE) == -1)
-      if(msShapefileOpen(tSHP->tileshpfile, "rb", msBuildPath(szPath, layer->map->mappath, layer->tileindex), MS_TRUE) == -1)
+    cachesize = msSHPLayerCacheSize(layer);
+    if(msShapefileOpenCached(tSHP->tileshpfile, msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->tileindex), MS_TRUE, cachesize) == -1)
+      if(msShapefileOpenCached(tSHP->tileshpfile, msBuildPath(szPath, layer->map->mappath, layer->tileindex), MS_TRUE, cachesize) == -1)
         return(MS_FAILURE);
   }
 
@@ -1991,6 +2275,7 @@ int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
         return(MS_FAILURE);
 
       status = msShapefileWhichShapes(tSHP->shpfile, rect, layer->debug);
+      if(status == MS_SUCCESS) status = msFilterAttributeIndex(layer, tSHP->shpfile);
       if(status == MS_DONE) {
         /* Close and continue to next tile */
         msShapefileClose(tSHP->shpfile);
@@ -2033,6 +2318,7 @@ int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
           return(MS_FAILURE);
 
         status = msShapefileWhichShapes(tSHP->shpfile, rect, layer->debug);
+        if(status == MS_SUCCESS) status = msFilterAttributeIndex(layer, tSHP->shpfile);
         if(status == MS_DONE) {
           /* Close and continue to next tile */
           msShapefileClose(tSHP->shpfile);
@@ -2056,9 +2342,80 @@ int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   return(MS_FAILURE); /* should *never* get here */
 }
 
+/*
+** Returns MS_TRUE if the layer FILTER refers to the feature geometry
+** ([shape]), in which case it can't be evaluated before the geometry is read.
+*/
+static int msSHPFilterUsesShape(layerObj *layer)
+{
+  tokenListNodeObjPtr node;
+
+  if(layer->filter.type != MS_EXPRESSION || !layer->filter.string) return MS_FALSE;
+  if(!layer->filter.tokens) return MS_TRUE; /* not tokenized yet, play it safe */
+
+  for(node=layer->filter.tokens; node; node=node->next) {
+    if(node->token == MS_TOKEN_BINDING_SHAPE) return MS_TRUE;
+  }
+  return MS_FALSE;
+}
+
+/*
+** Reads feature i of shpfile into shape if it passes the layer FILTER. The DBF
+** record is read and the filter evaluated first, so geometry is only decoded
+** for the features that are kept. Returns MS_FALSE, with shape freed, for
+** rejected features and NULL shapes.
+*/
+static int msSHPReadFilteredShape(layerObj *layer, shapefileObj *shpfile, int i, int geometry_first, shapeObj *shape)
+{
+  char **values;
+  int numvalues, filter_passed;
+
+  msResetShapeArena(layer->shapearena); /* the caller is done with the previous shape */
+
+  if(geometry_first) {
+    msSHPReadShapeArena(shpfile->hSHP, i, shape, layer->shapearena);
+    if(shape->type == MS_SHAPE_NULL) {
+      msFreeShape(shape);
+      return MS_FALSE; /* skip NULL shapes */
+    }
+  } else {
+    msInitShape(shape);
+    shape->arena = layer->shapearena;
+    shape->index = i;
+  }
+
+  shape->numvalues = layer->numitems;
+  shape->values = msDBFGetValueListArena(shpfile->hDBF, i, layer->iteminfo, layer->numitems, layer->shapearena);
+  if(!shape->values) shape->numvalues = 0;
+
+  filter_passed = MS_TRUE;  /* By default accept ANY shape */
+  if(layer->numitems > 0 && layer->iteminfo) {
+    filter_passed = msEvalExpression(layer, shape, &(layer->filter), layer->filteritemindex);
+  }
+
+  if(!filter_passed) {
+    msFreeShape(shape); /* free's values as well */
+    return MS_FALSE;
+  }
+
+  if(!geometry_first) {
+    values = shape->values;
+    numvalues = shape->numvalues;
+    msSHPReadShapeArena(shpfile->hSHP, i, shape, layer->shapearena);
+    shape->values = values;
+    shape->numvalues = numvalues;
+    if(shape->type == MS_SHAPE_NULL) {
+      msFreeShape(shape);
+      return MS_FALSE; /* skip NULL shapes */
+    }
+  }
+
+  return MS_TRUE;
+}
+
 int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
 {
-  int i, status, filter_passed = MS_FALSE;
+  int i, status, filter_passed = MS_FALSE, geometry_first;
   char *filename, tilename[MS_MAXPATHLEN];
   char tiFileAbsDir[MS_MAXPATHLEN];
 
@@ -2074,6 +2431,7 @@ int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
   }
 
   msTileIndexAbsoluteDir(tiFileAbsDir, layer);
+  geometry_first = msSHPFilterUsesShape(layer);
 
   do {
     i = tSHP->shpfile->lastshape + 1;
@@ -2110,6 +2468,7 @@ int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
             return(MS_FAILURE);
 
           status = msShapefileWhichShapes(tSHP->shpfile, tSHP->tileshpfile->statusbounds, layer->debug);
+          if(status == MS_SUCCESS) status = msFilterAttributeIndex(layer, tSHP->shpfile);
           if(status == MS_DONE) {
             /* Close and continue to next tile */
             msShapefileClose(tSHP->shpfile);
@@ -2152,6 +2511,7 @@ int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
               return(MS_FAILURE);
 
             status = msShapefileWhichShapes(tSHP->shpfile, tSHP->tileshpfile->statusbounds, layer->debug);
+            if(status == MS_SUCCESS) status = msFilterAttributeIndex(layer, tSHP->shpfile);
             if(status == MS_DONE) {
               /* Close and continue to next tile */
               msShapefileClose(tSHP->shpfile);
@@ -2173,22 +2533,8 @@ int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
 
     tSHP->shpfile->lastshape = i;
 
-    msSHPReadShape(tSHP->shpfile->hSHP, i, shape);
-    if(shape->type == MS_SHAPE_NULL) {
-      msFreeShape(shape);
-      continue; /* skip NULL shapes */
-    }
-    shape->tileindex = tSHP->tileshpfile->lastshape;
-    shape->numvalues = layer->numitems;
-    shape->values = msDBFGetValueList(tSHP->shpfile->hDBF, i, layer->iteminfo, layer->numitems);
-    if(!shape->values) shape->numvalues = 0;
-
-    filter_passed = MS_TRUE;  /* By default accept ANY shape */
-    if(layer->numitems > 0 && layer->iteminfo) {
-      filter_passed = msEvalExpression(layer, shape, &(layer->filter), layer->filteritemindex);
-    }
-
-    if(!filter_passed) msFreeShape(shape); /* free's values as well */
+    filter_passed = msSHPReadFilteredShape(layer, tSHP->shpfile, i, geometry_first, shape);
+    if(filter_passed) shape->tileindex = tSHP->tileshpfile->lastshape;
 
   } while(!filter_passed);  /* Loop until both spatial and attribute filters match  */
 
@@ -2198,6 +2544,7 @@ int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
 int msTiledSHPGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
 {
   char *filename, tilename[MS_MAXPATHLEN], szPath[MS_MAXPATHLEN];
+  int cachesize;
 
   msTiledSHPLayerInfo *tSHP=NULL;
   char tiFileAbsDir[MS_MAXPATHLEN];
@@ -2228,9 +2575,10 @@ int msTiledSHPGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
 
     /* open the shapefile, since a specific tile was request an error should be generated if that tile does not exist */
     if(strlen(filename) == 0) return(MS_FAILURE);
-    if(msShapefileOpen(tSHP->shpfile, "rb", msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), MS_TRUE) == -1) {
-      if(msShapefileOpen(tSHP->shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), MS_TRUE) == -1) {
-        if(msShapefileOpen(tSHP->shpfile, "rb", msBuildPath(szPath, layer->map->mappath, filename), MS_TRUE) == -1) {
+    cachesize = msSHPLayerCacheSize(layer);
+    if(msShapefileOpenCached(tSHP->shpfile, msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), MS_TRUE, cachesize) == -1) {
+      if(msShapefileOpenCached(tSHP->shpfile, msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), MS_TRUE, cachesize) == -1) {
+        if(msShapefileOpenCached(tSHP->shpfile, msBuildPath(szPath, layer->map->mappath, filename), MS_TRUE, cachesize) == -1) {
           return(MS_FAILURE);
         }
       }
@@ -2480,6 +2828,7 @@ int msSHPLayerOpen(layerObj *layer)
 {
   char szPath[MS_MAXPATHLEN];
   shapefileObj *shpfile;
+  int cachesize;
 
   if(layer->layerinfo) return MS_SUCCESS; /* layer already open */
 
@@ -2493,8 +2842,9 @@ int msSHPLayerOpen(layerObj *layer)
 
   layer->layerinfo = shpfile;
 
-  if(msShapefileOpen(shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->data), MS_TRUE) == -1) {
-    if(msShapefileOpen(shpfile, "rb", msBuildPath(szPath, layer->map->mappath, layer->data), MS_TRUE) == -1) {
+  cachesize = msSHPLayerCacheSize(layer);
+  if(msShapefileOpenCached(shpfile, msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->data), MS_TRUE, cachesize) == -1) {
+    if(msShapefileOpenCached(shpfile, msBuildPath(szPath, layer->map->mappath, layer->data), MS_TRUE, cachesize) == -1) {
       layer->layerinfo = NULL;
       free(shpfile);
       return MS_FAILURE;
@@ -2529,12 +2879,13 @@ int msSHPLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     return status;
   }
 
-  return MS_SUCCESS;
+  /* narrow the spatial selection down with any attribute index on the FILTER columns */
+  return msFilterAttributeIndex(layer, shpfile);
 }
 
 int msSHPLayerNextShape(layerObj *layer, shapeObj *shape)
 {
-  int i, filter_passed=MS_FALSE;
+  int i, filter_passed=MS_FALSE, geometry_first;
   shapefileObj *shpfile;
 
   shpfile = layer->layerinfo;
@@ -2544,28 +2895,14 @@ int msSHPLayerNextShape(layerObj *layer, shapeObj *shape)
     return MS_FAILURE;
   }
 
+  geometry_first = msSHPFilterUsesShape(layer);
+
   do {
     i = msGetNextBit(shpfile->status, shpfile->lastshape + 1, shpfile->numshapes);
     shpfile->lastshape = i;
     if(i == -1) return(MS_DONE); /* nothing else to read */
 
-    msSHPReadShape(shpfile->hSHP, i, shape);
-    if(shape->type == MS_SHAPE_NULL) {
-      msFreeShape(shape);
-      continue; /* skip NULL shapes */
-    }
-    shape->numvalues = layer->numitems;
-    shape->values = msDBFGetValueList(shpfile->hDBF, i, layer->iteminfo, layer->numitems);
-    if(!shape->values) {
-      shape->numvalues = 0;
-    }
-
-    filter_passed = MS_TRUE;  /* By default accept ANY shape */
-    if(layer->numitems > 0 && layer->iteminfo) {
-      filter_passed = msEvalExpression(layer, shape, &(layer->filter), layer->filteritemindex);
-    }
-
-    if(!filter_passed) msFreeShape(shape);
+    filter_passed = msSHPReadFilteredShape(layer, shpfile, i, geometry_first, shape);
   } while(!filter_passed);  /* Loop until both spatial and attribute filters match */
 
   return MS_SUCCESS;
@@ -168,6 +168,11 @@ extern "C" {
     rectObj statusbounds; /* holds extent associated with the status vector */
 
     int isopen;
+
+#ifndef SWIG
+    int cachesize; /* if > 0, msShapefileClose() returns the handles to the handle cache */
+    time_t cachemtime[2]; /* .shp and .dbf modification times when opened */
+#endif
 #ifdef SWIG
     %mutable;
 #endif
@@ -186,6 +191,9 @@ extern "C" {
   MS_DLL_EXPORT int msShapefileCreate(shapefileObj *shpfile, char *filename, int type);
   MS_DLL_EXPORT void msShapefileClose(shapefileObj *shpfile);
   MS_DLL_EXPORT int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug);
+  MS_DLL_EXPORT int msShapefileOpenCached(shapefileObj *shpfile, char *filename, int log_failures, int cachesize);
+  MS_DLL_EXPORT void msShapefileCacheCleanup(void);
+  MS_DLL_EXPORT time_t msShapefileGetMTime(const char *filename, const char *extension);
 
   /* SHP/SHX function prototypes */
   MS_DLL_EXPORT SHPHandle msSHPOpen( const char * pszShapeFile, const char * pszAccess );
@@ -228,6 +236,7 @@ extern "C" {
   MS_DLL_EXPORT char **msDBFGetItems(DBFHandle dbffile);
   MS_DLL_EXPORT char **msDBFGetValues(DBFHandle dbffile, int record);
   MS_DLL_EXPORT char **msDBFGetValueList(DBFHandle dbffile, int record, int *itemindexes, int numitems);
+  MS_DLL_EXPORT char **msDBFGetValueListArena(DBFHandle dbffile, int record, int *itemindexes, int numitems, shapeArenaObj *arena);
   MS_DLL_EXPORT int *msDBFGetItemIndexes(DBFHandle dbffile, char **items, int numitems);
   MS_DLL_EXPORT int msDBFGetItemIndex(DBFHandle dbffile, char *name);
 
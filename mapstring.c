@@ -1599,6 +1599,94 @@ char *msGetFriBidiEncodedString(const char *string, const char *encoding)
 ** Simple charset converter. Converts string from specified encoding to UTF-8.
 ** The return value must be freed by the caller.
 */
+#ifdef USE_ICONV
+/*
+** iconv descriptors are costly to open, and labels of a layer with an
+** ENCODING set convert every string from the same charset. Opened
+** descriptors are kept per (tocode, fromcode) pair for the life of the
+** process. A descriptor carries conversion state, so it is checked out for
+** the duration of a conversion and reset when it is handed back.
+*/
+#define MS_ICONV_CACHE_SIZE 16
+
+typedef struct {
+  char *tocode;
+  char *fromcode;
+  iconv_t cd;
+  int inuse;
+} iconvCacheEntryObj;
+
+static iconvCacheEntryObj iconvCache[MS_ICONV_CACHE_SIZE];
+static int iconvCacheCount = 0;
+
+static iconv_t msIconvOpen(const char *tocode, const char *fromcode)
+{
+  iconv_t cd;
+  int i;
+
+  msAcquireLock(TLOCK_ICONV);
+  for(i=0; i<iconvCacheCount; i++) {
+    if(!iconvCache[i].inuse && strcasecmp(iconvCache[i].tocode, tocode) == 0 &&
+        strcasecmp(iconvCache[i].fromcode, fromcode) == 0) {
+      iconvCache[i].inuse = MS_TRUE;
+      msReleaseLock(TLOCK_ICONV);
+      return iconvCache[i].cd;
+    }
+  }
+  msReleaseLock(TLOCK_ICONV);
+
+  cd = iconv_open(tocode, fromcode);
+  if(cd == (iconv_t)-1)
+    return cd;
+
+  msAcquireLock(TLOCK_ICONV);
+  if(iconvCacheCount < MS_ICONV_CACHE_SIZE) { /* otherwise it is closed in msIconvClose() */
+    iconvCache[iconvCacheCount].tocode = msStrdup(tocode);
+    iconvCache[iconvCacheCount].fromcode = msStrdup(fromcode);
+    iconvCache[iconvCacheCount].cd = cd;
+    iconvCache[iconvCacheCount].inuse = MS_TRUE;
+    iconvCacheCount++;
+  }
+  msReleaseLock(TLOCK_ICONV);
+
+  return cd;
+}
+
+static void msIconvClose(iconv_t cd)
+{
+  int i;
+
+  msAcquireLock(TLOCK_ICONV);
+  for(i=0; i<iconvCacheCount; i++) {
+    if(iconvCache[i].inuse && iconvCache[i].cd == cd) {
+      iconv(cd, NULL, NULL, NULL, NULL); /* back to the initial state */
+      iconvCache[i].inuse = MS_FALSE;
+      msReleaseLock(TLOCK_ICONV);
+      return;
+    }
+  }
+  msReleaseLock(TLOCK_ICONV);
+
+  iconv_close(cd);
+}
+#endif /* USE_ICONV */
+
+void msIconvCleanup()
+{
+#ifdef USE_ICONV
+  int i;
+
+  msAcquireLock(TLOCK_ICONV);
+  for(i=0; i<iconvCacheCount; i++) {
+    iconv_close(iconvCache[i].cd);
+    msFree(iconvCache[i].tocode);
+    msFree(iconvCache[i].fromcode);
+  }
+  iconvCacheCount = 0;
+  msReleaseLock(TLOCK_ICONV);
+#endif
+}
+
 char *msGetEncodedString(const char *string, const char *encoding)
 {
 #ifdef USE_ICONV
@@ -1621,7 +1709,7 @@ char *msGetEncodedString(const char *string, const char *encoding)
   if (len == 0 || (encoding && strcasecmp(encoding, "UTF-8")==0))
     return msStrdup(string);    /* Nothing to do: string already in UTF-8 */
 
-  cd = iconv_open("UTF-8", encoding);
+  cd = msIconvOpen("UTF-8", encoding);
   if(cd == (iconv_t)-1) {
     msSetError(MS_IDENTERR, "Encoding not supported by libiconv (%s).",
                "msGetEncodedString()", encoding);
@@ -1633,7 +1721,7 @@ char *msGetEncodedString(const char *string, const char *encoding)
   out = (char*) malloc(bufsize);
   if(out == NULL) {
     msSetError(MS_MEMERR, NULL, "msGetEncodedString()");
-    iconv_close(cd);
+    msIconvClose(cd);
     return NULL;
   }
   strlcpy(out, string, bufsize);
@@ -1646,13 +1734,13 @@ char *msGetEncodedString(const char *string, const char *encoding)
     iconv_status = iconv(cd, (char**)&inp, &len, &outp, &bufleft);
     if(iconv_status == -1) {
       msFree(out);
-      iconv_close(cd);
+      msIconvClose(cd);
       return msStrdup(string);
     }
   }
   out[bufsize - bufleft] = '\0';
 
-  iconv_close(cd);
+  msIconvClose(cd);
 
   return out;
 #else
@@ -1692,7 +1780,7 @@ char* msConvertWideStringToUTF8 (const wchar_t* string, const char* encoding)
       return output;
     }
 
-    cd = iconv_open("UTF-8", encoding);
+    cd = msIconvOpen("UTF-8", encoding);
 
     nOutSize = nBufferSize;
     if ((iconv_t)-1 != cd) {
@@ -1718,11 +1806,11 @@ char* msConvertWideStringToUTF8 (const wchar_t* string, const char* encoding)
         msSetError(MS_MISCERR, "Unable to convert string in encoding '%s' to UTF8 %s",
                    "msConvertWideStringToUTF8()",
                    encoding,errormessage);
-        iconv_close(cd);
+        msIconvClose(cd);
         msFree(output);
         return NULL;
       }
-      iconv_close(cd);
+      msIconvClose(cd);
     } else {
       msSetError(MS_MISCERR, "Encoding not supported by libiconv (%s).",
                  "msConvertWideStringToUTF8()",
@@ -75,6 +75,9 @@ static char *olLayerWMSTag = \
                              "                                   {singleTile: \"true\", ratio:1, projection: '[openlayers_projection]'});\n";
 
 static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mode);
+static int processItemTag(layerObj *layer, char **line, shapeObj *shape);
+static int processShplabelTag(layerObj *layer, char **line, shapeObj *origshape);
+static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape);
 
 static int isValidTemplate(FILE *stream, const char *filename)
 {
@@ -262,6 +265,13 @@ int msReturnTemplateQuery(mapservObj *mapserv, char *queryFormat, char **papszBu
       return status;
     }
 
+    if( MS_RENDERER_GEOJSON(outputFormat) ) {
+      if( mapserv != NULL )
+        checkWebScale(mapserv);
+
+      return msGeoJSONWriteFromQuery(map, outputFormat, mapserv->sendheaders);
+    }
+
     if( !MS_RENDERER_TEMPLATE(outputFormat) ) { /* got an image format, return the query results that way */
       outputFormatObj *tempOutputFormat = map->outputformat; /* save format */
 
@@ -839,6 +849,347 @@ static char *getPostTagText(const char *string1, const char *string2)
   return msStrdup(tmpstr);
 }
 
+/*
+** Append len bytes of text to a buffer that tracks its own length and
+** allocated size. The buffer grows geometrically so that building a long
+** result set stays linear in the size of the output.
+*/
+static void appendTemplateText(char **buffer, int *length, int *size, const char *text, int len)
+{
+  if(len <= 0) return;
+
+  if(*buffer == NULL || *length + len + 1 > *size) {
+    int newsize = (*size > 0) ? *size : MS_BUFFER_LENGTH;
+    while(*length + len + 1 > newsize)
+      newsize *= 2;
+    *buffer = (char *) msSmallRealloc(*buffer, newsize);
+    *size = newsize;
+  }
+
+  memcpy(*buffer + *length, text, len);
+  *length += len;
+  (*buffer)[*length] = '\0';
+}
+
+/*
+** A [feature] block is compiled once into a list of tokens that is then
+** rendered for every result, instead of running the full processLine()
+** substitution chain over the block for each feature. Only the per-feature
+** tags are compiled, anything that processLine() could resolve to map level
+** content (or that it resolves in an order we can't reproduce here) makes
+** the compilation fail and the caller falls back to processLine().
+*/
+enum featureTokenType {
+  FT_LITERAL, FT_ITEM, FT_PARAM, FT_TAG_SHPXY, FT_TAG_SHPLABEL, FT_TAG_ITEM,
+  FT_SHPMID, FT_SHPMIDX, FT_SHPMIDY, FT_SHPCLASS, FT_SHPMINX, FT_SHPMINY, FT_SHPMAXX, FT_SHPMAXY,
+  FT_SHPIDX, FT_TILEIDX, FT_VALUES, FT_RN, FT_LRN, FT_CL
+};
+
+typedef struct {
+  enum featureTokenType type;
+  int index; /* item or parameter index */
+  int encoding; /* 0=html, 1=url, 2=raw */
+  const char *text; /* points into the template */
+  int length;
+} featureTokenObj;
+
+typedef struct {
+  featureTokenObj *tokens;
+  int numtokens;
+} featureTemplateObj;
+
+static const struct {
+  const char *name;
+  enum featureTokenType type;
+} featureSimpleTags[] = {
+  {"shpmid", FT_SHPMID}, {"shpmidx", FT_SHPMIDX}, {"shpmidy", FT_SHPMIDY}, {"shpclass", FT_SHPCLASS},
+  {"shpminx", FT_SHPMINX}, {"shpminy", FT_SHPMINY}, {"shpmaxx", FT_SHPMAXX}, {"shpmaxy", FT_SHPMAXY},
+  {"shpidx", FT_SHPIDX}, {"tileidx", FT_TILEIDX}, {"values", FT_VALUES}, {"rn", FT_RN}, {"lrn", FT_LRN}, {"cl", FT_CL},
+  {NULL, FT_LITERAL}
+};
+
+/* tags processLine() substitutes with map level values before it gets to the attributes */
+static const char *featureReservedTags[] = {
+  "version", "img", "ref", "errmsg", "errmsg_esc", "legend", "scalebar", "queryfile", "map", "mapserv_onlineresource",
+  "host", "port", "id", "layers", "layers_esc", "toggle_layers", "toggle_layers_esc", "mapx", "mapy", "minx", "maxx",
+  "miny", "maxy", "date", "mapext", "mapext_esc", "dx", "dy", "rawminx", "rawmaxx", "rawminy", "rawmaxy", "rawext",
+  "rawext_esc", "maplon", "maplat", "minlon", "maxlon", "minlat", "maxlat", "mapext_latlon", "mapext_latlon_esc",
+  "refminx", "refmaxx", "refminy", "refmaxy", "refext", "refext_esc", "mapsize", "mapsize_esc", "mapwidth", "mapheight",
+  "scale", "scaledenom", "cellsize", "center", "center_x", "center_y", "nr", "nl", "nlr", "items", "shpext", "shpext_esc",
+  "include", "resultset", "feature", "if", NULL
+};
+
+static const char *featureReservedPrefixes[] = { "web_", "zoom_", "zoomdir_", "metadata_", "join_", NULL };
+
+static int isReservedFeatureTag(mapservObj *mapserv, const char *tag, int length)
+{
+  int i, n;
+
+  for(n=0; n<length && tag[n] != ' '; n++); /* tag name, without arguments */
+
+  for(i=0; featureReservedTags[i]; i++)
+    if((int)strlen(featureReservedTags[i]) == n && strncmp(tag, featureReservedTags[i], n) == 0) return MS_TRUE;
+
+  for(i=0; featureReservedPrefixes[i]; i++)
+    if(strncmp(tag, featureReservedPrefixes[i], strlen(featureReservedPrefixes[i])) == 0) return MS_TRUE;
+
+  /* layer metadata ([layer_key]) and toggle ([layer_check], [group_select]) tags */
+  for(i=0; i<mapserv->map->numlayers; i++) {
+    layerObj *lp = GET_LAYER(mapserv->map, i);
+    if(lp->name && (n = strlen(lp->name)) < length && strncmp(tag, lp->name, n) == 0 && tag[n] == '_') return MS_TRUE;
+    if(lp->group && (n = strlen(lp->group)) < length && strncmp(tag, lp->group, n) == 0 && tag[n] == '_') return MS_TRUE;
+  }
+
+  return MS_FALSE;
+}
+
+/* does tag (length bytes) match name followed by suffix? */
+static int matchFeatureTag(const char *tag, int length, const char *name, const char *suffix, int casesensitive)
+{
+  int n = strlen(name), m = strlen(suffix);
+
+  if(n + m != length) return MS_FALSE;
+  if(casesensitive)
+    return(strncmp(tag, name, n) == 0 && strncmp(tag + n, suffix, m) == 0);
+  return(strncasecmp(tag, name, n) == 0 && strncasecmp(tag + n, suffix, m) == 0);
+}
+
+static void addFeatureToken(featureTemplateObj *ft, int *size, enum featureTokenType type, int index, int encoding, const char *text, int length)
+{
+  featureTokenObj *token;
+
+  if(type == FT_LITERAL && ft->numtokens > 0 && ft->tokens[ft->numtokens-1].type == FT_LITERAL) {
+    ft->tokens[ft->numtokens-1].length += length; /* literals are always contiguous */
+    return;
+  }
+
+  if(ft->numtokens == *size) {
+    *size = (*size == 0) ? 16 : *size * 2;
+    ft->tokens = (featureTokenObj *) msSmallRealloc(ft->tokens, sizeof(featureTokenObj) * (*size));
+  }
+
+  token = &(ft->tokens[ft->numtokens++]);
+  token->type = type;
+  token->index = index;
+  token->encoding = encoding;
+  token->text = text;
+  token->length = length;
+}
+
+static int isFeatureTagStart(const char *p, const char *name)
+{
+  int n = strlen(name);
+  return(strncmp(p + 1, name, n) == 0 && (p[n+1] == ' ' || p[n+1] == ']'));
+}
+
+/*
+** Compile the body of a [feature] block. Returns MS_FALSE if the block uses
+** something we can't render from tokens, ft is left empty in that case.
+*/
+static int compileFeatureTemplate(mapservObj *mapserv, layerObj *layer, const char *tag, featureTemplateObj *ft)
+{
+  const char *p = tag, *q, *end;
+  int i, length, size = 0, found;
+
+  ft->tokens = NULL;
+  ft->numtokens = 0;
+
+  if(layer->numjoins > 0) return MS_FALSE;
+
+  while(*p) {
+    if(*p != '[') {
+      q = strchr(p, '[');
+      length = q ? (int)(q - p) : (int)strlen(p);
+      addFeatureToken(ft, &size, FT_LITERAL, 0, 0, p, length);
+      p += length;
+      continue;
+    }
+
+    /* self-contained tags with arguments, processed ahead of the attributes */
+    if(isFeatureTagStart(p, "shpxy") || isFeatureTagStart(p, "shplabel")) {
+      if((end = findTagEnd(p)) == NULL) break;
+      addFeatureToken(ft, &size, isFeatureTagStart(p, "shpxy") ? FT_TAG_SHPXY : FT_TAG_SHPLABEL, 0, 0, p, end - p + 1);
+      p = end + 1;
+      continue;
+    }
+
+    q = p + 1 + strcspn(p + 1, "[]");
+    if(*q != ']') { /* not a tag */
+      addFeatureToken(ft, &size, FT_LITERAL, 0, 0, p, 1);
+      p++;
+      continue;
+    }
+    length = q - p - 1;
+
+    found = MS_FALSE;
+    for(i=0; featureSimpleTags[i].name; i++) {
+      if(matchFeatureTag(p + 1, length, featureSimpleTags[i].name, "", MS_TRUE)) {
+        addFeatureToken(ft, &size, featureSimpleTags[i].type, 0, 0, p, length + 2);
+        found = MS_TRUE;
+        break;
+      }
+    }
+    if(found) {
+      p = q + 1;
+      continue;
+    }
+
+    if(isReservedFeatureTag(mapserv, p + 1, length)) break;
+
+    for(i=0; i<layer->numitems && !found; i++) {
+      if(matchFeatureTag(p + 1, length, layer->items[i], "", MS_TRUE)) {
+        addFeatureToken(ft, &size, FT_ITEM, i, 0, p, length + 2);
+        found = MS_TRUE;
+      } else if(matchFeatureTag(p + 1, length, layer->items[i], "_esc", MS_TRUE)) {
+        addFeatureToken(ft, &size, FT_ITEM, i, 1, p, length + 2);
+        found = MS_TRUE;
+      } else if(matchFeatureTag(p + 1, length, layer->items[i], "_raw", MS_TRUE)) {
+        addFeatureToken(ft, &size, FT_ITEM, i, 2, p, length + 2);
+        found = MS_TRUE;
+      }
+    }
+    if(found) {
+      p = q + 1;
+      continue;
+    }
+
+    if(isFeatureTagStart(p, "item")) {
+      if((end = findTagEnd(p)) == NULL) break;
+      addFeatureToken(ft, &size, FT_TAG_ITEM, 0, 0, p, end - p + 1);
+      p = end + 1;
+      continue;
+    }
+
+    for(i=0; i<mapserv->request->NumParams && !found; i++) {
+      if(matchFeatureTag(p + 1, length, mapserv->request->ParamNames[i], "", MS_FALSE)) {
+        addFeatureToken(ft, &size, FT_PARAM, i, 0, p, length + 2);
+        found = MS_TRUE;
+      } else if(matchFeatureTag(p + 1, length, mapserv->request->ParamNames[i], "_esc", MS_FALSE)) {
+        addFeatureToken(ft, &size, FT_PARAM, i, 1, p, length + 2);
+        found = MS_TRUE;
+      }
+    }
+    if(found) {
+      p = q + 1;
+      continue;
+    }
+
+    /* nothing in processLine() would replace this, keep it as text */
+    addFeatureToken(ft, &size, FT_LITERAL, 0, 0, p, 1);
+    p++;
+  }
+
+  if(*p) { /* bailed out */
+    free(ft->tokens);
+    ft->tokens = NULL;
+    ft->numtokens = 0;
+    return MS_FALSE;
+  }
+
+  return MS_TRUE;
+}
+
+static int renderFeatureTemplate(mapservObj *mapserv, featureTemplateObj *ft, char **buffer, int *length, int *size)
+{
+  int i, status;
+  char repstr[256], *str;
+  layerObj *layer = mapserv->resultlayer;
+  shapeObj *shape = &(mapserv->resultshape);
+
+  for(i=0; i<ft->numtokens; i++) {
+    featureTokenObj *token = &(ft->tokens[i]);
+
+    repstr[0] = '\0';
+    str = NULL;
+
+    switch(token->type) {
+      case FT_LITERAL:
+        appendTemplateText(buffer, length, size, token->text, token->length);
+        continue;
+      case FT_ITEM:
+        if(token->encoding == 0)
+          str = msEncodeHTMLEntities(shape->values[token->index]);
+        else if(token->encoding == 1)
+          str = msEncodeUrl(shape->values[token->index]);
+        else
+          str = msStrdup(shape->values[token->index]);
+        break;
+      case FT_PARAM:
+        if(token->encoding == 0)
+          str = msEncodeHTMLEntities(mapserv->request->ParamValues[token->index]);
+        else
+          str = msEncodeUrl(mapserv->request->ParamValues[token->index]);
+        break;
+      case FT_TAG_SHPXY:
+      case FT_TAG_SHPLABEL:
+      case FT_TAG_ITEM:
+        str = (char *) msSmallMalloc(token->length + 1);
+        strlcpy(str, token->text, token->length + 1);
+        if(token->type == FT_TAG_SHPXY)
+          status = processShpxyTag(layer, &str, shape);
+        else if(token->type == FT_TAG_SHPLABEL)
+          status = processShplabelTag(layer, &str, shape);
+        else
+          status = processItemTag(layer, &str, shape);
+        if(status != MS_SUCCESS) {
+          free(str);
+          return MS_FAILURE;
+        }
+        break;
+      case FT_SHPMID:
+        snprintf(repstr, sizeof(repstr), "%f %f", (shape->bounds.maxx + shape->bounds.minx)/2, (shape->bounds.maxy + shape->bounds.miny)/2);
+        break;
+      case FT_SHPMIDX:
+        snprintf(repstr, sizeof(repstr), "%f", (shape->bounds.maxx + shape->bounds.minx)/2);
+        break;
+      case FT_SHPMIDY:
+        snprintf(repstr, sizeof(repstr), "%f", (shape->bounds.maxy + shape->bounds.miny)/2);
+        break;
+      case FT_SHPCLASS:
+        snprintf(repstr, sizeof(repstr), "%d", shape->classindex);
+        break;
+      case FT_SHPMINX:
+        snprintf(repstr, sizeof(repstr), "%f", shape->bounds.minx);
+        break;
+      case FT_SHPMINY:
+        snprintf(repstr, sizeof(repstr), "%f", shape->bounds.miny);
+        break;
+      case FT_SHPMAXX:
+        snprintf(repstr, sizeof(repstr), "%f", shape->bounds.maxx);
+        break;
+      case FT_SHPMAXY:
+        snprintf(repstr, sizeof(repstr), "%f", shape->bounds.maxy);
+        break;
+      case FT_SHPIDX:
+        snprintf(repstr, sizeof(repstr), "%ld", shape->index);
+        break;
+      case FT_TILEIDX:
+        snprintf(repstr, sizeof(repstr), "%d", shape->tileindex);
+        break;
+      case FT_VALUES:
+        str = msJoinStrings(shape->values, layer->numitems, ",");
+        break;
+      case FT_RN:
+        snprintf(repstr, sizeof(repstr), "%d", mapserv->RN);
+        break;
+      case FT_LRN:
+        snprintf(repstr, sizeof(repstr), "%d", mapserv->LRN);
+        break;
+      case FT_CL:
+        if(layer->name) appendTemplateText(buffer, length, size, layer->name, strlen(layer->name));
+        continue;
+    }
+
+    if(str) {
+      appendTemplateText(buffer, length, size, str, strlen(str));
+      free(str);
+    } else
+      appendTemplateText(buffer, length, size, repstr, strlen(repstr));
+  }
+
+  return MS_SUCCESS;
+}
+
 /*
 ** Function to process a [feature ...] tag. This tag can *only* be found within
 ** a [resultset ...][/resultset] block.
@@ -854,6 +1205,10 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   int limit=-1;
   char *trimLast=NULL;
 
+  featureTemplateObj ft;
+  int compiled;
+  int length, size;
+
   int i, j, status;
 
   if(!*line) {
@@ -892,6 +1247,8 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   /* start rebuilding **line */
   free(*line);
   *line = preTag;
+  length = strlen(preTag);
+  size = length + 1;
 
   /* we know the layer has query results or we wouldn't be in this code */
 
@@ -921,9 +1278,12 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   else
     limit = MS_MIN(limit, layer->resultcache->numresults);
 
+  compiled = compileFeatureTemplate(mapserv, layer, tag, &ft);
+
   for(i=0; i<limit; i++) {
     status = msLayerGetShape(layer, &(mapserv->resultshape), &(layer->resultcache->results[i]));
     if(status != MS_SUCCESS) {
+      free(ft.tokens);
       msFreeHashTable(tagArgs);
       return status;
     }
@@ -949,15 +1309,30 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
     */
     if(trimLast && (i == limit-1)) {
       char *ptr;
-      if((ptr = strrstr(tag, trimLast)) != NULL)
+      if((ptr = strrstr(tag, trimLast)) != NULL) {
         *ptr = '\0';
+        compiled = MS_FALSE; /* tokens point into the old tag */
+      }
     }
 
     /* process the tag */
-    tagInstance = processLine(mapserv, tag, NULL, QUERY); /* do substitutions */
-    *line = msStringConcatenate(*line, tagInstance); /* grow the line */
+    if(compiled) {
+      if(renderFeatureTemplate(mapserv, &ft, line, &length, &size) != MS_SUCCESS) {
+        free(ft.tokens);
+        msFreeHashTable(tagArgs);
+        return MS_FAILURE;
+      }
+    } else {
+      tagInstance = processLine(mapserv, tag, NULL, QUERY); /* do substitutions */
+      if(!tagInstance) {
+        free(ft.tokens);
+        msFreeHashTable(tagArgs);
+        return MS_FAILURE;
+      }
+      appendTemplateText(line, &length, &size, tagInstance, strlen(tagInstance)); /* grow the line */
+      free(tagInstance);
+    }
 
-    free(tagInstance);
     msFreeShape(&(mapserv->resultshape)); /* init too */
 
     mapserv->RN++; /* increment counters */
@@ -967,11 +1342,12 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   /* msLayerClose(layer); */
   mapserv->resultlayer = NULL; /* necessary? */
 
-  *line = msStringConcatenate(*line, postTag);
+  appendTemplateText(line, &length, &size, postTag, strlen(postTag));
 
   /*
   ** clean up
   */
+  free(ft.tokens);
   free(postTag);
   free(tag);
   msFreeHashTable(tagArgs);
@@ -3685,7 +4061,7 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
    */
 
   if(&(mapserv->map->web.metadata) && strstr(outstr, "web_")) {
-    for (j=0; j<MS_HASHSIZE; j++) {
+    for (j=0; j<mapserv->map->web.metadata.size; j++) {
       if(mapserv->map->web.metadata.items[j] != NULL) {
         for(tp=mapserv->map->web.metadata.items[j]; tp!=NULL; tp=tp->next) {
           snprintf(substr, PROCESSLINE_BUFLEN, "[web_%s]", tp->key);
@@ -3703,7 +4079,7 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
   /* allow layer metadata access in template */
   for(i=0; i<mapserv->map->numlayers; i++) {
     if(&(GET_LAYER(mapserv->map, i)->metadata) && GET_LAYER(mapserv->map, i)->name && strstr(outstr, GET_LAYER(mapserv->map, i)->name)) {
-      for(j=0; j<MS_HASHSIZE; j++) {
+      for(j=0; j<GET_LAYER(mapserv->map, i)->metadata.size; j++) {
         if(GET_LAYER(mapserv->map, i)->metadata.items[j] != NULL) {
           for(tp=GET_LAYER(mapserv->map, i)->metadata.items[j]; tp!=NULL; tp=tp->next) {
             snprintf(substr, PROCESSLINE_BUFLEN, "[%s_%s]", GET_LAYER(mapserv->map, i)->name, tp->key);
@@ -3870,7 +4246,7 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
 
     /* allow layer metadata access in a query template, within the context of a query no layer name is necessary */
     if(&(mapserv->resultlayer->metadata) && strstr(outstr, "[metadata_")) {
-      for(i=0; i<MS_HASHSIZE; i++) {
+      for(i=0; i<mapserv->resultlayer->metadata.size; i++) {
         if(mapserv->resultlayer->metadata.items[i] != NULL) {
           for(tp=mapserv->resultlayer->metadata.items[i]; tp!=NULL; tp=tp->next) {
             snprintf(substr, PROCESSLINE_BUFLEN, "[metadata_%s]", tp->key);
@@ -4028,7 +4404,6 @@ int msReturnPage(mapservObj *mapserv, char *html, int mode, char **papszBuffer)
   char line[MS_BUFFER_LENGTH], *tmpline;
   int   nBufferSize = 0;
   int   nCurrentSize = 0;
-  int   nExpandBuffer = 0;
 
   ms_regex_t re; /* compiled regular expression to be matched */
   char szPath[MS_MAXPATHLEN];
@@ -4066,11 +4441,9 @@ int msReturnPage(mapservObj *mapserv, char *html, int mode, char **papszBuffer)
       (*papszBuffer)[0] = '\0';
       nBufferSize = MS_TEMPLATE_BUFFER;
       nCurrentSize = 0;
-      nExpandBuffer = 1;
     } else {
       nCurrentSize = strlen((*papszBuffer));
-      nBufferSize = nCurrentSize;
-      nExpandBuffer = (nCurrentSize/MS_TEMPLATE_BUFFER) + 1;
+      nBufferSize = nCurrentSize + 1;
     }
   }
 
@@ -4078,37 +4451,28 @@ int msReturnPage(mapservObj *mapserv, char *html, int mode, char **papszBuffer)
 
     if(strchr(line, '[') != NULL) {
       tmpline = processLine(mapserv, line, stream, mode);
-      if(!tmpline)
+      if(!tmpline) {
+        fclose(stream);
         return MS_FAILURE;
+      }
 
-      if(papszBuffer) {
-        if(nBufferSize <= (int)(nCurrentSize + strlen(tmpline) + 1)) {
-          nExpandBuffer = (strlen(tmpline) /  MS_TEMPLATE_BUFFER) + 1;
-          nBufferSize = MS_TEMPLATE_BUFFER*nExpandBuffer + strlen((*papszBuffer));
-          (*papszBuffer) = (char *) msSmallRealloc((*papszBuffer),sizeof(char)*nBufferSize);
-        }
-        strcat((*papszBuffer), tmpline);
-        nCurrentSize += strlen(tmpline);
-      } else
+      if(papszBuffer)
+        appendTemplateText(papszBuffer, &nCurrentSize, &nBufferSize, tmpline, strlen(tmpline));
+      else
         msIO_fwrite(tmpline, strlen(tmpline), 1, stdout);
 
       free(tmpline);
     } else {
-      if(papszBuffer) {
-        if(nBufferSize <= (int)(nCurrentSize + strlen(line))) {
-          nExpandBuffer = (strlen(line) /  MS_TEMPLATE_BUFFER) + 1;
-          nBufferSize = MS_TEMPLATE_BUFFER*nExpandBuffer + strlen((*papszBuffer));
-          (*papszBuffer) = (char *)msSmallRealloc((*papszBuffer),sizeof(char)*nBufferSize);
-        }
-        strcat((*papszBuffer), line);
-        nCurrentSize += strlen(line);
-      } else
+      if(papszBuffer)
+        appendTemplateText(papszBuffer, &nCurrentSize, &nBufferSize, line, strlen(line));
+      else
         msIO_fwrite(line, strlen(line), 1, stdout);
     }
-    if(!papszBuffer)
-      fflush(stdout);
   } /* next line */
 
+  if(!papszBuffer)
+    fflush(stdout);
+
   fclose(stream);
 
   return MS_SUCCESS;
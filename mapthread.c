@@ -144,7 +144,9 @@ static int thread_debug = 0;
 
 static char *lock_names[] = {
   NULL, "PARSER", "GDAL", "ERROROBJ", "PROJ", "TTF", "POOL", "SDE",
-  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", NULL
+  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ",
+  "OGR", "TIME", "FRIBIDI", "CLUSTER", "HTTPCACHE", "ICONV", "SHPCACHE",
+  "CLASSCACHE", "LABELPOINTCACHE", NULL
 };
 #endif
 
@@ -67,8 +67,14 @@ extern "C" {
 #define TLOCK_OGR       14
 #define TLOCK_TIME      15
 #define TLOCK_FRIBIDI   16
-
-#define TLOCK_STATIC_MAX 20
+#define TLOCK_CLUSTER   17
+#define TLOCK_HTTPCACHE 18
+#define TLOCK_ICONV     19
+#define TLOCK_SHPCACHE  20
+#define TLOCK_CLASSCACHE 21
+#define TLOCK_LABELPOINTCACHE 22
+
+#define TLOCK_STATIC_MAX 23
 #define TLOCK_MAX       100
 
 #ifdef __cplusplus
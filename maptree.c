@@ -31,6 +31,10 @@
 #include "mapserver.h"
 #include "maptree.h"
 
+#if defined(USE_THREAD) && !defined(_WIN32)
+#include <pthread.h>
+#endif
+
 
 
 /* -------------------------------------------------------------------- */
@@ -43,6 +47,8 @@
 #define SPLITRATIO  0.55
 
 static int treeAddShapeId(treeObj *tree, int id, rectObj rect);
+static int treeNodeAddShapeId( treeNodeObj *node, int id, rectObj rect, int maxdepth);
+static void treeSplitBounds( rectObj *in, rectObj *out1, rectObj *out2);
 
 static void SwapWord( int length, void * wordP )
 {
@@ -191,13 +197,9 @@ void msSHPDiskTreeClose(SHPTreeHandle disktree)
 }
 
 
-treeObj *msCreateTree(shapefileObj *shapefile, int maxdepth)
+static treeObj *treeCreate(shapefileObj *shapefile, int maxdepth)
 {
-  int i;
   treeObj *tree;
-  rectObj bounds;
-
-  if(!shapefile) return NULL;
 
   /* -------------------------------------------------------------------- */
   /*      Allocate the tree object                                        */
@@ -225,6 +227,19 @@ treeObj *msCreateTree(shapefileObj *shapefile, int maxdepth)
   /* -------------------------------------------------------------------- */
   tree->root = treeNodeCreate(shapefile->bounds);
 
+  return tree;
+}
+
+treeObj *msCreateTree(shapefileObj *shapefile, int maxdepth)
+{
+  int i;
+  treeObj *tree;
+  rectObj bounds;
+
+  if(!shapefile) return NULL;
+
+  tree = treeCreate(shapefile, maxdepth);
+
   for(i=0; i<shapefile->numshapes; i++) {
     if(msSHPReadBounds(shapefile->hSHP, i, &bounds) == MS_SUCCESS)
       treeAddShapeId(tree, i, bounds);
@@ -233,6 +248,181 @@ treeObj *msCreateTree(shapefileObj *shapefile, int maxdepth)
   return tree;
 }
 
+#if defined(USE_THREAD) && !defined(_WIN32) && MAX_SUBNODES == 4
+
+/* -------------------------------------------------------------------- */
+/*      Number of shapes whose bounds are read and inserted at a time   */
+/*      by msCreateTreeParallel(), this bounds the memory used.         */
+/* -------------------------------------------------------------------- */
+#define TREE_CHUNK_SIZE 262144
+
+typedef struct {
+  treeObj *tree;
+  SHPHandle hSHP; /* private handle of this thread */
+  int first, last; /* range of shape ids of the chunk */
+  int start, end; /* part of the range handled by this thread */
+  rectObj *bounds; /* bounds of the shapes of the chunk */
+  signed char *part; /* -1: unreadable, 0: root node, 1-4: root subnode */
+} treeBuildTask;
+
+static void *treeReadBoundsThread(void *arg)
+{
+  treeBuildTask *task = (treeBuildTask *) arg;
+  int i;
+
+  for(i=task->start; i<task->end; i++) {
+    if(msSHPReadBounds(task->hSHP, i, &task->bounds[i-task->first]) == MS_SUCCESS)
+      task->part[i-task->first] = 0;
+    else
+      task->part[i-task->first] = -1;
+  }
+
+  return NULL;
+}
+
+/* inserts the shapes of the chunk that belong to the root subnode task->start */
+static void *treeAddSubnodeThread(void *arg)
+{
+  treeBuildTask *task = (treeBuildTask *) arg;
+  treeNodeObj *subnode = task->tree->root->subnode[task->start-1];
+  int i;
+
+  for(i=task->first; i<task->last; i++) {
+    if(task->part[i-task->first] == task->start)
+      treeNodeAddShapeId(subnode, i, task->bounds[i-task->first], task->tree->maxdepth-1);
+  }
+
+  return NULL;
+}
+
+/* -------------------------------------------------------------------- */
+/*      Same as msCreateTree(), but the shape bounds are read by        */
+/*      numthreads threads with their own .shp handle, and the four     */
+/*      subtrees of the root node are built concurrently.  Shapes are   */
+/*      added to each node in id order, so the resulting tree is        */
+/*      identical to the one built by msCreateTree().                   */
+/* -------------------------------------------------------------------- */
+treeObj *msCreateTreeParallel(shapefileObj *shapefile, int maxdepth, int numthreads)
+{
+  treeObj *tree;
+  treeBuildTask *tasks, subtasks[4];
+  pthread_t *threads, subthreads[4];
+  rectObj *bounds, half1, half2, quad[4];
+  signed char *part;
+  int *started, substarted[4];
+  int i, j, first;
+
+  if(!shapefile) return NULL;
+
+  if(numthreads <= 1)
+    return msCreateTree(shapefile, maxdepth);
+
+  tree = treeCreate(shapefile, maxdepth);
+  if(tree->maxdepth <= 1) { /* everything goes into the root node */
+    msDestroyTree(tree);
+    return msCreateTree(shapefile, maxdepth);
+  }
+
+  tasks = (treeBuildTask *) msSmallCalloc(numthreads, sizeof(treeBuildTask));
+  threads = (pthread_t *) msSmallMalloc(sizeof(pthread_t) * numthreads);
+  started = (int *) msSmallMalloc(sizeof(int) * numthreads);
+  bounds = (rectObj *) msSmallMalloc(sizeof(rectObj) * MS_MIN(shapefile->numshapes, TREE_CHUNK_SIZE));
+  part = (signed char *) msSmallMalloc(MS_MAX(MS_MIN(shapefile->numshapes, TREE_CHUNK_SIZE), 1));
+
+  for(j=0; j<numthreads; j++) {
+    tasks[j].tree = tree;
+    tasks[j].hSHP = msSHPOpen(shapefile->source, "rb");
+    tasks[j].bounds = bounds;
+    tasks[j].part = part;
+    if(!tasks[j].hSHP) {
+      msSetError(MS_IOERR, "(%s)", "msCreateTreeParallel()", shapefile->source);
+      msDestroyTree(tree);
+      tree = NULL;
+      numthreads = j;
+      break;
+    }
+  }
+
+  /* the root subnodes that treeNodeAddShapeId() would create */
+  treeSplitBounds(&shapefile->bounds, &half1, &half2);
+  treeSplitBounds(&half1, &quad[0], &quad[1]);
+  treeSplitBounds(&half2, &quad[2], &quad[3]);
+
+  for(first=0; tree && first<shapefile->numshapes; first+=TREE_CHUNK_SIZE) {
+    int last = MS_MIN(first+TREE_CHUNK_SIZE, shapefile->numshapes);
+    int numsubtrees;
+
+    /* read the bounds of the chunk */
+    for(j=0; j<numthreads; j++) {
+      tasks[j].first = first;
+      tasks[j].last = last;
+      tasks[j].start = first + (int)(((double)(last-first) * j) / numthreads);
+      tasks[j].end = first + (int)(((double)(last-first) * (j+1)) / numthreads);
+      /* if no thread can be created (e.g. EAGAIN), do the work in this one */
+      started[j] = (pthread_create(&threads[j], NULL, treeReadBoundsThread, &tasks[j]) == 0);
+      if(!started[j])
+        treeReadBoundsThread(&tasks[j]);
+    }
+    for(j=0; j<numthreads; j++)
+      if(started[j]) pthread_join(threads[j], NULL);
+
+    /* assign each shape to the first root subnode containing it */
+    for(i=first; i<last; i++) {
+      if(part[i-first] < 0) continue;
+      for(j=0; j<4; j++) {
+        if(msRectContained(&bounds[i-first], &quad[j])) {
+          part[i-first] = j+1;
+          break;
+        }
+      }
+      if(part[i-first] > 0 && tree->root->numsubnodes == 0) {
+        tree->root->numsubnodes = 4;
+        for(j=0; j<4; j++)
+          tree->root->subnode[j] = treeNodeCreate(quad[j]);
+      }
+    }
+
+    /* build the subtrees, at most numthreads at a time, and fill the root node meanwhile */
+    numsubtrees = tree->root->numsubnodes;
+    for(j=0; j<numsubtrees; j++) {
+      subtasks[j] = tasks[0];
+      subtasks[j].start = j+1;
+      if(j >= numthreads && substarted[j-numthreads])
+        pthread_join(subthreads[j-numthreads], NULL);
+      substarted[j] = (pthread_create(&subthreads[j], NULL, treeAddSubnodeThread, &subtasks[j]) == 0);
+      if(!substarted[j])
+        treeAddSubnodeThread(&subtasks[j]);
+    }
+
+    for(i=first; i<last; i++) {
+      if(part[i-first] == 0)
+        treeNodeAddShapeId(tree->root, i, bounds[i-first], 1);
+    }
+
+    for(j=MS_MAX(numsubtrees-numthreads, 0); j<numsubtrees; j++)
+      if(substarted[j]) pthread_join(subthreads[j], NULL);
+  }
+
+  for(j=0; j<numthreads; j++)
+    msSHPClose(tasks[j].hSHP);
+  free(tasks);
+  free(threads);
+  free(started);
+  free(bounds);
+  free(part);
+
+  return tree;
+}
+
+#else
+
+treeObj *msCreateTreeParallel(shapefileObj *shapefile, int maxdepth, int numthreads)
+{
+  return msCreateTree(shapefile, maxdepth);
+}
+
+#endif
+
 static void destroyTreeNode(treeNodeObj *node)
 {
   int i;
@@ -521,16 +711,25 @@ ms_bitarray msSearchDiskTree(char *filename, rectObj aoi, int debug)
     return(NULL);
   }
 
+  status = msSearchDiskTreeHandle(disktree, aoi);
+
+  msSHPDiskTreeClose( disktree );
+  return(status);
+}
+
+/* disktree must be positioned at the root node, i.e. just after the header */
+ms_bitarray msSearchDiskTreeHandle(SHPTreeHandle disktree, rectObj aoi)
+{
+  ms_bitarray status=NULL;
+
   status = msAllocBitArray(disktree->nShapes);
   if(!status) {
     msSetError(MS_MEMERR, NULL, "msSearchDiskTree()");
-    msSHPDiskTreeClose( disktree );
     return(NULL);
   }
 
   searchDiskTreeNode(disktree, aoi, status);
 
-  msSHPDiskTreeClose( disktree );
   return(status);
 }
 
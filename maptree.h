@@ -81,11 +81,13 @@ extern "C" {
   MS_DLL_EXPORT treeNodeObj *readTreeNode( SHPTreeHandle disktree );
 
   MS_DLL_EXPORT treeObj *msCreateTree(shapefileObj *shapefile, int maxdepth);
+  MS_DLL_EXPORT treeObj *msCreateTreeParallel(shapefileObj *shapefile, int maxdepth, int numthreads);
   MS_DLL_EXPORT void msTreeTrim(treeObj *tree);
   MS_DLL_EXPORT void msDestroyTree(treeObj *tree);
 
   MS_DLL_EXPORT ms_bitarray msSearchTree(treeObj *tree, rectObj aoi);
   MS_DLL_EXPORT ms_bitarray msSearchDiskTree(char *filename, rectObj aoi, int debug);
+  MS_DLL_EXPORT ms_bitarray msSearchDiskTreeHandle(SHPTreeHandle disktree, rectObj aoi);
 
   MS_DLL_EXPORT treeObj *msReadTree(char *filename, int debug);
   MS_DLL_EXPORT int msWriteTree(treeObj *tree, char *filename, int LSB_order);
@@ -446,6 +446,89 @@ int msEvalContext(mapObj *map, layerObj *layer, char *context)
  * (check the error stack if you care)
  *
  */
+/*
+** Converts an attribute value to a number the way atof() does, with a
+** shortcut for the plain integers that make up most classification items.
+*/
+static double msValueToDouble(const char *value)
+{
+  const char *c = value;
+  double result = 0;
+  int negative = MS_FALSE, digits = 0;
+
+  if(*c == '-') {
+    negative = MS_TRUE;
+    c++;
+  }
+  while(*c >= '0' && *c <= '9' && digits < 15) {
+    result = result*10 + (*c - '0');
+    c++;
+    digits++;
+  }
+  if(*c != '\0' || digits == 0)
+    return atof(value); /* decimals, exponents, blanks, ... */
+
+  return negative?-result:result;
+}
+
+/*
+** Numeric fast path for the common classification expressions made of
+** "[item] <op> <number>" comparisons joined by AND, e.g.
+** ([POP] >= 1000 AND [POP] < 5000). Anything else returns -1 and goes
+** through the parser; the result is the same either way.
+*/
+static int msEvalNumericExpression(shapeObj *shape, expressionObj *expression)
+{
+  tokenListNodeObjPtr node = expression->tokens;
+  int depth = 0, result = MS_TRUE;
+
+  while(node) {
+    double value, number;
+    int op;
+
+    while(node && node->token == '(') {
+      depth++;
+      node = node->next;
+    }
+
+    /* [item] <op> <number> */
+    if(!node || (node->token != MS_TOKEN_BINDING_DOUBLE && node->token != MS_TOKEN_BINDING_INTEGER)) return -1;
+    if(node->tokenval.bindval.index < 0 || node->tokenval.bindval.index >= shape->numvalues) return -1;
+    value = msValueToDouble(shape->values[node->tokenval.bindval.index]);
+    node = node->next;
+    if(!node) return -1;
+    op = node->token;
+    node = node->next;
+    if(!node || node->token != MS_TOKEN_LITERAL_NUMBER) return -1;
+    number = node->tokenval.dblval;
+    node = node->next;
+
+    switch(op) {
+      case MS_TOKEN_COMPARISON_EQ: result = result && (value == number); break;
+      case MS_TOKEN_COMPARISON_NE: result = result && (value != number); break;
+      case MS_TOKEN_COMPARISON_GT: result = result && (value > number); break;
+      case MS_TOKEN_COMPARISON_LT: result = result && (value < number); break;
+      case MS_TOKEN_COMPARISON_GE: result = result && (value >= number); break;
+      case MS_TOKEN_COMPARISON_LE: result = result && (value <= number); break;
+      default: return -1;
+    }
+
+    while(node && node->token == ')') {
+      if(--depth < 0) return -1;
+      node = node->next;
+    }
+
+    if(node) {
+      if(node->token != MS_TOKEN_LOGICAL_AND) return -1;
+      node = node->next;
+      if(!node) return -1;
+    }
+  }
+
+  if(depth != 0) return -1;
+  return result;
+}
+
 int msEvalExpression(layerObj *layer, shapeObj *shape, expressionObj *expression, int itemindex)
 {
   if(!expression->string) return MS_TRUE; /* empty expressions are ALWAYS true */
@@ -470,6 +553,9 @@ int msEvalExpression(layerObj *layer, shapeObj *shape, expressionObj *expression
       int status;
       parseObj p;
 
+      status = msEvalNumericExpression(shape, expression);
+      if(status != -1) return status;
+
       p.shape = shape;
       p.expr = expression;
       p.expr->curtoken = p.expr->tokens; /* reset */
@@ -546,10 +632,403 @@ int *msAllocateValidClassGroups(layerObj *lp, int *nclasses)
 
 }
 
-int msShapeGetClass(layerObj *layer, mapObj *map, shapeObj *shape, int *classgroup, int numclasses)
+/************************************************************************/
+/*                            Feature caches                            */
+/*                                                                      */
+/*      A featureCacheListObj holds up to maxcaches caches of data      */
+/*      computed for each shape of a shapefile, keyed by a string that  */
+/*      identifies the file and the way the data was computed.  A cache */
+/*      is reset when the file it was computed from is modified, unless */
+/*      a layer is still drawing with it, and the least recently used   */
+/*      cache that no layer is drawing with is dropped to make room for */
+/*      a new one.  Used by the class and label point caches.           */
+/************************************************************************/
+
+static void msFeatureCacheReset(featureCacheListObj *list, featureCacheObj *cache, int numshapes, time_t mtime)
+{
+  list->reset(cache, numshapes);
+  cache->numshapes = numshapes;
+  cache->mtime = mtime;
+}
+
+static void msFeatureCacheRemove(featureCacheListObj *list, int i)
+{
+  list->free(list->caches[i]);
+  msFree(list->caches[i]->key);
+  msFree(list->caches[i]);
+
+  list->caches[i] = list->caches[--list->numcaches];
+}
+
+/*
+** Returns the cache of list identified by key, which is taken over, for a file
+** of numshapes shapes modified at mtime, or NULL if there is no room for it or
+** the data has changed while another layer is using it. Must be released with
+** msReleaseFeatureCache().
+*/
+featureCacheObj *msAcquireFeatureCache(featureCacheListObj *list, char *key, time_t mtime, int numshapes)
+{
+  featureCacheObj *cache = NULL;
+  int i;
+
+  msAcquireLock( list->lock );
+
+  for(i=0; i<list->numcaches; i++) {
+    if(strcmp(list->caches[i]->key, key) == 0) {
+      cache = list->caches[i];
+      break;
+    }
+  }
+
+  if(cache && (cache->mtime != mtime || cache->numshapes != numshapes)) {
+    /* the data has changed, start over unless another layer is still using the cache */
+    if(cache->refcount > 0)
+      cache = NULL;
+    else
+      msFeatureCacheReset(list, cache, numshapes, mtime);
+  } else if(!cache) {
+    while(list->numcaches >= list->maxcaches) {
+      int lru = -1;
+
+      for(i=0; i<list->numcaches; i++) {
+        if(list->caches[i]->refcount == 0 && (lru == -1 || list->caches[i]->last_used < list->caches[lru]->last_used))
+          lru = i;
+      }
+      if(lru == -1) break;
+      msFeatureCacheRemove(list, lru);
+    }
+
+    if(list->numcaches < list->maxcaches) {
+      if(!list->caches)
+        list->caches = (featureCacheObj **) msSmallMalloc(sizeof(featureCacheObj *) * list->maxcaches);
+      cache = (featureCacheObj *) msSmallCalloc(1, list->size);
+      cache->key = key;
+      key = NULL;
+      cache->numshapes = -1;
+      msFeatureCacheReset(list, cache, numshapes, mtime);
+      list->caches[list->numcaches++] = cache;
+    }
+  }
+
+  if(cache) {
+    cache->refcount++;
+    cache->last_used = ++list->clock;
+  }
+
+  msReleaseLock( list->lock );
+
+  msFree(key);
+  return cache;
+}
+
+void msReleaseFeatureCache(featureCacheListObj *list, featureCacheObj *cache)
+{
+  if(!cache) return;
+
+  msAcquireLock( list->lock );
+  cache->refcount--;
+  msReleaseLock( list->lock );
+}
+
+/* Frees the caches of list */
+void msFeatureCacheListCleanup(featureCacheListObj *list)
+{
+  msAcquireLock( list->lock );
+
+  while(list->numcaches > 0)
+    msFeatureCacheRemove(list, list->numcaches - 1);
+
+  msFree(list->caches);
+  list->caches = NULL;
+
+  msReleaseLock( list->lock );
+}
+
+/************************************************************************/
+/*                        Class assignment cache                        */
+/*                                                                      */
+/*      When the classes of a shapefile layer only depend on feature    */
+/*      attributes, the class of feature N is the same on every         */
+/*      request.  With PROCESSING "CLASS_CACHE=ON" the class resolved   */
+/*      for each shape index is kept for the lifetime of the process,   */
+/*      and msShapeGetClass() only evaluates the class expressions for  */
+/*      features it has not seen yet.  The cache is keyed by the data   */
+/*      source, CLASSITEM and the expressions of the classes that are   */
+/*      active at the current scale, and is reset when the .dbf file    */
+/*      is modified.  Protected by TLOCK_CLASSCACHE.                    */
+/************************************************************************/
+
+#define MS_CLASS_CACHE_UNKNOWN -2
+#define MS_CLASS_CACHE_MAX_LAYERS 32
+
+struct classCacheObj {
+  featureCacheObj cache;
+  short *classindex; /* resolved class of each shape, or MS_CLASS_CACHE_UNKNOWN */
+};
+
+static void msClassCacheReset(featureCacheObj *cache, int numshapes)
+{
+  classCacheObj *classcache = (classCacheObj *) cache;
+  int i;
+
+  if(cache->numshapes != numshapes) {
+    msFree(classcache->classindex);
+    classcache->classindex = (short *) msSmallMalloc(sizeof(short) * MS_MAX(numshapes, 1));
+  }
+  for(i=0; i<numshapes; i++)
+    classcache->classindex[i] = MS_CLASS_CACHE_UNKNOWN;
+}
+
+static void msClassCacheFree(featureCacheObj *cache)
+{
+  msFree(((classCacheObj *) cache)->classindex);
+}
+
+static featureCacheListObj classCaches = {
+  TLOCK_CLASSCACHE, MS_CLASS_CACHE_MAX_LAYERS, sizeof(classCacheObj),
+  msClassCacheReset, msClassCacheFree, NULL, 0, 0
+};
+
+/* expressions that only look at the attributes of a feature */
+static int msClassCacheIsApplicable(expressionObj *expression)
+{
+  tokenListNodeObjPtr node;
+
+  if(expression->type != MS_EXPRESSION || !expression->string) return MS_TRUE;
+  if(!expression->tokens) return MS_FALSE; /* not tokenized, play it safe */
+
+  for(node=expression->tokens; node; node=node->next) {
+    if(node->token == MS_TOKEN_BINDING_SHAPE || node->token == MS_TOKEN_BINDING_MAP_CELLSIZE)
+      return MS_FALSE;
+  }
+
+  return MS_TRUE;
+}
+
+/*
+** Returns the class cache to use while drawing layer, or NULL if the layer does
+** not ask for one or cannot use one. classgroup and numclasses are the ones that
+** will be passed to msShapeGetClass(). Must be released with msReleaseClassCache().
+*/
+classCacheObj *msAcquireClassCache(layerObj *layer, mapObj *map, int *classgroup, int numclasses)
 {
+  const char *value = msLayerGetProcessingKey(layer, "CLASS_CACHE");
+  shapefileObj *shpfile;
+  char *key, buffer[64];
   int i, iclass;
 
+  if (!value || !(EQUAL(value, "ON") || EQUAL(value, "TRUE") || EQUAL(value, "YES")))
+    return NULL;
+
+  if(layer->connectiontype != MS_SHAPEFILE || !layer->layerinfo || layer->numclasses <= 0 || layer->numclasses > SHRT_MAX)
+    return NULL;
+  shpfile = (shapefileObj *) layer->layerinfo;
+
+  if (classgroup == NULL || numclasses <= 0)
+    numclasses = layer->numclasses;
+
+  key = msStringConcatenate(msStrdup(shpfile->source), "\n");
+  if(layer->classitem)
+    key = msStringConcatenate(key, layer->classitem);
+
+  /* the classes msShapeEvalClass() will consider at this scale */
+  for(i=0; i<numclasses; i++) {
+    classObj *class;
+
+    iclass = classgroup ? classgroup[i] : i;
+    if (iclass < 0 || iclass >= layer->numclasses)
+      continue;
+    class = layer->class[iclass];
+
+    if(map->scaledenom > 0) {
+      if((class->maxscaledenom > 0) && (map->scaledenom > class->maxscaledenom))
+        continue;
+      if((class->minscaledenom > 0) && (map->scaledenom <= class->minscaledenom))
+        continue;
+    }
+
+    if(class->minfeaturesize > 0 || !msClassCacheIsApplicable(&class->expression)) {
+      msFree(key);
+      return NULL;
+    }
+
+    snprintf(buffer, sizeof(buffer), "\n%d %d %d %d ", iclass, class->status == MS_DELETE, class->expression.type, class->expression.flags);
+    key = msStringConcatenate(key, buffer);
+    if(class->expression.string)
+      key = msStringConcatenate(key, class->expression.string);
+  }
+
+  return (classCacheObj *) msAcquireFeatureCache(&classCaches, key, msShapefileGetMTime(shpfile->source, ".dbf"), shpfile->numshapes);
+}
+
+void msReleaseClassCache(classCacheObj *cache)
+{
+  msReleaseFeatureCache(&classCaches, (featureCacheObj *) cache);
+}
+
+/************************************************************************/
+/*                        msClassCacheCleanup()                         */
+/*                                                                      */
+/*      Free the class caches.  Called from msCleanup().                */
+/************************************************************************/
+
+void msClassCacheCleanup(void)
+{
+  msFeatureCacheListCleanup(&classCaches);
+}
+
+/************************************************************************/
+/*                        Class dispatch index                          */
+/*                                                                      */
+/*      Layers classified by comparing CLASSITEM against many string    */
+/*      literals (e.g. hundreds of land use codes) would test every     */
+/*      class in turn for every feature.  When all classes that are     */
+/*      active at the current scale are such literals, or have no       */
+/*      expression at all, the literals are put in a hash table and     */
+/*      the class of a feature is found with a single lookup.  The      */
+/*      classes sharing a literal (ignoring case) are chained in class  */
+/*      order, so the result is the same as the sequential search.      */
+/************************************************************************/
+
+#define MS_CLASS_DISPATCH_MIN_CLASSES 8 /* below this the sequential search is as fast */
+
+struct classDispatchObj {
+  hashTableObj *literals; /* literal -> first class testing it, as a decimal string */
+  int *next; /* next class testing the same literal, or -1, by class index */
+  int *fallbacks; /* classes without expression, which always match */
+  int numfallbacks;
+};
+
+classDispatchObj *msCreateClassDispatch(layerObj *layer, mapObj *map, int *classgroup, int numclasses)
+{
+  classDispatchObj *dispatch;
+  int i, iclass, numliterals = 0;
+  int *last;
+  char buffer[32];
+
+  if(layer->numclasses < MS_CLASS_DISPATCH_MIN_CLASSES || layer->classitemindex < 0)
+    return NULL;
+
+  if (classgroup == NULL || numclasses <= 0)
+    numclasses = layer->numclasses;
+
+  /* can only be used if all the candidate classes are simple string comparisons */
+  for(i=0; i<numclasses; i++) {
+    iclass = classgroup ? classgroup[i] : i;
+    if (iclass < 0 || iclass >= layer->numclasses)
+      continue;
+    if(layer->class[iclass]->expression.string) {
+      if(layer->class[iclass]->expression.type != MS_STRING)
+        return NULL;
+      numliterals++;
+    }
+  }
+  if(numliterals < MS_CLASS_DISPATCH_MIN_CLASSES)
+    return NULL;
+
+  dispatch = (classDispatchObj *) msSmallMalloc(sizeof(classDispatchObj));
+  dispatch->literals = msCreateHashTable();
+  dispatch->next = (int *) msSmallMalloc(sizeof(int) * layer->numclasses);
+  dispatch->fallbacks = (int *) msSmallMalloc(sizeof(int) * layer->numclasses);
+  dispatch->numfallbacks = 0;
+  last = (int *) msSmallMalloc(sizeof(int) * layer->numclasses);
+
+  for(i=0; i<numclasses; i++) {
+    classObj *class;
+    char *first;
+
+    iclass = classgroup ? classgroup[i] : i;
+    if (iclass < 0 || iclass >= layer->numclasses)
+      continue;
+    class = layer->class[iclass];
+
+    /* the scale and status tests of msShapeEvalClass(), done once */
+    if(map->scaledenom > 0) {
+      if((class->maxscaledenom > 0) && (map->scaledenom > class->maxscaledenom))
+        continue;
+      if((class->minscaledenom > 0) && (map->scaledenom <= class->minscaledenom))
+        continue;
+    }
+    if(class->status == MS_DELETE)
+      continue;
+
+    dispatch->next[iclass] = -1;
+    if(!class->expression.string) {
+      dispatch->fallbacks[dispatch->numfallbacks++] = iclass;
+      continue;
+    }
+
+    first = msLookupHashTable(dispatch->literals, class->expression.string);
+    if(first) { /* append to the chain of this literal */
+      int head = atoi(first);
+      dispatch->next[last[head]] = iclass;
+      last[head] = iclass;
+    } else {
+      snprintf(buffer, sizeof(buffer), "%d", iclass);
+      msInsertHashTable(dispatch->literals, class->expression.string, buffer);
+      last[iclass] = iclass;
+    }
+  }
+
+  free(last);
+  return dispatch;
+}
+
+void msFreeClassDispatch(classDispatchObj *dispatch)
+{
+  if(!dispatch) return;
+
+  msFreeHashTable(dispatch->literals);
+  msFree(dispatch->next);
+  msFree(dispatch->fallbacks);
+  msFree(dispatch);
+}
+
+/* msShapeEvalClass() using the dispatch index of the layer */
+static int msClassDispatchGetClass(layerObj *layer, mapObj *map, shapeObj *shape)
+{
+  classDispatchObj *dispatch = layer->classdispatch;
+  const char *value = shape->values[layer->classitemindex];
+  char *first = msLookupHashTable(dispatch->literals, value);
+  int literal = first ? atoi(first) : -1, fallback = 0;
+
+  /* walk the matching literal classes and the fallback classes in class order */
+  while(literal != -1 || fallback < dispatch->numfallbacks) {
+    classObj *class;
+    int iclass;
+
+    if(literal != -1 && (fallback == dispatch->numfallbacks || literal < dispatch->fallbacks[fallback])) {
+      iclass = literal;
+      literal = dispatch->next[literal];
+    } else {
+      iclass = dispatch->fallbacks[fallback++];
+    }
+    class = layer->class[iclass];
+
+    /* verify the minfeaturesize */
+    if ((shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) && (class->minfeaturesize > 0)) {
+      double minfeaturesize = Pix2LayerGeoref(map, layer, class->minfeaturesize);
+      if (msShapeCheckSize(shape, minfeaturesize) == MS_FALSE)
+        continue;
+    }
+
+    /* the hash table ignores case */
+    if(class->expression.string && !(class->expression.flags & MS_EXP_INSENSITIVE) && strcmp(class->expression.string, value) != 0)
+      continue;
+
+    return(iclass);
+  }
+
+  return(-1); /* no match */
+}
+
+static int msShapeEvalClass(layerObj *layer, mapObj *map, shapeObj *shape, int *classgroup, int numclasses)
+{
+  int i, iclass;
+
+  if(layer->classdispatch && layer->classitemindex < layer->numitems && layer->classitemindex < shape->numvalues)
+    return msClassDispatchGetClass(layer, map, shape);
+
   if (layer->numclasses > 0) {
     if (classgroup == NULL || numclasses <=0)
       numclasses = layer->numclasses;
@@ -586,6 +1065,20 @@ int msShapeGetClass(layerObj *layer, mapObj *map, shapeObj *shape, int *classgro
   return(-1); /* no match */
 }
 
+int msShapeGetClass(layerObj *layer, mapObj *map, shapeObj *shape, int *classgroup, int numclasses)
+{
+  classCacheObj *cache = layer->classcache;
+
+  if(cache && shape->index >= 0 && shape->index < cache->cache.numshapes) {
+    /* concurrent renderers of the same layer can only ever store the same value */
+    if(cache->classindex[shape->index] == MS_CLASS_CACHE_UNKNOWN)
+      cache->classindex[shape->index] = msShapeEvalClass(layer, map, shape, classgroup, numclasses);
+    return(cache->classindex[shape->index]);
+  }
+
+  return(msShapeEvalClass(layer, map, shape, classgroup, numclasses));
+}
+
 static char *evalTextExpression(expressionObj *expr, shapeObj *shape)
 {
   char *result=NULL;
@@ -1870,6 +2363,11 @@ void msCleanup(int signal)
 {
   msForceTmpFileBase( NULL );
   msConnPoolFinalCleanup();
+  msClusterCacheCleanup();
+  msIconvCleanup();
+  msShapefileCacheCleanup();
+  msClassCacheCleanup();
+  msLabelPointCacheCleanup();
   /* Lexer string parsing variable */
   if (msyystring_buffer != NULL) {
     msFree(msyystring_buffer);
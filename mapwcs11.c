@@ -1190,8 +1190,11 @@ int  msWCSReturnCoverage11( wcsParamsObj *params, mapObj *map,
     if( pszExtension == NULL )
       pszExtension = "img.tmp";
 
+    /* drivers that write one file sequentially are streamed to the */
+    /* client below, without holding the whole result under /vsimem */
     if( GDALGetMetadataItem( hDriver, GDAL_DCAP_VIRTUALIO, NULL )
-        != NULL ) {
+        != NULL
+        && (fo_filename || !msGDALSupportsStreamingOutput( image->format, MS_TRUE )) ) {
       base_dir = msTmpFile(map, map->mappath, "/vsimem/wcsout", NULL);
       if( fo_filename )
         filename = msStrdup(CPLFormFilename(base_dir,
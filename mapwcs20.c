@@ -1640,8 +1640,10 @@ static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr para
     if( pszExtension == NULL )
       pszExtension = "img.tmp";
 
+    /* drivers that write one file sequentially are streamed to the */
+    /* client below, without holding the whole result under /vsimem */
     if( GDALGetMetadataItem( hDriver, GDAL_DCAP_VIRTUALIO, NULL )
-        != NULL ) {
+        != NULL && !msGDALSupportsStreamingOutput( image->format, MS_TRUE ) ) {
       base_dir = msTmpFile(map, map->mappath, "/vsimem/wcsout", NULL);
       if( fo_filename )
         filename = msStrdup(CPLFormFilename(base_dir,
@@ -1686,7 +1688,7 @@ static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr para
                       fo_filename);
       else
         msIO_fprintf( stdout,
-                      "Content-ID: coverage/wcs.%s\r\n"
+                      "Content-ID: coverage/out.%s\r\n"
                       "Content-Disposition: INLINE\r\n\r\n",
                       MS_IMAGE_EXTENSION(map->outputformat));
     } else {
@@ -1698,7 +1700,7 @@ static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr para
         msIO_setHeader("Content-ID","coverage/%s",fo_filename);
         msIO_setHeader("Content-Disposition","INLINE; filename=%s",fo_filename);
       } else {
-        msIO_setHeader("Content-ID","coverage/wcs.%s",MS_IMAGE_EXTENSION(map->outputformat));
+        msIO_setHeader("Content-ID","coverage/out.%s",MS_IMAGE_EXTENSION(map->outputformat));
         msIO_setHeader("Content-Disposition","INLINE");
       }
       msIO_sendHeaders();
@@ -612,14 +612,24 @@ int msPrepareWFSLayerRequest(int nLayerId, mapObj *map, layerObj *lp,
   /* We'll store the remote server's response to a tmp file. */
   pasReqInfo[(*numRequests)].pszOutputFile = msTmpFile(map, map->mappath, NULL, "tmp.gml");
 
-  /* TODO: Implement Caching of GML responses. There was an older caching
-   * method, but it suffered from a race condition. See #3137.
+  /* Cached GML responses are copied into this private tmp file by the
+   * HTTP response cache (see wfs_cache_max_age below), which avoids the
+   * race condition of the older caching method (#3137).
    */
 
   pasReqInfo[(*numRequests)].pszHTTPCookieData = pszHTTPCookieData;
   pszHTTPCookieData = NULL;
   pasReqInfo[(*numRequests)].nStatus = 0;
   pasReqInfo[(*numRequests)].nTimeout = nTimeout;
+
+  /* Responses may be served from the HTTP response cache if
+   * wfs_cache_max_age (in seconds) is set. */
+  if ((pszTmp = msOWSLookupMetadata(&(lp->metadata),
+                                    "FO", "cache_max_age")) != NULL) {
+    pasReqInfo[(*numRequests)].nCacheMaxAge = atoi(pszTmp);
+    if ((pszTmp = msGetConfigOption(map, "MS_HTTP_CACHE_DIR")) != NULL)
+      pasReqInfo[(*numRequests)].pszCacheDir = msStrdup(pszTmp);
+  }
   pasReqInfo[(*numRequests)].bbox = bbox;
   pasReqInfo[(*numRequests)].debug = lp->debug;
 
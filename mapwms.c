@@ -1092,7 +1092,8 @@ int msWMSLoadGetMapParams(mapObj *map, int nVersion,
                strncasecmp(format->driver, "CAIRO/", 6) != 0 &&
                strncasecmp(format->driver, "OGL/", 4) != 0 &&
                strncasecmp(format->driver, "KML", 3) != 0 &&
-               strncasecmp(format->driver, "KMZ", 3) != 0)) {
+               strncasecmp(format->driver, "KMZ", 3) != 0 &&
+               strcasecmp(format->driver, "MVT") != 0)) {
             msSetError(MS_IMGERR,
                        "Unsupported output format (%s).",
                        "msWMSLoadGetMapParams()",
@@ -711,6 +711,58 @@ msBuildWMSLayerURL(mapObj *map, layerObj *lp, int nRequestType,
     }
   }
 
+  /* -------------------------------------------------------------------- */
+  /*      Snap GetMap requests to a fixed tile grid if requested, so      */
+  /*      that nearby views issue identical requests which can be         */
+  /*      served from the HTTP response cache.  wms_tile_grid is          */
+  /*      "resolution [tilesize [originx originy]]" where resolution      */
+  /*      is the cellsize of zoom level 0 in the layer SRS, halved at     */
+  /*      each following level.                                           */
+  /* -------------------------------------------------------------------- */
+  if( nRequestType == WMS_GETMAP && bbox_width != 0 && bbox_height != 0
+      && (pszTmp = msOWSLookupMetadata(&(lp->metadata),
+                                       "MO", "tile_grid")) != NULL ) {
+    char **tokens;
+    int n;
+    double resolution, tilesize = 256, originx = 0, originy = 0;
+    double cellsize = MIN((bbox.maxx-bbox.minx) / bbox_width,
+                          (bbox.maxy-bbox.miny) / bbox_height);
+
+    tokens = msStringSplit(pszTmp, ' ', &n);
+    if (tokens==NULL || (n != 1 && n != 2 && n != 4) || atof(tokens[0]) <= 0) {
+      msSetError(MS_WMSCONNERR, "Wrong arguments for 'wms_tile_grid' metadata.",
+                 "msBuildWMSLayerURL()");
+      msFreeCharArray(tokens, n);
+      free(pszEPSG);
+      return MS_FAILURE;
+    }
+    resolution = atof(tokens[0]);
+    if (n >= 2 && atof(tokens[1]) >= 1)
+      tilesize = atof(tokens[1]);
+    if (n == 4) {
+      originx = atof(tokens[2]);
+      originy = atof(tokens[3]);
+    }
+    msFreeCharArray(tokens, n);
+
+    /* use the first level at least as fine as the requested cellsize */
+    while (resolution > cellsize * 1.000001)
+      resolution /= 2;
+
+    bbox.minx = originx + floor((bbox.minx - originx) / (resolution*tilesize)) * resolution*tilesize;
+    bbox.miny = originy + floor((bbox.miny - originy) / (resolution*tilesize)) * resolution*tilesize;
+    bbox.maxx = originx + ceil((bbox.maxx - originx) / (resolution*tilesize)) * resolution*tilesize;
+    bbox.maxy = originy + ceil((bbox.maxy - originy) / (resolution*tilesize)) * resolution*tilesize;
+
+    bbox_width = MS_NINT((bbox.maxx - bbox.minx) / resolution);
+    bbox_height = MS_NINT((bbox.maxy - bbox.miny) / resolution);
+
+    if (lp->debug)
+      msDebug("wms_tile_grid: snapped request to %.15g,%.15g,%.15g,%.15g (%dx%d).\n",
+              bbox.minx, bbox.miny, bbox.maxx, bbox.maxy,
+              bbox_width, bbox_height);
+  }
+
   /* -------------------------------------------------------------------- */
   /*      Potentially return the bbox.                                    */
   /* -------------------------------------------------------------------- */
@@ -906,6 +958,7 @@ int msPrepareWMSLayerRequest(int nLayerId, mapObj *map, layerObj *lp,
   rectObj bbox;
   int bbox_width, bbox_height;
   int nTimeout, bOkToMerge, bForceSeparateRequest, bCacheToDisk;
+  int nCacheMaxAge = 0;
   wmsParamsObj sThisWMSParams;
 
   char    *pszProxyHost=NULL;
@@ -1014,6 +1067,15 @@ int msPrepareWMSLayerRequest(int nLayerId, mapObj *map, layerObj *lp,
     nTimeout = atoi(pszTmp);
   }
 
+  /* ------------------------------------------------------------------
+   * Check to see if responses may be kept in the HTTP response cache
+   * (wms_cache_max_age in seconds, in the layer or map metadata).
+   * ------------------------------------------------------------------ */
+  if ((pszTmp = msOWSLookupMetadata2(&(lp->metadata), &(map->web.metadata),
+                                     "MO", "cache_max_age")) != NULL) {
+    nCacheMaxAge = atoi(pszTmp);
+  }
+
   /* ------------------------------------------------------------------
    * Check for authentication and proxying metadata. If the metadata is not found
    * in the layer metadata, check the map-level metadata.
@@ -1268,6 +1330,12 @@ int msPrepareWMSLayerRequest(int nLayerId, mapObj *map, layerObj *lp,
       pasReqInfo[(*numRequests)].pszOutputFile = NULL;
     pasReqInfo[(*numRequests)].nStatus = 0;
     pasReqInfo[(*numRequests)].nTimeout = nTimeout;
+    pasReqInfo[(*numRequests)].nCacheMaxAge = nCacheMaxAge;
+    /* GetMap and GetLegendGraphic answer with an image unless they failed */
+    pasReqInfo[(*numRequests)].bCacheImagesOnly = (nRequestType != WMS_GETFEATUREINFO);
+    if (nCacheMaxAge > 0 &&
+        (pszTmp = msGetConfigOption(map, "MS_HTTP_CACHE_DIR")) != NULL)
+      pasReqInfo[(*numRequests)].pszCacheDir = msStrdup(pszTmp);
     pasReqInfo[(*numRequests)].bbox   = bbox;
     pasReqInfo[(*numRequests)].width  = bbox_width;
     pasReqInfo[(*numRequests)].height = bbox_height;
@@ -1369,9 +1437,7 @@ int msDrawWMSLayerLow(int nLayerId, httpRequestObj *pasReqInfo,
    * We log an error but we still return SUCCESS here so that the layer
    * is only skipped intead of aborting the whole draw map.
    * ------------------------------------------------------------------ */
-  if (pasReqInfo[iReq].pszContentType &&
-      (strcmp(pasReqInfo[iReq].pszContentType, "text/xml") == 0 ||
-       strcmp(pasReqInfo[iReq].pszContentType, "application/vnd.ogc.se_xml") == 0)) {
+  if (msHTTPIsExceptionContentType(pasReqInfo[iReq].pszContentType)) {
     FILE *fp;
     char szBuf[MS_BUFFER_LENGTH];
 
@@ -1460,8 +1526,10 @@ int msDrawWMSLayerLow(int nLayerId, httpRequestObj *pasReqInfo,
     lp->data =  msStrdup(pasReqInfo[iReq].pszOutputFile);
 
   /* #3138 If PROCESSING "RESAMPLE=..." is set we cannot use the simple case */
+  /* neither can we when the request was snapped to wms_tile_grid */
   if (!msProjectionsDiffer(&(map->projection), &(lp->projection)) &&
-      (msLayerGetProcessingKey(lp, "RESAMPLE") == NULL) ) {
+      (msLayerGetProcessingKey(lp, "RESAMPLE") == NULL) &&
+      msOWSLookupMetadata(&(lp->metadata), "MO", "tile_grid") == NULL ) {
     /* The simple case... no reprojection needed... render layer directly. */
     lp->transform = MS_FALSE;
     /* if (msDrawRasterLayerLow(map, lp, img) != 0) */
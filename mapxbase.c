@@ -459,58 +459,43 @@ int msDBFAddField(DBFHandle psDBF, const char * pszFieldName, DBFFieldType eType
 /*      Based on DBFIsAttributeNULL of shapelib                         */
 /************************************************************************/
 
-int DBFIsValueNULL( const char* pszValue, char type )
+static int DBFIsValueNULL( const char* pszValue, int nLength, char type )
 
 {
   switch(type) {
     case 'N':
     case 'F':
       /* NULL numeric fields have value "****************" */
-      return pszValue[0] == '*';
+      return nLength > 0 && pszValue[0] == '*';
 
     case 'D':
       /* NULL date fields have value "00000000" */
-      return strncmp(pszValue,"00000000",8) == 0;
+      return nLength >= 8 && strncmp(pszValue,"00000000",8) == 0;
 
     case 'L':
       /* NULL boolean fields have value "?" */
-      return pszValue[0] == '?';
+      return nLength > 0 && pszValue[0] == '?';
 
     default:
       /* empty string fields are considered NULL */
-      return strlen(pszValue) == 0;
+      return nLength == 0;
   }
 }
 
 /************************************************************************/
-/*                          msDBFReadAttribute()                        */
+/*                           msDBFLoadRecord()                          */
 /*                                                                      */
-/*      Read one of the attribute fields of a record.                   */
+/*      Make sure hEntity is the record in the record buffer.           */
 /************************************************************************/
-static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
-
+static int msDBFLoadRecord(DBFHandle psDBF, int hEntity, const char *pszFunction)
 {
-  int         i;
   unsigned int nRecordOffset;
-  uchar *pabyRec;
-  char  *pReturnField = NULL;
-
-  /* -------------------------------------------------------------------- */
-  /*  Is the request valid?                             */
-  /* -------------------------------------------------------------------- */
-  if( iField < 0 || iField >= psDBF->nFields ) {
-    msSetError(MS_DBFERR, "Invalid field index %d.", "msDBFReadAttribute()",iField );
-    return( NULL );
-  }
 
   if( hEntity < 0 || hEntity >= psDBF->nRecords ) {
-    msSetError(MS_DBFERR, "Invalid record number %d.", "msDBFReadAttribute()",hEntity );
-    return( NULL );
+    msSetError(MS_DBFERR, "Invalid record number %d.", pszFunction, hEntity );
+    return( MS_FAILURE );
   }
 
-  /* -------------------------------------------------------------------- */
-  /*  Have we read the record?              */
-  /* -------------------------------------------------------------------- */
   if( psDBF->nCurrentRecord != hEntity ) {
     flushRecord( psDBF );
 
@@ -522,54 +507,86 @@ static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
     psDBF->nCurrentRecord = hEntity;
   }
 
-  pabyRec = (uchar *) psDBF->pszCurrentRecord;
-  /* DEBUG */
-  /* printf("CurrentRecord(%c):%s\n", psDBF->pachFieldType[iField], pabyRec); */
+  return( MS_SUCCESS );
+}
 
-  /* -------------------------------------------------------------------- */
-  /*  Ensure our field buffer is large enough to hold this buffer.      */
-  /* -------------------------------------------------------------------- */
-  if( psDBF->panFieldSize[iField]+1 > psDBF->nStringFieldLen ) {
-    psDBF->nStringFieldLen = psDBF->panFieldSize[iField]*2 + 10;
-    psDBF->pszStringField = (char *) SfRealloc(psDBF->pszStringField,psDBF->nStringFieldLen);
-  }
+/************************************************************************/
+/*                           msDBFFieldSlice()                          */
+/*                                                                      */
+/*      Locate a field of the current record without copying it.        */
+/*      Trailing blanks (and leading ones for numeric types) are        */
+/*      trimmed and NULL numeric/date values are returned as "0".       */
+/*      The result is NOT nul terminated, use *pnLength.                */
+/************************************************************************/
+static const char *msDBFFieldSlice(DBFHandle psDBF, int iField, int *pnLength)
+{
+  const char *pszField = psDBF->pszCurrentRecord + psDBF->panFieldOffset[iField];
+  const char *pszEnd;
+  char chType = psDBF->pachFieldType[iField];
+  int nStart = 0, nEnd = psDBF->panFieldSize[iField];
 
-  /* -------------------------------------------------------------------- */
-  /*  Extract the requested field.              */
-  /* -------------------------------------------------------------------- */
-  strncpy( psDBF->pszStringField,(char *) pabyRec+psDBF->panFieldOffset[iField], psDBF->panFieldSize[iField] );
-  psDBF->pszStringField[psDBF->panFieldSize[iField]] = '\0';
+  /* the field may be nul terminated early */
+  pszEnd = (const char *) memchr(pszField, '\0', nEnd);
+  if(pszEnd) nEnd = pszEnd - pszField;
 
   /*
   ** Trim trailing blanks (SDL Modification)
   */
-  for(i=strlen(psDBF->pszStringField)-1; i>=0; i--) {
-    if(psDBF->pszStringField[i] != ' ') {
-      psDBF->pszStringField[i+1] = '\0';
-      break;
-    }
-  }
-
-  if(i == -1) psDBF->pszStringField[0] = '\0'; /* whole string is blank (SDL fix)       */
+  while(nEnd > 0 && pszField[nEnd-1] == ' ') nEnd--;
 
   /*
   ** Trim/skip leading blanks (SDL/DM Modification - only on numeric types)
   */
-  if( psDBF->pachFieldType[iField] == 'N' || psDBF->pachFieldType[iField] == 'F' || psDBF->pachFieldType[iField] == 'D' ) {
-    for(i=0; psDBF->pszStringField[i] != '\0' ; i++) {
-      if(psDBF->pszStringField[i] != ' ')
-        break;
+  if( chType == 'N' || chType == 'F' || chType == 'D' ) {
+    while(nStart < nEnd && pszField[nStart] == ' ') nStart++;
+
+    /*  detect null values */
+    if( DBFIsValueNULL( pszField+nStart, nEnd-nStart, chType ) ) {
+      *pnLength = 1;
+      return "0";
     }
-    pReturnField = psDBF->pszStringField+i;
-  } else
-    pReturnField = psDBF->pszStringField;
-
-  /*  detect null values */
-  if ( DBFIsValueNULL( pReturnField, psDBF->pachFieldType[iField] )  ) {
-    if (psDBF->pachFieldType[iField] == 'N' || psDBF->pachFieldType[iField] == 'F' || psDBF->pachFieldType[iField] == 'D')
-      pReturnField="0";
   }
-  return( pReturnField );
+
+  *pnLength = nEnd - nStart;
+  return pszField + nStart;
+}
+
+/************************************************************************/
+/*                          msDBFReadAttribute()                        */
+/*                                                                      */
+/*      Read one of the attribute fields of a record.                   */
+/************************************************************************/
+static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
+
+{
+  const char *pszValue;
+  int nLength;
+
+  /* -------------------------------------------------------------------- */
+  /*  Is the request valid?                             */
+  /* -------------------------------------------------------------------- */
+  if( iField < 0 || iField >= psDBF->nFields ) {
+    msSetError(MS_DBFERR, "Invalid field index %d.", "msDBFReadAttribute()",iField );
+    return( NULL );
+  }
+
+  if( msDBFLoadRecord( psDBF, hEntity, "msDBFReadAttribute()" ) != MS_SUCCESS )
+    return( NULL );
+
+  pszValue = msDBFFieldSlice( psDBF, iField, &nLength );
+
+  /* -------------------------------------------------------------------- */
+  /*  Ensure our field buffer is large enough to hold this buffer.      */
+  /* -------------------------------------------------------------------- */
+  if( psDBF->panFieldSize[iField]+1 > psDBF->nStringFieldLen ) {
+    psDBF->nStringFieldLen = psDBF->panFieldSize[iField]*2 + 10;
+    psDBF->pszStringField = (char *) SfRealloc(psDBF->pszStringField,psDBF->nStringFieldLen);
+  }
+
+  memcpy( psDBF->pszStringField, pszValue, nLength );
+  psDBF->pszStringField[nLength] = '\0';
+
+  return( psDBF->pszStringField );
 }
 
 /************************************************************************/
@@ -875,23 +892,42 @@ int *msDBFGetItemIndexes(DBFHandle dbffile, char **items, int numitems)
 }
 
 char **msDBFGetValueList(DBFHandle dbffile, int record, int *itemindexes, int numitems)
+{
+  return msDBFGetValueListArena(dbffile, record, itemindexes, numitems, NULL);
+}
+
+/*
+** Same as msDBFGetValueList() but the array and strings come from arena
+** (or the heap if arena is NULL).
+*/
+char **msDBFGetValueListArena(DBFHandle dbffile, int record, int *itemindexes, int numitems, shapeArenaObj *arena)
 {
   const char *value;
   char **values=NULL;
-  int i;
+  int i, length;
 
   if(numitems == 0) return(NULL);
 
-  values = (char **)malloc(sizeof(char *)*numitems);
+  /* read the record once and copy each requested field straight out of it */
+  if(msDBFLoadRecord(dbffile, record, "msDBFGetValueList()") != MS_SUCCESS)
+    return NULL;
+
+  values = (char **)msShapeArenaAlloc(arena, sizeof(char *)*numitems);
   MS_CHECK_ALLOC(values, sizeof(char *)*numitems, NULL);
 
   for(i=0; i<numitems; i++) {
-    value = msDBFReadStringAttribute(dbffile, record, itemindexes[i]);
-    if (value == NULL) {
-      free(values);
-      return NULL; /* Error already reported by msDBFReadStringAttribute() */
+    if(itemindexes[i] < 0 || itemindexes[i] >= dbffile->nFields) {
+      msSetError(MS_DBFERR, "Invalid field index %d.", "msDBFGetValueList()", itemindexes[i]);
+      while(--i >= 0)
+        msShapeArenaFree(arena, values[i]);
+      msShapeArenaFree(arena, values);
+      return NULL;
     }
-    values[i] = msStrdup(value);
+    value = msDBFFieldSlice(dbffile, itemindexes[i], &length);
+    values[i] = (char *)msShapeArenaAlloc(arena, length+1);
+    MS_CHECK_ALLOC(values[i], length+1, NULL);
+    memcpy(values[i], value, length);
+    values[i][length] = '\0';
   }
 
   return(values);
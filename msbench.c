@@ -0,0 +1,777 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Micro-benchmarks for the geometry, shapefile and label cache
+ *           primitives used when drawing a map.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "mapserver.h"
+#include "maptime.h"
+#include "maptree.h"
+
+#include <math.h>
+#include <signal.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/*
+** Timing methodology: every benchmark runs a single operation on inputs
+** that are generated (or read) before timing starts, cycling through them
+** so caches see more than one input. The number of operations per batch is
+** doubled until a batch takes at least the minimum batch time, which also
+** warms up the code and data. Then the configured number of batches is
+** timed and the min, median and max time per operation are reported; the
+** min and median are the figures to compare between builds.
+*/
+
+#define BENCH_NUMSHAPES 10000 /* polygons in the synthetic shapefile */
+#define BENCH_NUMWINDOWS 64 /* spatial index search windows */
+#define BENCH_NUMLABELS 4000 /* labels already in the label cache */
+#define BENCH_NUMCANDIDATES 256 /* labels tested against the label cache */
+#define BENCH_MAXRECORDS 1000 /* records read for the expression benchmarks */
+
+enum { BENCH_NEEDS_NOTHING, BENCH_NEEDS_PROJ, BENCH_NEEDS_TESTDATA, BENCH_NEEDS_SYNTHETIC, BENCH_NEEDS_EXPRESSIONS, BENCH_NEEDS_LABELS, BENCH_NUMNEEDS };
+
+typedef struct {
+  int have[BENCH_NUMNEEDS];
+
+  shapeObj polygon, polyline, polygon_far, polygon_latlon;
+  rectObj cliprect;
+  projectionObj latlon, merc;
+
+  char synthetic[MS_MAXPATHLEN]; /* synthetic shapefile and its .qix, without extension */
+  SHPHandle synthetic_shp;
+  int synthetic_numshapes;
+  rectObj windows[BENCH_NUMWINDOWS];
+
+  SHPHandle test_shp[3];
+  int test_numshapes[3];
+  int numtest;
+
+  mapObj *expression_map;
+  shapeObj *records;
+  int numrecords;
+
+  mapObj *label_map, *label_grid_map;
+  labelCacheMemberObj candidates[BENCH_NUMCANDIDATES];
+
+  int counter; /* cycles through the inputs */
+} benchDataObj;
+
+typedef struct {
+  const char *name;
+  const char *description;
+  int needs;
+  void (*run)(benchDataObj *data);
+} benchCaseObj;
+
+/* results are folded into this so the compiler cannot drop the work */
+static volatile double bench_sink = 0;
+
+static unsigned int bench_seed = 1;
+
+/* files of the synthetic shapefile, removed however msbench exits */
+static char bench_synthetic_files[4][MS_MAXPATHLEN+8];
+
+/* small deterministic generator, the same inputs on every platform */
+static double benchRandom(void)
+{
+  bench_seed = bench_seed * 1103515245U + 12345U;
+  return ((bench_seed >> 8) & 0xffffff) / (double) 0x1000000;
+}
+
+static double benchNow(void)
+{
+  struct mstimeval t;
+  msGettimeofday(&t, NULL);
+  return t.tv_sec + t.tv_usec / 1.0e6;
+}
+
+/* an irregular star shaped ring, or an open random walk if polygon is MS_FALSE */
+static void benchMakeShape(shapeObj *shape, int polygon, int numpoints, double x, double y, double radius)
+{
+  lineObj line;
+  int i;
+
+  msInitShape(shape);
+  shape->type = polygon ? MS_SHAPE_POLYGON : MS_SHAPE_LINE;
+
+  line.numpoints = numpoints;
+  line.point = (pointObj *) msSmallMalloc(sizeof(pointObj) * numpoints);
+  for(i=0; i<numpoints; i++) {
+    if(polygon) {
+      double a = 2 * MS_PI * i / (numpoints-1);
+      double r = 0.5 + 0.5 * benchRandom();
+      line.point[i].x = x + radius * r * cos(a);
+      line.point[i].y = y + radius * r * sin(a);
+    } else {
+      line.point[i].x = x + radius * (2 * benchRandom() - 1);
+      line.point[i].y = y + radius * (2 * benchRandom() - 1);
+    }
+#ifdef USE_POINT_Z_M
+    line.point[i].z = line.point[i].m = 0;
+#endif
+  }
+  if(polygon) /* close the ring */
+    line.point[numpoints-1] = line.point[0];
+
+  msAddLineDirectly(shape, &line);
+  msComputeBounds(shape);
+}
+
+/* ---------------------------------------------------------------------- */
+/*      Benchmarks                                                        */
+/* ---------------------------------------------------------------------- */
+
+static void benchCopyShape(benchDataObj *data)
+{
+  shapeObj shape;
+
+  msInitShape(&shape);
+  msCopyShape(&(data->polygon), &shape);
+  bench_sink += shape.line[0].numpoints;
+  msFreeShape(&shape);
+}
+
+static void benchClipPolygon(benchDataObj *data)
+{
+  shapeObj shape;
+
+  msInitShape(&shape);
+  msCopyShape(&(data->polygon), &shape);
+  msClipPolygonRect(&shape, data->cliprect);
+  bench_sink += shape.numlines;
+  msFreeShape(&shape);
+}
+
+static void benchClipPolyline(benchDataObj *data)
+{
+  shapeObj shape;
+
+  msInitShape(&shape);
+  msCopyShape(&(data->polyline), &shape);
+  msClipPolylineRect(&shape, data->cliprect);
+  bench_sink += shape.numlines;
+  msFreeShape(&shape);
+}
+
+static void benchTransformSimplify(benchDataObj *data)
+{
+  shapeObj shape;
+  rectObj extent = { 0, 0, 1000, 1000 };
+
+  msInitShape(&shape);
+  msCopyShape(&(data->polygon), &shape);
+  msTransformShapeSimplify(&shape, extent, 1000.0 / 256);
+  bench_sink += shape.numlines ? shape.line[0].numpoints : 0;
+  msFreeShape(&shape);
+}
+
+static void benchProjectShape(benchDataObj *data)
+{
+#ifdef USE_PROJ
+  shapeObj shape;
+
+  msInitShape(&shape);
+  msCopyShape(&(data->polygon_latlon), &shape);
+  msProjectShape(&(data->latlon), &(data->merc), &shape);
+  bench_sink += shape.line[0].point[0].x;
+  msFreeShape(&shape);
+#endif
+}
+
+static void benchIntersectPolygons(benchDataObj *data)
+{
+  bench_sink += msIntersectPolygons(&(data->polygon), &(data->polygon_far));
+}
+
+static void benchReadSynthetic(benchDataObj *data)
+{
+  shapeObj shape;
+
+  msInitShape(&shape);
+  msSHPReadShape(data->synthetic_shp, data->counter++ % data->synthetic_numshapes, &shape);
+  bench_sink += shape.numlines;
+  msFreeShape(&shape);
+}
+
+static void benchReadTestData(benchDataObj *data)
+{
+  shapeObj shape;
+  int f = data->counter++ % data->numtest;
+
+  msInitShape(&shape);
+  msSHPReadShape(data->test_shp[f], (data->counter / data->numtest) % data->test_numshapes[f], &shape);
+  bench_sink += shape.numlines;
+  msFreeShape(&shape);
+}
+
+static void benchSearchDiskTree(benchDataObj *data)
+{
+  ms_bitarray status;
+
+  status = msSearchDiskTree(data->synthetic, data->windows[data->counter++ % BENCH_NUMWINDOWS], MS_FALSE);
+  bench_sink += (status != NULL);
+  msFree(status);
+}
+
+static void benchEvalExpression(benchDataObj *data, int classindex)
+{
+  layerObj *layer = GET_LAYER(data->expression_map, 0);
+  shapeObj *shape = &(data->records[data->counter++ % data->numrecords]);
+
+  bench_sink += msEvalExpression(layer, shape, &(layer->class[classindex]->expression), layer->classitemindex);
+}
+
+static void benchEvalString(benchDataObj *data)
+{
+  benchEvalExpression(data, 0);
+}
+
+static void benchEvalLogical(benchDataObj *data)
+{
+  benchEvalExpression(data, 1);
+}
+
+static void benchEvalRegex(benchDataObj *data)
+{
+  benchEvalExpression(data, 2);
+}
+
+static void benchLabelCollisions(benchDataObj *data)
+{
+  labelCacheMemberObj *cachePtr = &(data->candidates[data->counter++ % BENCH_NUMCANDIDATES]);
+
+  bench_sink += msTestLabelCacheCollisions(data->label_map, cachePtr, cachePtr->poly, 0, 0, -BENCH_NUMLABELS);
+}
+
+static void benchLabelCollisionsGrid(benchDataObj *data)
+{
+  labelCacheMemberObj *cachePtr = &(data->candidates[data->counter++ % BENCH_NUMCANDIDATES]);
+
+  bench_sink += msTestLabelCacheCollisions(data->label_grid_map, cachePtr, cachePtr->poly, 0, 0, -BENCH_NUMLABELS);
+}
+
+static benchCaseObj bench_cases[] = {
+  { "copy_shape", "msCopyShape() of a 1000 point polygon, the baseline of the *_shape and clip_* cases", BENCH_NEEDS_NOTHING, benchCopyShape },
+  { "clip_polygon", "msClipPolygonRect() of a 1000 point polygon", BENCH_NEEDS_NOTHING, benchClipPolygon },
+  { "clip_polyline", "msClipPolylineRect() of a 1000 point line", BENCH_NEEDS_NOTHING, benchClipPolyline },
+  { "transform_simplify", "msTransformShapeSimplify() of a 1000 point polygon to a 256 pixel image", BENCH_NEEDS_NOTHING, benchTransformSimplify },
+  { "project_shape", "msProjectShape() of a 1000 point polygon from lat/long to mercator", BENCH_NEEDS_PROJ, benchProjectShape },
+  { "intersect_polygons", "msIntersectPolygons() of a 1000 and a 500 point polygon that do not intersect", BENCH_NEEDS_NOTHING, benchIntersectPolygons },
+  { "shp_read_synthetic", "msSHPReadShape() of 8 to 64 point polygons", BENCH_NEEDS_SYNTHETIC, benchReadSynthetic },
+  { "shp_read_tests", "msSHPReadShape() of tests/point, line and polygon.shp", BENCH_NEEDS_TESTDATA, benchReadTestData },
+  { "search_disk_tree", "msSearchDiskTree() of a 1/400 area window on 10000 polygons", BENCH_NEEDS_SYNTHETIC, benchSearchDiskTree },
+  { "eval_string", "msEvalExpression() of a CLASSITEM string", BENCH_NEEDS_EXPRESSIONS, benchEvalString },
+  { "eval_logical", "msEvalExpression() of a logical expression with two attributes", BENCH_NEEDS_EXPRESSIONS, benchEvalLogical },
+  { "eval_regex", "msEvalExpression() of a CLASSITEM regular expression", BENCH_NEEDS_EXPRESSIONS, benchEvalRegex },
+  { "label_collisions", "msTestLabelCacheCollisions() against 4000 cached labels", BENCH_NEEDS_LABELS, benchLabelCollisions },
+  { "label_collisions_grid", "msTestLabelCacheCollisions() against the same labels with labelcache_grid_size 64", BENCH_NEEDS_LABELS, benchLabelCollisionsGrid },
+  { NULL, NULL, 0, NULL }
+};
+
+/* ---------------------------------------------------------------------- */
+/*      Inputs                                                            */
+/* ---------------------------------------------------------------------- */
+
+static void benchRemoveSyntheticFiles(void)
+{
+  int i;
+
+  for(i=0; i<4; i++) {
+    if(bench_synthetic_files[i][0])
+      unlink(bench_synthetic_files[i]);
+    bench_synthetic_files[i][0] = '\0';
+  }
+}
+
+static void benchSignalHandler(int sig)
+{
+  benchRemoveSyntheticFiles();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+static int benchSetupSynthetic(benchDataObj *data, const char *tmpdir)
+{
+  const char *extensions[] = { ".shp", ".shx", ".dbf", MS_INDEX_EXTENSION };
+  SHPHandle hSHP;
+  DBFHandle hDBF;
+  shapefileObj shapefile;
+  treeObj *tree;
+  char filename[MS_MAXPATHLEN+8], value[32]; /* synthetic plus an extension */
+  int i;
+
+  snprintf(data->synthetic, sizeof(data->synthetic), "%s/msbench_%d", tmpdir, (int) getpid());
+
+  /* register the cleanup before the first file is created */
+  for(i=0; i<4; i++)
+    snprintf(bench_synthetic_files[i], sizeof(bench_synthetic_files[i]), "%s%s", data->synthetic, extensions[i]);
+  atexit(benchRemoveSyntheticFiles);
+  signal(SIGINT, benchSignalHandler);
+  signal(SIGTERM, benchSignalHandler);
+  signal(SIGSEGV, benchSignalHandler);
+  signal(SIGABRT, benchSignalHandler);
+
+  hSHP = msSHPCreate(data->synthetic, SHP_POLYGON);
+  snprintf(filename, sizeof(filename), "%s.dbf", data->synthetic);
+  hDBF = msDBFCreate(filename);
+  if(!hSHP || !hDBF ||
+      msDBFAddField(hDBF, "NAME", FTString, 16, 0) == -1 ||
+      msDBFAddField(hDBF, "VALUE", FTInteger, 8, 0) == -1) {
+    if(hSHP) msSHPClose(hSHP);
+    if(hDBF) msDBFClose(hDBF);
+    return MS_FAILURE;
+  }
+
+  for(i=0; i<BENCH_NUMSHAPES; i++) {
+    shapeObj shape;
+
+    benchMakeShape(&shape, MS_TRUE, 8 + (int)(56 * benchRandom()),
+                   100000 * benchRandom(), 100000 * benchRandom(), 50 + 450 * benchRandom());
+    msSHPWriteShape(hSHP, &shape);
+    msFreeShape(&shape);
+
+    snprintf(value, sizeof(value), "name_%d", i % 100);
+    msDBFWriteStringAttribute(hDBF, i, 0, value);
+    msDBFWriteIntegerAttribute(hDBF, i, 1, i % 1000);
+  }
+  msSHPClose(hSHP);
+  msDBFClose(hDBF);
+
+  /* spatial index, as built by shptree */
+  if(msShapefileOpen(&shapefile, "rb", data->synthetic, MS_TRUE) == -1)
+    return MS_FAILURE;
+  tree = msCreateTree(&shapefile, 0);
+  snprintf(filename, sizeof(filename), "%s%s", data->synthetic, MS_INDEX_EXTENSION);
+  msWriteTree(tree, filename, MS_NEW_LSB_ORDER);
+  msDestroyTree(tree);
+  msShapefileClose(&shapefile);
+
+  for(i=0; i<BENCH_NUMWINDOWS; i++) {
+    data->windows[i].minx = 95000 * benchRandom();
+    data->windows[i].miny = 95000 * benchRandom();
+    data->windows[i].maxx = data->windows[i].minx + 5000;
+    data->windows[i].maxy = data->windows[i].miny + 5000;
+  }
+
+  data->synthetic_shp = msSHPOpen(data->synthetic, "rb");
+  if(!data->synthetic_shp)
+    return MS_FAILURE;
+  msSHPGetInfo(data->synthetic_shp, &(data->synthetic_numshapes), NULL);
+
+  return MS_SUCCESS;
+}
+
+static void benchRemoveSynthetic(benchDataObj *data)
+{
+  if(data->synthetic_shp)
+    msSHPClose(data->synthetic_shp);
+  data->synthetic_shp = NULL;
+  benchRemoveSyntheticFiles();
+}
+
+static int benchSetupTestData(benchDataObj *data, const char *testdir)
+{
+  const char *names[] = { "point", "line", "polygon" };
+  char filename[MS_MAXPATHLEN+8];
+  int i;
+
+  data->numtest = 0;
+  for(i=0; i<3; i++) {
+    SHPHandle hSHP;
+    int numshapes = 0;
+
+    snprintf(filename, sizeof(filename), "%s/%s", testdir, names[i]);
+    hSHP = msSHPOpen(filename, "rb");
+    if(!hSHP) continue;
+    msSHPGetInfo(hSHP, &numshapes, NULL);
+    if(numshapes == 0) {
+      msSHPClose(hSHP);
+      continue;
+    }
+    data->test_shp[data->numtest] = hSHP;
+    data->test_numshapes[data->numtest] = numshapes;
+    data->numtest++;
+  }
+
+  return (data->numtest > 0) ? MS_SUCCESS : MS_FAILURE;
+}
+
+/* reads records of the synthetic shapefile through a layer, as msDrawVectorLayer() does */
+static int benchSetupExpressions(benchDataObj *data)
+{
+  char buffer[2048];
+  layerObj *layer;
+  rectObj extent = { 0, 0, 100000, 100000 };
+  shapeObj shape;
+
+  snprintf(buffer, sizeof(buffer),
+           "MAP\n"
+           "  LAYER\n"
+           "    NAME \"bench\" TYPE POLYGON STATUS ON\n"
+           "    DATA \"%s\"\n"
+           "    CLASSITEM \"NAME\"\n"
+           "    CLASS EXPRESSION \"name_17\" END\n"
+           "    CLASS EXPRESSION ([VALUE] > 500 AND \"[NAME]\" != \"name_3\") END\n"
+           "    CLASS EXPRESSION /^name_1[0-9]*$/ END\n"
+           "  END\n"
+           "END\n", data->synthetic);
+
+  data->expression_map = msLoadMapFromString(buffer, NULL);
+  if(!data->expression_map)
+    return MS_FAILURE;
+
+  layer = GET_LAYER(data->expression_map, 0);
+  if(msLayerOpen(layer) != MS_SUCCESS ||
+      msLayerWhichItems(layer, MS_FALSE, NULL) != MS_SUCCESS ||
+      msLayerWhichShapes(layer, extent, MS_FALSE) != MS_SUCCESS)
+    return MS_FAILURE;
+
+  data->records = (shapeObj *) msSmallMalloc(sizeof(shapeObj) * BENCH_MAXRECORDS);
+  msInitShape(&shape);
+  while(data->numrecords < BENCH_MAXRECORDS && msLayerNextShape(layer, &shape) == MS_SUCCESS) {
+    data->records[data->numrecords++] = shape; /* takes ownership */
+    msInitShape(&shape);
+  }
+
+  return (data->numrecords > 0) ? MS_SUCCESS : MS_FAILURE;
+}
+
+static void benchInitLabelCacheMember(labelCacheMemberObj *cachePtr, rectObj bounds)
+{
+  memset(cachePtr, 0, sizeof(labelCacheMemberObj));
+  cachePtr->labels = (labelObj *) msSmallMalloc(sizeof(labelObj));
+  initLabel(cachePtr->labels);
+  cachePtr->numlabels = 1;
+  cachePtr->point.x = (bounds.minx + bounds.maxx) / 2;
+  cachePtr->point.y = (bounds.miny + bounds.maxy) / 2;
+  cachePtr->poly = (shapeObj *) msSmallMalloc(sizeof(shapeObj));
+  msInitShape(cachePtr->poly);
+  msRectToPolygon(bounds, cachePtr->poly);
+  cachePtr->status = MS_TRUE; /* already rendered */
+  cachePtr->markerid = -1;
+  cachePtr->gridnext = -1;
+}
+
+/* a 2048x2048 map with one slot of randomly placed 48x12 pixel labels */
+static mapObj *benchLabelMap(int gridsize)
+{
+  char buffer[] = "MAP SIZE 2048 2048 EXTENT 0 0 2048 2048 LAYER NAME \"labels\" TYPE POINT STATUS ON END END";
+  labelCacheSlotObj *cacheslot;
+  mapObj *map;
+  int i;
+
+  map = msLoadMapFromString(buffer, NULL);
+  if(!map)
+    return NULL;
+  map->cellsize = msAdjustExtent(&(map->extent), map->width, map->height);
+
+  cacheslot = &(map->labelcache.slots[0]);
+  cacheslot->labels = (labelCacheMemberObj *) msSmallRealloc(cacheslot->labels, sizeof(labelCacheMemberObj) * BENCH_NUMLABELS);
+  cacheslot->cachesize = BENCH_NUMLABELS;
+  for(i=0; i<BENCH_NUMLABELS; i++) {
+    rectObj bounds;
+    bounds.minx = 2000 * benchRandom();
+    bounds.miny = 2036 * benchRandom();
+    bounds.maxx = bounds.minx + 48;
+    bounds.maxy = bounds.miny + 12;
+    benchInitLabelCacheMember(&(cacheslot->labels[i]), bounds);
+  }
+  cacheslot->numlabels = BENCH_NUMLABELS;
+  map->labelcache.numlabels = BENCH_NUMLABELS;
+
+  if(gridsize > 0 && msLabelCacheBuildGrid(map, gridsize) != MS_SUCCESS) {
+    msFreeMap(map);
+    return NULL;
+  }
+
+  return map;
+}
+
+static int benchSetupLabels(benchDataObj *data)
+{
+  unsigned int seed = bench_seed;
+  int i;
+
+  /* both maps get the same labels */
+  data->label_map = benchLabelMap(0);
+  bench_seed = seed;
+  data->label_grid_map = benchLabelMap(64);
+  if(!data->label_map || !data->label_grid_map)
+    return MS_FAILURE;
+
+  for(i=0; i<BENCH_NUMCANDIDATES; i++) {
+    rectObj bounds;
+    bounds.minx = 2000 * benchRandom();
+    bounds.miny = 2036 * benchRandom();
+    bounds.maxx = bounds.minx + 48;
+    bounds.maxy = bounds.miny + 12;
+    benchInitLabelCacheMember(&(data->candidates[i]), bounds);
+  }
+
+  return MS_SUCCESS;
+}
+
+static void benchFreeData(benchDataObj *data)
+{
+  int i;
+
+  msFreeShape(&(data->polygon));
+  msFreeShape(&(data->polyline));
+  msFreeShape(&(data->polygon_far));
+  msFreeShape(&(data->polygon_latlon));
+#ifdef USE_PROJ
+  msFreeProjection(&(data->latlon));
+  msFreeProjection(&(data->merc));
+#endif
+
+  for(i=0; i<data->numtest; i++)
+    msSHPClose(data->test_shp[i]);
+
+  for(i=0; i<data->numrecords; i++)
+    msFreeShape(&(data->records[i]));
+  msFree(data->records);
+  if(data->expression_map) {
+    msLayerClose(GET_LAYER(data->expression_map, 0));
+    msFreeMap(data->expression_map);
+  }
+
+  if(data->label_map) {
+    for(i=0; i<BENCH_NUMCANDIDATES; i++)
+      msFreeLabelCacheMember(&(data->candidates[i]));
+    msFreeMap(data->label_map);
+  }
+  if(data->label_grid_map)
+    msFreeMap(data->label_grid_map);
+
+  benchRemoveSynthetic(data);
+}
+
+/* ---------------------------------------------------------------------- */
+/*      Driver                                                            */
+/* ---------------------------------------------------------------------- */
+
+static int compareDoubles(const void *a, const void *b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+static void benchWriteJSONString(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for(; *s; s++) {
+    if(*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if((unsigned char)*s < 0x20)
+      fprintf(fp, "\\u%04x", (unsigned char)*s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+/* returns the time per operation of each of the repeats batches in ns, sorted */
+static long benchRun(benchCaseObj *bench, benchDataObj *data, double mintime, int repeats, double *samples)
+{
+  long n, i;
+  int r;
+  double start, elapsed;
+
+  /* calibrate, this is also the warm-up */
+  for(n=1; ; n*=2) {
+    start = benchNow();
+    for(i=0; i<n; i++)
+      bench->run(data);
+    elapsed = benchNow() - start;
+    if(elapsed >= mintime || n >= (1L << 30))
+      break;
+  }
+
+  for(r=0; r<repeats; r++) {
+    start = benchNow();
+    for(i=0; i<n; i++)
+      bench->run(data);
+    samples[r] = (benchNow() - start) * 1.0e9 / n;
+  }
+  qsort(samples, repeats, sizeof(double), compareDoubles);
+
+  return n;
+}
+
+static void usage(void)
+{
+  int i;
+
+  fprintf(stdout, "\nPurpose: time the core geometry, shapefile and label cache primitives\n\n");
+  fprintf(stdout,
+          "Syntax: msbench [-c n] [-t ms] [-d testdir] [-tmp dir] [-r report] [-l] [benchmark...]\n\n");
+  fprintf(stdout,"  -c n: number of timed batches per benchmark (default 9)\n" );
+  fprintf(stdout,"  -t ms: minimum duration of a batch in milliseconds (default 50)\n" );
+  fprintf(stdout,"  -d testdir: directory holding the tests/ data set (default tests)\n" );
+  fprintf(stdout,"  -tmp dir: where the synthetic shapefile is written (default $TMPDIR or /tmp)\n" );
+  fprintf(stdout,"  -r report: write the results as JSON to this file\n" );
+  fprintf(stdout,"  -l: list the benchmarks and exit\n" );
+  fprintf(stdout,"  benchmark: only run the benchmarks whose name starts with this\n\n" );
+  for(i=0; bench_cases[i].name; i++)
+    fprintf(stdout, "  %-22s %s\n", bench_cases[i].name, bench_cases[i].description);
+}
+
+int main(int argc, char *argv[])
+{
+  benchDataObj data;
+  const char *testdir = "tests", *tmpdir = NULL, *report = NULL;
+  double mintime = 0.05;
+  int repeats = 9;
+  char **selected;
+  int numselected = 0;
+  double *samples;
+  FILE *fp = NULL;
+  int i, j, numrun = 0;
+
+  selected = (char **) msSmallMalloc(sizeof(char *) * argc);
+
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-c") == 0 && i < argc-1) {
+      repeats = atoi(argv[++i]);
+      repeats = MS_MAX(1, repeats);
+    } else if(strcmp(argv[i], "-t") == 0 && i < argc-1) {
+      mintime = atof(argv[++i]) / 1000.0;
+    } else if(strcmp(argv[i], "-d") == 0 && i < argc-1) {
+      testdir = argv[++i];
+    } else if(strcmp(argv[i], "-tmp") == 0 && i < argc-1) {
+      tmpdir = argv[++i];
+    } else if(strcmp(argv[i], "-r") == 0 && i < argc-1) {
+      report = argv[++i];
+    } else if(strcmp(argv[i], "-l") == 0 || argv[i][0] == '-') {
+      usage();
+      free(selected);
+      exit(0);
+    } else {
+      selected[numselected++] = argv[i];
+    }
+  }
+
+  if(!tmpdir) tmpdir = getenv("TMPDIR");
+#ifdef _WIN32
+  if(!tmpdir) tmpdir = getenv("TEMP");
+#endif
+  if(!tmpdir) tmpdir = "/tmp";
+
+  if(msSetup() != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  /* ---- build the inputs, before anything is timed ---- */
+  memset(&data, 0, sizeof(data));
+  data.have[BENCH_NEEDS_NOTHING] = MS_TRUE;
+
+  benchMakeShape(&(data.polygon), MS_TRUE, 1000, 500, 500, 400);
+  benchMakeShape(&(data.polyline), MS_FALSE, 1000, 500, 500, 400);
+  benchMakeShape(&(data.polygon_far), MS_TRUE, 500, 1500, 500, 99); /* bounds do not touch data.polygon */
+  benchMakeShape(&(data.polygon_latlon), MS_TRUE, 1000, 10, 50, 5);
+  data.cliprect.minx = data.cliprect.miny = 300;
+  data.cliprect.maxx = data.cliprect.maxy = 700;
+
+#ifdef USE_PROJ
+  msInitProjection(&(data.latlon));
+  msInitProjection(&(data.merc));
+  data.have[BENCH_NEEDS_PROJ] =
+    msLoadProjectionString(&(data.latlon), "+proj=longlat +datum=WGS84 +no_defs") == 0 &&
+    msLoadProjectionString(&(data.merc), "+proj=merc +a=6378137 +b=6378137 +units=m +no_defs") == 0;
+#endif
+
+  data.have[BENCH_NEEDS_TESTDATA] = (benchSetupTestData(&data, testdir) == MS_SUCCESS);
+  data.have[BENCH_NEEDS_SYNTHETIC] = (benchSetupSynthetic(&data, tmpdir) == MS_SUCCESS);
+  if(data.have[BENCH_NEEDS_SYNTHETIC])
+    data.have[BENCH_NEEDS_EXPRESSIONS] = (benchSetupExpressions(&data) == MS_SUCCESS);
+  data.have[BENCH_NEEDS_LABELS] = (benchSetupLabels(&data) == MS_SUCCESS);
+  msResetErrorList();
+
+  if(report) {
+    fp = fopen(report, "w");
+    if(!fp) {
+      fprintf(stderr, "Unable to open benchmark report file %s.\n", report);
+      benchFreeData(&data);
+      free(selected);
+      msCleanup(0);
+      exit(1);
+    }
+    fprintf(fp, "{\n  \"version\": ");
+    benchWriteJSONString(fp, msGetVersion());
+    fprintf(fp, ",\n  \"repeats\": %d,\n  \"min_batch_ms\": %g,\n  \"benchmarks\": [", repeats, mintime * 1000);
+  }
+
+  fprintf(stdout, "%-22s %12s %12s %12s %12s %8s\n", "benchmark", "ops/batch", "min ns/op", "median ns/op", "max ns/op", "spread");
+
+  samples = (double *) msSmallMalloc(sizeof(double) * repeats);
+  for(i=0; bench_cases[i].name; i++) {
+    benchCaseObj *bench = &(bench_cases[i]);
+    long n;
+    double median;
+
+    if(numselected > 0) {
+      for(j=0; j<numselected; j++)
+        if(strncmp(bench->name, selected[j], strlen(selected[j])) == 0) break;
+      if(j == numselected) continue;
+    }
+
+    if(!data.have[bench->needs]) {
+      fprintf(stdout, "%-22s %12s\n", bench->name, "(skipped, input not available)");
+      continue;
+    }
+
+    data.counter = 0;
+    n = benchRun(bench, &data, mintime, repeats, samples);
+    median = samples[repeats/2];
+
+    fprintf(stdout, "%-22s %12ld %12.1f %12.1f %12.1f %7.1f%%\n", bench->name, n,
+            samples[0], median, samples[repeats-1], 100 * (samples[repeats-1] - samples[0]) / median);
+
+    if(fp) {
+      fprintf(fp, "%s\n    { \"name\": ", (numrun > 0) ? "," : "");
+      benchWriteJSONString(fp, bench->name);
+      fprintf(fp, ", \"ops_per_batch\": %ld, \"min_ns\": %.1f, \"median_ns\": %.1f, \"max_ns\": %.1f }",
+              n, samples[0], median, samples[repeats-1]);
+    }
+    numrun++;
+  }
+
+  if(fp) {
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+  }
+
+  free(samples);
+  free(selected);
+  benchFreeData(&data);
+  msCleanup(0);
+
+  return(0);
+}
@@ -30,139 +30,201 @@
 #include "mapserver.h"
 #include "maptime.h"
 
+#include <math.h>
+
+/*
+** Allocation statistics for -bench. The heap growth of each draw is taken
+** from glibc's mallinfo2(), which leaves the allocator alone. Counting the
+** individual allocations means replacing the allocator entry points, so it
+** is only built when SHP2IMG_COUNT_ALLOCS is defined (CFLAGS=
+** -DSHP2IMG_COUNT_ALLOCS on glibc). All of them are then routed to glibc,
+** do not combine such a build with an LD_PRELOADed malloc.
+*/
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define SHP2IMG_HEAP_STATS
+#endif
+
+#if defined(SHP2IMG_COUNT_ALLOCS) && !defined(__GLIBC__)
+#error "SHP2IMG_COUNT_ALLOCS requires glibc"
+#endif
+
+#ifdef SHP2IMG_COUNT_ALLOCS
+#include <errno.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long alloc_count = 0;
+
+void *malloc(size_t size)
+{
+  __sync_fetch_and_add(&alloc_count, 1);
+  return __libc_malloc(size);
+}
 
+void *calloc(size_t nmemb, size_t size)
+{
+  __sync_fetch_and_add(&alloc_count, 1);
+  return __libc_calloc(nmemb, size);
+}
 
-int main(int argc, char *argv[])
+void *realloc(void *ptr, size_t size)
 {
-  int i,j,k;
+  __sync_fetch_and_add(&alloc_count, 1);
+  return __libc_realloc(ptr, size);
+}
 
-  mapObj         *map=NULL;
-  imageObj         *image = NULL;
+void *memalign(size_t alignment, size_t size)
+{
+  __sync_fetch_and_add(&alloc_count, 1);
+  return __libc_memalign(alignment, size);
+}
 
-  char **layers=NULL;
-  int num_layers=0;
+void *aligned_alloc(size_t alignment, size_t size)
+{
+  return memalign(alignment, size);
+}
 
-  int layer_found=0;
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  void *ptr;
+
+  if(alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  ptr = memalign(alignment, size);
+  if(!ptr)
+    return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+void *valloc(size_t size)
+{
+  __sync_fetch_and_add(&alloc_count, 1);
+  return __libc_valloc(size);
+}
 
-  char *outfile=NULL; /* no -o sends image to STDOUT */
+void *pvalloc(size_t size)
+{
+  __sync_fetch_and_add(&alloc_count, 1);
+  return __libc_pvalloc(size);
+}
 
-  int iterations = 1;
-  int draws = 0;
+void free(void *ptr)
+{
+  __libc_free(ptr);
+}
+#endif
 
-  for(i=1; i<argc; i++) {
-    if (strcmp(argv[i],"-c") == 0) { /* user specified number of draws */
-      iterations = atoi(argv[i+1]);
-      printf("We will draw %d times...\n", iterations);
-      continue;
-    }
+enum { BENCH_LOAD, BENCH_QUERY, BENCH_RENDER, BENCH_LABELCACHE, BENCH_ENCODE, BENCH_TOTAL, BENCH_NUMSTAGES };
 
-    if(strcmp(argv[i], "-all_debug") == 0 && i < argc-1 ) { /* global debug */
-      int debug_level = atoi(argv[++i]);
+static const char *bench_stages[BENCH_NUMSTAGES] = { "load", "query", "render", "labelcache", "encode", "total" };
 
-      msSetGlobalDebugLevel(debug_level);
+typedef struct {
+  double min, mean, p50, p90, p99, max;
+} benchStatsObj;
 
-      /* Send output to stderr by default */
-      if (msGetErrorFile() == NULL)
-        msSetErrorFile("stderr", NULL);
+static int compareDoubles(const void *a, const void *b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
 
-      continue;
-    }
+/* nearest rank percentile of a sorted array */
+static double benchPercentile(const double *values, int n, double p)
+{
+  int i = (int)ceil(p / 100.0 * n) - 1;
+  return values[MS_MAX(0, MS_MIN(n-1, i))];
+}
 
+/* sorts values in place */
+static void benchComputeStats(double *values, int n, benchStatsObj *stats)
+{
+  int i;
+
+  qsort(values, n, sizeof(double), compareDoubles);
+  stats->mean = 0;
+  for(i=0; i<n; i++)
+    stats->mean += values[i];
+  stats->mean /= n;
+  stats->min = values[0];
+  stats->max = values[n-1];
+  stats->p50 = benchPercentile(values, n, 50);
+  stats->p90 = benchPercentile(values, n, 90);
+  stats->p99 = benchPercentile(values, n, 99);
+}
+
+static void benchWriteJSONString(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for(; *s; s++) {
+    if(*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if((unsigned char)*s < 0x20)
+      fprintf(fp, "\\u%04x", (unsigned char)*s);
+    else
+      fputc(*s, fp);
   }
+  fputc('"', fp);
+}
 
-  for(draws=0; draws<iterations; draws++) {
-
-    struct mstimeval requeststarttime, requestendtime;
-
-    if(msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_TUNING)
-      msGettimeofday(&requeststarttime, NULL);
-
-    if(argc > 1 && strcmp(argv[1], "-v") == 0) {
-      printf("%s\n", msGetVersion());
-      exit(0);
-    }
-
-    /* ---- check the number of arguments, return syntax if not correct ---- */
-    if( argc < 3 ) {
-      fprintf(stdout, "\nPurpose: convert a mapfile to an image\n\n");
-      fprintf(stdout,
-              "Syntax: shp2img -m mapfile [-o image] [-e minx miny maxx maxy] [-s sizex sizey]\n"
-              "               [-l \"layer1 [layers2...]\"] [-i format]\n"
-              "               [-all_debug n] [-map_debug n] [-layer_debug n] [-p n] [-c n] [-d layername datavalue]\n");
-
-
-      fprintf(stdout,"  -m mapfile: Map file to operate on - required\n" );
-      fprintf(stdout,"  -i format: Override the IMAGETYPE value to pick output format\n" );
-      fprintf(stdout,"  -o image: output filename (stdout if not provided)\n");
-      fprintf(stdout,"  -e minx miny maxx maxy: extents to render\n");
-      fprintf(stdout,"  -s sizex sizey: output image size\n");
-      fprintf(stdout,"  -l layers: layers / groups to enable - make sure they are quoted and space seperated if more than one listed\n" );
-      fprintf(stdout,"  -all_debug n: Set debug level for map and all layers\n" );
-      fprintf(stdout,"  -map_debug n: Set map debug level\n" );
-      fprintf(stdout,"  -layer_debug layer_name n: Set layer debug level\n" );
-      fprintf(stdout,"  -c n: draw map n number of times\n" );
-      fprintf(stdout,"  -p n: pause for n seconds after reading the map\n" );
-      fprintf(stdout,"  -d layername datavalue: change DATA value for layer\n" );
-
-
-      exit(0);
-    }
+static void benchWriteJSONStats(FILE *fp, const benchStatsObj *stats)
+{
+  fprintf(fp, "{ \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f }",
+          stats->min, stats->mean, stats->p50, stats->p90, stats->p99, stats->max);
+}
 
-    if ( msSetup() != MS_SUCCESS ) {
-      msWriteError(stderr);
-      exit(1);
-    }
+static double benchElapsed(struct mstimeval *start, struct mstimeval *end)
+{
+  return ((end->tv_sec+end->tv_usec/1.0e6) - (start->tv_sec+start->tv_usec/1.0e6)) * 1000.0; /* ms */
+}
+
+/*
+** Apply the command line switches that modify a loaded map. In benchmark
+** mode the extent, size and output format come from the benchmark matrix
+** so -e, -s and -i are parsed but not applied, and -p is ignored.
+*/
+static int applyArguments(mapObj *map, int argc, char *argv[], char **outfile, int bench)
+{
+  int i,j,k;
 
-    /* Use MS_ERRORFILE and MS_DEBUGLEVEL env vars if set */
-    if ( msDebugInitFromEnv() != MS_SUCCESS ) {
-      msWriteError(stderr);
-      msCleanup(0);
-      exit(1);
-    }
+  char **layers=NULL;
+  int num_layers=0;
 
-    for(i=1; i<argc; i++) { /* Step though the user arguments, 1st to find map file */
+  int layer_found=0;
 
-      if(strcmp(argv[i],"-m") == 0) {
-        map = msLoadMap(argv[i+1], NULL);
-        if(!map) {
-          msWriteError(stderr);
-          msCleanup(0);
-          exit(1);
-        }
-        msApplyDefaultSubstitutions(map);
-      }
-    }
+  for(i=1; i<argc; i++) { /* Step though the user arguments */
 
-    if(!map) {
-      fprintf(stderr, "Mapfile (-m) option not specified.\n");
-      msCleanup(0);
-      exit(1);
+    if(strcmp(argv[i],"-m") == 0) { /* skip it */
+      i+=1;
     }
 
-
-    for(i=1; i<argc; i++) { /* Step though the user arguments */
-
-      if(strcmp(argv[i],"-m") == 0) { /* skip it */
-        i+=1;
-      }
-
-      if(strcmp(argv[i],"-p") == 0) {
+    if(strcmp(argv[i],"-p") == 0) {
+      if(!bench) {
         int pause_length = atoi(argv[i+1]);
         time_t start_time = time(NULL);
 
         printf( "Start pause of %d seconds.\n", pause_length );
         while( time(NULL) < start_time + pause_length ) {}
         printf( "Done pause.\n" );
-
-        i+=1;
       }
 
-      if(strcmp(argv[i],"-o") == 0) { /* load the output image filename */
-        outfile = argv[i+1];
-        i+=1;
-      }
+      i+=1;
+    }
+
+    if(strcmp(argv[i],"-o") == 0) { /* load the output image filename */
+      *outfile = argv[i+1];
+      i+=1;
+    }
 
-      if(strcmp(argv[i],"-i") == 0) {
+    if(strcmp(argv[i],"-i") == 0) {
+      if(!bench) {
         outputFormatObj *format;
 
         format = msSelectOutputFormat( map, argv[i+1] );
@@ -176,120 +238,533 @@ int main(int argc, char *argv[])
                                map->transparent, map->interlace,
                                map->imagequality );
         }
-        i+=1;
       }
+      i+=1;
+    }
 
-      if(strcmp(argv[i],"-d") == 0) { /* swap layer data */
-        for(j=0; j<map->numlayers; j++) {
-          if(strcmp(GET_LAYER(map, j)->name, argv[i+1]) == 0) {
-            free(GET_LAYER(map, j)->data);
-            GET_LAYER(map, j)->data = msStrdup(argv[i+2]);
-            break;
-          }
+    if(strcmp(argv[i],"-d") == 0) { /* swap layer data */
+      for(j=0; j<map->numlayers; j++) {
+        if(strcmp(GET_LAYER(map, j)->name, argv[i+1]) == 0) {
+          free(GET_LAYER(map, j)->data);
+          GET_LAYER(map, j)->data = msStrdup(argv[i+2]);
+          break;
         }
-        i+=2;
       }
+      i+=2;
+    }
 
-      if(strcmp(argv[i], "-all_debug") == 0 && i < argc-1 ) { /* global debug */
-        int debug_level = atoi(argv[++i]);
-
-        /* msSetGlobalDebugLevel() already called. Just need to force debug
-         * level in map and all layers
-         */
-        map->debug = debug_level;
-        for(j=0; j<map->numlayers; j++) {
-          GET_LAYER(map, j)->debug = debug_level;
-        }
+    if(strcmp(argv[i], "-all_debug") == 0 && i < argc-1 ) { /* global debug */
+      int debug_level = atoi(argv[++i]);
 
+      /* msSetGlobalDebugLevel() already called. Just need to force debug
+       * level in map and all layers
+       */
+      map->debug = debug_level;
+      for(j=0; j<map->numlayers; j++) {
+        GET_LAYER(map, j)->debug = debug_level;
       }
 
-      if(strcmp(argv[i], "-map_debug") == 0 && i < argc-1 ) { /* debug */
-        map->debug = atoi(argv[++i]);
+    }
 
-        /* Send output to stderr by default */
-        if (msGetErrorFile() == NULL)
-          msSetErrorFile("stderr", NULL);
-      }
+    if(strcmp(argv[i], "-map_debug") == 0 && i < argc-1 ) { /* debug */
+      map->debug = atoi(argv[++i]);
+
+      /* Send output to stderr by default */
+      if (msGetErrorFile() == NULL)
+        msSetErrorFile("stderr", NULL);
+    }
 
-      if(strcmp(argv[i], "-layer_debug") == 0 && i < argc-1 ) { /* debug */
-        const char *layer_name = argv[++i];
-        int debug_level = atoi(argv[++i]);
-        int got_layer = 0;
+    if(strcmp(argv[i], "-layer_debug") == 0 && i < argc-1 ) { /* debug */
+      const char *layer_name = argv[++i];
+      int debug_level = atoi(argv[++i]);
+      int got_layer = 0;
 
-        for(j=0; j<map->numlayers; j++) {
-          if(strcmp(GET_LAYER(map, j)->name,layer_name) == 0 ) {
-            GET_LAYER(map, j)->debug = debug_level;
-            got_layer = 1;
-          }
+      for(j=0; j<map->numlayers; j++) {
+        if(strcmp(GET_LAYER(map, j)->name,layer_name) == 0 ) {
+          GET_LAYER(map, j)->debug = debug_level;
+          got_layer = 1;
         }
-        if( !got_layer )
-          fprintf( stderr,
-                   " Did not find layer '%s' from -layer_debug switch.\n",
-                   layer_name );
-
-        /* Send output to stderr by default */
-        if (msGetErrorFile() == NULL)
-          msSetErrorFile("stderr", NULL);
       }
+      if( !got_layer )
+        fprintf( stderr,
+                 " Did not find layer '%s' from -layer_debug switch.\n",
+                 layer_name );
 
-      if(strcmp(argv[i],"-e") == 0) { /* change extent */
-        if( argc <= i+4 ) {
-          fprintf( stderr,
-                   "Argument -e needs 4 space separated numbers as argument.\n" );
-          msCleanup(0);
-          exit(1);
-        }
+      /* Send output to stderr by default */
+      if (msGetErrorFile() == NULL)
+        msSetErrorFile("stderr", NULL);
+    }
+
+    if(strcmp(argv[i],"-e") == 0) { /* change extent */
+      if( argc <= i+4 ) {
+        fprintf( stderr,
+                 "Argument -e needs 4 space separated numbers as argument.\n" );
+        return MS_FAILURE;
+      }
+      if(!bench) {
         map->extent.minx = atof(argv[i+1]);
         map->extent.miny = atof(argv[i+2]);
         map->extent.maxx = atof(argv[i+3]);
         map->extent.maxy = atof(argv[i+4]);
-        i+=4;
       }
+      i+=4;
+    }
 
-      if (strcmp(argv[i], "-s") == 0) {
+    if (strcmp(argv[i], "-s") == 0) {
+      if(!bench)
         msMapSetSize(map, atoi(argv[i+1]), atoi(argv[i+2]));
-        i+=2;
-      }
+      i+=2;
+    }
 
-      if(strcmp(argv[i],"-l") == 0) { /* load layer list */
-        layers = msStringSplit(argv[i+1], ' ', &(num_layers));
+    if(strcmp(argv[i],"-l") == 0) { /* load layer list */
+      layers = msStringSplit(argv[i+1], ' ', &(num_layers));
+
+      for(j=0; j<num_layers; j++) { /* loop over -l */
+        layer_found=0;
+        for(k=0; k<map->numlayers; k++) {
+          if((GET_LAYER(map, k)->name && strcasecmp(GET_LAYER(map, k)->name, layers[j]) == 0) || (GET_LAYER(map, k)->group && strcasecmp(GET_LAYER(map, k)->group, layers[j]) == 0)) {
+            layer_found = 1;
+            break;
+          }
+        }
+        if (layer_found==0) {
+          fprintf(stderr, "Layer (-l) \"%s\" not found\n", layers[j]);
+          msFreeCharArray(layers, num_layers);
+          return MS_FAILURE;
+        }
+      }
 
-        for(j=0; j<num_layers; j++) { /* loop over -l */
-          layer_found=0;
-          for(k=0; k<map->numlayers; k++) {
-            if((GET_LAYER(map, k)->name && strcasecmp(GET_LAYER(map, k)->name, layers[j]) == 0) || (GET_LAYER(map, k)->group && strcasecmp(GET_LAYER(map, k)->group, layers[j]) == 0)) {
-              layer_found = 1;
+      for(j=0; j<map->numlayers; j++) {
+        if(GET_LAYER(map, j)->status == MS_DEFAULT)
+          continue;
+        else {
+          GET_LAYER(map, j)->status = MS_OFF;
+          for(k=0; k<num_layers; k++) {
+            if((GET_LAYER(map, j)->name && strcasecmp(GET_LAYER(map, j)->name, layers[k]) == 0) ||
+                (GET_LAYER(map, j)->group && strcasecmp(GET_LAYER(map, j)->group, layers[k]) == 0)) {
+              GET_LAYER(map, j)->status = MS_ON;
               break;
             }
           }
-          if (layer_found==0) {
-            fprintf(stderr, "Layer (-l) \"%s\" not found\n", layers[j]);
-            msCleanup(0);
-            exit(1);
-          }
         }
+      }
 
-        for(j=0; j<map->numlayers; j++) {
-          if(GET_LAYER(map, j)->status == MS_DEFAULT)
-            continue;
-          else {
-            GET_LAYER(map, j)->status = MS_OFF;
-            for(k=0; k<num_layers; k++) {
-              if((GET_LAYER(map, j)->name && strcasecmp(GET_LAYER(map, j)->name, layers[k]) == 0) ||
-                  (GET_LAYER(map, j)->group && strcasecmp(GET_LAYER(map, j)->group, layers[k]) == 0)) {
-                GET_LAYER(map, j)->status = MS_ON;
+      msFreeCharArray(layers, num_layers);
+
+      i+=1;
+    }
+  }
+
+  return MS_SUCCESS;
+}
+
+/*
+** Benchmark mode: draw every combination of the mapfiles (-m), extents
+** (-e), sizes (-s) and output formats (-i) given on the command line.
+** Each combination gets warmup untimed passes followed by iterations
+** timed passes of load, draw and in-memory encode. Latency percentiles,
+** a per-stage breakdown, heap growth and (in SHP2IMG_COUNT_ALLOCS builds)
+** allocation counts are printed, and written as JSON to the report file
+** if one is given.
+*/
+static int runBenchmark(int argc, char *argv[], int iterations, int warmup, const char *report)
+{
+  int i, m, e, s, f, n, it;
+  int status = MS_SUCCESS, numruns = 0;
+  FILE *fp = NULL;
+
+  char **mapfiles;
+  rectObj *extents;
+  int *sizes;
+  char **formats;
+  int nummapfiles=0, numextents=0, numsizes=0, numformats=0;
+
+  double *samples[BENCH_NUMSTAGES];
+  double *allocs, *heap;
+
+  mapfiles = (char **) msSmallMalloc(argc * sizeof(char *));
+  extents = (rectObj *) msSmallMalloc(argc * sizeof(rectObj));
+  sizes = (int *) msSmallMalloc(2 * argc * sizeof(int));
+  formats = (char **) msSmallMalloc(argc * sizeof(char *));
+
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i],"-m") == 0 && i < argc-1) {
+      mapfiles[nummapfiles++] = argv[++i];
+    } else if(strcmp(argv[i],"-e") == 0 && i < argc-4) {
+      extents[numextents].minx = atof(argv[i+1]);
+      extents[numextents].miny = atof(argv[i+2]);
+      extents[numextents].maxx = atof(argv[i+3]);
+      extents[numextents].maxy = atof(argv[i+4]);
+      numextents++;
+      i+=4;
+    } else if(strcmp(argv[i],"-s") == 0 && i < argc-2) {
+      sizes[2*numsizes] = atoi(argv[i+1]);
+      sizes[2*numsizes+1] = atoi(argv[i+2]);
+      numsizes++;
+      i+=2;
+    } else if(strcmp(argv[i],"-i") == 0 && i < argc-1) {
+      formats[numformats++] = argv[++i];
+    }
+  }
+
+  if(nummapfiles == 0) /* default corpus */
+    mapfiles[nummapfiles++] = "tests/test.map";
+
+  if(report) {
+    fp = fopen(report, "w");
+    if(!fp) {
+      fprintf(stderr, "Unable to open benchmark report file %s.\n", report);
+      free(mapfiles);
+      free(extents);
+      free(sizes);
+      free(formats);
+      return MS_FAILURE;
+    }
+    fprintf(fp, "{\n  \"version\": ");
+    benchWriteJSONString(fp, msGetVersion());
+    fprintf(fp, ",\n  \"iterations\": %d,\n  \"warmup\": %d,\n  \"runs\": [", iterations, warmup);
+  }
+
+  for(n=0; n<BENCH_NUMSTAGES; n++)
+    samples[n] = (double *) msSmallMalloc(iterations * sizeof(double));
+  allocs = (double *) msSmallMalloc(iterations * sizeof(double));
+  heap = (double *) msSmallMalloc(iterations * sizeof(double));
+
+  for(m=0; m<nummapfiles; m++) {
+    for(e=0; e<MS_MAX(1, numextents); e++) {
+      for(s=0; s<MS_MAX(1, numsizes); s++) {
+        for(f=0; f<MS_MAX(1, numformats); f++) {
+          char formatname[64] = "";
+          rectObj extent = {0,0,0,0};
+          int width=0, height=0, failures=0;
+          benchStatsObj stats;
+
+          n = 0;
+          for(it=-warmup; it<iterations; it++) {
+            mapObj *map;
+            imageObj *image;
+            unsigned char *buffer = NULL;
+            int size = 0;
+            char *outfile = NULL;
+            struct mstimeval t0, t1, t2, t3;
+#ifdef SHP2IMG_COUNT_ALLOCS
+            unsigned long allocs0 = alloc_count;
+#endif
+#ifdef SHP2IMG_HEAP_STATS
+            size_t heap0 = mallinfo2().uordblks;
+#endif
+
+            msGettimeofday(&t0, NULL);
+
+            map = msLoadMap(mapfiles[m], NULL);
+            if(!map) {
+              msWriteError(stderr);
+              msResetErrorList();
+              failures++;
+              break; /* no point trying again */
+            }
+            msApplyDefaultSubstitutions(map);
+
+            if(applyArguments(map, argc, argv, &outfile, MS_TRUE) != MS_SUCCESS) {
+              msFreeMap(map);
+              failures++;
+              break;
+            }
+
+            if(numextents > 0)
+              map->extent = extents[e];
+            if(numsizes > 0)
+              msMapSetSize(map, sizes[2*s], sizes[2*s+1]);
+            if(numformats > 0) {
+              outputFormatObj *format = msSelectOutputFormat(map, formats[f]);
+              if(format == NULL) {
+                fprintf(stderr, "No such OUTPUTFORMAT as %s.\n", formats[f]);
+                msFreeMap(map);
+                failures++;
                 break;
               }
+              msFree(map->imagetype);
+              map->imagetype = msStrdup(formats[f]);
+              msApplyOutputFormat(&(map->outputformat), format,
+                                  map->transparent, map->interlace,
+                                  map->imagequality);
+            }
+
+            /* record what was drawn before msDrawMap() adjusts the extent */
+            strlcpy(formatname, map->outputformat ? map->outputformat->name : "", sizeof(formatname));
+            extent = map->extent;
+            width = map->width;
+            height = map->height;
+
+            map->profile.enabled = MS_TRUE;
+
+            msGettimeofday(&t1, NULL);
+            image = msDrawMap(map, MS_FALSE);
+            msGettimeofday(&t2, NULL);
+            if(image) {
+              buffer = msSaveImageBuffer(image, &size, map->outputformat);
+              msFree(buffer);
+              msFreeImage(image);
+            }
+            msGettimeofday(&t3, NULL);
+
+            if(!image || !buffer) {
+              msWriteError(stderr);
+              msResetErrorList();
+              msFreeMap(map);
+              failures++;
+              continue;
+            }
+
+            if(it >= 0) {
+              samples[BENCH_LOAD][n] = benchElapsed(&t0, &t1);
+              samples[BENCH_QUERY][n] = map->profile.query * 1000.0;
+              samples[BENCH_LABELCACHE][n] = map->profile.labelcache * 1000.0;
+              samples[BENCH_RENDER][n] = MS_MAX(0, benchElapsed(&t1, &t2) - samples[BENCH_QUERY][n] - samples[BENCH_LABELCACHE][n]);
+              samples[BENCH_ENCODE][n] = benchElapsed(&t2, &t3);
+              samples[BENCH_TOTAL][n] = benchElapsed(&t0, &t3);
+            }
+
+            msFreeMap(map);
+
+            if(it >= 0) {
+#ifdef SHP2IMG_COUNT_ALLOCS
+              allocs[n] = (double)(alloc_count - allocs0);
+#else
+              allocs[n] = -1;
+#endif
+#ifdef SHP2IMG_HEAP_STATS
+              heap[n] = (double) mallinfo2().uordblks - (double) heap0;
+#else
+              heap[n] = 0;
+#endif
+              n++;
+            }
+          }
+
+          printf("%s %s %dx%d extent %g %g %g %g\n", mapfiles[m], formatname, width, height,
+                 extent.minx, extent.miny, extent.maxx, extent.maxy);
+
+          if(fp) {
+            fprintf(fp, "%s\n    {\n      \"mapfile\": ", (numruns > 0) ? "," : "");
+            benchWriteJSONString(fp, mapfiles[m]);
+            fprintf(fp, ",\n      \"format\": ");
+            benchWriteJSONString(fp, formatname);
+            fprintf(fp, ",\n      \"width\": %d,\n      \"height\": %d,\n", width, height);
+            fprintf(fp, "      \"extent\": [ %.15g, %.15g, %.15g, %.15g ],\n",
+                    extent.minx, extent.miny, extent.maxx, extent.maxy);
+            fprintf(fp, "      \"samples\": %d,\n      \"failures\": %d", n, failures);
+          }
+          numruns++;
+
+          if(failures > 0)
+            status = MS_FAILURE;
+
+          if(n == 0) {
+            printf("  no successful draws, %d failures\n", failures);
+            if(fp) fprintf(fp, "\n    }");
+            continue;
+          }
+
+          for(i=0; i<BENCH_NUMSTAGES; i++) {
+            benchComputeStats(samples[i], n, &stats);
+            printf("  %-10s ms: min %8.3f  mean %8.3f  p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f\n",
+                   bench_stages[i], stats.min, stats.mean, stats.p50, stats.p90, stats.p99, stats.max);
+            if(fp) {
+              fprintf(fp, ",\n      \"%s_ms\": ", bench_stages[i]);
+              benchWriteJSONStats(fp, &stats);
             }
           }
+
+          benchComputeStats(allocs, n, &stats);
+          if(stats.min < 0) {
+            printf("  allocations: not counted (build with -DSHP2IMG_COUNT_ALLOCS)\n");
+            if(fp) fprintf(fp, ",\n      \"allocations\": null");
+          } else {
+            printf("  allocations: min %.0f  p50 %.0f  max %.0f\n", stats.min, stats.p50, stats.max);
+            if(fp) fprintf(fp, ",\n      \"allocations\": { \"min\": %.0f, \"p50\": %.0f, \"max\": %.0f }",
+                             stats.min, stats.p50, stats.max);
+          }
+#ifdef SHP2IMG_HEAP_STATS
+          /* bytes still allocated after the map was freed, i.e. retained or leaked */
+          benchComputeStats(heap, n, &stats);
+          printf("  heap growth bytes: min %.0f  p50 %.0f  max %.0f\n", stats.min, stats.p50, stats.max);
+          if(fp) fprintf(fp, ",\n      \"heap_growth_bytes\": { \"min\": %.0f, \"p50\": %.0f, \"max\": %.0f }",
+                           stats.min, stats.p50, stats.max);
+#else
+          if(fp) fprintf(fp, ",\n      \"heap_growth_bytes\": null");
+#endif
+          if(failures > 0)
+            printf("  %d failures\n", failures);
+
+          if(fp) fprintf(fp, "\n    }");
         }
+      }
+    }
+  }
+
+  if(fp) {
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+  }
+
+  for(n=0; n<BENCH_NUMSTAGES; n++)
+    free(samples[n]);
+  free(allocs);
+  free(heap);
+  free(mapfiles);
+  free(extents);
+  free(sizes);
+  free(formats);
+
+  return status;
+}
+
+int main(int argc, char *argv[])
+{
+  int i;
+
+  mapObj         *map=NULL;
+  imageObj         *image = NULL;
+
+  char *outfile=NULL; /* no -o sends image to STDOUT */
+
+  int iterations = 1;
+  int draws = 0;
+
+  int bench = MS_FALSE, iterations_set = MS_FALSE;
+  int warmup = 2;
+  char *report = NULL;
+
+  for(i=1; i<argc; i++) {
+    if (strcmp(argv[i],"-c") == 0) { /* user specified number of draws */
+      iterations = atoi(argv[i+1]);
+      iterations_set = MS_TRUE;
+      continue;
+    }
+
+    if(strcmp(argv[i], "-all_debug") == 0 && i < argc-1 ) { /* global debug */
+      int debug_level = atoi(argv[++i]);
+
+      msSetGlobalDebugLevel(debug_level);
+
+      /* Send output to stderr by default */
+      if (msGetErrorFile() == NULL)
+        msSetErrorFile("stderr", NULL);
+
+      continue;
+    }
+
+    if(strcmp(argv[i], "-bench") == 0) {
+      bench = MS_TRUE;
+      continue;
+    }
+
+    if(strcmp(argv[i], "-w") == 0 && i < argc-1) { /* warm-up draws for -bench */
+      warmup = atoi(argv[++i]);
+      continue;
+    }
+
+    if(strcmp(argv[i], "-r") == 0 && i < argc-1) { /* -bench report file */
+      report = argv[++i];
+      continue;
+    }
+  }
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  /* ---- check the number of arguments, return syntax if not correct ---- */
+  if( argc < 3 && !bench ) {
+    fprintf(stdout, "\nPurpose: convert a mapfile to an image\n\n");
+    fprintf(stdout,
+            "Syntax: shp2img -m mapfile [-o image] [-e minx miny maxx maxy] [-s sizex sizey]\n"
+            "               [-l \"layer1 [layers2...]\"] [-i format]\n"
+            "               [-all_debug n] [-map_debug n] [-layer_debug n] [-p n] [-c n] [-d layername datavalue]\n"
+            "               [-bench [-w n] [-r report]]\n");
+
+
+    fprintf(stdout,"  -m mapfile: Map file to operate on - required\n" );
+    fprintf(stdout,"  -i format: Override the IMAGETYPE value to pick output format\n" );
+    fprintf(stdout,"  -o image: output filename (stdout if not provided)\n");
+    fprintf(stdout,"  -e minx miny maxx maxy: extents to render\n");
+    fprintf(stdout,"  -s sizex sizey: output image size\n");
+    fprintf(stdout,"  -l layers: layers / groups to enable - make sure they are quoted and space seperated if more than one listed\n" );
+    fprintf(stdout,"  -all_debug n: Set debug level for map and all layers\n" );
+    fprintf(stdout,"  -map_debug n: Set map debug level\n" );
+    fprintf(stdout,"  -layer_debug layer_name n: Set layer debug level\n" );
+    fprintf(stdout,"  -c n: draw map n number of times\n" );
+    fprintf(stdout,"  -p n: pause for n seconds after reading the map\n" );
+    fprintf(stdout,"  -d layername datavalue: change DATA value for layer\n" );
+    fprintf(stdout,"  -bench: time every combination of the -m, -e, -s and -i values given (which may be\n"
+                   "         repeated), -c n times each (default 20), nothing is written; -m defaults to tests/test.map\n" );
+    fprintf(stdout,"  -w n: untimed warm-up draws of each -bench combination (default 2)\n" );
+    fprintf(stdout,"  -r report: write the -bench results as JSON to this file\n" );
+
+
+    exit(0);
+  }
+
+  if ( msSetup() != MS_SUCCESS ) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  /* Use MS_ERRORFILE and MS_DEBUGLEVEL env vars if set */
+  if ( msDebugInitFromEnv() != MS_SUCCESS ) {
+    msWriteError(stderr);
+    msCleanup(0);
+    exit(1);
+  }
+
+  if(bench) {
+    int status;
+
+    if(!iterations_set)
+      iterations = 20;
+
+    status = runBenchmark(argc, argv, MS_MAX(1, iterations), MS_MAX(0, warmup), report);
+    msCleanup(0);
+    return (status == MS_SUCCESS) ? 0 : 1;
+  }
 
-        msFreeCharArray(layers, num_layers);
+  if(iterations_set)
+    printf("We will draw %d times...\n", iterations);
 
-        i+=1;
+  for(draws=0; draws<iterations; draws++) {
+
+    struct mstimeval requeststarttime, requestendtime;
+
+    if(msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_TUNING)
+      msGettimeofday(&requeststarttime, NULL);
+
+    for(i=1; i<argc; i++) { /* Step though the user arguments, 1st to find map file */
+
+      if(strcmp(argv[i],"-m") == 0) {
+        map = msLoadMap(argv[i+1], NULL);
+        if(!map) {
+          msWriteError(stderr);
+          msCleanup(0);
+          exit(1);
+        }
+        msApplyDefaultSubstitutions(map);
       }
     }
 
+    if(!map) {
+      fprintf(stderr, "Mapfile (-m) option not specified.\n");
+      msCleanup(0);
+      exit(1);
+    }
+
+    if(applyArguments(map, argc, argv, &outfile, MS_FALSE) != MS_SUCCESS) {
+      msFreeMap(map);
+      msCleanup(0);
+      exit(1);
+    }
+
     image = msDrawMap(map, MS_FALSE);
 
     if(!image) {
@@ -306,6 +781,7 @@ int main(int argc, char *argv[])
 
     msFreeImage(image);
     msFreeMap(map);
+    map = NULL;
 
     if(msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_TUNING) {
       msGettimeofday(&requestendtime, NULL);
@@ -314,8 +790,9 @@ int main(int argc, char *argv[])
               (requeststarttime.tv_sec+requeststarttime.tv_usec/1.0e6) );
     }
 
-    msCleanup(0);
-
   } /*   for(draws=0; draws<iterations; draws++) { */
+
+  msCleanup(0);
+
   return(0);
 } /* ---- END Main Routine ---- */
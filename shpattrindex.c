@@ -0,0 +1,89 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline utility to generate .aix shapefile attribute indexes.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "mapserver.h"
+#include <string.h>
+
+
+
+int main(int argc, char *argv[])
+{
+  shapefileObj shapefile;
+  char keytype = 0;
+  char *filename;
+  int i, first = 2, status = 0;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if(argc > 2 && (strcmp(argv[1], "-n") == 0 || strcmp(argv[1], "-c") == 0)) {
+    keytype = (argv[1][1] == 'n') ? 'N' : 'C';
+    argv++;
+    argc--;
+  }
+
+  if(argc<3) {
+    fprintf(stdout,"Syntax:\n");
+    fprintf(stdout,"    shpattrindex [-n|-c] <shpfile> <item> [<item>...]\n" );
+    fprintf(stdout,"Where:\n");
+    fprintf(stdout," <shpfile> is the name of the .shp file to index.\n");
+    fprintf(stdout," <item>    is a DBF column to index, one <shpfile>.<item>.aix\n");
+    fprintf(stdout,"           file is written per column.\n");
+    fprintf(stdout," -n        index the values as numbers, for FILTERs like ([ID] = 12).\n");
+    fprintf(stdout," -c        index the values as strings, for FILTERs like (\"[ID]\" = \"12\")\n");
+    fprintf(stdout,"           or a FILTERITEM. By default numeric DBF columns get a\n");
+    fprintf(stdout,"           numeric index and everything else a string index.\n\n");
+    exit(0);
+  }
+
+  if(msShapefileOpen(&shapefile, "rb", argv[1], MS_TRUE) == -1) {
+    fprintf(stdout, "Error opening shapefile %s.\n", argv[1]);
+    exit(1);
+  }
+
+  for(i=first; i<argc; i++) {
+    filename = msAttributeIndexFilename(argv[1], argv[i]);
+    printf("creating attribute index %s\n", filename);
+
+    if(msWriteAttributeIndex(&shapefile, argv[i], keytype, filename) != MS_SUCCESS) {
+      msWriteError(stdout);
+      status = 1;
+    }
+    msFree(filename);
+  }
+
+  /*
+  ** Clean things up
+  */
+  msShapefileClose(&shapefile);
+
+  return(status);
+}
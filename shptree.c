@@ -71,6 +71,7 @@ int main(int argc, char *argv[])
   treeObj *tree;
   int byte_order = MS_NEW_LSB_ORDER, i;
   int depth=0;
+  int numthreads=1;
 
   if(argc > 1 && strcmp(argv[1], "-v") == 0) {
     printf("%s\n", msGetVersion());
@@ -88,10 +89,18 @@ int main(int argc, char *argv[])
     byte_order = MS_NEW_MSB_ORDER;
 
 
+  if(argc > 2 && strcmp(argv[1], "-j") == 0) { /* number of threads */
+    numthreads = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
   if(argc<2) {
     fprintf(stdout,"Syntax:\n");
-    fprintf(stdout,"    shptree <shpfile> [<depth>] [<index_format>]\n" );
+    fprintf(stdout,"    shptree [-j <threads>] <shpfile> [<depth>] [<index_format>]\n" );
     fprintf(stdout,"Where:\n");
+    fprintf(stdout," <threads> (optional) is the number of threads used to\n");
+    fprintf(stdout,"           read the shapes and build the index, default is 1.\n");
     fprintf(stdout," <shpfile> is the name of the .shp file to index.\n");
     fprintf(stdout," <depth>   (optional) is the maximum depth of the index\n");
     fprintf(stdout,"           to create, default is 0 meaning that shptree\n");
@@ -133,7 +142,7 @@ int main(int argc, char *argv[])
           ((byte_order == MS_NATIVE_ORDER) ? "native" :
            ((byte_order == MS_LSB_ORDER) || (byte_order == MS_NEW_LSB_ORDER)? " LSB":"MSB")));
 
-  tree = msCreateTree(&shapefile, depth);
+  tree = msCreateTreeParallel(&shapefile, depth, numthreads);
   if(!tree) {
 #if MAX_SUBNODE == 2
     fprintf(stdout, "Error generating binary tree.\n");
@@ -4,7 +4,9 @@
  * Project:  MapServer
  * Purpose:  Command line utility to sort a shapefile based on a single
  *           attribute in ascending or decending order. Useful for
- *           prioritizing drawing or labeling of shapes.
+ *           prioritizing drawing or labeling of shapes. Can also sort
+ *           along a Hilbert or Z-order curve, so that shapes that are
+ *           close in space are also close in the file.
  * Author:   Steve Lime and the MapServer team.
  *
  ******************************************************************************
@@ -76,6 +78,69 @@ static int compare_number_ascending(const void *a, const void *b)
   return(0);
 }
 
+/* -------------------------------------------------------------------- */
+/*      Position of the cell (x,y) of a 65536x65536 grid along a        */
+/*      Hilbert curve.                                                  */
+/* -------------------------------------------------------------------- */
+static ms_uint32 hilbert_index(ms_uint32 x, ms_uint32 y)
+{
+  ms_uint32 rx, ry, s, t, d = 0;
+
+  for(s = 0x8000; s > 0; s >>= 1) {
+    rx = (x & s) > 0;
+    ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+
+    /* rotate the quadrant */
+    if(ry == 0) {
+      if(rx == 1) {
+        x = 0xFFFF - x;
+        y = 0xFFFF - y;
+      }
+      t = x;
+      x = y;
+      y = t;
+    }
+  }
+
+  return(d);
+}
+
+/* -------------------------------------------------------------------- */
+/*      Position of the cell (x,y) of a 65536x65536 grid along a        */
+/*      Z-order (Morton) curve: the bits of x and y interleaved.        */
+/* -------------------------------------------------------------------- */
+static ms_uint32 zorder_index(ms_uint32 x, ms_uint32 y)
+{
+  ms_uint32 s, d = 0;
+
+  for(s = 0; s < 16; s++)
+    d |= ((x >> s) & 1) << (2*s) | ((y >> s) & 1) << (2*s+1);
+
+  return(d);
+}
+
+/* -------------------------------------------------------------------- */
+/*      Sort key of a shape: the curve position of the center of its    */
+/*      bounds, on a grid covering the bounds of the shapefile.         */
+/* -------------------------------------------------------------------- */
+static double spatial_key(SHPHandle hSHP, int i, rectObj *extent, int hilbert)
+{
+  rectObj bounds;
+  double width = extent->maxx - extent->minx, height = extent->maxy - extent->miny;
+  ms_uint32 x = 0, y = 0;
+
+  if(msSHPReadBounds(hSHP, i, &bounds) != MS_SUCCESS)
+    return(0); /* null shapes go first */
+
+  if(width > 0)
+    x = (ms_uint32) MS_MIN(((bounds.minx + bounds.maxx)/2 - extent->minx) / width * 65536, 65535);
+  if(height > 0)
+    y = (ms_uint32) MS_MIN(((bounds.miny + bounds.maxy)/2 - extent->miny) / height * 65536, 65535);
+
+  return(hilbert ? hilbert_index(x, y) : zorder_index(x, y));
+}
+
 int main(int argc, char *argv[])
 {
   SHPHandle    inSHP,outSHP; /* ---- Shapefile file pointers ---- */
@@ -90,6 +155,8 @@ int main(int argc, char *argv[])
   char         buffer[1024];
   int i,j;
   int num_fields, num_records;
+  int spatial=MS_FALSE, hilbert=MS_FALSE;
+  rectObj extent;
 
   if(argc > 1 && strcmp(argv[1], "-v") == 0) {
     printf("%s\n", msGetVersion());
@@ -100,10 +167,15 @@ int main(int argc, char *argv[])
   /*       Check the number of arguments, return syntax if not correct               */
   /* ------------------------------------------------------------------------------- */
   if( argc != 5 ) {
-    fprintf(stderr,"Syntax: sortshp [infile] [outfile] [item] [ascending|descending]\n" );
+    fprintf(stderr,"Syntax: sortshp [infile] [outfile] [item|-hilbert|-zorder] [ascending|descending]\n" );
     exit(1);
   }
 
+  if(strcasecmp(argv[3], "-hilbert") == 0)
+    spatial = hilbert = MS_TRUE;
+  else if(strcasecmp(argv[3], "-zorder") == 0)
+    spatial = MS_TRUE;
+
   msSetErrorFile("stderr", NULL);
 
   /* ------------------------------------------------------------------------------- */
@@ -129,7 +201,7 @@ int main(int argc, char *argv[])
   num_fields = msDBFGetFieldCount(inDBF);
   num_records = msDBFGetRecordCount(inDBF);
 
-  for(i=0; i<num_fields; i++) {
+  for(i=0; i<num_fields && !spatial; i++) {
     msDBFGetFieldInfo(inDBF,i,fName,NULL,NULL);
     if(strncasecmp(argv[3],fName,strlen(argv[3])) == 0) { /* ---- Found it ---- */
       fieldNumber = i;
@@ -137,7 +209,7 @@ int main(int argc, char *argv[])
     }
   }
 
-  if(fieldNumber < 0) {
+  if(fieldNumber < 0 && !spatial) {
     fprintf(stderr,"Item %s doesn't exist in %s\n",argv[3],buffer);
     exit(1);
   }
@@ -151,7 +223,12 @@ int main(int argc, char *argv[])
   /* ------------------------------------------------------------------------------- */
   /*       Load the array to be sorted                                               */
   /* ------------------------------------------------------------------------------- */
-  dbfField = msDBFGetFieldInfo(inDBF,fieldNumber,NULL,NULL,NULL);
+  if(spatial) {
+    msSHPReadBounds(inSHP, -1, &extent);
+    dbfField = FTDouble;
+  } else
+    dbfField = msDBFGetFieldInfo(inDBF,fieldNumber,NULL,NULL,NULL);
+
   switch (dbfField) {
     case FTString:
       for(i=0; i<num_records; i++) {
@@ -167,7 +244,10 @@ int main(int argc, char *argv[])
     case FTInteger:
     case FTDouble:
       for(i=0; i<num_records; i++) {
-        array[i].number = msDBFReadDoubleAttribute( inDBF, i, fieldNumber);
+        if(spatial)
+          array[i].number = spatial_key(inSHP, i, &extent, hilbert);
+        else
+          array[i].number = msDBFReadDoubleAttribute( inDBF, i, fieldNumber);
         array[i].index = i;
       }
 